@@ -1,5 +1,6 @@
 #include <addrmodes.h>
 #include <color.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,13 +39,14 @@ void run_hex(int argc, char *argv[]);
 void pause(void);
 void resume(void);
 bool is_paused(void);
+void trace(bool enabled);
 
 /* callback functions */
 
 void before_execute(operation_t ins);
 void after_execute(operation_t ins);
 
-void update_screen(const char *data);
+void update_screen(const uint16_t *data);
 
 uint8_t poll_input_p1(void);
 uint8_t poll_input_p2(void);
@@ -9,6 +9,8 @@ static SDL_Surface *surface = NULL;
 static SDL_Renderer *renderer = NULL;
 static SDL_Texture *screen = NULL;
 
+static uint8_t pixels[PPU_BUFFER * COLOR_STRIDE];
+
 static uint64_t frame_counter = 0;
 static uint64_t last_fps = 0;
 
@@ -58,7 +60,7 @@ bool is_fullscreen(void) {
     return fullscreen;
 }
 
-void update_screen(const char *data) {
+void update_screen(const uint16_t *data) {
     // Poll events.
     poll_events();
 
@@ -82,7 +84,8 @@ void update_screen(const char *data) {
     // Update and copy the texture to the surface.
     SDL_Rect rect = { Vx, Vy, SCREEN_WIDTH, SCREEN_HEIGHT };
     if (data != NULL) {
-        SDL_UpdateTexture(screen, NULL, data, PIXEL_STRIDE * SCREEN_WIDTH);
+        color_convert(data, pixels, PPU_BUFFER);
+        SDL_UpdateTexture(screen, NULL, pixels, COLOR_STRIDE * SCREEN_WIDTH);
     }
     SDL_RenderCopy(renderer, screen, NULL, &rect);
 
@@ -7,6 +7,7 @@ void start_log(void) {
         return;
     
     log_fp = fopen("emu.log", "w");
+    trace(log_fp != NULL);
 }
 
 void end_log(void) {
@@ -15,6 +16,7 @@ void end_log(void) {
     
     fclose(log_fp);
     log_fp = NULL;
+    trace(false);
 }
 
 void log_ins(operation_t ins) {
@@ -35,17 +35,40 @@ int main(int argc, char *argv[]) {
         else if (strcmp(arg, "-l") == 0) {
             start_log();
         }
+        else if (strcmp(arg, "-p") == 0 && i + 1 < argc) {
+            const char *pal_path = argv[++i];
+            if (!color_load(pal_path)) {
+                printf("Unable to load palette: %s\n", pal_path);
+                return EXIT_FAILURE;
+            }
+        }
+        else if (strcmp(arg, "-s") == 0 && i + 1 < argc) {
+            const char *skip = argv[++i];
+            if (strcmp(skip, "auto") == 0) {
+                handlers.frame_skip = FRAME_SKIP_AUTO;
+            }
+            else {
+                // Only a whole number of frames is accepted.
+                char *end;
+                const long frames = strtol(skip, &end, 10);
+                if (*skip == '\0' || *end != '\0' || frames < 0 || frames > INT_MAX) {
+                    printf("Invalid frame skip: %s\n", skip);
+                    return EXIT_FAILURE;
+                }
+                handlers.frame_skip = frames;
+            }
+        }
         else if (!strprefix(arg, "-") && path == NULL) {
             path = arg;
         }
         else {
-            printf("Usage: %s [<path|-x hex...>] [-l] [-t]\n", argv[0]);
+            printf("Usage: %s [<path|-x hex...>] [-l] [-t] [-p palette] [-s frames|auto]\n", argv[0]);
             return EXIT_FAILURE;
         }
     }
     
     if (path == NULL) {
-        printf("Usage: %s [<path|-x hex...>] [-l] [-t]\n", argv[0]);
+        printf("Usage: %s [<path|-x hex...>] [-l] [-t] [-p palette] [-s frames|auto]\n", argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -136,9 +159,9 @@ void run_bin(const char *path, bool test) {
         }
     }
 
-    // Setup the handlers.
-    handlers.before_execute = before_execute;
-    handlers.after_execute = after_execute;
+    // Setup the handlers (instructions are only watched while they're logged or a test is running, as the
+    // system can only run ahead of the PPU and APU when there are no per-instruction handlers).
+    handlers.after_execute = test ? after_execute : NULL;
     handlers.update_screen = update_screen;
     handlers.poll_input_p1 = poll_input_p1;
     handlers.poll_input_p2 = poll_input_p2;
@@ -196,6 +219,10 @@ bool is_paused(void) {
     return handlers.paused;
 }
 
+void trace(bool enabled) {
+    handlers.before_execute = enabled ? before_execute : NULL;
+}
+
 void before_execute(operation_t ins) {
     // Log the instruction.
     log_ins(ins);
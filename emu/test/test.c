@@ -1,11 +1,71 @@
 #include <assert.h>
 #include <addrmodes.h>
+#include <color.h>
 #include <instructions.h>
+#include <ppu.h>
+#include <sys.h>
 #include <stdio.h>
+#include <string.h>
 
 void exec_ins(const instruction_t *ins, tframe_t *frame, const addrspace_t *as, addr_t addr, uint8_t *value);
+uint8_t count_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+uint8_t bank_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+bool status_read(addr_t vaddr);
+sr_flags_t get_flags(const tframe_t *frame);
+
+/* The PPU memory accesses made while rendering (hashed in the order they were made). */
+typedef struct fetch_log {
+    uint32_t    hash;
+    int         count;
+    addr_t      last;
+} fetch_log_t;
+
+/* The fields of a VRAM address register, as the PPU used to store them. */
+typedef struct vram_fields {
+    unsigned    coarse_x : 5;
+    unsigned    coarse_y : 5;
+    unsigned    nt_x : 1;
+    unsigned    nt_y : 1;
+    unsigned    fine_y : 3;
+} vram_fields_t;
+
+uint32_t random_next(uint32_t *seed);
+uint8_t fetch_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+ppu_t *create_ppu(uint16_t *out, fetch_log_t *log);
+void randomise_ppu(ppu_t *ppu, uint32_t seed, int line, uint8_t mask);
+void render_dots(ppu_t *ppu, int dots);
+void run_frames(const char *rom, int frames, bool lockstep);
+void watch_instruction(operation_t ins);
+void frame_done(const uint16_t *data);
+uint8_t no_input(void);
+vram_fields_t unpack_vram(uint16_t value);
+uint16_t pack_vram(vram_fields_t fields);
+void inc_fields_x(vram_fields_t *addr);
+void inc_fields_y(vram_fields_t *addr);
+void inc_fields(vram_fields_t *addr, bool vram_inc);
+
+static uint8_t program_rom[0xC000];
+static uint8_t pattern_tables[0x2000];
+static uint16_t screen_a[PPU_BUFFER];
+static uint16_t screen_b[PPU_BUFFER];
+
+/* The state of the system after running a program for some frames. */
+static handlers_t run_handlers;
+static int frames_left;
+static uint32_t frames_hash;
 
 void test_virtual_memory(void);
+void test_decode_table(void);
+void test_threaded_core(void);
+void test_block_cache(void);
+void test_code_fetch(void);
+void test_random_programs(void);
+void test_idle_loops(void);
+void test_mapper_cores(void);
+void test_run_to_event(void);
+void test_vram_registers(void);
+void test_scanline_renderer(void);
+void test_frame_skip(void);
 void test_address_modes(tframe_t *frame);
 void test_instructions(tframe_t *frame);
 
@@ -17,6 +77,17 @@ void test_branch(tframe_t *frame, const addrspace_t *as, const instruction_t *br
 int main() {
     tframe_t frame;
     test_virtual_memory();
+    test_decode_table();
+    test_threaded_core();
+    test_block_cache();
+    test_code_fetch();
+    test_random_programs();
+    test_idle_loops();
+    test_mapper_cores();
+    test_run_to_event();
+    test_vram_registers();
+    test_scanline_renderer();
+    test_frame_skip();
     test_address_modes(&frame);
     test_instructions(&frame);
     printf("All tests passed successfully!\n");
@@ -24,7 +95,162 @@ int main() {
 
 void exec_ins(const instruction_t *ins, tframe_t *frame, const addrspace_t *as, addr_t addr, uint8_t *value) {
     mem_loc_t loc = { addr, value };
-    ins->apply(frame, as, NULL, loc);
+    ins->apply(frame, as, &AM_IMPLIED, loc);
+}
+
+uint8_t count_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    (*(int*)data)++;
+    return mode == AS_READ ? value + 1 : value * 2;
+}
+
+sr_flags_t get_flags(const tframe_t *frame) {
+    return bits_to_sr(get_sr(frame));
+}
+
+uint8_t bank_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    cpu_t *cpu = data;
+    as_map_bank(cpu->as, 0xC000, 0x4000, program_rom + 0x4000 + (value & 1) * 0x4000, AS_READ);
+    return value;
+}
+
+uint8_t uxrom_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    cpu_t *cpu = data;
+    as_map_bank(cpu->as, 0x8000, 0x4000, program_rom + 0x4000 + (value & 1) * 0x4000, AS_READ);
+    return value;
+}
+
+uint8_t stop_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    cpu_stop(data);
+    return value;
+}
+
+bool status_read(addr_t vaddr) {
+    return vaddr == 0x2002;
+}
+
+uint32_t random_next(uint32_t *seed) {
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 16;
+}
+
+uint8_t fetch_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    fetch_log_t *log = data;
+    log->hash = (log->hash ^ vaddr) * 16777619;
+    log->count++;
+    log->last = vaddr;
+    return value;
+}
+
+ppu_t *create_ppu(uint16_t *out, fetch_log_t *log) {
+    // The pattern tables are plain memory and the nametables are mirrored vertically.
+    ppu_t *ppu = ppu_create(out);
+    as_map_bank(ppu->as, 0x0000, sizeof(pattern_tables), pattern_tables, AS_READ);
+    for (int nt = 0; nt < 4; nt++) {
+        as_map_bank(ppu->as, NAMETABLE0 + nt * NT_SIZE, NT_SIZE, ppu->vram + (nt % 2) * NT_SIZE, AS_READ | AS_WRITE);
+    }
+    ppu_set_chr(ppu, pattern_tables, sizeof(pattern_tables), NULL, 0);
+
+    // Logging the accesses makes them go through the address space (as they do when a mapper watches them).
+    if (log != NULL) {
+        as_add_handler(ppu->as, 0x0000, 0xFFFF, fetch_handler, log, AS_READ);
+    }
+    return ppu;
+}
+
+void randomise_ppu(ppu_t *ppu, uint32_t seed, int line, uint8_t mask) {
+    // Registers (the sprite size and both pattern tables are random).
+    ppu_write(ppu, PPU_CTRL, random_next(&seed) & 0x38);
+    ppu_write(ppu, PPU_MASK, mask);
+    ppu->status.value = random_next(&seed) & 0x60;
+    ppu->v = random_next(&seed) & VRAM_ADDR;
+    ppu->t = random_next(&seed) & VRAM_ADDR;
+    ppu->x = random_next(&seed) & 0x07;
+    ppu->oam_addr = random_next(&seed) % 2 ? random_next(&seed) : 0;
+
+    // Memory.
+    for (int i = 0; i < VRAM_SIZE; i++) {
+        ppu->vram[i] = random_next(&seed);
+    }
+    ppu->bkg_color = random_next(&seed) & 0x3F;
+    for (int i = 0; i < sizeof(ppu->bkg_palette); i++) {
+        ppu->bkg_palette[i] = random_next(&seed) & 0x3F;
+    }
+    for (int i = 0; i < sizeof(ppu->spr_palette); i++) {
+        ppu->spr_palette[i] = random_next(&seed) & 0x3F;
+    }
+
+    // Sprites (some are in range of the line, so that secondary OAM may overflow).
+    for (int i = 0; i < sizeof(ppu->oam); i++) {
+        ppu->oam[i] = random_next(&seed);
+    }
+    const int in_range = random_next(&seed) % 24;
+    for (int i = 0; i < in_range; i++) {
+        ppu->oam[(random_next(&seed) % N_SPRITES) * 4] = line - random_next(&seed) % 16;
+    }
+
+    // What was left by the previous line (the first two tiles, and the sprites that are drawn on this line).
+    for (int i = 0; i < 2; i++) {
+        ppu->sr_tile[i] = random_next(&seed);
+        ppu->sr_attr[i] = random_next(&seed);
+    }
+    for (int i = 0; i < sizeof(ppu->oam2); i++) {
+        ppu->oam2[i] = random_next(&seed);
+    }
+    for (int i = 0; i < SCREEN_WIDTH; i++) {
+        ppu->spr_line[i] = random_next(&seed) % 2 ? random_next(&seed) & 0x3F : 0;
+    }
+    ppu->szc = random_next(&seed) % 2;
+    ppu->oam_buffer = random_next(&seed);
+
+    // Start of the line.
+    ppu->draw_x = 0;
+    ppu->draw_y = line;
+}
+
+void render_dots(ppu_t *ppu, int dots) {
+    for (int i = 0; i < dots; i++) {
+        ppu_render(ppu, 1);
+    }
+}
+
+void watch_instruction(operation_t ins) {
+    // Watching each instruction keeps the system in lockstep.
+}
+
+void frame_done(const uint16_t *data) {
+    for (int i = 0; i < PPU_BUFFER; i++) {
+        frames_hash = (frames_hash ^ data[i]) * 16777619;
+    }
+    memcpy(screen_a, data, sizeof(screen_a));
+
+    // Nothing plays the audio, so it is thrown away (otherwise the APU would block).
+    apu->out.cons = apu->out.prod;
+    if (--frames_left == 0) {
+        run_handlers.running = false;
+    }
+}
+
+uint8_t no_input(void) {
+    return 0;
+}
+
+void run_frames(const char *rom, int frames, bool lockstep) {
+    sys_poweron();
+    prog_t *prog = prog_create(rom);
+    sys_insert(prog);
+
+    // The contents of RAM are undefined at power on, so both runs start with it cleared.
+    memset(cpu->wmem, 0, WMEM_SIZE);
+    memset(ppu->vram, 0, VRAM_SIZE);
+
+    memset(&run_handlers, 0, sizeof(run_handlers));
+    run_handlers.before_execute = lockstep ? watch_instruction : NULL;
+    run_handlers.update_screen = frame_done;
+    run_handlers.poll_input_p1 = no_input;
+    run_handlers.poll_input_p2 = no_input;
+    frames_left = frames;
+    frames_hash = 2166136261u;
+    sys_run(&run_handlers);
 }
 
 void test_virtual_memory() {
@@ -32,7 +258,7 @@ void test_virtual_memory() {
 
     uint8_t a[1024] = { 0 };
     uint8_t b[512] = { 0 };
-    //uint8_t c[512] = { 0 };
+    uint8_t c[512] = { 0 };
 
     /* Test a single segment of memory. */
     as = as_create();
@@ -88,7 +314,975 @@ void test_virtual_memory() {
     assert(b[350] == 11);
     assert(b[511] == 12);
 
+    /* Overwrite part of a page with smaller segments. */
+    as_add_segment(as, 300, 1, &c[0], AS_READ);
+    as_add_segment(as, 301, 2, &c[1], AS_WRITE);
+
+    c[0] = 13;
+    a[44] = 14;
+    a[47] = 15;
+
+    assert(as_read(as, 300) == 13);
+    assert(as_read(as, 301) == 0);
+    assert(as_read(as, 300 - 1) == a[43]);
+    assert(as_read(as, 303) == 15);
+
+    as_write(as, 300, 16);
+    as_write(as, 302, 17);
+
+    assert(c[0] == 13);
+    assert(c[2] == 17);
+
     as_destroy(as);
+
+    /* Test mirrors that repeat a segment of memory. */
+    as = as_create();
+    as_add_segment(as, 0, 256, b, AS_READ | AS_WRITE);
+    as_add_segment(as, 0x2000, 1, &c[0], AS_READ | AS_WRITE);
+    as_add_segment(as, 0x2001, 1, &c[1], AS_READ | AS_WRITE);
+    as_add_mirror(as, 0x0100, 0x07FF, 256, 0x0000);
+    as_add_mirror(as, 0x2002, 0x3FFF, 2, 0x2000);
+
+    b[20] = 18;
+    c[0] = 19;
+    c[1] = 20;
+
+    assert(as_read(as, 0x0100 + 20) == 18);
+    assert(as_read(as, 0x0700 + 20) == 18);
+    assert(as_read(as, 0x0800 + 20) == 0);
+    assert(as_read(as, 0x2002) == 19);
+    assert(as_read(as, 0x3FFF) == 20);
+
+    as_write(as, 0x0500 + 30, 21);
+    as_write(as, 0x2A01, 22);
+
+    assert(b[30] == 21);
+    assert(c[1] == 22);
+
+    /* Segments added after a mirror should still be visible through the mirror. */
+    as_add_segment(as, 0x0800, 256, a, AS_READ | AS_WRITE);
+    as_add_mirror(as, 0x0900, 0x0FFF, 256, 0x0800);
+    as_add_segment(as, 0x0000, 256, b + 256, AS_READ | AS_WRITE);
+
+    a[5] = 23;
+    b[256 + 5] = 24;
+
+    assert(as_read(as, 0x0E05) == 23);
+    assert(as_read(as, 0x0605) == 24);
+
+    /* Test I/O handlers (which are given the address before mirroring). */
+    int reads = 0, writes = 0;
+    as_add_handler(as, 0x2000, 0x3FFF, count_handler, &reads, AS_READ);
+    as_add_handler(as, 0x3000, 0x3000, count_handler, &writes, AS_WRITE);
+
+    assert(as_read(as, 0x3001) == 23);
+    assert(as_read(as, 0x0605) == 24);
+    assert(reads == 1);
+
+    as_write(as, 0x3000, 25);
+    as_write(as, 0x2000, 26);
+
+    assert(c[0] == 26);
+    assert(as_read(as, 0x3000) == 27);
+    as_write(as, 0x3000, 25);
+    assert(c[0] == 50);
+    assert(reads == 2);
+    assert(writes == 2);
+
+    /* Test bank switching (which should also be visible through mirrors). */
+    as_map_bank(as, 0x0800, 256, a + 256, AS_READ);
+    a[256 + 5] = 28;
+
+    assert(as_read(as, 0x0805) == 28);
+    assert(as_read(as, 0x0E05) == 28);
+
+    as_write(as, 0x0805, 29);
+    assert(a[256 + 5] == 28);
+
+    as_map_bank(as, 0x0800, 256, NULL, 0);
+    assert(as_read(as, 0x0E05) == 0);
+
+    as_destroy(as);
+
+    /* Test block accesses (which are split into spans of contiguous memory). */
+    uint8_t block[512];
+    size_t size;
+    as = as_create();
+    as_add_segment(as, 0x0000, 512, a, AS_READ | AS_WRITE);
+    as_add_segment(as, 0x0200, 256, b, AS_READ | AS_WRITE);
+    as_add_segment(as, 0x0210, 1, &c[0], AS_READ | AS_WRITE);
+    as_add_handler(as, 0x0300, 0x0300, count_handler, &reads, AS_READ);
+    as_add_segment(as, 0x0300, 256, b + 256, AS_READ | AS_WRITE);
+
+    assert(as_span(as, 0x0010, 1024, AS_READ, &size) == a + 0x10 && size == 0x01F0);
+    assert(as_span(as, 0x0200, 1024, AS_READ, &size) == b && size == 0x10);
+    assert(as_span(as, 0x0300, 1024, AS_READ, &size) == NULL && size == 1);
+
+    for (int i = 0; i < 512; i++) {
+        block[i] = i;
+    }
+    as_write_block(as, 0x0101, block, 512);
+    assert(a[0x01FF] == 0xFE && b[0] == 0xFF && c[0] == 0x0F && b[256] == 0xFF);
+
+    reads = 0;
+    as_read_block(as, 0x0101, block, 512);
+    assert(block[0x00FE] == 0xFE && block[0x010F] == 0x0F && block[0x01FF] == 0x00);
+    assert(reads == 1);
+
+    as_traverse(as, 0x0101, block, 512);
+    assert(block[0x01FF] == 0xFF && reads == 1);
+
+    as_destroy(as);
+}
+
+void test_decode_table() {
+    const decode_entry_t *table = get_decode_table();
+
+    // LDA #$BB
+    assert(table[0xA9].instruction == &INS_LDA);
+    assert(table[0xA9].addr_mode == &AM_IMMEDIATE);
+    assert(table[0xA9].argc == 1);
+    assert(table[0xA9].cycles == 2);
+
+    // STA $LLHH,Y
+    assert(table[0x99].instruction == &INS_STA);
+    assert(table[0x99].addr_mode == &AM_ABSOLUTE_Y);
+    assert(table[0x99].argc == 2);
+    assert(table[0x99].page_penalty);
+
+    // JMP ($LLHH)
+    assert(table[0x6C].instruction == &INS_JMP);
+    assert(table[0x6C].addr_mode == &AM_INDIRECT);
+
+    // Every entry should match the opcode groups.
+    for (int opc = 0; opc < 256; opc++) {
+        opcode_t opcode = { .group = opc & 0x03, .addrmode = (opc >> 2) & 0x07, .num = (opc >> 5) & 0x07 };
+        assert(table[opc].instruction == get_instruction(opcode));
+        assert(table[opc].addr_mode == get_address_mode(opcode));
+    }
+}
+
+void test_threaded_core() {
+    static uint8_t mem_a[65536];
+    static uint8_t mem_b[65536];
+    static uint8_t init[65536];
+
+    // Setup two CPUs with identical flat address spaces.
+    cpu_t *a = cpu_create();
+    cpu_t *b = cpu_create();
+    as_add_segment(a->as, 0, 65536, mem_a, AS_READ | AS_WRITE);
+    as_add_segment(b->as, 0, 65536, mem_b, AS_READ | AS_WRITE);
+
+    // Fill memory with pseudo-random values.
+    uint32_t seed = 12345;
+    for (int i = 0; i < 65536; i++) {
+        seed = seed * 1103515245 + 12345;
+        init[i] = seed >> 16;
+    }
+
+    // Every implemented opcode should behave the same as decoding and executing the instruction.
+    const decode_entry_t *table = get_decode_table();
+    for (int opc = 0; opc < 256; opc++) {
+        if (table[opc].instruction->apply == NULL || table[opc].instruction == &INS_JAM)
+            continue;
+
+        for (int trial = 0; trial < 16; trial++) {
+            memcpy(mem_a, init, sizeof(init));
+            seed = seed * 1103515245 + 12345;
+            a->frame.pc = 0x0200 + ((seed >> 8) & 0x3FFF);
+            a->frame.ac = seed >> 16;
+            a->frame.x = seed >> 24;
+            a->frame.y = seed >> 4;
+            a->frame.sp = seed >> 12;
+            set_sr(&a->frame, seed >> 20);
+            mem_a[a->frame.pc] = opc;
+            memcpy(mem_b, mem_a, sizeof(mem_a));
+            b->frame = a->frame;
+
+            int expected = cpu_execute(a, cpu_decode(a, cpu_fetch(a)));
+            int cycles = cpu_run(b, 1);
+            assert(cycles == expected);
+            assert(a->frame.pc == b->frame.pc);
+            assert(a->frame.ac == b->frame.ac && a->frame.x == b->frame.x && a->frame.y == b->frame.y);
+            assert(a->frame.sp == b->frame.sp);
+            assert(get_sr(&a->frame) == get_sr(&b->frame));
+            assert(memcmp(mem_a, mem_b, sizeof(mem_a)) == 0);
+        }
+    }
+
+    // Instructions should be run until the budget has been used.
+    memset(mem_b, 0xEA, sizeof(mem_b)); // NOP
+    b->frame.pc = 0x0200;
+    assert(cpu_run(b, 9) == 10);
+    assert(b->frame.pc == 0x0205);
+
+    // The cycle counter should be advanced by the cycles that were run.
+    uint64_t start = b->cycles;
+    assert(cpu_run(b, 4) == 4);
+    assert(b->cycles == start + 4);
+
+    // An I/O handler should be able to stop the CPU after the current instruction (NOP; STA $4000; NOP).
+    as_add_handler(b->as, 0x4000, 0x4000, stop_handler, b, AS_WRITE);
+    mem_b[0x0300] = 0xEA;
+    mem_b[0x0301] = 0x8D;
+    mem_b[0x0302] = 0x00;
+    mem_b[0x0303] = 0x40;
+    b->frame.pc = 0x0300;
+    start = b->cycles;
+    assert(cpu_run(b, 100) == 6);
+    assert(b->frame.pc == 0x0304);
+    assert(b->cycles == start + 6);
+
+    cpu_destroy(a);
+    cpu_destroy(b);
+}
+
+void test_block_cache() {
+    static uint8_t ram[0x8000];
+    static uint8_t rom[0x0200];
+
+    cpu_t *cpu = cpu_create();
+    as_add_segment(cpu->as, 0x0000, sizeof(ram), ram, AS_READ | AS_WRITE);
+    as_map_bank(cpu->as, 0x8000, 0x0100, rom, AS_READ);
+
+    /* Countdown loop (LDX #$05; DEX; BNE -3), which uses a superinstruction. */
+    uint8_t loop[] = { 0xA2, 0x05, 0xCA, 0xD0, 0xFD };
+    memcpy(rom, loop, sizeof(loop));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+
+    cpu->frame.pc = 0x8000;
+    assert(cpu_run(cpu, 26) == 26);
+    assert(cpu->frame.pc == 0x8005);
+    assert(cpu->frame.x == 0);
+
+    // Running a single instruction at a time should give the same result.
+    int cycles = 0;
+    cpu->frame.pc = 0x8000;
+    while (cpu->frame.pc != 0x8005) {
+        cycles += cpu_run(cpu, 1);
+    }
+    assert(cycles == 26);
+
+    /* Switching banks in the middle of a block. */
+    uint8_t bank_a[] = { 0xA9, 0x11, 0xA9, 0x22 }; // LDA #$11; LDA #$22
+    uint8_t bank_b[] = { 0xA9, 0x33, 0xA9, 0x44 }; // LDA #$33; LDA #$44
+    memcpy(rom, bank_a, sizeof(bank_a));
+    memcpy(rom + 0x0100, bank_b, sizeof(bank_b));
+    cpu_set_rom(cpu, rom, sizeof(rom)); // ROM has changed.
+
+    cpu->frame.pc = 0x8000;
+    assert(cpu_run(cpu, 1) == 2);
+    assert(cpu->frame.ac == 0x11);
+    as_map_bank(cpu->as, 0x8000, 0x0100, rom + 0x0100, AS_READ);
+    assert(cpu_run(cpu, 1) == 2);
+    assert(cpu->frame.ac == 0x44);
+
+    /* Self-modifying code in RAM (LDA #$55; STA $0206; LDA #$66). */
+    uint8_t code[] = { 0xA9, 0x55, 0x8D, 0x06, 0x02, 0xA9, 0x66 };
+    memcpy(ram + 0x0200, code, sizeof(code));
+
+    cpu->frame.pc = 0x0200;
+    assert(cpu_run(cpu, 8) == 8);
+    assert(cpu->frame.pc == 0x0207);
+    assert(cpu->frame.ac == 0x55);
+
+    // Blocks in RAM should be decoded again if the RAM changes.
+    ram[0x0201] = 0x77;
+    cpu->frame.pc = 0x0200;
+    assert(cpu_run(cpu, 1) == 2);
+    assert(cpu->frame.ac == 0x77);
+
+    cpu_destroy(cpu);
+}
+
+void test_code_fetch() {
+    static uint8_t io[0x0100];
+    static uint8_t rom[0x0300];
+
+    cpu_t *cpu = cpu_create();
+    as_add_segment(cpu->as, 0x4000, sizeof(io), io, AS_READ | AS_WRITE);
+    as_map_bank(cpu->as, 0x8000, 0x0200, rom, AS_READ);
+
+    int reads = 0;
+    as_add_handler(cpu->as, 0x40FF, 0x40FF, count_handler, &reads, AS_READ);
+
+    /* Fetching from the cached code page (LDA #$11 at the end of the page, with its argument on the next page). */
+    rom[0x00FF] = 0xA9;
+    rom[0x0100] = 0x11;
+    cpu->frame.pc = 0x80FF;
+    operation_t ins = cpu_decode(cpu, cpu_fetch(cpu));
+    assert(ins.opc == 0xA9 && ins.args[0] == 0x11);
+
+    // Switching banks should be seen by the next fetch from the same page.
+    rom[0x01FF] = 0xA2; // LDX #$22
+    rom[0x0200] = 0x22;
+    as_map_bank(cpu->as, 0x8000, 0x0200, rom + 0x0100, AS_READ);
+    ins = cpu_decode(cpu, cpu_fetch(cpu));
+    assert(ins.opc == 0xA2 && ins.args[0] == 0x22);
+
+    /* Pages with I/O registers are read through the address space (and unused argument bytes aren't read). */
+    io[0xFE] = 0xEA; // NOP
+    cpu->frame.pc = 0x40FE;
+    ins = cpu_decode(cpu, cpu_fetch(cpu));
+    assert(ins.opc == 0xEA);
+    assert(reads == 0);
+
+    io[0xFE] = 0xA9; // LDA #$33 (the handler adds 1 to the value read)
+    io[0xFF] = 0x32;
+    ins = cpu_decode(cpu, cpu_fetch(cpu));
+    assert(ins.opc == 0xA9 && ins.args[0] == 0x33);
+    assert(reads == 1);
+
+    cpu_destroy(cpu);
+}
+
+void test_random_programs() {
+    static uint8_t ram_a[0x8000];
+    static uint8_t ram_b[0x8000];
+
+    const decode_entry_t *table = get_decode_table();
+    uint8_t safe[256];
+    int nsafe = 0;
+    for (int opc = 0; opc < 256; opc++) {
+        const instruction_t *ins = table[opc].instruction;
+        if (ins->apply != NULL && ins != &INS_JAM && !ins->jump)
+            safe[nsafe++] = opc;
+    }
+
+    // Setup two CPUs with a fixed bank at $8000 and a switchable bank at $C000 (which is switched by
+    // writes to $6000-$7FFF).
+    cpu_t *a = cpu_create();
+    cpu_t *b = cpu_create();
+    as_add_segment(a->as, 0x0000, sizeof(ram_a), ram_a, AS_READ | AS_WRITE);
+    as_add_segment(b->as, 0x0000, sizeof(ram_b), ram_b, AS_READ | AS_WRITE);
+    as_map_bank(a->as, 0x8000, 0x4000, program_rom, AS_READ);
+    as_map_bank(b->as, 0x8000, 0x4000, program_rom, AS_READ);
+    as_add_handler(a->as, 0x6000, 0x7FFF, bank_handler, a, AS_WRITE);
+    as_add_handler(b->as, 0x6000, 0x7FFF, bank_handler, b, AS_WRITE);
+
+    uint32_t seed = 4321;
+    for (int program = 0; program < 64; program++) {
+        // Fill ROM with random instructions (every byte is an implemented opcode that isn't a jump, so
+        // a branch into the middle of an instruction still runs a valid program). The fixed bank and
+        // each switchable bank have a short random program surrounded by NOPs (so branches can't
+        // leave the program), and the programs jump to each other so that their blocks become hot.
+        memset(program_rom, 0xEA, sizeof(program_rom)); // NOP
+        for (int bank = 0; bank < sizeof(program_rom); bank += 0x4000) {
+            for (int i = 0x0100; i < 0x0400; i++) {
+                seed = seed * 1103515245 + 12345;
+                program_rom[bank + i] = safe[(seed >> 16) % nsafe];
+            }
+            program_rom[bank + 0x0500] = 0x4C; // JMP $C000 (from the fixed bank) or JMP $8100
+            program_rom[bank + 0x0501] = 0x00;
+            program_rom[bank + 0x0502] = bank == 0 ? 0xC0 : 0x81;
+        }
+
+        for (int i = 0; i < sizeof(ram_a); i++) {
+            seed = seed * 1103515245 + 12345;
+            ram_a[i] = seed >> 16;
+        }
+        memcpy(ram_b, ram_a, sizeof(ram_a));
+
+        as_map_bank(a->as, 0xC000, 0x4000, program_rom + 0x4000, AS_READ);
+        as_map_bank(b->as, 0xC000, 0x4000, program_rom + 0x4000, AS_READ);
+        cpu_set_rom(a, program_rom, sizeof(program_rom));
+        cpu_set_rom(b, program_rom, sizeof(program_rom));
+        a->frame.pc = 0x8000;
+        a->frame.sp = 0xFF;
+        set_sr(&a->frame, seed >> 24);
+        b->frame = a->frame;
+
+        // Running blocks (which are compiled once they are hot) in chunks of random sizes should
+        // behave the same as running each instruction on its own.
+        int total_a = 0, total_b = 0;
+        while (total_b < 20000) {
+            seed = seed * 1103515245 + 12345;
+            total_b += cpu_run(b, 1 + (seed >> 16) % 200);
+            while (total_a < total_b) {
+                total_a += cpu_execute(a, cpu_decode(a, cpu_fetch(a)));
+            }
+
+            assert(total_a == total_b);
+            assert(a->frame.pc == b->frame.pc);
+            assert(a->frame.ac == b->frame.ac && a->frame.x == b->frame.x && a->frame.y == b->frame.y);
+            assert(a->frame.sp == b->frame.sp);
+            assert(get_sr(&a->frame) == get_sr(&b->frame));
+            assert(memcmp(ram_a, ram_b, sizeof(ram_a)) == 0);
+        }
+    }
+
+    cpu_destroy(a);
+    cpu_destroy(b);
+}
+
+void test_idle_loops() {
+    static uint8_t ram[0x0800];
+    static uint8_t rom[0x0100];
+    int count = 0;
+
+    cpu_t *cpu = cpu_create();
+    as_add_segment(cpu->as, 0x0000, sizeof(ram), ram, AS_READ | AS_WRITE);
+    as_add_handler(cpu->as, 0x2000, 0x2007, count_handler, &count, AS_READ | AS_WRITE);
+    as_map_bank(cpu->as, 0x8000, 0x0100, rom, AS_READ);
+    cpu->frame.pc = 0x8000;
+
+    /* Polling RAM (LDA $10; BEQ -4) takes 3 + 3 cycles per iteration. */
+    uint8_t poll_ram[] = { 0xA5, 0x10, 0xF0, 0xFC };
+    memcpy(rom, poll_ram, sizeof(poll_ram));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 6);
+
+    /* Jumping to the same instruction (JMP $8000). */
+    uint8_t jump[] = { 0x4C, 0x00, 0x80 };
+    memcpy(rom, jump, sizeof(jump));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 3);
+
+    /* Polling an I/O register (BIT $2002; BPL -5) is only idle if reading it again has no further effect. */
+    uint8_t poll_io[] = { 0x2C, 0x02, 0x20, 0x10, 0xFB };
+    memcpy(rom, poll_io, sizeof(poll_io));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 0);
+    assert(cpu_idle_loop(cpu, status_read) == 7);
+    poll_io[1] = 0x07; // BIT $2007
+    memcpy(rom, poll_io, sizeof(poll_io));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, status_read) == 0);
+    assert(count == 0); // Checking for idle loops doesn't access I/O registers.
+
+    /* Loops that change the state of the CPU or memory aren't idle. */
+    uint8_t count_down[] = { 0xCA, 0xD0, 0xFD }; // DEX; BNE -3
+    memcpy(rom, count_down, sizeof(count_down));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 0);
+
+    uint8_t store[] = { 0xA5, 0x10, 0x85, 0x11, 0xF0, 0xFA }; // LDA $10; STA $11; BEQ -6
+    memcpy(rom, store, sizeof(store));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 0);
+
+    /* Branches that don't go back to the start of the loop. */
+    uint8_t not_loop[] = { 0xA5, 0x10, 0xF0, 0xFE }; // LDA $10; BEQ -2
+    memcpy(rom, not_loop, sizeof(not_loop));
+    cpu_set_rom(cpu, rom, sizeof(rom));
+    assert(cpu_idle_loop(cpu, NULL) == 0);
+
+    cpu_destroy(cpu);
+}
+
+void test_mapper_cores() {
+    static uint8_t prg_ram_a[0x2000];
+    static uint8_t prg_ram_b[0x2000];
+
+    const decode_entry_t *table = get_decode_table();
+    uint8_t safe[256];
+    int nsafe = 0;
+    for (int opc = 0; opc < 256; opc++) {
+        const instruction_t *ins = table[opc].instruction;
+        if (ins->apply != NULL && ins != &INS_JAM && !ins->jump)
+            safe[nsafe++] = opc;
+    }
+
+    uint32_t seed = 8765;
+    const cpu_core_t cores[] = { CPU_CORE_NROM, CPU_CORE_UXROM };
+    for (int c = 0; c < sizeof(cores) / sizeof(cores[0]); c++) {
+        // Setup two CPUs with the memory layout of the mapper (work RAM, PRG-RAM, a switchable bank at
+        // $8000 and a fixed bank at $C000). Only the second CPU uses the specialised core.
+        cpu_t *a = cpu_create();
+        cpu_t *b = cpu_create();
+        cpu_t *cpus[] = { a, b };
+        uint8_t *prg_ram[] = { prg_ram_a, prg_ram_b };
+        for (int i = 0; i < 2; i++) {
+            as_add_segment(cpus[i]->as, 0x0000, WMEM_SIZE, cpus[i]->wmem, AS_READ | AS_WRITE);
+            as_add_mirror(cpus[i]->as, WMEM_SIZE, 0x1FFF, WMEM_SIZE, 0x0000);
+            as_add_segment(cpus[i]->as, 0x6000, 0x2000, prg_ram[i], AS_READ | AS_WRITE);
+            as_map_bank(cpus[i]->as, 0x8000, 0x4000, program_rom + 0x4000, AS_READ);
+            as_map_bank(cpus[i]->as, 0xC000, 0x4000, program_rom, AS_READ);
+            if (cores[c] == CPU_CORE_UXROM) {
+                as_add_handler(cpus[i]->as, 0x8000, 0xFFFF, uxrom_handler, cpus[i], AS_WRITE);
+            }
+        }
+        cpu_set_core(b, cores[c]);
+
+        for (int program = 0; program < 32; program++) {
+            // Fill each bank with a short random program that jumps to the program in the other bank.
+            memset(program_rom, 0xEA, sizeof(program_rom)); // NOP
+            for (int bank = 0; bank < sizeof(program_rom); bank += 0x4000) {
+                for (int i = 0x0100; i < 0x0400; i++) {
+                    seed = seed * 1103515245 + 12345;
+                    program_rom[bank + i] = safe[(seed >> 16) % nsafe];
+                }
+                program_rom[bank + 0x0500] = 0x4C; // JMP $8100 (from the fixed bank) or JMP $C100
+                program_rom[bank + 0x0501] = 0x00;
+                program_rom[bank + 0x0502] = bank == 0 ? 0x81 : 0xC1;
+            }
+
+            for (int i = 0; i < WMEM_SIZE; i++) {
+                seed = seed * 1103515245 + 12345;
+                a->wmem[i] = b->wmem[i] = seed >> 16;
+            }
+            for (int i = 0; i < sizeof(prg_ram_a); i++) {
+                seed = seed * 1103515245 + 12345;
+                prg_ram_a[i] = prg_ram_b[i] = seed >> 16;
+            }
+
+            as_map_bank(a->as, 0x8000, 0x4000, program_rom + 0x4000, AS_READ);
+            as_map_bank(b->as, 0x8000, 0x4000, program_rom + 0x4000, AS_READ);
+            cpu_set_rom(a, program_rom, sizeof(program_rom));
+            cpu_set_rom(b, program_rom, sizeof(program_rom));
+            a->frame.pc = 0xC100;
+            a->frame.sp = 0xFF;
+            set_sr(&a->frame, seed >> 24);
+            b->frame = a->frame;
+
+            // Accessing memory directly should behave the same as going through the address space.
+            int total_a = 0, total_b = 0;
+            while (total_b < 20000) {
+                seed = seed * 1103515245 + 12345;
+                total_b += cpu_run(b, 1 + (seed >> 16) % 200);
+                while (total_a < total_b) {
+                    total_a += cpu_execute(a, cpu_decode(a, cpu_fetch(a)));
+                }
+
+                assert(total_a == total_b);
+                assert(a->frame.pc == b->frame.pc);
+                assert(a->frame.ac == b->frame.ac && a->frame.x == b->frame.x && a->frame.y == b->frame.y);
+                assert(a->frame.sp == b->frame.sp);
+                assert(get_sr(&a->frame) == get_sr(&b->frame));
+                assert(memcmp(a->wmem, b->wmem, WMEM_SIZE) == 0);
+                assert(memcmp(prg_ram_a, prg_ram_b, sizeof(prg_ram_a)) == 0);
+            }
+        }
+
+        cpu_destroy(a);
+        cpu_destroy(b);
+    }
+}
+
+vram_fields_t unpack_vram(uint16_t value) {
+    vram_fields_t fields = {
+        .coarse_x = value & 0x1F,
+        .coarse_y = (value >> 5) & 0x1F,
+        .nt_x = (value >> 10) & 0x01,
+        .nt_y = (value >> 11) & 0x01,
+        .fine_y = (value >> 12) & 0x07
+    };
+    return fields;
+}
+
+uint16_t pack_vram(vram_fields_t fields) {
+    return fields.fine_y << 12 | fields.nt_y << 11 | fields.nt_x << 10 | fields.coarse_y << 5 | fields.coarse_x;
+}
+
+void inc_fields_x(vram_fields_t *addr) {
+    if (addr->coarse_x < 31) {
+        addr->coarse_x++;
+    }
+    else {
+        addr->coarse_x = 0;
+        addr->nt_x = !addr->nt_x;
+    }
+}
+
+void inc_fields_y(vram_fields_t *addr) {
+    if (addr->fine_y < 7) {
+        addr->fine_y++;
+    }
+    else {
+        addr->fine_y = 0;
+        if (addr->coarse_y == 29) {
+            addr->coarse_y = 0;
+            addr->nt_y = !addr->nt_y;
+        }
+        else if (addr->coarse_y == 31) {
+            addr->coarse_y = 0;
+        }
+        else {
+            addr->coarse_y++;
+        }
+    }
+}
+
+void inc_fields(vram_fields_t *addr, bool vram_inc) {
+    if (!vram_inc) {
+        addr->coarse_x++;
+    }
+    if (vram_inc || addr->coarse_x == 0) {
+        addr->coarse_y++;
+        if (addr->coarse_y == 0) {
+            addr->nt_x++;
+            if (addr->nt_x == 0) {
+                addr->nt_y++;
+                if (addr->nt_y == 0) {
+                    addr->fine_y++;
+                    if (addr->fine_y == 0) {
+                        if (!vram_inc) {
+                            addr->coarse_x = 0;
+                        }
+                        addr->coarse_y = 0;
+                        addr->nt_x = 0;
+                        addr->nt_y = 0;
+                        addr->fine_y = 0;
+                    }
+                }
+            }
+        }
+    }
+}
+
+void test_run_to_event() {
+    static char rom[INES_HEADER_SIZE + 2 * INES_PRG_ROM_UNIT + INES_CHR_ROM_UNIT];
+    static uint8_t ram[WMEM_SIZE];
+
+    // An MMC3 program that renders with NMI, OAM DMA, a sprite 0 hit split and scanline IRQs.
+    const uint8_t program[] = {
+            // reset:
+            0x78,                           // SEI
+            0xD8,                           // CLD
+            0xA2, 0xFF,                 // LDX #$FF
+            0x9A,                           // TXS
+            0xA9, 0x40,                 // LDA #$40
+            0x8D, 0x17, 0x40,       // STA $4017
+            // vwait1:
+            0x2C, 0x02, 0x20,       // BIT $2002
+            0x10, 0xFB,                 // BPL vwait1
+            // vwait2:
+            0x2C, 0x02, 0x20,       // BIT $2002
+            0x10, 0xFB,                 // BPL vwait2
+            // Palette.
+            0xA9, 0x3F,                 // LDA #$3F
+            0x8D, 0x06, 0x20,       // STA $2006
+            0xA2, 0x00,                 // LDX #$00
+            0x8E, 0x06, 0x20,       // STX $2006
+            // palette:
+            0x8E, 0x07, 0x20,       // STX $2007
+            0xE8,                           // INX
+            0xE0, 0x20,                 // CPX #$20
+            0xD0, 0xF8,                 // BNE palette
+            // Nametables.
+            0xA9, 0x20,                 // LDA #$20
+            0x8D, 0x06, 0x20,       // STA $2006
+            0xA9, 0x00,                 // LDA #$00
+            0x8D, 0x06, 0x20,       // STA $2006
+            0xA0, 0x08,                 // LDY #$08
+            // nametables:
+            0x8E, 0x07, 0x20,       // STX $2007
+            0xE8,                           // INX
+            0xD0, 0xFA,                 // BNE nametables
+            0x88,                           // DEY
+            0xD0, 0xF7,                 // BNE nametables
+            // Sprites (16 on each row, so that some lines overflow).
+            // sprites:
+            0x8A,                           // TXA
+            0x4A,                           // LSR A
+            0x4A,                           // LSR A
+            0x29, 0xF0,                 // AND #$F0
+            0x9D, 0x00, 0x02,       // STA $0200,X
+            0xE8,                           // INX
+            0xD0, 0xF5,                 // BNE sprites
+            // Scanline IRQ, NMI and rendering.
+            0xA9, 0x14,                 // LDA #$14
+            0x8D, 0x00, 0xC0,       // STA $C000
+            0x8D, 0x01, 0xC0,       // STA $C001
+            0x8D, 0x01, 0xE0,       // STA $E001
+            0x58,                           // CLI
+            0xA9, 0x88,                 // LDA #$88
+            0x8D, 0x00, 0x20,       // STA $2000
+            0xA9, 0x1E,                 // LDA #$1E
+            0x8D, 0x01, 0x20,       // STA $2001
+            // main:
+            0xE6, 0x20,                 // INC $20
+            0xD0, 0x02,                 // BNE hit_clear
+            0xE6, 0x21,                 // INC $21
+            // Wait for sprite 0 hit and change the scroll.
+            // hit_clear:
+            0x2C, 0x02, 0x20,       // BIT $2002
+            0x70, 0xFB,                 // BVS hit_clear
+            // hit_set:
+            0x2C, 0x02, 0x20,       // BIT $2002
+            0x50, 0xFB,                 // BVC hit_set
+            0xA5, 0x20,                 // LDA $20
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x4C, 0x5C, 0xE0,       // JMP main
+            // nmi:
+            0x48,                           // PHA
+            0xE6, 0x10,                 // INC $10
+            0xA9, 0x00,                 // LDA #$00
+            0x8D, 0x03, 0x20,       // STA $2003
+            0xA9, 0x02,                 // LDA #$02
+            0x8D, 0x14, 0x40,       // STA $4014
+            0xA5, 0x10,                 // LDA $10
+            0x8D, 0x02, 0x40,       // STA $4002
+            0xA9, 0xBF,                 // LDA #$BF
+            0x8D, 0x00, 0x40,       // STA $4000
+            0xA9, 0x08,                 // LDA #$08
+            0x8D, 0x03, 0x40,       // STA $4003
+            0xA5, 0x10,                 // LDA $10
+            0x29, 0x01,                 // AND #$01
+            0x09, 0x88,                 // ORA #$88
+            0x8D, 0x00, 0x20,       // STA $2000
+            0xA5, 0x10,                 // LDA $10
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x8D, 0x01, 0xC0,       // STA $C001
+            0x68,                           // PLA
+            0x40,                           // RTI
+            // irq:
+            0x48,                           // PHA
+            0x8D, 0x00, 0xE0,       // STA $E000
+            0x8D, 0x01, 0xE0,       // STA $E001
+            0xE6, 0x11,                 // INC $11
+            0xA5, 0x11,                 // LDA $11
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x8D, 0x05, 0x20,       // STA $2005
+            0x68,                           // PLA
+            0x40,                           // RTI
+    };
+    const addr_t vectors[] = { 0xE077, 0xE000, 0xE0A9 };
+
+    // iNES image (32KB of PRG-ROM with the program in the last bank, and 8KB of random CHR-ROM).
+    const uint8_t header[] = { 'N', 'E', 'S', 0x1A, 2, 1, 0x41, 0x00 };
+    memcpy(rom, header, sizeof(header));
+    char *prg = rom + INES_HEADER_SIZE;
+    memset(prg, 0xFF, 2 * INES_PRG_ROM_UNIT);
+    memcpy(prg + 0x6000, program, sizeof(program));
+    for (int i = 0; i < 3; i++) {
+        prg[0x7FFA + i * 2] = vectors[i] & 0xFF;
+        prg[0x7FFB + i * 2] = vectors[i] >> 8;
+    }
+    uint32_t seed = 3579;
+    for (int i = 0; i < INES_CHR_ROM_UNIT; i++) {
+        prg[2 * INES_PRG_ROM_UNIT + i] = random_next(&seed);
+    }
+
+    // Run the program in lockstep (with an instruction handler), and then ahead of the rest of the system.
+    run_frames(rom, 30, true);
+    const uint64_t cycles = cpu->cycles;
+    const uint32_t hash = frames_hash;
+    memcpy(ram, cpu->wmem, sizeof(ram));
+    memcpy(screen_b, screen_a, sizeof(screen_b));
+    prog_t *prog = curprog;
+    sys_poweroff();
+    prog_destroy(prog);
+
+    // The frames, cycle count and RAM should be the same.
+    run_frames(rom, 30, false);
+    assert(cpu->cycles == cycles);
+    assert(frames_hash == hash);
+    assert(memcmp(cpu->wmem, ram, sizeof(ram)) == 0);
+    assert(memcmp(screen_a, screen_b, sizeof(screen_a)) == 0);
+
+    // The program should have taken NMIs, scanline IRQs and sprite 0 hits.
+    assert(ram[0x10] > 15 && ram[0x11] > ram[0x10] && ram[0x20] > 15);
+    prog = curprog;
+    sys_poweroff();
+    prog_destroy(prog);
+}
+
+void test_vram_registers() {
+    uint32_t seed = 1357;
+    fetch_log_t log = { 0 };
+    ppu_t *ppu = create_ppu(screen_a, &log);
+    for (int i = 0; i < VRAM_SIZE; i++) {
+        ppu->vram[i] = random_next(&seed);
+    }
+    ppu_write(ppu, PPU_MASK, 0x08);
+
+    // Compare the addresses and increments for every value of the register with the bitfields they replaced.
+    for (int value = 0; value <= VRAM_ADDR; value++) {
+        const vram_fields_t fields = unpack_vram(value);
+        assert(pack_vram(fields) == value);
+        ppu->draw_y = 0;
+
+        // Nametable fetch (dot 2).
+        ppu->v = value;
+        ppu->draw_x = 2;
+        ppu_render(ppu, 1);
+        const addr_t nt_addr = NAMETABLE0 | fields.nt_y << 11 | fields.nt_x << 10 | fields.coarse_y << 5 | fields.coarse_x;
+        assert(log.last == nt_addr);
+        assert(ppu->v == value);
+
+        // Attribute fetch (dot 4), including which quadrant's bits are selected.
+        ppu->draw_x = 4;
+        ppu_render(ppu, 1);
+        const addr_t at_addr = NAMETABLE0 | fields.nt_y << 11 | fields.nt_x << 10 | 0x0F << 6 | (fields.coarse_y >> 2) << 3
+            | fields.coarse_x >> 2;
+        const int shift = (fields.coarse_y & 0x02) << 1 | (fields.coarse_x & 0x02);
+        assert(log.last == at_addr);
+        assert(ppu->attr_latch == ((ppu->vram[at_addr & (VRAM_SIZE - 1)] >> shift) & 0x03));
+
+        // Horizontal increment (dot 8).
+        vram_fields_t expected = fields;
+        inc_fields_x(&expected);
+        ppu->draw_x = 8;
+        ppu_render(ppu, 1);
+        assert(ppu->v == pack_vram(expected));
+
+        // Vertical increment (dot 256).
+        expected = fields;
+        inc_fields_y(&expected);
+        ppu->v = value;
+        ppu->draw_x = 256;
+        ppu_render(ppu, 1);
+        assert(ppu->v == pack_vram(expected));
+
+        // PPUDATA reads (incrementing by 1 and by 32).
+        for (int vram_inc = 0; vram_inc < 2; vram_inc++) {
+            expected = fields;
+            inc_fields(&expected, vram_inc);
+            ppu_write(ppu, PPU_CTRL, vram_inc ? 0x04 : 0x00);
+            ppu->v = value;
+            ppu_read(ppu, PPU_DATA);
+            assert(log.last == (fields.fine_y << 12 | fields.nt_y << 11 | fields.nt_x << 10 | fields.coarse_y << 5
+                | fields.coarse_x));
+            assert(ppu->v == pack_vram(expected));
+        }
+    }
+
+    ppu_destroy(ppu);
+}
+
+void test_scanline_renderer() {
+    uint32_t seed = 8642;
+    for (int i = 0; i < sizeof(pattern_tables); i++) {
+        pattern_tables[i] = random_next(&seed);
+    }
+
+    // Every combination of the PPUMASK flags, with the fetches either logged or read from the tile cache.
+    for (int mask = 0; mask < 0x100; mask++) {
+        for (int test = 0; test < 8; test++) {
+            const bool logged = test % 2;
+            const uint32_t state = random_next(&seed) << 16 | random_next(&seed);
+            const int line = random_next(&seed) % SCREEN_HEIGHT;
+            fetch_log_t log_a = { 0 }, log_b = { 0 };
+            ppu_t *a = create_ppu(screen_a, logged ? &log_a : NULL);
+            ppu_t *b = create_ppu(screen_b, logged ? &log_b : NULL);
+            randomise_ppu(a, state, line, mask);
+            randomise_ppu(b, state, line, mask);
+
+            // Half of the tests use a background palette in which every entry differs (with every color in every
+            // entry across the tests), and start with every pixel value in the first two tiles, so that each is
+            // resolved with both clip masks.
+            if (test >= 4) {
+                const int base = (mask * 4 + test) & MAX_COLOR;
+                for (ppu_t *ppu = a; ppu != NULL; ppu = ppu == a ? b : NULL) {
+                    ppu->bkg_color = base;
+                    for (int i = 1; i < 16; i++) {
+                        ppu->bkg_palette[i - 1] = (base + 7 * i) & MAX_COLOR;
+                    }
+                    ppu->sr_tile[0] = 0x5555;
+                    ppu->sr_tile[1] = 0x3333;
+                    ppu->sr_attr[0] = 0x0F0F;
+                    ppu->sr_attr[1] = 0x00FF;
+                }
+            }
+            memset(screen_a, 0xFF, sizeof(screen_a));
+            memset(screen_b, 0xFF, sizeof(screen_b));
+
+            // Rendering the whole line in one pass (which resolves 8 pixels at a time, with SIMD instructions if
+            // PPU_SIMD is defined) should draw the same pixels, make the same PPU memory accesses in the same
+            // order, and leave the same state as rendering each dot.
+            ppu_render(a, SCANLINE_END + 1);
+            render_dots(b, SCANLINE_END + 1);
+            assert(memcmp(screen_a, screen_b, sizeof(screen_a)) == 0);
+            assert(log_a.hash == log_b.hash && log_a.count == log_b.count);
+            assert(a->draw_x == b->draw_x && a->draw_y == b->draw_y);
+            assert(a->v == b->v && a->t == b->t);
+            assert(a->status.value == b->status.value);
+            assert(a->oam_addr == b->oam_addr);
+            assert(memcmp(a->sr_tile, b->sr_tile, sizeof(a->sr_tile)) == 0);
+            assert(memcmp(a->sr_attr, b->sr_attr, sizeof(a->sr_attr)) == 0);
+            assert(a->attr_latch == b->attr_latch);
+            assert(memcmp(a->oam2, b->oam2, sizeof(a->oam2)) == 0);
+            assert(memcmp(a->spr_line, b->spr_line, sizeof(a->spr_line)) == 0);
+            assert(a->n == b->n && a->m == b->m && a->oam2_ptr == b->oam2_ptr);
+            assert(a->oam_buffer == b->oam_buffer);
+            assert(a->szn == b->szn && a->szc == b->szc);
+
+            ppu_destroy(a);
+            ppu_destroy(b);
+        }
+    }
+}
+
+void test_frame_skip() {
+    uint32_t seed = 9753;
+    for (int i = 0; i < sizeof(pattern_tables); i++) {
+        pattern_tables[i] = random_next(&seed);
+    }
+
+    int hits = 0, overflows = 0;
+    for (int test = 0; test < 48; test++) {
+        // Two PPUs in the same random state at the start of a frame, one of which skips its frames.
+        const uint32_t state = random_next(&seed) << 16 | random_next(&seed);
+        const int line = random_next(&seed) % SCREEN_HEIGHT;
+        const uint8_t mask = random_next(&seed) % 4 ? random_next(&seed) | 0x1E : random_next(&seed);
+        fetch_log_t log_a = { 0 }, log_b = { 0 };
+        ppu_t *a = create_ppu(screen_a, NULL);
+        ppu_t *b = create_ppu(screen_b, NULL);
+        as_add_handler(a->as, 0x0000, NAMETABLE0 - 1, fetch_handler, &log_a, AS_READ);
+        as_add_handler(b->as, 0x0000, NAMETABLE0 - 1, fetch_handler, &log_b, AS_READ);
+        randomise_ppu(a, state, line, mask);
+        randomise_ppu(b, state, line, mask);
+        a->draw_y = b->draw_y = -1;
+        b->skip = true;
+
+        // Render a few frames in the same chunks (every other test a dot at a time, so that the dot at which
+        // each flag is set is exact), changing PPUMASK and reading PPUSTATUS in between.
+        int hit_a = -1, hit_b = -1, overflow_a = -1, overflow_b = -1;
+        int dots = 3 * (N_SCANLINES + 2) * (SCANLINE_END + 1);
+        while (dots > 0) {
+            int chunk = 1;
+            if (test % 2) {
+                switch (random_next(&seed) % 4) {
+                    case 0:
+                        chunk = random_next(&seed) % 16 + 1;
+                        break;
+                    case 1:
+                        chunk = random_next(&seed) % 700 + 1;
+                        break;
+                    case 2:
+                        chunk = (random_next(&seed) % 20 + 1) * (SCANLINE_END + 1);
+                        break;
+                }
+            }
+            chunk = chunk < dots ? chunk : dots;
+            ppu_render(a, chunk);
+            ppu_render(b, chunk);
+            dots -= chunk;
+
+            // The flags, the VRAM address and the pattern fetches (which mappers may watch) should be the same.
+            assert(a->draw_x == b->draw_x && a->draw_y == b->draw_y);
+            assert(a->status.value == b->status.value);
+            assert(a->v == b->v);
+            assert(log_a.hash == log_b.hash && log_a.count == log_b.count);
+
+            const int dot = a->draw_y * (SCANLINE_END + 1) + a->draw_x;
+            hit_a = a->status.hit ? (hit_a < 0 ? dot : hit_a) : -1;
+            hit_b = b->status.hit ? (hit_b < 0 ? dot : hit_b) : -1;
+            overflow_a = a->status.overflow ? (overflow_a < 0 ? dot : overflow_a) : -1;
+            overflow_b = b->status.overflow ? (overflow_b < 0 ? dot : overflow_b) : -1;
+            assert(hit_a == hit_b && overflow_a == overflow_b);
+            hits += a->status.hit;
+            overflows += a->status.overflow;
+
+            if (random_next(&seed) % 64 == 0) {
+                const uint8_t value = random_next(&seed);
+                ppu_write(a, PPU_MASK, value);
+                ppu_write(b, PPU_MASK, value);
+            }
+            if (random_next(&seed) % 64 == 0) {
+                assert(ppu_read(a, PPU_STATUS) == ppu_read(b, PPU_STATUS));
+            }
+        }
+
+        ppu_destroy(a);
+        ppu_destroy(b);
+    }
+
+    // Make sure that the flags were actually set.
+    assert(hits > 0 && overflows > 0);
 }
 
 void test_address_modes(tframe_t *frame) {
@@ -318,15 +1512,15 @@ void test_instructions(tframe_t *frame) {
     assert(frame->ac == 10);
     assert(frame->sp = sp_start);
 
-    sr_flags_t sr = frame->sr;
+    sr_flags_t sr = get_flags(frame);
     exec_ins(&INS_PHP, frame, as, 0, NULL);
     exec_ins(&INS_PLP, frame, as, 0, NULL);
-    assert(frame->sr.carry == sr.carry);
-    assert(frame->sr.dec == sr.dec);
-    assert(frame->sr.irq == sr.irq);
-    assert(frame->sr.neg == sr.neg);
-    assert(frame->sr.vflow == sr.vflow);
-    assert(frame->sr.zero == sr.zero);
+    assert(get_flags(frame).carry == sr.carry);
+    assert(get_flags(frame).dec == sr.dec);
+    assert(get_flags(frame).irq == sr.irq);
+    assert(get_flags(frame).neg == sr.neg);
+    assert(get_flags(frame).vflow == sr.vflow);
+    assert(get_flags(frame).zero == sr.zero);
 
     /**
      * Test decrements and increments.
@@ -342,176 +1536,176 @@ void test_instructions(tframe_t *frame) {
 
     // ADC
     
-    frame->sr.dec = 0;
+    set_flag(frame, SR_DECIMAL, 0);
 
     frame->ac = 0x01;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0x02;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0x03);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x01;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x02;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0x04);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x7F;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0x01;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac = 0x80);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.vflow == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).vflow == 1);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0xFF;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0x01;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 1);
 
     frame->ac = 0xFF;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0x02;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0x01);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0xFF;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0xFF;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0xFF);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x80;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0xFF;
 
     exec_ins(&INS_ADC, frame, as, 0, &value);
     assert(frame->ac == 0x7F);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 1);
+    assert(get_flags(frame).zero == 0);
 
     // SBC
 
-    frame->sr.dec = 0;
+    set_flag(frame, SR_DECIMAL, 0);
 
     frame->ac = 0x08;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x02;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x06);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x08;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x08;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 1);
 
     frame->ac = 0x08;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x09;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0xFF);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x08;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     value = 0x02;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x05);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x81;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x02;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x7F);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 1);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x85;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0x02;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x83);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x00;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0xFF;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x01);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.vflow == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).vflow == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x7F;
-    frame->sr.carry = 1;
+    set_flag(frame, SR_CARRY, 1);
     value = 0xFF;
 
     exec_ins(&INS_SBC, frame, as, 0, &value);
     assert(frame->ac == 0x80);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.vflow == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).vflow == 1);
+    assert(get_flags(frame).zero == 0);
 
     /**
      * Test logical operators.
@@ -523,22 +1717,22 @@ void test_instructions(tframe_t *frame) {
     value = 0x0F;
     exec_ins(&INS_AND, frame, as, 0, &value);
     assert(frame->ac == 0x00);
-    assert(frame->sr.zero == 1);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 1);
+    assert(get_flags(frame).neg == 0);
 
     frame->ac = 0x03;
     value = 0x06;
     exec_ins(&INS_AND, frame, as, 0, &value);
     assert(frame->ac == 0x02);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 0);
 
     frame->ac = 0xF0;
     value = 0xF0;
     exec_ins(&INS_AND, frame, as, 0, &value);
     assert(frame->ac == 0xF0);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 1);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 1);
 
     // OR
 
@@ -546,22 +1740,22 @@ void test_instructions(tframe_t *frame) {
     value = 0x0F;
     exec_ins(&INS_ORA, frame, as, 0, &value);
     assert(frame->ac == 0xFF);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 1);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 1);
 
     frame->ac = 0x03;
     value = 0x06;
     exec_ins(&INS_ORA, frame, as, 0, &value);
     assert(frame->ac == 0x07);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 0);
 
     frame->ac = 0x00;
     value = 0x00;
     exec_ins(&INS_ORA, frame, as, 0, &value);
     assert(frame->ac == 0x00);
-    assert(frame->sr.zero == 1);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 1);
+    assert(get_flags(frame).neg == 0);
 
     // XOR
 
@@ -569,22 +1763,22 @@ void test_instructions(tframe_t *frame) {
     value = 0x0F;
     exec_ins(&INS_EOR, frame, as, 0, &value);
     assert(frame->ac == 0xFF);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 1);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 1);
 
     frame->ac = 0x03;
     value = 0x06;
     exec_ins(&INS_EOR, frame, as, 0, &value);
     assert(frame->ac == 0x05);
-    assert(frame->sr.zero == 0);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 0);
+    assert(get_flags(frame).neg == 0);
 
     frame->ac = 0xF0;
     value = 0xF0;
     exec_ins(&INS_EOR, frame, as, 0, &value);
     assert(frame->ac == 0x00);
-    assert(frame->sr.zero == 1);
-    assert(frame->sr.neg == 0);
+    assert(get_flags(frame).zero == 1);
+    assert(get_flags(frame).neg == 0);
 
     /**
      * Test shift and rotate instructions.
@@ -593,150 +1787,150 @@ void test_instructions(tframe_t *frame) {
     // ASL (left shift).
 
     frame->ac = 0x20;
-    frame->sr.carry = 1;
-    frame->sr.neg = 1;
-    frame->sr.zero = 1;
+    set_flag(frame, SR_CARRY, 1);
+    set_flag(frame, SR_NEGATIVE, 1);
+    set_flag(frame, SR_ZERO, 1);
 
     exec_ins(&INS_ASL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x40);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(&INS_ASL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x80);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(&INS_ASL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     exec_ins(&INS_ASL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     // LSR (right shift).
 
     frame->ac = 0x02;
-    frame->sr.carry = 1;
-    frame->sr.neg = 1;
-    frame->sr.zero = 1;
+    set_flag(frame, SR_CARRY, 1);
+    set_flag(frame, SR_NEGATIVE, 1);
+    set_flag(frame, SR_ZERO, 1);
 
     exec_ins(&INS_LSR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x01);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(&INS_LSR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     exec_ins(&INS_LSR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     frame->ac = 0x90;
-    frame->sr.carry = 1;
-    frame->sr.neg = 1;
-    frame->sr.zero = 1;
+    set_flag(frame, SR_CARRY, 1);
+    set_flag(frame, SR_NEGATIVE, 1);
+    set_flag(frame, SR_ZERO, 1);
 
     exec_ins(&INS_LSR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x48);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     // ROL (rotate left).
 
     frame->ac = 0x41;
-    frame->sr.carry = 0;
-    frame->sr.neg = 0;
-    frame->sr.zero = 0;
+    set_flag(frame, SR_CARRY, 0);
+    set_flag(frame, SR_NEGATIVE, 0);
+    set_flag(frame, SR_ZERO, 0);
 
     exec_ins(&INS_ROL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x82);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(&INS_ROL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x04);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x00;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
     
     exec_ins(&INS_ROL, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     // ROR (rotate right).
 
     frame->ac = 0x05;
-    frame->sr.carry = 0;
-    frame->sr.neg = 0;
-    frame->sr.zero = 0;
+    set_flag(frame, SR_CARRY, 0);
+    set_flag(frame, SR_NEGATIVE, 0);
+    set_flag(frame, SR_ZERO, 0);
 
     exec_ins(&INS_ROR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x02);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(&INS_ROR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x81);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     frame->ac = 0x00;
-    frame->sr.carry = 0;
+    set_flag(frame, SR_CARRY, 0);
 
     exec_ins(&INS_ROR, frame, as, 0, &frame->ac);
     assert(frame->ac == 0x00);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     /**
      * Test flag instructions (set and clear).
      */
 
-    frame->sr.carry = 0;
-    frame->sr.dec = 0;
-    frame->sr.irq = 0;
-    frame->sr.vflow = 1;
+    set_flag(frame, SR_CARRY, 0);
+    set_flag(frame, SR_DECIMAL, 0);
+    set_flag(frame, SR_INTERRUPT, 0);
+    set_flag(frame, SR_OVERFLOW, 1);
 
     exec_ins(&INS_SEC, frame, as, 0, NULL);
-    assert(frame->sr.carry == 1);
+    assert(get_flags(frame).carry == 1);
     exec_ins(&INS_SED, frame, as, 0, NULL);
-    assert(frame->sr.dec == 1);
+    assert(get_flags(frame).dec == 1);
     exec_ins(&INS_SEI, frame, as, 0, NULL);
-    assert(frame->sr.irq == 1);
+    assert(get_flags(frame).irq == 1);
 
     exec_ins(&INS_CLC, frame, as, 0, NULL);
-    assert(frame->sr.carry == 0);
+    assert(get_flags(frame).carry == 0);
     exec_ins(&INS_CLD, frame, as, 0, NULL);
-    assert(frame->sr.dec == 0);
+    assert(get_flags(frame).dec == 0);
     exec_ins(&INS_CLI, frame, as, 0, NULL);
-    assert(frame->sr.irq == 0);
+    assert(get_flags(frame).irq == 0);
     exec_ins(&INS_CLV, frame, as, 0, NULL);
-    assert(frame->sr.vflow == 0);
+    assert(get_flags(frame).vflow == 0);
 
     /**
      * Test comparisons.
@@ -802,14 +1996,14 @@ void test_instructions(tframe_t *frame) {
     assert(prev.ac == frame->ac);
     assert(prev.pc == frame->pc);
     assert(prev.sp == frame->sp);
-    assert(prev.sr.brk == frame->sr.brk);
-    assert(prev.sr.carry == frame->sr.carry);
-    assert(prev.sr.dec == frame->sr.dec);
-    assert(prev.sr.ign == frame->sr.ign);
-    assert(prev.sr.irq == frame->sr.irq);
-    assert(prev.sr.neg == frame->sr.neg);
-    assert(prev.sr.vflow == frame->sr.vflow);
-    assert(prev.sr.zero == frame->sr.zero);
+    assert(get_flags(&prev).brk == get_flags(frame).brk);
+    assert(get_flags(&prev).carry == get_flags(frame).carry);
+    assert(get_flags(&prev).dec == get_flags(frame).dec);
+    assert(get_flags(&prev).ign == get_flags(frame).ign);
+    assert(get_flags(&prev).irq == get_flags(frame).irq);
+    assert(get_flags(&prev).neg == get_flags(frame).neg);
+    assert(get_flags(&prev).vflow == get_flags(frame).vflow);
+    assert(get_flags(&prev).zero == get_flags(frame).zero);
     assert(prev.sp == frame->sp);
     assert(prev.x == frame->x);
     assert(prev.y == frame->y);
@@ -826,14 +2020,14 @@ void test_load_store(tframe_t *frame, const addrspace_t *as, uint8_t *reg, const
     value = 0x00;
     exec_ins(load, frame, as, 0, &value);
     assert(*reg == 0x00);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
     
     as_write(as, 0x19, 0x05);
     exec_ins(load, frame, as, 0x19, NULL);
     assert(*reg == 0x05);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(store, frame, as, 0x20, NULL);
     assert(as_read(as, 0x20) == 0x05);
@@ -841,8 +2035,8 @@ void test_load_store(tframe_t *frame, const addrspace_t *as, uint8_t *reg, const
     value = 0xF9;
     exec_ins(load, frame, as, 0x20, &value);
     assert(*reg == 0xF9);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(store, frame, as, 0x21, NULL);
     assert(as_read(as, 0x21) == 0xF9);
@@ -853,70 +2047,70 @@ void test_inc_dec(tframe_t *frame, const addrspace_t *as, uint8_t *value, const
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 255);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 254);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 255);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     *value = 129;
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 128);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 127);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(dec, frame, as, 0, value);
     assert(*value == 126);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
     
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 127);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 128);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     exec_ins(inc, frame, as, 0, value);
     assert(*value == 129);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 }
 
 void test_compare(tframe_t *frame, const addrspace_t *as, uint8_t *reg, const instruction_t *cmp) {
@@ -926,65 +2120,65 @@ void test_compare(tframe_t *frame, const addrspace_t *as, uint8_t *reg, const in
     *reg = 0x08;
     value = 0x05;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 
     // 8 - 8 = 0
     *reg = 0x08;
     value = 0x08;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
 
     // 8 - 10 = -2 < 0
     *reg = 0x08;
     value = 0x0A;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     // (-1) - (-1) = 0
     *reg = 0xFF;
     value = 0xFF;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 1);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 1);
     
     // (-1) - (-2) = 1 > 0
     *reg = 0xFF;
     value = 0xFE;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
     
     // (-2) - (-1) = -1 < 0
     *reg = 0xFE;
     value = 0xFF;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     // (-1) - 0 = -1 < 0
     *reg = 0xFF;
     value = 0x00;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 1);
-    assert(frame->sr.neg == 1);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 1);
+    assert(get_flags(frame).neg == 1);
+    assert(get_flags(frame).zero == 0);
 
     // 0 - (-1) = 1 > 0
     *reg = 0x00;
     value = 0xFF;
     exec_ins(cmp, frame, as, 0, &value);
-    assert(frame->sr.carry == 0);
-    assert(frame->sr.neg == 0);
-    assert(frame->sr.zero == 0);
+    assert(get_flags(frame).carry == 0);
+    assert(get_flags(frame).neg == 0);
+    assert(get_flags(frame).zero == 0);
 }
 
 void test_branch(tframe_t *frame, const addrspace_t *as, const instruction_t *branch, uint8_t mask, unsigned int true_val) {
@@ -992,18 +2186,18 @@ void test_branch(tframe_t *frame, const addrspace_t *as, const instruction_t *br
     addr_t target = start + 5;
     frame->pc = start;
 
-    frame->sr = bits_to_sr(!true_val ? mask : 0x00);
+    set_sr(frame, !true_val ? mask : 0x00);
     exec_ins(branch, frame, as, target, NULL);
     assert(frame->pc == start);
 
-    frame->sr = bits_to_sr(true_val ? mask : 0x00);
+    set_sr(frame, true_val ? mask : 0x00);
     exec_ins(branch, frame, as, target, NULL);
     assert(frame->pc == target);
 
     frame->pc = start;
     target = start - 5;
 
-    frame->sr = bits_to_sr(true_val ? mask : 0x00);
+    set_sr(frame, true_val ? mask : 0x00);
     exec_ins(branch, frame, as, target, NULL);
     assert(frame->pc == target);
 }
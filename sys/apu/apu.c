@@ -1,4 +1,5 @@
 #include <apu.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
@@ -42,6 +43,14 @@ static inline void len_counter_load(uint8_t *counter, uint8_t load, bool status,
  */
 static inline void len_counter_clock(uint8_t *counter, bool halt);
 
+/**
+ * @brief Gets the increment of the frame counter between the current step of the sequencer and the next.
+ * 
+ * @param apu The APU.
+ * @return The increment between quarter-frames.
+ */
+static inline int frame_step(const apu_t *apu);
+
 static const uint8_t PULSE_DUTY[4] = {
     0x01, 0x03, 0x0F, 0xFC
 };
@@ -61,7 +70,7 @@ static const uint16_t DMC_RATES[16] = {
 
 apu_t *apu_create(void) {
     // Create the APU.
-    apu_t *apu = malloc(sizeof(struct apu));
+    apu_t *apu = calloc(1, sizeof(struct apu));
 
     // Clear registers.
     apu->pulse[0].reg0 = 0;
@@ -220,11 +229,11 @@ void apu_update(apu_t *apu, addrspace_t *cpuas, int hcycles) {
     }
 
     // Calculate the increment between quarter-frames.
-    const int frame_step = apu->step == 4 ? 2 * (QUARTER_FRAME - 2) : apu->step < 2 ? 2 * QUARTER_FRAME : 2 * (QUARTER_FRAME + 1);
+    const int step = frame_step(apu);
     
     // Handle sequencer events.
     apu->frame_counter += hcycles;
-    if (apu->frame.mode == 0 && apu->step == 3 && apu->frame_counter >= frame_step && !apu->irq_occurred) {
+    if (apu->frame.mode == 0 && apu->step == 3 && apu->frame_counter >= step && !apu->irq_occurred) {
         if (apu->frame.irq) {
             apu->status.f_irq = 0;
         }
@@ -234,7 +243,7 @@ void apu_update(apu_t *apu, addrspace_t *cpuas, int hcycles) {
         }
         apu->irq_occurred = true;
     }
-    if (apu->frame_counter > frame_step) {
+    if (apu->frame_counter > step) {
         // Check if the current step is a half-frame.
         bool half_frame = apu->step == 1 || (apu->frame.mode == 0 && apu->step == 3) || (apu->frame.mode == 1 && apu->step == 4);
 
@@ -299,7 +308,7 @@ void apu_update(apu_t *apu, addrspace_t *cpuas, int hcycles) {
         }
         
         // Decrement the frame counter and increment the step.
-        apu->frame_counter -= frame_step;
+        apu->frame_counter -= step;
         if ((apu->frame.mode == 0 && apu->step == 3) || (apu->frame.mode == 1 && apu->step == 4)) {
             apu->irq_occurred = false;
             apu->step = 0;
@@ -527,6 +536,49 @@ void apu_update(apu_t *apu, addrspace_t *cpuas, int hcycles) {
     }
 }
 
+int apu_next_event(const apu_t *apu) {
+    // An IRQ is already pending, or the DMC may finish its sample (and generate an IRQ) at any time.
+    if (apu->irq_flag || (apu->dmc.irq && (apu->dmc.bytes_remaining > 0 || apu->dmc.start_flag)))
+        return 0;
+
+    // The frame counter is about to be reset.
+    if (apu->frame_reset > 0)
+        return apu->frame_reset;
+
+    // The frame IRQ can only occur when the sequencer steps.
+    if (apu->frame.mode == 0 && !apu->frame.irq)
+        return apu->frame_counter < frame_step(apu) ? frame_step(apu) - apu->frame_counter : 0;
+
+    return INT_MAX;
+}
+
+int apu_next_step(const apu_t *apu) {
+    // An IRQ is already pending.
+    if (apu->irq_flag)
+        return 0;
+
+    // The DMC may finish its sample (and generate an IRQ) at any time.
+    if (apu->dmc.irq && (apu->dmc.bytes_remaining > 0 || apu->dmc.start_flag))
+        return 1;
+
+    // The sequencer steps once the frame counter passes the step (the frame IRQ is raised as soon as it reaches it).
+    int cycles = frame_step(apu) - apu->frame_counter + 1;
+    if (apu->frame.mode == 0 && apu->step == 3 && !apu->irq_occurred) {
+        cycles--;
+    }
+
+    // The frame counter is about to be reset.
+    if (apu->frame_reset > 0 && apu->frame_reset < cycles) {
+        cycles = apu->frame_reset;
+    }
+
+    return cycles > 1 ? cycles : 1;
+}
+
+static inline int frame_step(const apu_t *apu) {
+    return apu->step == 4 ? 2 * (QUARTER_FRAME - 2) : apu->step < 2 ? 2 * QUARTER_FRAME : 2 * (QUARTER_FRAME + 1);
+}
+
 static inline void envelope_clock(envelope_t *env, uint8_t vol, uint8_t loop) {
     if (env->start_flag) {
         env->decay_level = 15;
@@ -75,20 +75,20 @@ static const mem_loc_t addrm_indy(const tframe_t *frame, const addrspace_t *as,
     return addrm_absy(frame, as, args1);
 }
 
-const addrmode_t AM_IMPLIED = { addrm_impl, 0 };
-const addrmode_t AM_ACCUMULATOR = { addrm_acc, 0 };
-const addrmode_t AM_IMMEDIATE = { addrm_imm, 1 };
+const addrmode_t AM_IMPLIED = { addrm_impl, 0, 2, false };
+const addrmode_t AM_ACCUMULATOR = { addrm_acc, 0, 0, false };
+const addrmode_t AM_IMMEDIATE = { addrm_imm, 1, 2, false };
 
-const addrmode_t AM_ZEROPAGE = { addrm_zpg, 1 };
-const addrmode_t AM_ZEROPAGE_X = { addrm_zpgx, 1 };
-const addrmode_t AM_ZEROPAGE_Y = { addrm_zpgy, 1 };
+const addrmode_t AM_ZEROPAGE = { addrm_zpg, 1, 3, false };
+const addrmode_t AM_ZEROPAGE_X = { addrm_zpgx, 1, 4, false };
+const addrmode_t AM_ZEROPAGE_Y = { addrm_zpgy, 1, 4, false };
 
-const addrmode_t AM_ABSOLUTE = { addrm_abs, 2 };
-const addrmode_t AM_ABSOLUTE_X = { addrm_absx, 2 };
-const addrmode_t AM_ABSOLUTE_Y = { addrm_absy, 2 };
+const addrmode_t AM_ABSOLUTE = { addrm_abs, 2, 4, false };
+const addrmode_t AM_ABSOLUTE_X = { addrm_absx, 2, 4, true };
+const addrmode_t AM_ABSOLUTE_Y = { addrm_absy, 2, 4, true };
 
-const addrmode_t AM_RELATIVE = { addrm_rel, 1 };
+const addrmode_t AM_RELATIVE = { addrm_rel, 1, 0, false };
 
-const addrmode_t AM_INDIRECT = { addrm_ind, 2 };
-const addrmode_t AM_INDIRECT_X = { addrm_indx, 1 };
-const addrmode_t AM_INDIRECT_Y = { addrm_indy, 1 };
+const addrmode_t AM_INDIRECT = { addrm_ind, 2, 0, false };
+const addrmode_t AM_INDIRECT_X = { addrm_indx, 1, 6, false };
+const addrmode_t AM_INDIRECT_Y = { addrm_indy, 1, 5, true };
@@ -0,0 +1,211 @@
+/**
+ * @file blocks.c
+ * @brief Cache of decoded blocks of 6502 code.
+ * @version 1.0
+ * @date 2022-03-26
+ */
+
+#include <addrmodes.h>
+#include <blocks.h>
+#include <instructions.h>
+#include <jit.h>
+#include <stdlib.h>
+#include <string.h>
+
+static size_t hash(const uint8_t *key) {
+    uintptr_t value = (uintptr_t)key;
+    return (value ^ (value >> 12)) % BLOCK_CACHE_SIZE;
+}
+
+// Determines whether the threaded core has a handler for the given instruction.
+static bool has_handler(const decode_entry_t *entry) {
+    return entry->instruction->apply != NULL && entry->instruction != &INS_JAM;
+}
+
+// Determines whether the given instruction ends a block.
+static bool ends_block(const decode_entry_t *entry) {
+    return entry->instruction->jump || entry->addr_mode == &AM_RELATIVE;
+}
+
+// Determines whether the given instruction writes to memory.
+static bool writes_memory(const decode_entry_t *entry) {
+    const instruction_t *ins = entry->instruction;
+    if (ins == &INS_ASL || ins == &INS_LSR || ins == &INS_ROL || ins == &INS_ROR)
+        return entry->addr_mode != &AM_ACCUMULATOR;
+
+    return ins == &INS_STA || ins == &INS_STX || ins == &INS_STY || ins == &INS_SAX || ins == &INS_SHA
+        || ins == &INS_DEC || ins == &INS_INC || ins == &INS_DCP || ins == &INS_ISC
+        || ins == &INS_SLO || ins == &INS_SRE || ins == &INS_RLA || ins == &INS_RRA
+        || ins == &INS_PHA || ins == &INS_PHP;
+}
+
+// Replaces common pairs of instructions with superinstructions.
+static void fuse(block_t *blk) {
+    for (int i = 0; i + 1 < blk->nops; i++) {
+        block_op_t *op = &blk->ops[i];
+        if (blk->ops[i + 1].handler == 0xD0) {
+            if (op->handler == 0xCA)
+                op->handler = SUPER_DEX_BNE;
+            else if (op->handler == 0x88)
+                op->handler = SUPER_DEY_BNE;
+        }
+        else if (blk->ops[i + 1].handler == 0x10) {
+            if (op->handler == 0xAD)
+                op->handler = SUPER_LDA_BPL;
+            else if (op->handler == 0x2C)
+                op->handler = SUPER_BIT_BPL;
+        }
+    }
+}
+
+static void decode(block_cache_t *bc, block_t *blk, const uint8_t *host, size_t size) {
+    const decode_entry_t *table = get_decode_table();
+    blk->key = host;
+    blk->rom = bc->rom != NULL && host >= bc->rom && host < bc->rom + bc->rom_size;
+    blk->nops = 0;
+    blk->nbytes = 0;
+#ifdef CPU_JIT
+    blk->hits = 0;
+    blk->jit = NULL;
+#endif
+
+    bool sync = false;
+    while (blk->nops < BLOCK_MAX_OPS && blk->nbytes < size) {
+        const decode_entry_t *entry = &table[host[blk->nbytes]];
+        if (!has_handler(entry) || blk->nbytes + entry->argc + 1 > size)
+            break;
+
+        // Decode the instruction.
+        block_op_t *op = &blk->ops[blk->nops++];
+        op->handler = host[blk->nbytes];
+        op->opc = host[blk->nbytes];
+        op->args[0] = entry->argc > 0 ? host[blk->nbytes + 1] : 0;
+        op->args[1] = entry->argc > 1 ? host[blk->nbytes + 2] : 0;
+        op->len = entry->argc + 1;
+        op->sync = sync;
+        blk->nbytes += op->len;
+
+        if (ends_block(entry))
+            break;
+
+        // A write can modify code in RAM (so the block has to end), or switch the bank that the
+        // block is in (so the bank has to be checked before the next instruction).
+        sync = writes_memory(entry);
+        if (sync && !blk->rom)
+            break;
+    }
+
+    // Keep a copy of blocks outside of ROM so they can be checked against memory.
+    if (!blk->rom) {
+        memcpy(blk->bytes, host, blk->nbytes);
+    }
+
+    fuse(blk);
+}
+
+block_cache_t *bc_create(void) {
+    return calloc(1, sizeof(struct block_cache));
+}
+
+void bc_destroy(block_cache_t *bc) {
+#ifdef CPU_JIT
+    jit_release(bc);
+#endif
+    free(bc);
+}
+
+void bc_reset(block_cache_t *bc, const uint8_t *rom, size_t size) {
+    memset(bc->blocks, 0, sizeof(bc->blocks));
+    bc->rom = rom;
+    bc->rom_size = size;
+#ifdef CPU_JIT
+    bc->code_used = 0;
+#endif
+    bc->blk = NULL;
+    bc->op = NULL;
+    bc->end = NULL;
+}
+
+const block_t *bc_lookup(block_cache_t *bc, const addrspace_t *as, addr_t vaddr) {
+    // Blocks don't extend past the end of the page (which is the finest granularity of a bank).
+    size_t size;
+    const uint8_t *host = as_span(as, vaddr, PAGE_SIZE - (vaddr & PAGE_MASK), AS_READ, &size);
+    if (host == NULL)
+        return NULL;
+
+    // Decode the block if it isn't cached, or if it was decoded from memory that has since changed.
+    block_t *blk = &bc->blocks[hash(host)];
+    if (blk->key != host || (!blk->rom && memcmp(blk->bytes, host, blk->nbytes) != 0)) {
+        decode(bc, blk, host, size);
+    }
+
+#ifdef CPU_JIT
+    // Compile blocks in PRG-ROM once they are hot (blocks anywhere else may be modified).
+    if (blk->rom && blk->jit == NULL && blk->nops > 0 && ++blk->hits == JIT_THRESHOLD) {
+        jit_compile(bc, blk);
+    }
+#endif
+
+    return blk->nops > 0 ? blk : NULL;
+}
+
+// Determines whether running the given instruction again (with nothing else changing in between)
+// leaves the CPU in the same state (i.e. the instruction only overwrites registers and flags).
+static bool idempotent(const decode_entry_t *entry) {
+    const instruction_t *ins = entry->instruction;
+    const addrmode_t *am = entry->addr_mode;
+    if (ins == &INS_NOP)
+        return am == &AM_IMPLIED || am == &AM_IMMEDIATE || am == &AM_ZEROPAGE || am == &AM_ABSOLUTE;
+
+    // AND and ORA are included as repeating them with the same operand has no further effect.
+    return (ins == &INS_LDA || ins == &INS_LDX || ins == &INS_LDY || ins == &INS_BIT
+        || ins == &INS_CMP || ins == &INS_CPX || ins == &INS_CPY || ins == &INS_AND || ins == &INS_ORA)
+        && (am == &AM_IMMEDIATE || am == &AM_ZEROPAGE || am == &AM_ABSOLUTE);
+}
+
+int bc_idle_loop(block_cache_t *bc, const addrspace_t *as, addr_t vaddr, bool (*pure_read)(addr_t vaddr)) {
+    const block_t *blk = bc_lookup(bc, as, vaddr);
+    if (blk == NULL)
+        return 0;
+
+    const decode_entry_t *table = get_decode_table();
+    addr_t pc = vaddr;
+    int cycles = 0;
+    for (int i = 0; i < blk->nops; i++) {
+        const block_op_t *op = &blk->ops[i];
+        const decode_entry_t *entry = &table[op->opc];
+        const addr_t operand = bytes_to_word(op->args[0], entry->argc > 1 ? op->args[1] : 0);
+
+        // The block has to end with a branch or jump back to its first instruction.
+        if (i == blk->nops - 1) {
+            if (entry->addr_mode == &AM_RELATIVE) {
+                const addr_t target = pc + op->len + (int8_t)op->args[0];
+                if (target != vaddr)
+                    return 0;
+
+                // A taken branch takes an extra cycle (and another if it lands on a different page).
+                cycles += 3 + (((pc + 2) & ~PAGE_MASK) != (target & ~PAGE_MASK));
+                return cycles;
+            }
+            if (entry->instruction == &INS_JMP && entry->addr_mode == &AM_ABSOLUTE && operand == vaddr)
+                return cycles + 3;
+
+            return 0;
+        }
+
+        if (!idempotent(entry))
+            return 0;
+
+        // Memory can only be read directly, unless reading the address again has no further effect.
+        if (entry->addr_mode != &AM_IMMEDIATE && entry->addr_mode != &AM_IMPLIED) {
+            size_t size;
+            if (as_span(as, operand, 1, AS_READ, &size) == NULL && (pure_read == NULL || !pure_read(operand)))
+                return 0;
+        }
+
+        cycles += entry->cycles;
+        pc += op->len;
+    }
+
+    return 0;
+}
@@ -1,45 +1,58 @@
+#include <blocks.h>
 #include <cpu.h>
 #include <stdio.h>
 #include <stdlib.h>
 
+/**
+ * @brief Reads a byte of code through the CPU's code page (only pages that are entirely plain memory
+ * are read directly, so I/O registers are still accessed through the address space).
+ *
+ * @param cpu The CPU.
+ * @param vaddr The virtual address of the byte.
+ * @return The byte at the virtual address.
+ */
+static uint8_t fetch_code(cpu_t *cpu, addr_t vaddr);
+
 uint16_t bytes_to_word(uint8_t low, uint8_t high) {
     return (high << 8) + low;
 }
 
 uint8_t sr_to_bits(const sr_flags_t sr) {
-    uint8_t bits = 0;
-    if (sr.brk)
-        bits |= SR_BREAK;
-    if (sr.carry)
-        bits |= SR_CARRY;
-    if (sr.dec)
-        bits |= SR_DECIMAL;
-    if (sr.ign)
-        bits |= SR_IGNORED;
-    if (sr.irq)
-        bits |= SR_INTERRUPT;
-    if (sr.neg)
-        bits |= SR_NEGATIVE;
-    if (sr.vflow)
-        bits |= SR_OVERFLOW;
-    if (sr.zero)
-        bits |= SR_ZERO;
-    return bits;
+    return sr.carry | (sr.zero << 1) | (sr.irq << 2) | (sr.dec << 3)
+        | (sr.brk << 4) | (sr.ign << 5) | (sr.vflow << 6) | (sr.neg << 7);
 }
 
 sr_flags_t bits_to_sr(uint8_t bits) {
     sr_flags_t sr;
-    sr.brk = (bits & SR_BREAK) > 0;
-    sr.carry = (bits & SR_CARRY) > 0;
-    sr.dec = (bits & SR_DECIMAL) > 0;
-    sr.ign = (bits & SR_IGNORED) > 0;
-    sr.irq = (bits & SR_INTERRUPT) > 0;
-    sr.neg = (bits & SR_NEGATIVE) > 0;
-    sr.vflow = (bits & SR_OVERFLOW) > 0;
-    sr.zero = (bits & SR_ZERO) > 0;
+    sr.carry = bits & 1;
+    sr.zero = (bits >> 1) & 1;
+    sr.irq = (bits >> 2) & 1;
+    sr.dec = (bits >> 3) & 1;
+    sr.brk = (bits >> 4) & 1;
+    sr.ign = (bits >> 5) & 1;
+    sr.vflow = (bits >> 6) & 1;
+    sr.neg = (bits >> 7) & 1;
     return sr;
 }
 
+uint8_t get_sr(const tframe_t *frame) {
+    return frame->flags | frame->carry | (SR_Z(frame) << 1) | ((frame->vflow & 0x80) >> 1) | (SR_N(frame) << 7);
+}
+
+void set_sr(tframe_t *frame, uint8_t bits) {
+    frame->flags = bits & (SR_INTERRUPT | SR_DECIMAL | SR_BREAK | SR_IGNORED);
+    frame->carry = bits & SR_CARRY;
+    frame->vflow = bits << 1;
+
+    // N comes from bit 8 so that N and Z can both be set.
+    frame->nz = ((bits & SR_NEGATIVE) << 1) | !(bits & SR_ZERO);
+}
+
+void set_flag(tframe_t *frame, uint8_t flag, bool value) {
+    uint8_t bits = get_sr(frame) & ~flag;
+    set_sr(frame, value ? bits | flag : bits);
+}
+
 void push(tframe_t *frame, const addrspace_t *as, uint8_t value) {
     as_write(as, STACK_START + frame->sp, value);
     frame->sp--;
@@ -74,7 +87,7 @@ cpu_t *cpu_create(void) {
     cpu->frame.sp = 0;
 
     // Initialise status register.
-    cpu->frame.sr = bits_to_sr(SR_IGNORED);
+    set_sr(&cpu->frame, SR_IGNORED);
 
     // Setup memory.
     cpu->wmem = malloc(sizeof(uint8_t) * WMEM_SIZE);
@@ -82,6 +95,22 @@ cpu_t *cpu_create(void) {
     // Create address space.
     cpu->as = as_create();
 
+    // Get the decode table.
+    cpu->decode = get_decode_table();
+
+    // Create the block cache.
+    cpu->blocks = bc_create();
+
+    // Use the generic core until a program is inserted.
+    cpu->core = CPU_CORE_GENERIC;
+    cpu->bus.wmem = cpu->wmem;
+    cpu->bus.generation = 0;
+
+    // The code page is resolved on the first fetch.
+    cpu->code.ptr = NULL;
+    cpu->code.page = 0;
+    cpu->code.generation = as_generation(cpu->as) - 1;
+
     // Other variables.
     cpu->joypad1 = 0;
     cpu->joypad2 = 0;
@@ -90,6 +119,7 @@ cpu_t *cpu_create(void) {
     cpu->jp_strobe = 0;
     cpu->oam_upload = 0;
     cpu->cycles = 0;
+    cpu->deadline = 0;
 
     return cpu;
 }
@@ -98,6 +128,9 @@ void cpu_destroy(cpu_t *cpu) {
     // Destroy address space.
     as_destroy(cpu->as);
 
+    // Destroy block cache.
+    bc_destroy(cpu->blocks);
+
     // Free memory.
     free(cpu->wmem);
 
@@ -105,18 +138,26 @@ void cpu_destroy(cpu_t *cpu) {
     free(cpu);
 }
 
+void cpu_set_rom(cpu_t *cpu, const uint8_t *rom, size_t size) {
+    bc_reset(cpu->blocks, rom, size);
+}
+
+int cpu_idle_loop(cpu_t *cpu, bool (*pure_read)(addr_t vaddr)) {
+    return bc_idle_loop(cpu->blocks, cpu->as, cpu->frame.pc, pure_read);
+}
+
 void cpu_reset(cpu_t *cpu) {
     const uint8_t low = as_read(cpu->as, RES_VECTOR);
     const uint8_t high = as_read(cpu->as, RES_VECTOR + 1);
     cpu->frame.pc = bytes_to_word(low, high);
-    cpu->frame.sr.irq = 1;
+    cpu->frame.flags |= SR_INTERRUPT;
     cpu->frame.sp -= 3;
 }
 
 void cpu_nmi(cpu_t *cpu) {
     // Push PC and status register.
     push_word(&cpu->frame, cpu->as, cpu->frame.pc);
-    push(&cpu->frame, cpu->as, sr_to_bits(cpu->frame.sr));
+    push(&cpu->frame, cpu->as, get_sr(&cpu->frame));
     
     // Jump to interrupt handler.
     const uint8_t low = as_read(cpu->as, NMI_VECTOR);
@@ -126,15 +167,15 @@ void cpu_nmi(cpu_t *cpu) {
 
 void cpu_irq(cpu_t *cpu) {
     // Ignore if interrupt flag is set.
-    if (cpu->frame.sr.irq)
+    if (cpu->frame.flags & SR_INTERRUPT)
         return;
     
     // Push PC and status register.
     push_word(&cpu->frame, cpu->as, cpu->frame.pc);
-    push(&cpu->frame, cpu->as, sr_to_bits(cpu->frame.sr));
+    push(&cpu->frame, cpu->as, get_sr(&cpu->frame));
 
     // Disable further interrupts.
-    cpu->frame.sr.irq = 1;
+    cpu->frame.flags |= SR_INTERRUPT;
     
     // Jump to interrupt handler.
     const uint8_t low = as_read(cpu->as, IRQ_VECTOR);
@@ -142,26 +183,20 @@ void cpu_irq(cpu_t *cpu) {
     cpu->frame.pc = bytes_to_word(low, high);
 }
 
-uint8_t cpu_fetch(const cpu_t *cpu) {
-    return as_read(cpu->as, cpu->frame.pc);
+uint8_t cpu_fetch(cpu_t *cpu) {
+    return fetch_code(cpu, cpu->frame.pc);
 }
 
-operation_t cpu_decode(const cpu_t *cpu, const uint8_t opc) {
-    // Convert the raw opcode into an opcode_t.
-    opcode_t opcode = {
-        .group = opc & 0x03,
-        .addrmode = (opc >> 2) & 0x07,
-        .num = (opc >> 5) & 0x07,
-    };
-
-    // Decode the opcode to determine the instruction and address mode.
+operation_t cpu_decode(cpu_t *cpu, const uint8_t opc) {
+    // Look up the instruction and address mode in the decode table.
+    const decode_entry_t *entry = &cpu->decode[opc];
     operation_t result = { .opc = opc };
-    result.instruction = get_instruction(opcode);
-    result.addr_mode = get_address_mode(opcode);
+    result.instruction = entry->instruction;
+    result.addr_mode = entry->addr_mode;
 
-    // Get the arguments.
-    result.args[0] = as_read(cpu->as, cpu->frame.pc + 1);
-    result.args[1] = as_read(cpu->as, cpu->frame.pc + 2);
+    // Get the arguments (only the bytes that are used by the instruction are read).
+    result.args[0] = entry->argc > 0 ? fetch_code(cpu, cpu->frame.pc + 1) : 0;
+    result.args[1] = entry->argc > 1 ? fetch_code(cpu, cpu->frame.pc + 2) : 0;
 
     // If the instruction is invalid, then print an error and terminate.
     if (result.instruction == NULL) {
@@ -192,3 +227,20 @@ int cpu_execute(cpu_t *cpu, operation_t op) {
 
     return cycles;
 }
+
+static uint8_t fetch_code(cpu_t *cpu, addr_t vaddr) {
+    cpu_code_t *code = &cpu->code;
+    const addr_t page = vaddr & ~PAGE_MASK;
+
+    // Resolve the page again if the program counter has left it or a bank has been switched.
+    if (page != code->page || code->generation != as_generation(cpu->as)) {
+        size_t size;
+        code->ptr = as_span(cpu->as, page, PAGE_SIZE, AS_READ, &size);
+        if (size < PAGE_SIZE)
+            code->ptr = NULL;
+        code->page = page;
+        code->generation = as_generation(cpu->as);
+    }
+
+    return code->ptr != NULL ? code->ptr[vaddr & PAGE_MASK] : as_read(cpu->as, vaddr);
+}
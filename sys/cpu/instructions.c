@@ -9,25 +9,11 @@
  */
 
 static inline int def_cycles(const addrmode_t *am, mem_loc_t loc) {
-    int cycles = 0;
-    if (am == &AM_IMPLIED || am == &AM_IMMEDIATE)
-        cycles = 2;
-    else if (am == &AM_ZEROPAGE)
-        cycles = 3;
-    else if (am == &AM_ABSOLUTE || am == &AM_ZEROPAGE_X || am == &AM_ZEROPAGE_Y)
-        cycles = 4;
-    else if (am == &AM_ABSOLUTE_X || am == &AM_ABSOLUTE_Y)
-        cycles = 4 + loc.page_boundary_crossed;
-    else if (am == &AM_INDIRECT_X)
-        cycles = 6;
-    else if (am == &AM_INDIRECT_Y)
-        cycles = 5 + loc.page_boundary_crossed;
-    return cycles;
+    return am->cycles + (am->page_penalty && loc.page_boundary_crossed);
 }
 
 static inline void update_sign_flags(tframe_t *frame, uint8_t result) {
-    frame->sr.zero = (result == 0x00);
-    frame->sr.neg = (result & 0x80) > 0;
+    frame->nz = result;
 }
 
 static uint8_t load(const addrspace_t *as, mem_loc_t loc) {
@@ -149,7 +135,7 @@ static int pha_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 }
 
 static int php_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    uint8_t bits = sr_to_bits(frame->sr) | SR_BREAK | SR_IGNORED;
+    uint8_t bits = get_sr(frame) | SR_BREAK | SR_IGNORED;
     push(frame, as, bits);
     return 3;
 }
@@ -162,10 +148,7 @@ static int pla_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 
 static int plp_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t bits = pull(frame, as);
-    sr_flags_t sr = bits_to_sr(bits);
-    sr.brk = frame->sr.brk;
-    sr.ign = frame->sr.ign;
-    frame->sr = sr;
+    set_sr(frame, (bits & ~(SR_BREAK | SR_IGNORED)) | (frame->flags & (SR_BREAK | SR_IGNORED)));
     return 4;
 }
 
@@ -224,9 +207,9 @@ const instruction_t INS_INY = { "INY", iny_apply, false };
  */
 
 static uint8_t add(tframe_t *frame, uint8_t arg) {
-    uint16_t result = frame->ac + arg + frame->sr.carry;
-    frame->sr.carry = (result > 255);
-    frame->sr.vflow = ((frame->ac ^ arg) & 0x80) == 0 && ((frame->ac ^ result) & 0x80) != 0;
+    uint16_t result = frame->ac + arg + frame->carry;
+    frame->carry = result >> 8;
+    frame->vflow = (frame->ac ^ result) & (arg ^ result); // Both operands have a different sign to the result.
     return result;
 }
 
@@ -283,7 +266,7 @@ const instruction_t INS_ORA = { "ORA", ora_apply, false };
 static int asl_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
     uint8_t new_val = store(as, loc, value << 1);
-    frame->sr.carry = (value & 0x80) > 0;
+    frame->carry = value >> 7;
     update_sign_flags(frame, new_val);
     loc.page_boundary_crossed = true;
     return am == &AM_ACCUMULATOR ? 2 : def_cycles(am, loc) + 2;
@@ -292,7 +275,7 @@ static int asl_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 static int lsr_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
     uint8_t new_val = store(as, loc, value >> 1);
-    frame->sr.carry = (value & 0x01) > 0;
+    frame->carry = value & 0x01;
     update_sign_flags(frame, new_val);
     loc.page_boundary_crossed = true;
     return am == &AM_ACCUMULATOR ? 2 : def_cycles(am, loc) + 2;
@@ -300,8 +283,8 @@ static int lsr_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 
 static int rol_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
-    uint8_t new_val = store(as, loc, (value << 1) | frame->sr.carry);
-    frame->sr.carry = (value & 0x80) > 0;
+    uint8_t new_val = store(as, loc, (value << 1) | frame->carry);
+    frame->carry = value >> 7;
     update_sign_flags(frame, new_val);
     loc.page_boundary_crossed = true;
     return am == &AM_ACCUMULATOR ? 2 : def_cycles(am, loc) + 2;
@@ -309,8 +292,8 @@ static int rol_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 
 static int ror_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
-    uint8_t new_val = store(as, loc, (value >> 1) | (frame->sr.carry << 7));
-    frame->sr.carry = (value & 0x01) > 0;
+    uint8_t new_val = store(as, loc, (value >> 1) | (frame->carry << 7));
+    frame->carry = value & 0x01;
     update_sign_flags(frame, new_val);
     loc.page_boundary_crossed = true;
     return am == &AM_ACCUMULATOR ? 2 : def_cycles(am, loc) + 2;
@@ -326,37 +309,37 @@ const instruction_t INS_ROR = { "ROR", ror_apply, false };
  */
 
 static int clc_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.carry = 0;
+    frame->carry = 0;
     return 2;
 }
 
 static int cld_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.dec = 0;
+    frame->flags &= ~SR_DECIMAL;
     return 2;
 }
 
 static int cli_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.irq = 0;
+    frame->flags &= ~SR_INTERRUPT;
     return 2;
 }
 
 static int clv_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.vflow = 0;
+    frame->vflow = 0;
     return 2;
 }
 
 static int sec_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.carry = 1;
+    frame->carry = 1;
     return 2;
 }
 
 static int sed_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.dec = 1;
+    frame->flags |= SR_DECIMAL;
     return 2;
 }
 
 static int sei_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    frame->sr.irq = 1;
+    frame->flags |= SR_INTERRUPT;
     return 2;
 }
 
@@ -374,7 +357,7 @@ const instruction_t INS_SEI = { "SEI", sei_apply, false };
 
 static void compare(tframe_t *frame, uint8_t reg, uint8_t value) {
     uint8_t result = reg - value;
-    frame->sr.carry = (reg >= value);
+    frame->carry = (reg >= value);
     update_sign_flags(frame, result);
 }
 
@@ -417,42 +400,42 @@ static int branch(tframe_t *frame, addr_t target, bool condition) {
 
 // Branch on carry clear.
 static int bcc_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.carry == 0);
+    return branch(frame, loc.vaddr, !SR_C(frame));
 }
 
 // Branch on carry set.
 static int bcs_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.carry == 1);
+    return branch(frame, loc.vaddr, SR_C(frame));
 }
 
 // Branch on result zero.
 static int beq_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.zero == 1);
+    return branch(frame, loc.vaddr, SR_Z(frame));
 }
 
 // Branch on result minus (negative).
 static int bmi_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.neg == 1);
+    return branch(frame, loc.vaddr, SR_N(frame));
 }
 
 // Branch on result not zero.
 static int bne_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.zero == 0);
+    return branch(frame, loc.vaddr, !SR_Z(frame));
 }
 
 // Branch on result plus (positive).
 static int bpl_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.neg == 0);
+    return branch(frame, loc.vaddr, !SR_N(frame));
 }
 
 // Branch on overflow clear.
 static int bvc_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.vflow == 0);
+    return branch(frame, loc.vaddr, !SR_V(frame));
 }
 
 // Branch on overflow set.
 static int bvs_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
-    return branch(frame, loc.vaddr, frame->sr.vflow == 1);
+    return branch(frame, loc.vaddr, SR_V(frame));
 }
 
 const instruction_t INS_BCC = { "BCC", bcc_apply, false };
@@ -495,10 +478,10 @@ const instruction_t INS_RTS = { "RTS", rts_apply, true };
 static int brk_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     // Push PC and status register.
     push_word(frame, as, frame->pc + 2);
-    push(frame, as, sr_to_bits(frame->sr) | SR_BREAK);
+    push(frame, as, get_sr(frame) | SR_BREAK);
 
     // Disable interrupts.
-    frame->sr.irq = 1;
+    frame->flags |= SR_INTERRUPT;
 
     // Jump to interrupt handler.
     uint8_t low = as_read(as, IRQ_VECTOR);
@@ -512,10 +495,7 @@ static int brk_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 static int rti_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     // Pull status register.
     uint8_t bits = pull(frame, as);
-    sr_flags_t sr = bits_to_sr(bits);
-    sr.brk = frame->sr.brk;
-    sr.ign = frame->sr.ign;
-    frame->sr = sr;
+    set_sr(frame, (bits & ~(SR_BREAK | SR_IGNORED)) | (frame->flags & (SR_BREAK | SR_IGNORED)));
 
     // Pull program counter.
     frame->pc = pull_word(frame, as);
@@ -533,9 +513,8 @@ const instruction_t INS_RTI = { "RTI", rti_apply, true };
 static int bit_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
     uint8_t result = frame->ac & value;
-    frame->sr.neg = ((value & 0x80) > 0);
-    frame->sr.vflow = ((value & 0x40) > 0);
-    frame->sr.zero = (result == 0);
+    frame->nz = result | ((value & 0x80) << 1); // N comes from the value rather than the result.
+    frame->vflow = value << 1;
     return def_cycles(am, loc);
 }
 
@@ -559,7 +538,7 @@ static int alr_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *a
 static int anc_apply(tframe_t *frame, const addrspace_t *as, const addrmode_t *am, mem_loc_t loc) {
     uint8_t value = load(as, loc);
     uint8_t result = frame->ac & value;
-    frame->sr.carry = ((result & 0x80) == 0x80);
+    frame->carry = result >> 7;
     update_sign_flags(frame, result);
     return def_cycles(am, loc);
 }
@@ -0,0 +1,803 @@
+/**
+ * @file interp.c
+ * @brief Threaded interpreter core for the 6502. Each opcode has its own handler, where the
+ * address mode and the instruction are fused together at compile time, so executing an
+ * instruction doesn't go through the decode table or any function pointers. The behaviour of
+ * each handler is identical to decoding and executing the instruction with `cpu_decode` and
+ * `cpu_execute` (which are still used for logging and testing).
+ * @version 1.0
+ * @date 2022-03-26
+ */
+
+#include <addrmodes.h>
+#include <blocks.h>
+#include <instructions.h>
+#include <jit.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Use computed gotos for dispatch where the compiler supports them (otherwise use a switch).
+#if defined(__GNUC__) && !defined(CPU_SWITCH_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+/**
+ * Address mode properties (these must match the address modes defined in addrmodes.c).
+ */
+
+#define ARGC_IMP    0
+#define ARGC_ACC    0
+#define ARGC_IMM    1
+#define ARGC_ZP     1
+#define ARGC_ZPX    1
+#define ARGC_ZPY    1
+#define ARGC_ABS    2
+#define ARGC_ABSX   2
+#define ARGC_ABSY   2
+#define ARGC_REL    1
+#define ARGC_IND    2
+#define ARGC_INDX   1
+#define ARGC_INDY   1
+
+#define CYC_IMP     2
+#define CYC_ACC     0
+#define CYC_IMM     2
+#define CYC_ZP      3
+#define CYC_ZPX     4
+#define CYC_ZPY     4
+#define CYC_ABS     4
+#define CYC_ABSX    4
+#define CYC_ABSY    4
+#define CYC_REL     0
+#define CYC_IND     0
+#define CYC_INDX    6
+#define CYC_INDY    5
+
+#define PEN_IMP     0
+#define PEN_ACC     0
+#define PEN_IMM     0
+#define PEN_ZP      0
+#define PEN_ZPX     0
+#define PEN_ZPY     0
+#define PEN_ABS     0
+#define PEN_ABSX    1
+#define PEN_ABSY    1
+#define PEN_REL     0
+#define PEN_IND     0
+#define PEN_INDX    0
+#define PEN_INDY    1
+
+// Cycles taken by a jump for each address mode.
+#define JMP_ABS     3
+#define JMP_IND     5
+
+// The default number of cycles taken by an instruction.
+#define DEF_CYCLES(m)   (CYC_##m + (PEN_##m && crossed))
+
+// The number of cycles taken by an instruction that always takes the page crossing penalty.
+#define RMW_CYCLES(m)   (CYC_##m + PEN_##m)
+
+/**
+ * Helper functions.
+ */
+
+static inline void update_sign_flags(tframe_t *frame, uint8_t result) {
+    frame->nz = result;
+}
+
+/**
+ * Memory access. A core that is specialised for a family of mappers has the traits of the family
+ * fixed at compile time, so that work RAM, PRG-RAM and the family's PRG-ROM windows are indexed
+ * directly (I/O registers, mapper registers and anything else still go through the address space).
+ */
+
+#define BUS_DIRECT      0x01            // Work RAM, PRG-RAM and PRG-ROM are accessed directly.
+#define BUS_BANKED      0x02            // Writes outside of work RAM may switch PRG banks.
+#define BUS_ROM_IO      0x04            // Writes to PRG-ROM are seen by the mapper (otherwise they are dropped).
+#define BUS_WINDOW(n)   ((n) << 4)      // PRG-ROM is switched in windows of 2^n bytes.
+
+#define BUS_SHIFT(t)    ((t) >> 4)
+#define BUS_RAM_SIZE    (PRG_ROM_START - PRG_RAM_START)
+#define BUS_ROM_SIZE    (0x10000 - PRG_ROM_START)
+#define WMEM_END        0x2000
+
+static void bus_resolve(cpu_bus_t *bus, const addrspace_t *as, unsigned traits) {
+    const size_t window = 1 << BUS_SHIFT(traits);
+    size_t size;
+
+    // Memory can only be accessed directly if the whole range is plain memory.
+    bus->ram = as_span(as, PRG_RAM_START, BUS_RAM_SIZE, AS_READ | AS_WRITE, &size);
+    if (size < BUS_RAM_SIZE)
+        bus->ram = NULL;
+    for (size_t i = 0; i < BUS_ROM_SIZE / window; i++) {
+        bus->prg[i] = as_span(as, PRG_ROM_START + i * window, window, AS_READ, &size);
+        if (size < window)
+            bus->prg[i] = NULL;
+    }
+    bus->generation = as_generation(as);
+}
+
+static inline void bus_sync(cpu_bus_t *bus, const addrspace_t *as, unsigned traits) {
+    if ((traits & BUS_DIRECT) && bus->generation != as_generation(as))
+        bus_resolve(bus, as, traits);
+}
+
+static inline uint8_t bus_read(const addrspace_t *as, const cpu_bus_t *bus, unsigned traits, addr_t addr) {
+    if (traits & BUS_DIRECT) {
+        if (addr < WMEM_END)
+            return bus->wmem[addr & (WMEM_SIZE - 1)];
+        if (addr >= PRG_ROM_START) {
+            const uint8_t *window = bus->prg[(addr - PRG_ROM_START) >> BUS_SHIFT(traits)];
+            if (window != NULL)
+                return window[addr & ((1 << BUS_SHIFT(traits)) - 1)];
+        }
+        else if (addr >= PRG_RAM_START && bus->ram != NULL) {
+            return bus->ram[addr - PRG_RAM_START];
+        }
+    }
+    return as_read(as, addr);
+}
+
+static inline void bus_write(const addrspace_t *as, cpu_bus_t *bus, unsigned traits, addr_t addr, uint8_t value) {
+    if (traits & BUS_DIRECT) {
+        if (addr < WMEM_END) {
+            bus->wmem[addr & (WMEM_SIZE - 1)] = value;
+            return;
+        }
+        if (addr >= PRG_ROM_START && !(traits & BUS_ROM_IO))
+            return;
+        if (addr >= PRG_RAM_START && addr < PRG_ROM_START && bus->ram != NULL) {
+            bus->ram[addr - PRG_RAM_START] = value;
+            return;
+        }
+    }
+    as_write(as, addr, value);
+
+    // The write may have switched banks.
+    if (traits & BUS_BANKED)
+        bus_sync(bus, as, traits);
+}
+
+static inline uint8_t load(const addrspace_t *as, const cpu_bus_t *bus, unsigned traits, addr_t addr, const uint8_t *ptr) {
+    return ptr != NULL ? *ptr : bus_read(as, bus, traits, addr);
+}
+
+static inline uint8_t store(const addrspace_t *as, cpu_bus_t *bus, unsigned traits, addr_t addr, uint8_t *ptr, uint8_t value) {
+    if (ptr != NULL) {
+        *ptr = value;
+    }
+    else {
+        bus_write(as, bus, traits, addr, value);
+    }
+    return value;
+}
+
+static inline uint8_t add(tframe_t *frame, uint8_t arg) {
+    uint16_t result = frame->ac + arg + frame->carry;
+    frame->carry = result >> 8;
+    frame->vflow = (frame->ac ^ result) & (arg ^ result);
+    return result;
+}
+
+static inline void compare(tframe_t *frame, uint8_t reg, uint8_t value) {
+    frame->carry = (reg >= value);
+    frame->nz = (uint8_t)(reg - value);
+}
+
+static inline int branch(tframe_t *frame, addr_t target, bool condition) {
+    int cycles = 2;
+    if (condition) {
+        cycles++; // Add 1 cycle if branch occurs.
+        if (((frame->pc + 2) & ~PAGE_MASK) != ((target + 2) & ~PAGE_MASK))
+            cycles++; // Add 1 cycle if branch occurs on different page.
+        frame->pc = target;
+    }
+    return cycles;
+}
+
+/**
+ * Address modes (these set addr, ptr and crossed to the memory location of the argument).
+ */
+
+#define ARG(n)      args[n]
+#define READ(a)     bus_read(as, bus, traits, (a))
+#define WRITE(a, v) bus_write(as, bus, traits, (a), (v))
+#define LOAD()      load(as, bus, traits, addr, ptr)
+#define STORE(v)    store(as, bus, traits, addr, ptr, (v))
+#define PUSH(v)     WRITE(STACK_START + frame->sp--, (v))
+#define PULL()      READ(STACK_START + ++frame->sp)
+
+#define M_IMP
+#define M_ACC       ptr = &frame->ac;
+#define M_IMM       arg = ARG(0); ptr = &arg;
+#define M_ZP        addr = ARG(0);
+#define M_ZPX       addr = (ARG(0) + frame->x) & PAGE_MASK;
+#define M_ZPY       addr = (ARG(0) + frame->y) & PAGE_MASK;
+#define M_ABS       lo = ARG(0); addr = bytes_to_word(lo, ARG(1));
+#define M_ABSX      M_ABS crossed = (addr & ~PAGE_MASK) != ((addr + frame->x) & ~PAGE_MASK); addr += frame->x;
+#define M_ABSY      M_ABS crossed = (addr & ~PAGE_MASK) != ((addr + frame->y) & ~PAGE_MASK); addr += frame->y;
+#define M_REL       addr = frame->pc + (int8_t)ARG(0);
+#define M_IND       M_ABS lo = READ(addr); addr = bytes_to_word(lo, READ((addr & ~PAGE_MASK) | ((addr + 1) & PAGE_MASK)));
+#define M_INDX      M_ZPX lo = READ(addr); addr = bytes_to_word(lo, READ((addr + 1) & PAGE_MASK));
+#define M_INDY      M_ZP lo = READ(addr); addr = bytes_to_word(lo, READ((addr + 1) & PAGE_MASK)); \
+                    crossed = (addr & ~PAGE_MASK) != ((addr + frame->y) & ~PAGE_MASK); addr += frame->y;
+
+/**
+ * Transfer instructions.
+ */
+
+#define I_LDA(m)    frame->ac = LOAD(); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+#define I_LDX(m)    frame->x = LOAD(); update_sign_flags(frame, frame->x); cycles = DEF_CYCLES(m);
+#define I_LDY(m)    frame->y = LOAD(); update_sign_flags(frame, frame->y); cycles = DEF_CYCLES(m);
+
+#define I_STA(m)    STORE(frame->ac); cycles = RMW_CYCLES(m);
+#define I_STX(m)    STORE(frame->x); cycles = DEF_CYCLES(m);
+#define I_STY(m)    STORE(frame->y); cycles = DEF_CYCLES(m);
+
+#define I_TAX(m)    frame->x = frame->ac; update_sign_flags(frame, frame->x); cycles = DEF_CYCLES(m);
+#define I_TAY(m)    frame->y = frame->ac; update_sign_flags(frame, frame->y); cycles = DEF_CYCLES(m);
+#define I_TSX(m)    frame->x = frame->sp; update_sign_flags(frame, frame->x); cycles = DEF_CYCLES(m);
+#define I_TXA(m)    frame->ac = frame->x; update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+#define I_TXS(m)    frame->sp = frame->x; cycles = DEF_CYCLES(m);
+#define I_TYA(m)    frame->ac = frame->y; update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+
+/**
+ * Stack instructions.
+ */
+
+#define I_PHA(m)    PUSH(frame->ac); cycles = 3;
+#define I_PHP(m)    PUSH(get_sr(frame) | SR_BREAK | SR_IGNORED); cycles = 3;
+#define I_PLA(m)    frame->ac = PULL(); update_sign_flags(frame, frame->ac); cycles = 4;
+#define I_PLP(m)    value = PULL(); pull_sr(frame, value); cycles = 4;
+
+static inline void pull_sr(tframe_t *frame, uint8_t bits) {
+    set_sr(frame, (bits & ~(SR_BREAK | SR_IGNORED)) | (frame->flags & (SR_BREAK | SR_IGNORED)));
+}
+
+/**
+ * Decrements and increments.
+ */
+
+#define I_DEC(m)    value = LOAD(); update_sign_flags(frame, STORE(--value)); cycles = RMW_CYCLES(m) + 2;
+#define I_DEX(m)    update_sign_flags(frame, --frame->x); cycles = DEF_CYCLES(m);
+#define I_DEY(m)    update_sign_flags(frame, --frame->y); cycles = DEF_CYCLES(m);
+#define I_INC(m)    value = LOAD(); update_sign_flags(frame, STORE(++value)); cycles = RMW_CYCLES(m) + 2;
+#define I_INX(m)    update_sign_flags(frame, ++frame->x); cycles = DEF_CYCLES(m);
+#define I_INY(m)    update_sign_flags(frame, ++frame->y); cycles = DEF_CYCLES(m);
+
+/**
+ * Arithmetic and logical operators.
+ */
+
+#define I_ADC(m)    frame->ac = add(frame, LOAD()); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+#define I_SBC(m)    frame->ac = add(frame, ~LOAD()); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+
+#define I_AND(m)    frame->ac &= LOAD(); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+#define I_EOR(m)    frame->ac ^= LOAD(); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+#define I_ORA(m)    frame->ac |= LOAD(); update_sign_flags(frame, frame->ac); cycles = DEF_CYCLES(m);
+
+/**
+ * Shift & rotate instructions (the accumulator address mode has no base cycles, so it takes 2).
+ */
+
+#define I_ASL(m)    value = LOAD(); update_sign_flags(frame, STORE(value << 1)); \
+                    frame->carry = value >> 7; cycles = RMW_CYCLES(m) + 2;
+#define I_LSR(m)    value = LOAD(); update_sign_flags(frame, STORE(value >> 1)); \
+                    frame->carry = value & 0x01; cycles = RMW_CYCLES(m) + 2;
+#define I_ROL(m)    value = LOAD(); update_sign_flags(frame, STORE((value << 1) | frame->carry)); \
+                    frame->carry = value >> 7; cycles = RMW_CYCLES(m) + 2;
+#define I_ROR(m)    value = LOAD(); update_sign_flags(frame, STORE((value >> 1) | (frame->carry << 7))); \
+                    frame->carry = value & 0x01; cycles = RMW_CYCLES(m) + 2;
+
+/**
+ * Flag instructions.
+ */
+
+#define I_CLC(m)    frame->carry = 0; cycles = 2;
+#define I_CLD(m)    frame->flags &= ~SR_DECIMAL; cycles = 2;
+#define I_CLI(m)    frame->flags &= ~SR_INTERRUPT; cycles = 2;
+#define I_CLV(m)    frame->vflow = 0; cycles = 2;
+#define I_SEC(m)    frame->carry = 1; cycles = 2;
+#define I_SED(m)    frame->flags |= SR_DECIMAL; cycles = 2;
+#define I_SEI(m)    frame->flags |= SR_INTERRUPT; cycles = 2;
+
+/**
+ * Comparisons.
+ */
+
+#define I_CMP(m)    compare(frame, frame->ac, LOAD()); cycles = DEF_CYCLES(m);
+#define I_CPX(m)    compare(frame, frame->x, LOAD()); cycles = DEF_CYCLES(m);
+#define I_CPY(m)    compare(frame, frame->y, LOAD()); cycles = DEF_CYCLES(m);
+
+/**
+ * Conditional branch instructions.
+ */
+
+#define I_BCC(m)    cycles = branch(frame, addr, !SR_C(frame));
+#define I_BCS(m)    cycles = branch(frame, addr, SR_C(frame));
+#define I_BEQ(m)    cycles = branch(frame, addr, SR_Z(frame));
+#define I_BMI(m)    cycles = branch(frame, addr, SR_N(frame));
+#define I_BNE(m)    cycles = branch(frame, addr, !SR_Z(frame));
+#define I_BPL(m)    cycles = branch(frame, addr, !SR_N(frame));
+#define I_BVC(m)    cycles = branch(frame, addr, !SR_V(frame));
+#define I_BVS(m)    cycles = branch(frame, addr, SR_V(frame));
+
+/**
+ * Jumps, subroutines and interrupts (these set the program counter themselves).
+ */
+
+#define I_JMP(m)    frame->pc = addr; cycles = JMP_##m;
+#define I_JSR(m)    PUSH((frame->pc + 2) >> 8); PUSH((frame->pc + 2) & 0xFF); frame->pc = addr; cycles = 6;
+#define I_RTS(m)    lo = PULL(); frame->pc = bytes_to_word(lo, PULL()) + 1; cycles = 6;
+#define I_RTI(m)    value = PULL(); pull_sr(frame, value); lo = PULL(); frame->pc = bytes_to_word(lo, PULL()); cycles = 6;
+#define I_BRK(m)    PUSH((frame->pc + 2) >> 8); PUSH((frame->pc + 2) & 0xFF); PUSH(get_sr(frame) | SR_BREAK); \
+                    frame->flags |= SR_INTERRUPT; lo = READ(IRQ_VECTOR); \
+                    frame->pc = bytes_to_word(lo, READ(IRQ_VECTOR + 1)); cycles = 7;
+
+/**
+ * Other.
+ */
+
+#define I_BIT(m)    value = LOAD(); frame->nz = (frame->ac & value) | ((value & 0x80) << 1); \
+                    frame->vflow = value << 1; cycles = DEF_CYCLES(m);
+#define I_NOP(m)    cycles = DEF_CYCLES(m);
+
+/**
+ * Illegal instructions (these follow the behaviour of the instructions in instructions.c).
+ */
+
+#define I_ALR(m)    I_AND(m) I_LSR(m) cycles = DEF_CYCLES(m);
+#define I_ANC(m)    value = frame->ac & LOAD(); frame->carry = value >> 7; \
+                    update_sign_flags(frame, value); cycles = DEF_CYCLES(m);
+#define I_DCP(m)    I_DEC(m) I_CMP(m) cycles = RMW_CYCLES(m) + 2;
+#define I_ISC(m)    I_INC(m) I_SBC(m) cycles = RMW_CYCLES(m) + 2;
+#define I_LAS(m)    frame->ac = frame->sp & LOAD(); frame->x = frame->ac; frame->sp = frame->x; \
+                    update_sign_flags(frame, frame->sp); cycles = DEF_CYCLES(m);
+#define I_LAX(m)    frame->ac = LOAD(); frame->x = frame->ac; update_sign_flags(frame, frame->x); cycles = DEF_CYCLES(m);
+#define I_RLA(m)    I_ROL(m) I_AND(m) cycles = RMW_CYCLES(m) + 2;
+#define I_RRA(m)    I_ROR(m) I_ADC(m) cycles = RMW_CYCLES(m) + 2;
+#define I_SAX(m)    STORE(frame->ac & frame->x); cycles = DEF_CYCLES(m);
+#define I_SHA(m)    STORE(frame->ac & frame->x & ((addr + 1) >> 8)); cycles = RMW_CYCLES(m);
+#define I_SLO(m)    I_ASL(m) I_ORA(m) cycles = RMW_CYCLES(m) + 2;
+#define I_SRE(m)    I_LSR(m) I_EOR(m) cycles = RMW_CYCLES(m) + 2;
+#define I_USBC(m)   I_SBC(m)
+
+/**
+ * Dispatch. Instructions are run from decoded blocks where possible, and the next instruction in
+ * the block is dispatched directly from the end of each handler.
+ */
+
+#ifdef THREADED_DISPATCH
+#define CASE(h)     op_##h
+#define JUMP()      goto *dispatch[handler]
+#define ROW(h)      &&op_0x##h##0, &&op_0x##h##1, &&op_0x##h##2, &&op_0x##h##3, \
+                    &&op_0x##h##4, &&op_0x##h##5, &&op_0x##h##6, &&op_0x##h##7, \
+                    &&op_0x##h##8, &&op_0x##h##9, &&op_0x##h##A, &&op_0x##h##B, \
+                    &&op_0x##h##C, &&op_0x##h##D, &&op_0x##h##E, &&op_0x##h##F
+#else
+#define CASE(h)     case h
+#define JUMP()      continue
+#endif
+
+// Moves onto the next instruction in the block (the block is left if it has been jumped out of,
+// or if the bank that the block is in may have been switched).
+#define NEXT() \
+    if (cpu->cycles >= cpu->deadline) \
+        goto done; \
+    if (++op < end && frame->pc == expect && (!op->sync || as_generation(as) == generation)) { \
+        args = op->args; \
+        expect += op->len; \
+        handler = op->handler; \
+        JUMP(); \
+    } \
+    goto lookup;
+
+// The body of an instruction that advances the program counter past its arguments.
+#define BODY(m, ins) \
+    { addr = 0; ptr = NULL; crossed = false; M_##m I_##ins(m) frame->pc += ARGC_##m + 1; cpu->cycles += cycles; }
+
+// An instruction that advances the program counter past its arguments.
+#define OP(opc, m, ins) \
+    CASE(opc): BODY(m, ins) NEXT()
+
+// An instruction that sets the program counter itself.
+#define JOP(opc, m, ins) \
+    CASE(opc): { addr = 0; ptr = NULL; crossed = false; M_##m I_##ins(m) cpu->cycles += cycles; } NEXT()
+
+// An instruction without a specialised handler.
+#define SLOW(opc) \
+    CASE(opc): goto slow;
+
+// A superinstruction (the second instruction is run directly after the first, as long as there
+// are cycles left in the budget).
+#define SUPER(h, m1, ins1, m2, ins2) \
+    CASE(h): BODY(m1, ins1) \
+    if (cpu->cycles >= cpu->deadline) \
+        goto done; \
+    op++; \
+    args = op->args; \
+    expect += op->len; \
+    BODY(m2, ins2) NEXT()
+
+/**
+ * Opcodes (in the form OP(opcode, address mode, instruction)).
+ */
+
+#define OPCODES(OP, JOP, SLOW) \
+    JOP(0x00, IMP, BRK) \
+    OP(0x01, INDX, ORA) \
+    SLOW(0x02)          \
+    OP(0x03, INDX, SLO) \
+    OP(0x04, ZP, NOP)   \
+    OP(0x05, ZP, ORA)   \
+    OP(0x06, ZP, ASL)   \
+    OP(0x07, ZP, SLO)   \
+    OP(0x08, IMP, PHP)  \
+    OP(0x09, IMM, ORA)  \
+    OP(0x0A, ACC, ASL)  \
+    OP(0x0B, IMM, ANC)  \
+    OP(0x0C, ABS, NOP)  \
+    OP(0x0D, ABS, ORA)  \
+    OP(0x0E, ABS, ASL)  \
+    OP(0x0F, ABS, SLO)  \
+                        \
+    OP(0x10, REL, BPL)  \
+    OP(0x11, INDY, ORA) \
+    SLOW(0x12)          \
+    OP(0x13, INDY, SLO) \
+    OP(0x14, ZPX, NOP)  \
+    OP(0x15, ZPX, ORA)  \
+    OP(0x16, ZPX, ASL)  \
+    OP(0x17, ZPX, SLO)  \
+    OP(0x18, IMP, CLC)  \
+    OP(0x19, ABSY, ORA) \
+    OP(0x1A, IMP, NOP)  \
+    OP(0x1B, ABSY, SLO) \
+    OP(0x1C, ABSX, NOP) \
+    OP(0x1D, ABSX, ORA) \
+    OP(0x1E, ABSX, ASL) \
+    OP(0x1F, ABSX, SLO) \
+                        \
+    JOP(0x20, ABS, JSR) \
+    OP(0x21, INDX, AND) \
+    SLOW(0x22)          \
+    OP(0x23, INDX, RLA) \
+    OP(0x24, ZP, BIT)   \
+    OP(0x25, ZP, AND)   \
+    OP(0x26, ZP, ROL)   \
+    OP(0x27, ZP, RLA)   \
+    OP(0x28, IMP, PLP)  \
+    OP(0x29, IMM, AND)  \
+    OP(0x2A, ACC, ROL)  \
+    OP(0x2B, IMM, ANC)  \
+    OP(0x2C, ABS, BIT)  \
+    OP(0x2D, ABS, AND)  \
+    OP(0x2E, ABS, ROL)  \
+    OP(0x2F, ABS, RLA)  \
+                        \
+    OP(0x30, REL, BMI)  \
+    OP(0x31, INDY, AND) \
+    SLOW(0x32)          \
+    OP(0x33, INDY, RLA) \
+    OP(0x34, ZPX, NOP)  \
+    OP(0x35, ZPX, AND)  \
+    OP(0x36, ZPX, ROL)  \
+    OP(0x37, ZPX, RLA)  \
+    OP(0x38, IMP, SEC)  \
+    OP(0x39, ABSY, AND) \
+    OP(0x3A, IMP, NOP)  \
+    OP(0x3B, ABSY, RLA) \
+    OP(0x3C, ABSX, NOP) \
+    OP(0x3D, ABSX, AND) \
+    OP(0x3E, ABSX, ROL) \
+    OP(0x3F, ABSX, RLA) \
+                        \
+    JOP(0x40, IMP, RTI) \
+    OP(0x41, INDX, EOR) \
+    SLOW(0x42)          \
+    OP(0x43, INDX, SRE) \
+    OP(0x44, ZP, NOP)   \
+    OP(0x45, ZP, EOR)   \
+    OP(0x46, ZP, LSR)   \
+    OP(0x47, ZP, SRE)   \
+    OP(0x48, IMP, PHA)  \
+    OP(0x49, IMM, EOR)  \
+    OP(0x4A, ACC, LSR)  \
+    OP(0x4B, IMM, ALR)  \
+    JOP(0x4C, ABS, JMP) \
+    OP(0x4D, ABS, EOR)  \
+    OP(0x4E, ABS, LSR)  \
+    OP(0x4F, ABS, SRE)  \
+                        \
+    OP(0x50, REL, BVC)  \
+    OP(0x51, INDY, EOR) \
+    SLOW(0x52)          \
+    OP(0x53, INDY, SRE) \
+    OP(0x54, ZPX, NOP)  \
+    OP(0x55, ZPX, EOR)  \
+    OP(0x56, ZPX, LSR)  \
+    OP(0x57, ZPX, SRE)  \
+    OP(0x58, IMP, CLI)  \
+    OP(0x59, ABSY, EOR) \
+    OP(0x5A, IMP, NOP)  \
+    OP(0x5B, ABSY, SRE) \
+    OP(0x5C, ABSX, NOP) \
+    OP(0x5D, ABSX, EOR) \
+    OP(0x5E, ABSX, LSR) \
+    OP(0x5F, ABSX, SRE) \
+                        \
+    JOP(0x60, IMP, RTS) \
+    OP(0x61, INDX, ADC) \
+    SLOW(0x62)          \
+    OP(0x63, INDX, RRA) \
+    OP(0x64, ZP, NOP)   \
+    OP(0x65, ZP, ADC)   \
+    OP(0x66, ZP, ROR)   \
+    OP(0x67, ZP, RRA)   \
+    OP(0x68, IMP, PLA)  \
+    OP(0x69, IMM, ADC)  \
+    OP(0x6A, ACC, ROR)  \
+    SLOW(0x6B)          \
+    JOP(0x6C, IND, JMP) \
+    OP(0x6D, ABS, ADC)  \
+    OP(0x6E, ABS, ROR)  \
+    OP(0x6F, ABS, RRA)  \
+                        \
+    OP(0x70, REL, BVS)  \
+    OP(0x71, INDY, ADC) \
+    SLOW(0x72)          \
+    OP(0x73, INDY, RRA) \
+    OP(0x74, ZPX, NOP)  \
+    OP(0x75, ZPX, ADC)  \
+    OP(0x76, ZPX, ROR)  \
+    OP(0x77, ZPX, RRA)  \
+    OP(0x78, IMP, SEI)  \
+    OP(0x79, ABSY, ADC) \
+    OP(0x7A, IMP, NOP)  \
+    OP(0x7B, ABSY, RRA) \
+    OP(0x7C, ABSX, NOP) \
+    OP(0x7D, ABSX, ADC) \
+    OP(0x7E, ABSX, ROR) \
+    OP(0x7F, ABSX, RRA) \
+                        \
+    OP(0x80, IMM, NOP)  \
+    OP(0x81, INDX, STA) \
+    OP(0x82, IMM, NOP)  \
+    OP(0x83, INDX, SAX) \
+    OP(0x84, ZP, STY)   \
+    OP(0x85, ZP, STA)   \
+    OP(0x86, ZP, STX)   \
+    OP(0x87, ZP, SAX)   \
+    OP(0x88, IMP, DEY)  \
+    OP(0x89, IMM, NOP)  \
+    OP(0x8A, IMP, TXA)  \
+    SLOW(0x8B)          \
+    OP(0x8C, ABS, STY)  \
+    OP(0x8D, ABS, STA)  \
+    OP(0x8E, ABS, STX)  \
+    OP(0x8F, ABS, SAX)  \
+                        \
+    OP(0x90, REL, BCC)  \
+    OP(0x91, INDY, STA) \
+    SLOW(0x92)          \
+    OP(0x93, INDY, SHA) \
+    OP(0x94, ZPX, STY)  \
+    OP(0x95, ZPX, STA)  \
+    OP(0x96, ZPY, STX)  \
+    OP(0x97, ZPY, SAX)  \
+    OP(0x98, IMP, TYA)  \
+    OP(0x99, ABSY, STA) \
+    OP(0x9A, IMP, TXS)  \
+    SLOW(0x9B)          \
+    SLOW(0x9C)          \
+    OP(0x9D, ABSX, STA) \
+    SLOW(0x9E)          \
+    OP(0x9F, ABSY, SHA) \
+                        \
+    OP(0xA0, IMM, LDY)  \
+    OP(0xA1, INDX, LDA) \
+    OP(0xA2, IMM, LDX)  \
+    OP(0xA3, INDX, LAX) \
+    OP(0xA4, ZP, LDY)   \
+    OP(0xA5, ZP, LDA)   \
+    OP(0xA6, ZP, LDX)   \
+    OP(0xA7, ZP, LAX)   \
+    OP(0xA8, IMP, TAY)  \
+    OP(0xA9, IMM, LDA)  \
+    OP(0xAA, IMP, TAX)  \
+    SLOW(0xAB)          \
+    OP(0xAC, ABS, LDY)  \
+    OP(0xAD, ABS, LDA)  \
+    OP(0xAE, ABS, LDX)  \
+    OP(0xAF, ABS, LAX)  \
+                        \
+    OP(0xB0, REL, BCS)  \
+    OP(0xB1, INDY, LDA) \
+    SLOW(0xB2)          \
+    OP(0xB3, INDY, LAX) \
+    OP(0xB4, ZPX, LDY)  \
+    OP(0xB5, ZPX, LDA)  \
+    OP(0xB6, ZPY, LDX)  \
+    OP(0xB7, ZPY, LAX)  \
+    OP(0xB8, IMP, CLV)  \
+    OP(0xB9, ABSY, LDA) \
+    OP(0xBA, IMP, TSX)  \
+    OP(0xBB, ABSY, LAS) \
+    OP(0xBC, ABSX, LDY) \
+    OP(0xBD, ABSX, LDA) \
+    OP(0xBE, ABSY, LDX) \
+    OP(0xBF, ABSY, LAX) \
+                        \
+    OP(0xC0, IMM, CPY)  \
+    OP(0xC1, INDX, CMP) \
+    OP(0xC2, IMM, NOP)  \
+    OP(0xC3, INDX, DCP) \
+    OP(0xC4, ZP, CPY)   \
+    OP(0xC5, ZP, CMP)   \
+    OP(0xC6, ZP, DEC)   \
+    OP(0xC7, ZP, DCP)   \
+    OP(0xC8, IMP, INY)  \
+    OP(0xC9, IMM, CMP)  \
+    OP(0xCA, IMP, DEX)  \
+    SLOW(0xCB)          \
+    OP(0xCC, ABS, CPY)  \
+    OP(0xCD, ABS, CMP)  \
+    OP(0xCE, ABS, DEC)  \
+    OP(0xCF, ABS, DCP)  \
+                        \
+    OP(0xD0, REL, BNE)  \
+    OP(0xD1, INDY, CMP) \
+    SLOW(0xD2)          \
+    OP(0xD3, INDY, DCP) \
+    OP(0xD4, ZPX, NOP)  \
+    OP(0xD5, ZPX, CMP)  \
+    OP(0xD6, ZPX, DEC)  \
+    OP(0xD7, ZPX, DCP)  \
+    OP(0xD8, IMP, CLD)  \
+    OP(0xD9, ABSY, CMP) \
+    OP(0xDA, IMP, NOP)  \
+    OP(0xDB, ABSY, DCP) \
+    OP(0xDC, ABSX, NOP) \
+    OP(0xDD, ABSX, CMP) \
+    OP(0xDE, ABSX, DEC) \
+    OP(0xDF, ABSX, DCP) \
+                        \
+    OP(0xE0, IMM, CPX)  \
+    OP(0xE1, INDX, SBC) \
+    OP(0xE2, IMM, NOP)  \
+    OP(0xE3, INDX, ISC) \
+    OP(0xE4, ZP, CPX)   \
+    OP(0xE5, ZP, SBC)   \
+    OP(0xE6, ZP, INC)   \
+    OP(0xE7, ZP, ISC)   \
+    OP(0xE8, IMP, INX)  \
+    OP(0xE9, IMM, SBC)  \
+    OP(0xEA, IMP, NOP)  \
+    OP(0xEB, IMM, USBC) \
+    OP(0xEC, ABS, CPX)  \
+    OP(0xED, ABS, SBC)  \
+    OP(0xEE, ABS, INC)  \
+    OP(0xEF, ABS, ISC)  \
+                        \
+    OP(0xF0, REL, BEQ)  \
+    OP(0xF1, INDY, SBC) \
+    SLOW(0xF2)          \
+    OP(0xF3, INDY, ISC) \
+    OP(0xF4, ZPX, NOP)  \
+    OP(0xF5, ZPX, SBC)  \
+    OP(0xF6, ZPX, INC)  \
+    OP(0xF7, ZPX, ISC)  \
+    OP(0xF8, IMP, SED)  \
+    OP(0xF9, ABSY, SBC) \
+    OP(0xFA, IMP, NOP)  \
+    OP(0xFB, ABSY, ISC) \
+    OP(0xFC, ABSX, NOP) \
+    OP(0xFD, ABSX, SBC) \
+    OP(0xFE, ABSX, INC) \
+    OP(0xFF, ABSX, ISC)
+
+#ifdef CPU_JIT
+
+/**
+ * Functions for each opcode (called from native code for instructions that aren't compiled inline).
+ */
+
+#define FN_LOCALS \
+    addr_t addr = 0; uint8_t *ptr = NULL; bool crossed = false; uint8_t arg, lo, value; int cycles; \
+    cpu_bus_t *bus = NULL; const unsigned traits = 0; \
+    (void)addr; (void)ptr; (void)crossed; (void)arg; (void)lo; (void)value; (void)bus; (void)traits;
+
+#define FN(opc, m, ins) \
+    static int jit_##opc(tframe_t *frame, const addrspace_t *as, const uint8_t *args) { \
+        FN_LOCALS M_##m I_##ins(m) frame->pc += ARGC_##m + 1; return cycles; \
+    }
+
+#define JFN(opc, m, ins) \
+    static int jit_##opc(tframe_t *frame, const addrspace_t *as, const uint8_t *args) { \
+        FN_LOCALS M_##m I_##ins(m) return cycles; \
+    }
+
+#define NO_FN(opc)
+#define FN_ENTRY(opc, m, ins) [opc] = jit_##opc,
+
+OPCODES(FN, JFN, NO_FN)
+
+const jit_fn_t JIT_FUNCTIONS[256] = {
+    OPCODES(FN_ENTRY, FN_ENTRY, NO_FN)
+};
+
+#endif
+
+/**
+ * Cores (the generic core accesses all memory through the address space, and the others are
+ * specialised for the PRG banking of a family of mappers).
+ */
+
+#define CORE_NAME       run_generic
+#define CORE_TRAITS     0
+#include <interp.h>
+
+// NROM and CNROM have fixed PRG-ROM (CNROM only switches CHR banks).
+#define CORE_NAME       run_nrom
+#define CORE_TRAITS     (BUS_DIRECT | BUS_WINDOW(14))
+#include <interp.h>
+
+#define CORE_NAME       run_cnrom
+#define CORE_TRAITS     (BUS_DIRECT | BUS_ROM_IO | BUS_WINDOW(14))
+#include <interp.h>
+
+// UxROM and MMC1 switch 16KB banks.
+#define CORE_NAME       run_uxrom
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(14))
+#include <interp.h>
+
+#define CORE_NAME       run_mmc1
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(14))
+#include <interp.h>
+
+// MMC2, MMC3 and MMC5 switch (at least) 8KB banks.
+#define CORE_NAME       run_mmc2
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(13))
+#include <interp.h>
+
+#define CORE_NAME       run_mmc3
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(13))
+#include <interp.h>
+
+#define CORE_NAME       run_mmc5
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(13))
+#include <interp.h>
+
+// Mapper 34 switches 32KB banks.
+#define CORE_NAME       run_ines034
+#define CORE_TRAITS     (BUS_DIRECT | BUS_BANKED | BUS_ROM_IO | BUS_WINDOW(15))
+#include <interp.h>
+
+static int (*const CORES[N_CPU_CORES])(cpu_t *cpu) = {
+    [CPU_CORE_GENERIC] = run_generic,
+    [CPU_CORE_NROM] = run_nrom,
+    [CPU_CORE_MMC1] = run_mmc1,
+    [CPU_CORE_UXROM] = run_uxrom,
+    [CPU_CORE_CNROM] = run_cnrom,
+    [CPU_CORE_MMC3] = run_mmc3,
+    [CPU_CORE_MMC5] = run_mmc5,
+    [CPU_CORE_MMC2] = run_mmc2,
+    [CPU_CORE_INES034] = run_ines034
+};
+
+void cpu_set_core(cpu_t *cpu, cpu_core_t core) {
+    cpu->core = core;
+
+    // Make sure the bus is resolved again before it is next used.
+    cpu->bus.generation = as_generation(cpu->as) - 1;
+}
+
+int cpu_run(cpu_t *cpu, int budget) {
+    cpu->deadline = cpu->cycles + budget;
+    return CORES[cpu->core](cpu);
+}
+
+void cpu_stop(cpu_t *cpu) {
+    cpu->deadline = cpu->cycles;
+}
@@ -0,0 +1,392 @@
+/**
+ * @file jit.c
+ * @brief Compiles blocks of 6502 code from PRG-ROM into native x86-64 code. Simple instructions
+ * (transfers, immediate loads, flag changes, branches, etc.) are compiled inline and any others
+ * call the function for their opcode, so memory (including I/O) is always accessed through the
+ * address space. The CPU's registers stay in the trap frame, which native code updates in place.
+ * @version 1.0
+ * @date 2022-03-26
+ */
+
+#include <jit.h>
+
+#ifdef CPU_JIT
+
+#include <stddef.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/**
+ * @brief The state shared between `jit_run` and native code.
+ */
+typedef struct jit_ctx {
+
+    tframe_t            *frame;         // The CPU's registers.
+    const addrspace_t   *as;            // The CPU's address space.
+    int32_t             total;          // The number of cycles taken.
+    int32_t             budget;         // The number of cycles to run for.
+    int32_t             next;           // The index of the next instruction in the block.
+    uint32_t            generation;     // The generation of the address space when the block was entered.
+    uint64_t            *clock;         // The CPU's cycle counter (updated before each call out of native code).
+    const uint64_t      *deadline;      // The cycle that the CPU stops at (which I/O handlers may bring forward).
+    uint64_t            base;           // The CPU's cycle counter when the block was entered.
+
+} jit_ctx_t;
+
+/**
+ * @brief Native code for a block (jumps to the given entry point after setting up registers).
+ */
+typedef void (*native_t)(jit_ctx_t *ctx, const uint8_t *entry);
+
+/**
+ * Registers used by native code:
+ *
+ * rbx:     The trap frame.
+ * r12d:    The number of cycles taken.
+ * r13d:    The budget.
+ * r14:     The address space.
+ * r15:     The context.
+ */
+
+#define CTX(field)      ((uint8_t)offsetof(jit_ctx_t, field))
+#define FRAME(field)    ((uint8_t)offsetof(tframe_t, field))
+
+
+/**
+ * Emitter.
+ */
+
+typedef struct emitter {
+
+    uint8_t     *start;                     // The start of the native code.
+    uint8_t     *p;                         // The current position.
+
+    uint8_t     *exits[BLOCK_MAX_OPS * 2];  // Jumps to the exit of the block (patched at the end).
+    int         nexits;
+
+} emitter_t;
+
+static void emit(emitter_t *e, int n, ...) {
+    __builtin_va_list args;
+    __builtin_va_start(args, n);
+    for (int i = 0; i < n; i++) {
+        *e->p++ = __builtin_va_arg(args, int);
+    }
+    __builtin_va_end(args);
+}
+
+static void emit16(emitter_t *e, uint16_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit32(emitter_t *e, uint32_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+static void emit64(emitter_t *e, uint64_t value) {
+    memcpy(e->p, &value, sizeof(value));
+    e->p += sizeof(value);
+}
+
+// Emits a conditional jump (0F cc rel32) to the exit of the block.
+static void emit_exit(emitter_t *e, uint8_t cc) {
+    emit(e, 2, 0x0F, cc);
+    e->exits[e->nexits++] = e->p;
+    emit32(e, 0);
+}
+
+// add r12d, imm8
+static void emit_cycles(emitter_t *e, uint8_t cycles) {
+    emit(e, 4, 0x41, 0x83, 0xC4, cycles);
+}
+
+// add word [rbx+pc], imm8
+static void emit_advance(emitter_t *e, uint8_t len) {
+    emit(e, 5, 0x66, 0x83, 0x43, FRAME(pc), len);
+}
+
+// Sets the N and Z flags from al.
+static void emit_sign_flags(emitter_t *e) {
+    emit(e, 4, 0x66, 0x0F, 0xB6, 0xC0);         // movzx ax, al
+    emit(e, 4, 0x66, 0x89, 0x43, FRAME(nz));    // mov [rbx+nz], ax
+}
+
+// Loads a register into al.
+static void emit_load(emitter_t *e, uint8_t reg) {
+    emit(e, 3, 0x8A, 0x43, reg);                // mov al, [rbx+reg]
+}
+
+// Stores al into a register.
+static void emit_store(emitter_t *e, uint8_t reg) {
+    emit(e, 3, 0x88, 0x43, reg);                // mov [rbx+reg], al
+}
+
+// Tests a flag (N, C and V are set if the result is non-zero, but Z is set if the result is zero).
+static void emit_test(emitter_t *e, uint8_t flag) {
+    switch (flag) {
+        case SR_NEGATIVE:
+            emit(e, 4, 0x66, 0xF7, 0x43, FRAME(nz));    // test word [rbx+nz], 0x180
+            emit16(e, 0x180);
+            break;
+        case SR_ZERO:
+            emit(e, 4, 0xF6, 0x43, FRAME(nz), 0xFF);    // test byte [rbx+nz], 0xFF
+            break;
+        case SR_CARRY:
+            emit(e, 4, 0xF6, 0x43, FRAME(carry), 0x01); // test byte [rbx+carry], 1
+            break;
+        case SR_OVERFLOW:
+            emit(e, 4, 0xF6, 0x43, FRAME(vflow), 0x80); // test byte [rbx+vflow], 0x80
+            break;
+    }
+}
+
+/**
+ * Instructions.
+ */
+
+static void emit_load_imm(emitter_t *e, uint8_t reg, uint8_t value) {
+    emit(e, 4, 0xC6, 0x43, reg, value);         // mov byte [rbx+reg], imm8
+    emit(e, 4, 0x66, 0xC7, 0x43, FRAME(nz));    // mov word [rbx+nz], imm16
+    emit16(e, value);
+    emit_advance(e, 2);
+    emit_cycles(e, 2);
+}
+
+static void emit_transfer(emitter_t *e, uint8_t src, uint8_t dest, bool flags) {
+    emit_load(e, src);
+    emit_store(e, dest);
+    if (flags)
+        emit_sign_flags(e);
+    emit_advance(e, 1);
+    emit_cycles(e, 2);
+}
+
+static void emit_step(emitter_t *e, uint8_t reg, bool inc) {
+    emit_load(e, reg);
+    emit(e, 2, 0xFE, inc ? 0xC0 : 0xC8);       // inc al / dec al
+    emit_store(e, reg);
+    emit_sign_flags(e);
+    emit_advance(e, 1);
+    emit_cycles(e, 2);
+}
+
+static void emit_flag(emitter_t *e, uint8_t flag, bool set) {
+    if (flag == SR_CARRY)
+        emit(e, 4, 0xC6, 0x43, FRAME(carry), set);          // mov byte [rbx+carry], imm8
+    else if (flag == SR_OVERFLOW)
+        emit(e, 4, 0xC6, 0x43, FRAME(vflow), 0);            // mov byte [rbx+vflow], 0
+    else if (set)
+        emit(e, 4, 0x80, 0x4B, FRAME(flags), flag);         // or byte [rbx+flags], flag
+    else
+        emit(e, 4, 0x80, 0x63, FRAME(flags), ~flag & 0xFF); // and byte [rbx+flags], ~flag
+    emit_advance(e, 1);
+    emit_cycles(e, 2);
+}
+
+static void emit_branch(emitter_t *e, uint8_t flag, bool set, int8_t offset) {
+    emit_test(e, flag);
+    emit(e, 2, (flag != SR_ZERO) == set ? 0x74 : 0x75, 0); // jz/jnz not_taken
+    uint8_t *not_taken = e->p;
+
+    // Taken: the target is relative to the address of the branch (wrapped to 16 bits), and an
+    // extra cycle is taken if the target is on a different page.
+    emit(e, 4, 0x0F, 0xB7, 0x4B, FRAME(pc));   // movzx ecx, word [rbx+pc]
+    emit(e, 2, 0x8D, 0x81);                     // lea eax, [rcx+offset]
+    emit32(e, (int32_t)offset);
+    emit(e, 3, 0x0F, 0xB7, 0xC0);               // movzx eax, ax
+    emit(e, 3, 0x83, 0xC0, 0x02);               // add eax, 2
+    emit(e, 3, 0x83, 0xC1, 0x02);               // add ecx, 2
+    emit(e, 4, 0x66, 0x89, 0x43, FRAME(pc));   // mov [rbx+pc], ax
+    emit(e, 2, 0x31, 0xC1);                     // xor ecx, eax
+    emit(e, 3, 0xC1, 0xE9, 0x08);               // shr ecx, 8
+    emit(e, 2, 0x85, 0xC9);                     // test ecx, ecx
+    emit(e, 3, 0x0F, 0x95, 0xC1);               // setnz cl
+    emit(e, 3, 0x0F, 0xB6, 0xC9);               // movzx ecx, cl
+    emit(e, 3, 0x41, 0x01, 0xCC);               // add r12d, ecx
+    emit_cycles(e, 3);
+    emit(e, 2, 0xEB, 0);                        // jmp done
+    uint8_t *done = e->p;
+
+    // Not taken.
+    not_taken[-1] = e->p - not_taken;
+    emit_advance(e, 2);
+    emit_cycles(e, 2);
+    done[-1] = e->p - done;
+}
+
+static void emit_jump(emitter_t *e, uint16_t target) {
+    emit(e, 4, 0x66, 0xC7, 0x43, FRAME(pc));   // mov word [rbx+pc], imm16
+    emit16(e, target);
+    emit_cycles(e, 3);
+}
+
+static void emit_call(emitter_t *e, jit_fn_t fn, const uint8_t *args) {
+    // Bring the CPU's cycle counter up to date (the function may access I/O).
+    emit(e, 4, 0x49, 0x8B, 0x47, CTX(base));    // mov rax, [r15+base]
+    emit(e, 3, 0x44, 0x89, 0xE1);               // mov ecx, r12d
+    emit(e, 3, 0x48, 0x01, 0xC8);               // add rax, rcx
+    emit(e, 4, 0x49, 0x8B, 0x4F, CTX(clock));   // mov rcx, [r15+clock]
+    emit(e, 3, 0x48, 0x89, 0x01);               // mov [rcx], rax
+
+    emit(e, 3, 0x48, 0x89, 0xDF);               // mov rdi, rbx
+    emit(e, 3, 0x4C, 0x89, 0xF6);               // mov rsi, r14
+    emit(e, 2, 0x48, 0xBA);                     // mov rdx, args
+    emit64(e, (uintptr_t)args);
+    emit(e, 2, 0x48, 0xB8);                     // mov rax, fn
+    emit64(e, (uintptr_t)fn);
+    emit(e, 2, 0xFF, 0xD0);                     // call rax
+    emit(e, 3, 0x41, 0x01, 0xC4);               // add r12d, eax
+
+    // An I/O handler may have brought the deadline forward, so reload the budget.
+    emit(e, 4, 0x49, 0x8B, 0x47, CTX(deadline)); // mov rax, [r15+deadline]
+    emit(e, 3, 0x48, 0x8B, 0x00);               // mov rax, [rax]
+    emit(e, 4, 0x49, 0x2B, 0x47, CTX(base));    // sub rax, [r15+base]
+    emit(e, 3, 0x41, 0x89, 0xC5);               // mov r13d, eax
+}
+
+static void emit_op(emitter_t *e, const block_op_t *op) {
+    switch (op->opc) {
+        case 0xA9: emit_load_imm(e, FRAME(ac), op->args[0]); break;     // LDA #
+        case 0xA2: emit_load_imm(e, FRAME(x), op->args[0]); break;      // LDX #
+        case 0xA0: emit_load_imm(e, FRAME(y), op->args[0]); break;      // LDY #
+
+        case 0xAA: emit_transfer(e, FRAME(ac), FRAME(x), true); break;  // TAX
+        case 0xA8: emit_transfer(e, FRAME(ac), FRAME(y), true); break;  // TAY
+        case 0xBA: emit_transfer(e, FRAME(sp), FRAME(x), true); break;  // TSX
+        case 0x8A: emit_transfer(e, FRAME(x), FRAME(ac), true); break;  // TXA
+        case 0x9A: emit_transfer(e, FRAME(x), FRAME(sp), false); break; // TXS
+        case 0x98: emit_transfer(e, FRAME(y), FRAME(ac), true); break;  // TYA
+
+        case 0xE8: emit_step(e, FRAME(x), true); break;                 // INX
+        case 0xC8: emit_step(e, FRAME(y), true); break;                 // INY
+        case 0xCA: emit_step(e, FRAME(x), false); break;                // DEX
+        case 0x88: emit_step(e, FRAME(y), false); break;                // DEY
+
+        case 0x18: emit_flag(e, SR_CARRY, false); break;                // CLC
+        case 0x38: emit_flag(e, SR_CARRY, true); break;                 // SEC
+        case 0x58: emit_flag(e, SR_INTERRUPT, false); break;            // CLI
+        case 0x78: emit_flag(e, SR_INTERRUPT, true); break;             // SEI
+        case 0xD8: emit_flag(e, SR_DECIMAL, false); break;              // CLD
+        case 0xF8: emit_flag(e, SR_DECIMAL, true); break;               // SED
+        case 0xB8: emit_flag(e, SR_OVERFLOW, false); break;             // CLV
+
+        case 0x1A: case 0x3A: case 0x5A: case 0x7A:
+        case 0xDA: case 0xEA: case 0xFA:                                // NOP (implied)
+            emit_advance(e, 1);
+            emit_cycles(e, 2);
+            break;
+
+        case 0x10: emit_branch(e, SR_NEGATIVE, false, op->args[0]); break;  // BPL
+        case 0x30: emit_branch(e, SR_NEGATIVE, true, op->args[0]); break;   // BMI
+        case 0x50: emit_branch(e, SR_OVERFLOW, false, op->args[0]); break;  // BVC
+        case 0x70: emit_branch(e, SR_OVERFLOW, true, op->args[0]); break;   // BVS
+        case 0x90: emit_branch(e, SR_CARRY, false, op->args[0]); break;     // BCC
+        case 0xB0: emit_branch(e, SR_CARRY, true, op->args[0]); break;      // BCS
+        case 0xD0: emit_branch(e, SR_ZERO, false, op->args[0]); break;      // BNE
+        case 0xF0: emit_branch(e, SR_ZERO, true, op->args[0]); break;       // BEQ
+
+        case 0x4C: emit_jump(e, bytes_to_word(op->args[0], op->args[1])); break;  // JMP $LLHH
+
+        default:
+            emit_call(e, JIT_FUNCTIONS[op->opc], op->args);
+            break;
+    }
+}
+
+/**
+ * Compilation.
+ */
+
+void jit_compile(block_cache_t *bc, block_t *blk) {
+    if (bc->no_jit)
+        return;
+
+    // Allocate executable memory the first time a block is compiled.
+    if (bc->code == NULL) {
+        void *code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (code == MAP_FAILED) {
+            bc->no_jit = true;
+            return;
+        }
+        bc->code = code;
+    }
+
+    // Throw away all native code once executable memory runs out.
+    if (bc->code_used + JIT_MAX_BLOCK > JIT_CODE_SIZE) {
+        for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+            bc->blocks[i].jit = NULL;
+        }
+        bc->code_used = 0;
+    }
+
+    emitter_t e = { .start = bc->code + bc->code_used, .nexits = 0 };
+    e.p = e.start;
+
+    // Prologue (saves callee-saved registers, loads the context and jumps to the entry point).
+    emit(&e, 1, 0x53);                          // push rbx
+    emit(&e, 2, 0x41, 0x54);                    // push r12
+    emit(&e, 2, 0x41, 0x55);                    // push r13
+    emit(&e, 2, 0x41, 0x56);                    // push r14
+    emit(&e, 2, 0x41, 0x57);                    // push r15
+    emit(&e, 3, 0x49, 0x89, 0xFF);              // mov r15, rdi
+    emit(&e, 4, 0x49, 0x8B, 0x5F, CTX(frame)); // mov rbx, [r15+frame]
+    emit(&e, 4, 0x4D, 0x8B, 0x77, CTX(as));    // mov r14, [r15+as]
+    emit(&e, 4, 0x45, 0x8B, 0x67, CTX(total)); // mov r12d, [r15+total]
+    emit(&e, 4, 0x45, 0x8B, 0x6F, CTX(budget));// mov r13d, [r15+budget]
+    emit(&e, 2, 0xFF, 0xE6);                    // jmp rsi
+
+    for (int i = 0; i < blk->nops; i++) {
+        blk->entries[i] = e.p - e.start;
+        emit_op(&e, &blk->ops[i]);
+
+        // Stop once the budget has been used.
+        emit(&e, 4, 0x41, 0xC7, 0x47, CTX(next));  // mov dword [r15+next], i + 1
+        emit32(&e, i + 1);
+        emit(&e, 3, 0x45, 0x39, 0xEC);              // cmp r12d, r13d
+        emit_exit(&e, 0x8D);                        // jge exit
+
+        // Stop if the bank that the block is in may have been switched.
+        if (i + 1 < blk->nops && blk->ops[i + 1].sync) {
+            emit(&e, 3, 0x4C, 0x89, 0xF7);          // mov rdi, r14
+            emit(&e, 2, 0x48, 0xB8);                // mov rax, as_generation
+            emit64(&e, (uintptr_t)as_generation);
+            emit(&e, 2, 0xFF, 0xD0);                // call rax
+            emit(&e, 4, 0x41, 0x3B, 0x47, CTX(generation)); // cmp eax, [r15+generation]
+            emit_exit(&e, 0x85);                    // jne exit
+        }
+    }
+
+    // Epilogue.
+    for (int i = 0; i < e.nexits; i++) {
+        uint32_t rel = e.p - (e.exits[i] + 4);
+        memcpy(e.exits[i], &rel, sizeof(rel));
+    }
+    emit(&e, 4, 0x45, 0x89, 0x67, CTX(total)); // mov [r15+total], r12d
+    emit(&e, 2, 0x41, 0x5F);                    // pop r15
+    emit(&e, 2, 0x41, 0x5E);                    // pop r14
+    emit(&e, 2, 0x41, 0x5D);                    // pop r13
+    emit(&e, 2, 0x41, 0x5C);                    // pop r12
+    emit(&e, 1, 0x5B);                          // pop rbx
+    emit(&e, 1, 0xC3);                          // ret
+
+    blk->jit = e.start;
+    bc->code_used += ((e.p - e.start) + 15) & ~15;
+}
+
+int jit_run(const block_t *blk, tframe_t *frame, const addrspace_t *as, int start, uint64_t *clock, const uint64_t *deadline, uint32_t generation, int *next) {
+    jit_ctx_t ctx = { frame, as, 0, *deadline - *clock, start, generation, clock, deadline, *clock };
+    ((native_t)blk->jit)(&ctx, blk->jit + blk->entries[start]);
+    *clock = ctx.base + ctx.total;
+    *next = ctx.next;
+    return ctx.total;
+}
+
+void jit_release(block_cache_t *bc) {
+    if (bc->code != NULL) {
+        munmap(bc->code, JIT_CODE_SIZE);
+    }
+}
+
+#endif
@@ -52,6 +52,8 @@ static const instruction_t *INS_GROUP4[8][8] = {
     { &INS_ISC, &INS_ISC, &INS_USBC, &INS_ISC, &INS_ISC, &INS_ISC, &INS_ISC, &INS_ISC }
 };
 
+static decode_entry_t DECODE_TABLE[256];
+
 const addrmode_t *get_address_mode(opcode_t opc) {
     const addrmode_t *am;
     switch (opc.addrmode) {
@@ -134,3 +136,29 @@ const instruction_t *get_instruction(opcode_t opc) {
     
     return ins;
 }
+
+const decode_entry_t *get_decode_table(void) {
+    // Lazy generation of the decode table.
+    static bool table_init = false;
+    if (!table_init) {
+        for (int opc = 0; opc < 256; opc++) {
+            // Convert the raw opcode into an opcode_t.
+            opcode_t opcode = {
+                .group = opc & 0x03,
+                .addrmode = (opc >> 2) & 0x07,
+                .num = (opc >> 5) & 0x07,
+            };
+
+            // Decode the opcode to determine the instruction and address mode.
+            decode_entry_t *entry = &DECODE_TABLE[opc];
+            entry->instruction = get_instruction(opcode);
+            entry->addr_mode = get_address_mode(opcode);
+            entry->argc = entry->addr_mode->argc;
+            entry->cycles = entry->addr_mode->cycles;
+            entry->page_penalty = entry->addr_mode->page_penalty;
+        }
+        table_init = true;
+    }
+
+    return DECODE_TABLE;
+}
@@ -313,4 +313,24 @@ void apu_reset(apu_t *apu);
  */
 void apu_update(apu_t *apu, addrspace_t *cpuas, int hcycles);
 
+/**
+ * @brief Gets the number of cycles (in the same units as `apu_update`) until the APU may next generate
+ * an IRQ. The APU can be updated by up to this many cycles at once without an IRQ being missed.
+ * 
+ * @param apu The APU.
+ * @return The number of cycles until the next possible IRQ (or `INT_MAX` if the APU can't generate one).
+ */
+int apu_next_event(const apu_t *apu);
+
+/**
+ * @brief Gets the number of cycles (in the same units as `apu_update`) until the APU's frame counter
+ * next steps or is reset, or until the APU may next generate an IRQ. Updating the APU by up to this
+ * many cycles in a single call leaves it in the same state (as far as the CPU can tell) as updating
+ * it a few cycles at a time.
+ * 
+ * @param apu The APU.
+ * @return The number of cycles until the next step (or 1 if the DMC may generate an IRQ at any time).
+ */
+int apu_next_step(const apu_t *apu);
+
 #endif
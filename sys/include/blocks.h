@@ -0,0 +1,145 @@
+#ifndef BLOCKS_H
+#define BLOCKS_H
+
+#include <cpu.h>
+
+// The JIT backend is only available on x86-64 (and needs mmap to allocate executable memory).
+#if defined(CPU_JIT) && !(defined(__x86_64__) && defined(__unix__))
+#undef CPU_JIT
+#endif
+
+#define BLOCK_MAX_OPS       32
+#define BLOCK_CACHE_SIZE    4096
+
+/**
+ * Superinstructions (handlers past the last opcode that execute two instructions at once).
+ *
+ * DEX_BNE:     DEX followed by BNE (countdown loops on X).
+ * DEY_BNE:     DEY followed by BNE (countdown loops on Y).
+ * LDA_BPL:     LDA $LLHH followed by BPL (e.g. waiting for vblank by polling $2002).
+ * BIT_BPL:     BIT $LLHH followed by BPL (same as above, but without clobbering the accumulator).
+ */
+#define SUPER_DEX_BNE       0x100
+#define SUPER_DEY_BNE       0x101
+#define SUPER_LDA_BPL       0x102
+#define SUPER_BIT_BPL       0x103
+
+#define N_HANDLERS          0x104
+
+/**
+ * @brief A decoded instruction within a block.
+ */
+typedef struct block_op {
+
+    uint16_t    handler;        // The handler that executes the instruction (the opcode or a superinstruction).
+    uint8_t     opc;            // The opcode of the instruction.
+    uint8_t     args[2];        // The arguments of the instruction.
+    uint8_t     len;            // The length of the instruction (in bytes).
+    bool        sync;           // Set if the previous instruction wrote to memory (which may have switched banks).
+
+} block_op_t;
+
+/**
+ * @brief A straight-line sequence of decoded instructions. A block ends at the first jump or branch, or
+ * at the end of the page that it starts in.
+ */
+typedef struct block {
+
+    const uint8_t   *key;                   // The host memory that the block was decoded from (or `NULL` if unused).
+    bool            rom;                    // Set if the block was decoded from PRG-ROM (so it never changes).
+
+    uint8_t         nops;                   // The number of instructions in the block.
+    uint8_t         nbytes;                 // The number of bytes in the block.
+
+    uint8_t         bytes[BLOCK_MAX_OPS * 3]; // The raw bytes of the block (used to check blocks in RAM).
+    block_op_t      ops[BLOCK_MAX_OPS];       // The decoded instructions.
+
+#ifdef CPU_JIT
+    /* native code */
+    uint16_t        hits;                   // The number of times the block has been entered.
+    const uint8_t   *jit;                   // The native code for the block (or `NULL` if it hasn't been compiled).
+    uint16_t        entries[BLOCK_MAX_OPS]; // The offset of each instruction within the native code.
+#endif
+
+} block_t;
+
+/**
+ * @brief A cache of decoded blocks. Blocks are keyed by the host memory that they were decoded from,
+ * so blocks in PRG-ROM are keyed by their offset within the ROM and stay valid when banks are
+ * switched. Blocks in any other memory are checked against the memory before they are used.
+ */
+typedef struct block_cache {
+
+    /* cached blocks */
+    block_t             blocks[BLOCK_CACHE_SIZE];   // The blocks (indexed by a hash of the key).
+
+    /* read-only program memory */
+    const uint8_t       *rom;                       // The start of PRG-ROM.
+    size_t              rom_size;                   // The size of PRG-ROM.
+
+#ifdef CPU_JIT
+    /* native code */
+    uint8_t             *code;                      // Executable memory that holds the native code for blocks.
+    size_t              code_used;                  // The number of bytes of executable memory used.
+    bool                no_jit;                     // Set if executable memory couldn't be allocated.
+#endif
+
+    /* state of the last run */
+    const block_t       *blk;                       // The block being executed.
+    const block_op_t    *op;                        // The last instruction that was executed.
+    const block_op_t    *end;                       // The end of the block being executed.
+    addr_t              expect;                     // The address of the next instruction in the block.
+    uint32_t            generation;                 // The generation of the address space when the block was entered.
+
+} block_cache_t;
+
+/**
+ * @brief Creates an empty block cache.
+ *
+ * @return The block cache.
+ */
+block_cache_t *bc_create(void);
+
+/**
+ * @brief Destroys the given block cache.
+ *
+ * @param bc The block cache to destroy.
+ */
+void bc_destroy(block_cache_t *bc);
+
+/**
+ * @brief Removes all blocks from the cache and sets the host memory that holds PRG-ROM.
+ *
+ * @param bc The block cache.
+ * @param rom The start of PRG-ROM (or `NULL` if there is none).
+ * @param size The size of PRG-ROM.
+ */
+void bc_reset(block_cache_t *bc, const uint8_t *rom, size_t size);
+
+/**
+ * @brief Looks up the block that starts at the given address, decoding it if it isn't in the cache
+ * (or if the memory that it was decoded from has changed).
+ *
+ * @param bc The block cache.
+ * @param as The address space that the block is executed in.
+ * @param vaddr The address of the first instruction.
+ * @return The block, or `NULL` if the instruction can't be run from a block (in which case it
+ * should be fetched through the address space).
+ */
+const block_t *bc_lookup(block_cache_t *bc, const addrspace_t *as, addr_t vaddr);
+
+/**
+ * @brief Checks whether the block that starts at the given address is an idle loop (i.e. a block that
+ * only reads memory and then branches or jumps back to its first instruction), so that running it
+ * again can't change anything unless the memory that it reads changes.
+ *
+ * @param bc The block cache.
+ * @param as The address space that the block is executed in.
+ * @param vaddr The address of the first instruction.
+ * @param pure_read Determines whether an address that can't be read directly (i.e. an I/O register)
+ * can be read repeatedly without any further side effects (or `NULL` if none can).
+ * @return The number of cycles taken by each iteration of the loop, or 0 if the block isn't an idle loop.
+ */
+int bc_idle_loop(block_cache_t *bc, const addrspace_t *as, addr_t vaddr, bool (*pure_read)(addr_t vaddr));
+
+#endif
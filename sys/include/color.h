@@ -1,6 +1,8 @@
 #ifndef COLOR_H
 #define COLOR_H
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 typedef struct color {
@@ -13,8 +15,39 @@ typedef struct color {
 
 #define MAX_COLOR   0x3F
 
+#define N_EMPHASIS  8                               // The number of combinations of the color emphasis bits.
+#define N_COLORS    ((MAX_COLOR + 1) * N_EMPHASIS)  // The number of colors the PPU can output.
+
+#define COLOR_EMPHASIS_SHIFT    6                   // The position of the emphasis bits in a pixel.
+#define COLOR_STRIDE            3                   // The number of bytes per pixel of converted output (RGB order).
+
 #define DEFAULT_COLORS { {84, 84, 84}, {0, 30, 116}, {8, 16, 144}, {48, 0, 136}, {68, 0, 100}, {92, 0, 48}, {84, 4, 0}, {60, 24, 0}, {32, 42, 0}, {8, 58, 0}, {0, 64, 0}, {0, 60, 0}, {0, 50, 60}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {152, 150, 152}, {8, 76, 196}, {48, 50, 236}, {92, 30, 228}, {136, 20, 176}, {160, 20, 100}, {152, 34, 32}, {120, 60, 0}, {84, 90, 0}, {40, 114, 0}, {8, 124, 0}, {0, 118, 40}, {0, 102, 120}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {236, 238, 236}, {76, 154, 236}, {120, 124, 236}, {176, 98, 236}, {228, 84, 236}, {236, 88, 180}, {236, 106, 100}, {212, 136, 32}, {160, 170, 0}, {116, 196, 0}, {76, 208, 32}, {56, 204, 108}, {56, 180, 204}, {60, 60, 60}, {0, 0, 0}, {0, 0, 0}, {236, 238, 236}, {168, 204, 236}, {188, 188, 236}, {212, 178, 236}, {236, 174, 236}, {236, 174, 212}, {236, 180, 176}, {228, 196, 144}, {204, 210, 120}, {180, 222, 120}, {168, 226, 144}, {152, 226, 180}, {160, 214, 228}, {160, 162, 160}, {0, 0, 0}, {0, 0, 0} }
 
-color_t color_resolve(uint8_t index);
+/**
+ * @brief Gets the color of a pixel output by the PPU.
+ * 
+ * @param pixel The pixel (a palette index in bits 0-5 and the emphasis bits of PPUMASK in bits 6-8).
+ * @return The color of the pixel.
+ */
+color_t color_resolve(uint16_t pixel);
+
+/**
+ * @brief Converts pixels output by the PPU into RGB colors (3 bytes per pixel).
+ * 
+ * @param pixels The pixels to convert.
+ * @param rgb The buffer to write the colors to (`COLOR_STRIDE` bytes per pixel).
+ * @param n The number of pixels.
+ */
+void color_convert(const uint16_t *pixels, uint8_t *rgb, size_t n);
+
+/**
+ * @brief Loads the colors from a palette file (.pal), which contains either the 64 palette colors or all
+ * 512 colors including emphasis (3 bytes per color; RGB order). The colors for emphasis are approximated
+ * if they aren't given.
+ * 
+ * @param path The path of the palette file.
+ * @return Whether the palette could be loaded (the current palette is kept if not).
+ */
+bool color_load(const char *path);
 
 #endif
@@ -42,7 +42,8 @@
 #define JOYPAD_RIGHT    0x80
 
 /**
- * @brief The flags for each bit in the status register.
+ * @brief The flags for each bit in the status register (used to inspect the status register, which
+ * is stored in the trap frame in a different form).
  */
 typedef struct sr_flags {
     unsigned carry : 1;     // Carry flag.
@@ -56,17 +57,71 @@ typedef struct sr_flags {
 } sr_flags_t;
 
 /**
- * @brief A trap frame that stores the state of the CPU's registers.
+ * @brief A trap frame that stores the state of the CPU's registers. The N, Z, C and V flags of the
+ * status register are stored as the values that they are derived from, so instructions don't have
+ * to compute them (they are only evaluated when they are read). Use `get_sr` and `set_sr` to
+ * access the status register as a whole.
  */
 typedef struct tframe {
     uint16_t    pc;     // program counter
     uint8_t     ac;     // accumulator
     uint8_t     x;      // X register
     uint8_t     y;      // Y register
-    sr_flags_t  sr;     // status register
     uint8_t     sp;     // stack pointer
+
+    /* status register */
+    uint8_t     flags;  // I, D, B and the ignored bit (the other bits are always clear).
+    uint8_t     carry;  // C (either 0 or 1).
+    uint8_t     vflow;  // V is bit 7 of this value.
+    uint16_t    nz;     // N is set if bit 7 or 8 of this value is set, and Z is set if the low byte is 0.
 } tframe_t;
 
+// Flag tests on the trap frame.
+#define SR_N(frame)     (((frame)->nz & 0x180) != 0)
+#define SR_Z(frame)     (((frame)->nz & 0xFF) == 0)
+#define SR_C(frame)     ((frame)->carry)
+#define SR_V(frame)     (((frame)->vflow & 0x80) != 0)
+
+/**
+ * @brief The interpreter cores. Other than the generic core, each core is specialised for the memory
+ * layout of a family of mappers, so that memory which the family maps directly (work RAM, PRG-RAM and
+ * PRG-ROM) doesn't have to be accessed through the address space.
+ */
+typedef enum cpu_core {
+    CPU_CORE_GENERIC = 0,   // Any memory layout (all memory is accessed through the address space).
+    CPU_CORE_NROM,          // NROM (mapper 0).
+    CPU_CORE_MMC1,          // MMC1 (mapper 1).
+    CPU_CORE_UXROM,         // UxROM (mapper 2).
+    CPU_CORE_CNROM,         // CNROM (mapper 3).
+    CPU_CORE_MMC3,          // MMC3 (mapper 4).
+    CPU_CORE_MMC5,          // MMC5 (mapper 5).
+    CPU_CORE_MMC2,          // MMC2 (mapper 9).
+    CPU_CORE_INES034,       // BNROM and NINA-001 (mapper 34).
+    N_CPU_CORES
+} cpu_core_t;
+
+/**
+ * @brief Host memory that a specialised core accesses directly. This is resolved from the address
+ * space, and is resolved again whenever the generation of the address space changes.
+ */
+typedef struct cpu_bus {
+    uint8_t         *wmem;              // Work memory ($0000-$1FFF, mirrored every 2KB).
+    uint8_t         *ram;               // PRG-RAM ($6000-$7FFF), or `NULL` if it must be accessed through the address space.
+    const uint8_t   *prg[4];            // The PRG-ROM windows from $8000 (each `NULL` if it must be accessed through the address space).
+    uint32_t        generation;         // The generation of the address space that the bus was resolved from.
+} cpu_bus_t;
+
+/**
+ * @brief The page of memory that code was last fetched from, so that instructions can be fetched
+ * without going through the address space. This is resolved again whenever the program counter moves
+ * to a different page or the generation of the address space changes (i.e. a bank is switched).
+ */
+typedef struct cpu_code {
+    const uint8_t   *ptr;               // The host memory of the page, or `NULL` if it must be read through the address space.
+    addr_t          page;               // The virtual address of the start of the page.
+    uint32_t        generation;         // The generation of the address space that the page was resolved from.
+} cpu_code_t;
+
 /**
  * @brief A CPU struct that contains all data needed to emulate the CPU.
  */
@@ -76,6 +131,13 @@ typedef struct cpu {
     addrspace_t     *as;                // The CPU's address space.
     uint8_t         *wmem;              // The CPU's working memory.
 
+    const struct decode_entry *decode;  // The decode table (indexed by raw opcode).
+    struct block_cache *blocks;         // The cache of decoded blocks (used by the threaded core).
+
+    cpu_core_t      core;               // The interpreter core used by `cpu_run`.
+    cpu_bus_t       bus;                // Memory accessed directly by the interpreter core.
+    cpu_code_t      code;               // The page that code is fetched from.
+
     uint8_t         oam_dma;            // OAM direct memory access.
 
     uint8_t         joypad1;            // Joypad 1
@@ -90,7 +152,8 @@ typedef struct cpu {
     unsigned        oam_upload  : 1;    // Whether the CPU is suspended due to OAM DMA.
     unsigned                    : 6;
 
-    uint64_t        cycles;             // CPU cycle counter (set to 0 on reset).
+    uint64_t        cycles;             // CPU cycle counter (set to 0 on reset; kept up to date by `cpu_run` between instructions).
+    uint64_t        deadline;           // The cycle that `cpu_run` stops at (the instruction that reaches it is completed).
 
 } cpu_t;
 
@@ -135,6 +198,18 @@ typedef struct addrmode {
     */
     const uint8_t argc;
 
+    /**
+    * @brief The base number of cycles taken by an instruction that uses this address mode
+    * (instructions may add extra cycles on top of this).
+    */
+    const uint8_t cycles;
+
+    /**
+    * @brief Indicates whether an extra cycle is taken when a page boundary is crossed in order
+    * to obtain the address.
+    */
+    const bool page_penalty;
+
 } addrmode_t;
 
 typedef struct instruction {
@@ -175,6 +250,20 @@ typedef struct opcode {
 
 } opcode_t;
 
+/**
+ * @brief An entry in the decode table, which holds everything needed to decode a raw opcode
+ * (so that decoding an instruction is a single lookup).
+ */
+typedef struct decode_entry {
+
+    const instruction_t     *instruction;       // The instruction (or `NULL` if the opcode is invalid).
+    const addrmode_t        *addr_mode;         // The address mode.
+    uint8_t                 argc;               // The number of arguments (bytes) taken by the instruction.
+    uint8_t                 cycles;             // The base number of cycles taken by the address mode.
+    bool                    page_penalty;       // Set if crossing a page boundary takes an extra cycle.
+
+} decode_entry_t;
+
 /**
  * @brief A single CPU operation that contains an instruction along with the
  * address mode that will be used to process the argument(s) to this instruction.
@@ -204,6 +293,14 @@ const addrmode_t *get_address_mode(opcode_t opc);
  */
 const instruction_t *get_instruction(opcode_t opc);
 
+/**
+ * @brief Gets the decode table, which is indexed by raw opcode. The table is generated the first
+ * time that it is requested.
+ * 
+ * @return The decode table (256 entries).
+ */
+const decode_entry_t *get_decode_table(void);
+
 /**
  * @brief Converts two bytes into a 16-bit word.
  * 
@@ -229,6 +326,31 @@ uint8_t sr_to_bits(const sr_flags_t sr);
  */
 sr_flags_t bits_to_sr(uint8_t bits);
 
+/**
+ * @brief Gets the value of the status register (evaluating the flags that are stored lazily).
+ * 
+ * @param frame The trap frame.
+ * @return The integral value of the status register.
+ */
+uint8_t get_sr(const tframe_t *frame);
+
+/**
+ * @brief Sets the value of the status register.
+ * 
+ * @param frame The trap frame.
+ * @param bits The integral value of the status register.
+ */
+void set_sr(tframe_t *frame, uint8_t bits);
+
+/**
+ * @brief Sets or clears a single flag in the status register.
+ * 
+ * @param frame The trap frame.
+ * @param flag The bit of the flag (one of `SR_*`).
+ * @param value Whether the flag is set.
+ */
+void set_flag(tframe_t *frame, uint8_t flag, bool value);
+
 /**
  * @brief Creates a new instance of an emulated CPU.
  * 
@@ -270,16 +392,16 @@ void cpu_irq(cpu_t *cpu);
  * @param cpu The CPU's state.
  * @return The resultant raw opcode.
  */
-uint8_t cpu_fetch(const cpu_t *cpu);
+uint8_t cpu_fetch(cpu_t *cpu);
 
 /**
- * @brief Decodes the given instruction.
+ * @brief Decodes the given instruction (the arguments are fetched from the same page as the opcode).
  * 
  * @param cpu The CPU's state.
  * @param opc The raw opcode.
  * @return A struct containing the decoded instruction.
  */
-operation_t cpu_decode(const cpu_t *cpu, const uint8_t opc);
+operation_t cpu_decode(cpu_t *cpu, const uint8_t opc);
 
 /**
  * @brief Executes an instruction. Advances the program counter after the instruction has been executed.
@@ -290,6 +412,60 @@ operation_t cpu_decode(const cpu_t *cpu, const uint8_t opc);
  */
 int cpu_execute(cpu_t *cpu, operation_t op);
 
+/**
+ * @brief Sets the host memory that holds the program's PRG-ROM. Code decoded from PRG-ROM is cached
+ * without being checked against memory, so this must be called whenever a program is inserted.
+ * 
+ * @param cpu The CPU.
+ * @param rom The start of PRG-ROM.
+ * @param size The size of PRG-ROM.
+ */
+void cpu_set_rom(cpu_t *cpu, const uint8_t *rom, size_t size);
+
+/**
+ * @brief Selects the interpreter core that is used by `cpu_run`. A core that is specialised for a
+ * family of mappers must only be used once a program using one of those mappers has been inserted.
+ * 
+ * @param cpu The CPU.
+ * @param core The core to use.
+ */
+void cpu_set_core(cpu_t *cpu, cpu_core_t core);
+
+/**
+ * @brief Runs instructions until the given number of cycles has elapsed. This uses the threaded
+ * interpreter core, which has the same effect as fetching, decoding and executing each
+ * instruction in turn, but with a specialised handler for each opcode. Instructions are decoded
+ * once into blocks, which are cached between runs. The CPU's cycle counter is advanced after each
+ * instruction, so I/O handlers see the cycle that the current instruction started on.
+ * 
+ * @param cpu The CPU's state.
+ * @param budget The number of cycles to run for (the last instruction may overshoot the budget).
+ * @return The number of cycles taken.
+ */
+int cpu_run(cpu_t *cpu, int budget);
+
+/**
+ * @brief Stops `cpu_run` once the current instruction has been completed. This can be called by
+ * an I/O handler when an access means that the rest of the system has to be looked at before the
+ * CPU carries on.
+ * 
+ * @param cpu The CPU's state.
+ */
+void cpu_stop(cpu_t *cpu);
+
+/**
+ * @brief Checks whether the CPU is at the start of an idle loop, such as `LDA $2002; BPL` or `JMP *`.
+ * An idle loop only reads memory (and I/O registers that are accepted by `pure_read`) and loads
+ * registers, so once an iteration has left the CPU's state unchanged, every iteration after it
+ * does the same until the memory that it reads changes or an interrupt occurs.
+ * 
+ * @param cpu The CPU's state.
+ * @param pure_read Determines whether an I/O register can be read repeatedly without any further
+ * side effects (or `NULL` if no I/O registers can be read).
+ * @return The number of cycles taken by each iteration of the loop, or 0 if the CPU isn't in an idle loop.
+ */
+int cpu_idle_loop(cpu_t *cpu, bool (*pure_read)(addr_t vaddr));
+
 /* stack instructions */
 
 void push(tframe_t *frame, const addrspace_t *as, uint8_t value);
@@ -0,0 +1,145 @@
+/**
+ * @file interp.h
+ * @brief The loop of a threaded interpreter core. This is included by interp.c once for each core,
+ * with `CORE_NAME` defined as the name of the function to generate and `CORE_TRAITS` defined as the
+ * traits of the memory layout that the core is specialised for (a combination of `BUS_*` flags).
+ * @version 1.0
+ * @date 2022-03-26
+ */
+
+static int CORE_NAME(cpu_t *cpu) {
+    tframe_t *frame = &cpu->frame;
+    const addrspace_t *as = cpu->as;
+    block_cache_t *bc = cpu->blocks;
+
+    // Memory that the core accesses directly (the traits are constant, so the checks are folded away).
+    const unsigned traits = CORE_TRAITS;
+    cpu_bus_t *bus = &cpu->bus;
+
+    // Position within the current block.
+    static const block_op_t none;
+    const block_t *blk = bc->blk;
+    const block_op_t *op = bc->op != NULL ? bc->op : &none;
+    const block_op_t *end = bc->end != NULL ? bc->end : &none;
+    addr_t expect = bc->expect;
+    uint32_t generation = bc->generation;
+
+    // State of the current instruction.
+    unsigned handler;
+    const uint8_t *args;
+    operation_t fetched;
+    addr_t addr;
+    uint8_t *ptr;
+    bool crossed;
+    uint8_t arg, lo, value;
+    int cycles;
+#ifdef CPU_JIT
+    int next;
+#endif
+
+    // The cycle counter at the start of the run (the counter is advanced after each instruction).
+    const uint64_t start = cpu->cycles;
+
+#ifdef THREADED_DISPATCH
+    static const void *const dispatch[N_HANDLERS] = {
+        ROW(0), ROW(1), ROW(2), ROW(3), ROW(4), ROW(5), ROW(6), ROW(7),
+        ROW(8), ROW(9), ROW(A), ROW(B), ROW(C), ROW(D), ROW(E), ROW(F),
+        &&op_0x100, &&op_0x101, &&op_0x102, &&op_0x103 // Superinstructions.
+    };
+#endif
+
+    // Banks may have been switched since the last run.
+    bus_sync(bus, as, traits);
+
+    // Continue the block from the last run if the program counter hasn't been moved since.
+    if (cpu->cycles >= cpu->deadline)
+        goto done;
+    if (++op < end && frame->pc == expect && as_generation(as) == generation) {
+        args = op->args;
+        expect += op->len;
+        handler = op->handler;
+    }
+    else {
+        goto lookup;
+    }
+#ifdef CPU_JIT
+    if (blk->jit != NULL)
+        goto native;
+#endif
+
+#ifndef THREADED_DISPATCH
+    for (;;) {
+        switch (handler) {
+#else
+    JUMP();
+#endif
+
+    OPCODES(OP, JOP, SLOW)
+
+    SUPER(SUPER_DEX_BNE, IMP, DEX, REL, BNE)
+    SUPER(SUPER_DEY_BNE, IMP, DEY, REL, BNE)
+    SUPER(SUPER_LDA_BPL, ABS, LDA, REL, BPL)
+    SUPER(SUPER_BIT_BPL, ABS, BIT, REL, BPL)
+
+    // Invalid or unimplemented instructions are handled by the per-instruction path (which
+    // terminates the program with the appropriate error).
+    slow:
+        cpu->cycles += cpu_execute(cpu, cpu_decode(cpu, cpu_fetch(cpu)));
+        bus_sync(bus, as, traits);
+        NEXT()
+
+#ifndef THREADED_DISPATCH
+        }
+
+    lookup:
+#else
+    lookup:
+#endif
+        // Find the block that starts at the program counter.
+        blk = bc_lookup(bc, as, frame->pc);
+        if (blk != NULL) {
+            op = blk->ops;
+            end = blk->ops + blk->nops;
+            args = op->args;
+            expect = frame->pc + op->len;
+            generation = as_generation(as);
+            handler = op->handler;
+#ifdef CPU_JIT
+            if (blk->jit != NULL)
+                goto native;
+#endif
+            JUMP();
+        }
+
+        // Otherwise, fetch and decode the instruction through the CPU's code page.
+        fetched = cpu_decode(cpu, cpu_fetch(cpu));
+        handler = fetched.opc;
+        op = end = &none;
+        args = fetched.args;
+        JUMP();
+
+#ifdef CPU_JIT
+    native:
+        // Run the rest of the block as native code.
+        jit_run(blk, frame, as, op - blk->ops, &cpu->cycles, &cpu->deadline, generation, &next);
+        bus_sync(bus, as, traits);
+        op = blk->ops + next - 1;
+        expect = frame->pc;
+        NEXT()
+#endif
+#ifndef THREADED_DISPATCH
+    }
+#endif
+
+done:
+    // Remember where the block is up to for the next run.
+    bc->blk = blk;
+    bc->op = op;
+    bc->end = end;
+    bc->expect = expect;
+    bc->generation = generation;
+    return cpu->cycles - start;
+}
+
+#undef CORE_NAME
+#undef CORE_TRAITS
@@ -0,0 +1,64 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <blocks.h>
+
+#ifdef CPU_JIT
+
+#define JIT_THRESHOLD   16              // The number of times a block is entered before it is compiled.
+#define JIT_CODE_SIZE   (4 << 20)       // The amount of executable memory for native code.
+#define JIT_MAX_BLOCK   (BLOCK_MAX_OPS * 128)   // The maximum size of the native code for a single block.
+
+/**
+ * @brief A function that executes a single instruction (advancing the program counter unless the
+ * instruction is a jump).
+ *
+ * @param frame The CPU's registers.
+ * @param as The CPU's address space.
+ * @param args The arguments of the instruction.
+ * @return The number of cycles taken.
+ */
+typedef int (*jit_fn_t)(tframe_t *frame, const addrspace_t *as, const uint8_t *args);
+
+/**
+ * @brief The function for each opcode (or `NULL` if the opcode doesn't have a specialised handler),
+ * which is called by native code for instructions that aren't compiled inline.
+ */
+extern const jit_fn_t JIT_FUNCTIONS[256];
+
+/**
+ * @brief Compiles the given block into native code. Native code has the same behaviour as running the
+ * block in the interpreter: it stops once the budget has been used, or if the bank that the block is
+ * in may have been switched.
+ *
+ * @param bc The block cache that the block belongs to.
+ * @param blk The block to compile (must be decoded from PRG-ROM).
+ */
+void jit_compile(block_cache_t *bc, block_t *blk);
+
+/**
+ * @brief Runs a compiled block as native code. The cycle counter is brought up to date before native
+ * code calls out to an opcode's function, and the deadline is checked again afterwards.
+ *
+ * @param blk The compiled block.
+ * @param frame The CPU's registers.
+ * @param as The CPU's address space.
+ * @param start The index of the first instruction to run.
+ * @param clock The CPU's cycle counter (advanced by the number of cycles taken).
+ * @param deadline The cycle to stop at.
+ * @param generation The generation of the address space when the block was entered.
+ * @param next Set to the index of the next instruction in the block.
+ * @return The number of cycles taken.
+ */
+int jit_run(const block_t *blk, tframe_t *frame, const addrspace_t *as, int start, uint64_t *clock, const uint64_t *deadline, uint32_t generation, int *next);
+
+/**
+ * @brief Frees the executable memory used by the given block cache.
+ *
+ * @param bc The block cache.
+ */
+void jit_release(block_cache_t *bc);
+
+#endif
+
+#endif
@@ -2,6 +2,7 @@
 #define MAPPERS_H
 
 #include <mapper.h>
+#include <ppu.h>
 #include <prog.h>
 
 #define N_PRG_BANKS(prog, sz) (prog->header.prg_rom_size * INES_PRG_ROM_UNIT / sz)
@@ -10,19 +11,6 @@
 #define PRG_RAM_START   0x6000
 #define PRG_ROM_START   0x8000
 
-/**
- * @brief Mapper rule (takes a similar form to an address space resolve rule).
- * 
- * @param mapper The mapper.
- * @param prog The NES program that is using the mapper.
- * @param vaddr The virtual address that is being mapped.
- * @param target The mapped address prior to performing any mapping.
- * @param offset The offset of the virtual address from the start of the segment
- *               that the address is contained in within the address space.
- * @return The resultant physical/emulator address that gets mapped.
- */
-typedef uint8_t *(*map_rule_t)(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-
 /* mapper implementation */
 struct mapper {
 
@@ -37,25 +25,24 @@ struct mapper {
     /* function pointers (must be declared by mapper)  */
 
     void            (*insert)(mapper_t *mapper, prog_t *prog);
-    void            (*monitor)(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
-
-    /* mapper functions (do not need to be declared by mapper) */
-
-    map_rule_t      map_ram;    // Maps PRG-RAM.
-    map_rule_t      map_prg;    // Maps PRG-ROM.
-    map_rule_t      map_chr;    // Maps CHR-ROM/RAM.
-    map_rule_t      map_nts;    // Maps nametables.
+    void            (*monitor)(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
     /* additional functions (do not need to be declared by mapper) */
 
     void            (*cycle)(mapper_t *mapper, prog_t *prog, int cycles);
     float           (*mix)(mapper_t *mapper, prog_t *prog, float input);
+    int             (*next_irq)(mapper_t *mapper, prog_t *prog, const ppu_t *ppu);
+
+    /* system hooks (set by the system, not the mapper) */
+
+    void            (*sync)(void);  // Called before the mapper sees a write from the CPU (e.g. so the PPU can catch up before banks are switched).
 
     /* system pointers */
 
     addrspace_t     *cpuas;     // Reference to CPU address space.
     addrspace_t     *ppuas;     // Reference to PPU address space.
     uint8_t         *vram;      // Reference to PPU VRAM.
+    prog_t          *prog;      // Reference to the program that is using the mapper (set on insert).
 
     /* mapper registers */
 
@@ -66,6 +53,7 @@ struct mapper {
     /* other variables */
 
     bool            irq;        // Set if the CPU should generate an IRQ on its next instruction fetch.    
+    bool            irq_armed;  // Set if the mapper may generate an IRQ (i.e. the mapper's IRQ is enabled).
     void            *data;      // Additional data that the mapper may allocate.
 
 };
@@ -88,19 +76,20 @@ mapper_t *mapper_create(void);
 void mapper_insert(mapper_t *mapper, prog_t *prog);
 
 /**
- * @brief Invoked whenever a read or write occurs to either the CPU or PPU's address
- * space, allowing the mapper to monitor reads and writes on the bus so that it may
- * update its state and perform any bank switching. As the mapper doesn't have a clock,
- * this is the only way that the mapper can keep track of its state.
+ * @brief Allows the mapper to monitor reads and/or writes to a range of addresses in either the
+ * CPU or PPU's address space, so that it may update its state and perform any bank switching.
+ * The mapper's monitor function is invoked whenever an address within the range is accessed.
+ * As the mapper doesn't have a clock, this is the only way that the mapper can keep track of
+ * its state. This should be called by the mapper when the program is inserted. Bank switching
+ * is performed by remapping the affected banks (via `as_map_bank`) whenever a register changes.
  * 
  * @param mapper The mapper.
- * @param prog The NES program that is using the mapper.
- * @param as The address space that was modified.
- * @param vaddr The virtual address that was accessed.
- * @param value The value that was read or written.
- * @param write Set if the access was a write.
+ * @param as The address space to monitor.
+ * @param start The start of the range.
+ * @param end The end of the range (inclusive).
+ * @param mode The accesses to monitor (reads and/or writes).
  */
-void mapper_monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+void mapper_watch(mapper_t *mapper, addrspace_t *as, addr_t start, addr_t end, uint8_t mode);
 
 /**
  * @brief Invoked whenever a CPU cycle occurs (or when a series of cycles occur). The
@@ -113,6 +102,20 @@ void mapper_monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
  */
 void mapper_cycle(mapper_t *mapper, prog_t *prog, int cycles);
 
+/**
+ * @brief Gets the number of PPU cycles that the PPU can render before the mapper may raise an IRQ (or
+ * change anything else that the CPU can observe) while it watches the PPU. The system runs the CPU on
+ * its own for up to this many cycles, and a write that the mapper sees (or a change to the PPU's state
+ * that the mapper depends on) stops the CPU so that the deadline is found again. Mappers that don't
+ * declare this are run in lockstep while they are clocked by the CPU or while their IRQ is armed.
+ * 
+ * @param mapper The mapper.
+ * @param prog The NES program that is using the mapper.
+ * @param ppu The PPU.
+ * @return The number of PPU cycles until the mapper may next raise an IRQ (`INT_MAX` if it can't).
+ */
+int mapper_next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu);
+
 /**
  * @brief Invoked whenever an APU cycle occurs, allowing the mapper to manipulate the
  * mixer output in order to add additional audio data.
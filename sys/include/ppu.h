@@ -3,6 +3,7 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <tiles.h>
 #include <time.h>
 #include <vm.h>
 
@@ -18,6 +19,17 @@
 #define NT_X(V)     ((V >> 10) & 0x01)
 #define NT_Y(V)     ((V >> 11) & 0x01)
 
+/* Fields of a VRAM address register. */
+#define VRAM_COARSE_X   0x001F  // Coarse-x scroll (i.e. x-coordinate of the cell along nametable).
+#define VRAM_COARSE_Y   0x03E0  // Coarse-y scroll (i.e. y-coordinate of the cell along nametable).
+#define VRAM_NT_X       0x0400  // Nametable along x-direction (0: left; 1: right).
+#define VRAM_NT_Y       0x0800  // Nametable along y-direction (0: top; 1: bottom).
+#define VRAM_FINE_Y     0x7000  // Fine-y scroll (i.e. y-coordinate of pixel within tile).
+#define VRAM_ADDR       0x7FFF  // All of the above.
+
+#define VRAM_HORIZONTAL (VRAM_COARSE_X | VRAM_NT_X)                 // The horizontal scroll position.
+#define VRAM_VERTICAL   (VRAM_COARSE_Y | VRAM_NT_Y | VRAM_FINE_Y)   // The vertical scroll position.
+
 #define PPU_CTRL    0x2000
 #define PPU_MASK    0x2001
 #define PPU_STATUS  0x2002
@@ -29,27 +41,59 @@
 
 #define SCREEN_WIDTH    256
 #define SCREEN_HEIGHT   240
-#define PIXEL_STRIDE    3
 
 #define NT_ROWS     30
 #define NT_COLS     32
 
 #define N_SPRITES   64
 
-#define OUT_R       0x00
-#define OUT_G       0x01
-#define OUT_B       0x02
+#define SPR_PIXEL       0x03    // The value of a sprite pixel in the sprite line buffer (0 if transparent).
+#define SPR_PALETTE     0x0C    // The palette of a sprite pixel in the sprite line buffer.
+#define SPR_BEHIND      0x10    // Set if a sprite pixel is behind the background.
+#define SPR_ZERO        0x20    // Set if a sprite pixel belongs to the first sprite in secondary OAM.
 
 #define SCANLINE_END    340
 #define N_SCANLINES     260
 
-#define PPU_BUFFER      (SCREEN_WIDTH * SCREEN_HEIGHT * PIXEL_STRIDE)
-
-typedef struct {
-    unsigned    read    : 1;
-    unsigned    write   : 1;
-    unsigned            : 6;
-} io_flags_t;
+#define PPU_BUFFER      (SCREEN_WIDTH * SCREEN_HEIGHT)
+
+/* Operations performed by the PPU on a dot (in this order). */
+#define DOT_CLEAR_FLAGS     0x00000001  // Clear the VBL, sprite 0 hit and sprite overflow flags.
+#define DOT_SET_VBLANK      0x00000002  // Set the VBL flag (unless suppressed).
+#define DOT_COPY_Y          0x00000004  // Copy the vertical scroll from t to v.
+#define DOT_ODD_FRAME       0x00000008  // Skip to the last dot on odd frames (if background rendering is enabled).
+#define DOT_PIXEL           0x00000010  // Output a pixel.
+#define DOT_SHIFT           0x00000020  // Clock the background shift registers.
+#define DOT_FETCH_HIGH      0x00000040  // Fetch the high background tile byte, increment v and reload the shift registers.
+#define DOT_INC_X           0x00000080  // Increment the horizontal position in v (with DOT_FETCH_HIGH).
+#define DOT_INC_Y           0x00000100  // Increment the vertical position in v (with DOT_FETCH_HIGH).
+#define DOT_FETCH_NT        0x00000200  // Fetch a nametable byte.
+#define DOT_FETCH_AT        0x00000400  // Fetch an attribute table byte.
+#define DOT_FETCH_LOW       0x00000800  // Fetch the low background tile byte.
+#define DOT_COPY_X          0x00001000  // Copy the horizontal scroll from t to v.
+#define DOT_EVAL_RESET      0x00002000  // Reset sprite evaluation.
+#define DOT_OAM2_CLEAR      0x00004000  // Clear a byte of secondary OAM.
+#define DOT_EVAL_READ       0x00008000  // Read a byte of OAM for sprite evaluation.
+#define DOT_EVAL_STEP       0x00010000  // Perform a step of sprite evaluation.
+#define DOT_SPR_HIGH        0x00020000  // Fetch the high sprite tile byte (and draw the sprite into the line buffer).
+#define DOT_SPR_LOAD        0x00040000  // Load a sprite from secondary OAM.
+#define DOT_SPR_LOW         0x00080000  // Fetch the low sprite tile byte.
+#define DOT_OAM_ADDR_RESET  0x00100000  // Reset OAMADDR.
+#define DOT_SZC             0x00200000  // Check if sprite 0 is in secondary OAM.
+
+#define DOT_STATUS_OPS      0x0000000F  // Operations on the status flags and scroll (which only occur outside of visible scanlines).
+#define DOT_BKG_OPS         0x00001FF0  // Background operations.
+#define DOT_SPR_OPS         0x003FE000  // Sprite operations.
+
+/* PPUMASK flags that the scanline renderers are specialised for. */
+#define MASK_BKG_LEFT       0x02    // Show background in leftmost 8 pixels of screen.
+#define MASK_SPR_LEFT       0x04    // Show sprites in leftmost 8 pixels of screen.
+#define MASK_BACKGROUND     0x08    // Show background.
+#define MASK_SPRITES        0x10    // Show sprites.
+#define MASK_RENDERING      0x1E    // All of the above.
+
+#define FETCH_PAGE_SIZE 0x0400
+#define N_FETCH_PAGES   ((NAMETABLE3 + NT_SIZE) / FETCH_PAGE_SIZE)
 
 /**
  * @brief A pattern table entry.
@@ -70,16 +114,30 @@ typedef union pt_entry {
 } pt_entry_t;
 
 /**
- * @brief A VRAM address register.
+ * @brief A VRAM address register (see VRAM_COARSE_X for its fields).
+ */
+typedef uint16_t vram_reg_t;
+
+/**
+ * @brief The operations performed by the PPU on a dot (see DOT_PIXEL).
+ */
+typedef uint32_t dot_ops_t;
+
+/**
+ * @brief The operations performed by the PPU on each dot of a type of scanline.
+ */
+typedef dot_ops_t line_schedule_t[SCANLINE_END + 1];
+
+/**
+ * @brief The types of scanline (each of which has its own schedule of operations).
  */
-typedef struct vram_reg {
-    unsigned    coarse_x    : 5;    // Coarse-x scroll (i.e. x-coordinate of the cell along nametable).
-    unsigned    coarse_y    : 5;    // Coarse-y scroll (i.e. y-coordinate of the cell along nametable).
-    unsigned    nt_x        : 1;    // Nametable along x-direction (0: left; 1: right).
-    unsigned    nt_y        : 1;    // Nametable along y-direction (0: top; 1: bottom).
-    unsigned    fine_y      : 3;    // Fine-y scroll (i.e. y-coordinate of pixel within tile).
-    unsigned                : 1;
-} vram_reg_t;
+typedef enum line_type {
+    LINE_PRE_RENDER,
+    LINE_VISIBLE,
+    LINE_POST_RENDER,                   // The post-render scanline, and the rest of vblank after its first scanline.
+    LINE_VBLANK,                        // The first scanline of vblank.
+    N_LINE_TYPES
+} line_type_t;
 
 /**
  * @brief A sprite attribute.
@@ -95,58 +153,38 @@ typedef struct spr_attr {
 } spr_attr_t;
 
 /**
- * @brief A PPU struct that contains all data needed to emulate the PPU.
+ * @brief A PPU struct that contains all data needed to emulate the PPU. The state that is used on every
+ * dot comes first, so that it shares as few cache lines as possible.
  */
 typedef struct ppu {
 
-    /* main registers/memory */
-    
-    vram_reg_t      v;                  // Current VRAM address.
-    vram_reg_t      t;                  // Temporary VRAM address.
-    
-    unsigned        x : 3;              // Fine X scroll.
-    unsigned        w : 1;              // First or second write toggle bit.
-    unsigned          : 4;
+    /* state used on every dot */
 
-    addrspace_t     *as;                // The PPU's address space.
-    uint8_t         *vram;              // 2KB of memory.
+    int16_t         draw_x, draw_y;     // Current screen position of render.
 
-    uint8_t         bkg_color;          // The universal background color.
-    uint8_t         bkg_palette[15];    // Background palette memory.
-    uint8_t         spr_palette[12];    // Sprite palette memory.
-
-    uint8_t         oam[256];           // Object attribute memory.
-    uint8_t         oam2[32];           // Secondary OAM.
-
-    /* background latches and shift registers */
+    vram_reg_t      v;                  // Current VRAM address.
+    vram_reg_t      t;                  // Temporary VRAM address.
+    uint8_t         x;                  // Fine X scroll (0 to 7).
+    uint8_t         w;                  // First or second write toggle bit.
+    uint8_t         nmi_suppress;       // If set, then NMI will not occur for the given number of PPU cycles.
+    bool            skip;               // Set if the pixels of the current frame aren't output (other than to find sprite 0 hits).
 
+    // Background latches and shift registers.
+    uint16_t        sr_tile[2];         // Shift registers for both tile planes (index 0: low byte; index 1: high byte).
+    uint16_t        sr_attr[2];         // Shift registers for tile attribute.
     pt_entry_t      nt_latch;           // NT byte latch.
     uint8_t         attr_latch;         // Attribute byte latch.
     uint8_t         tile_latch[2];      // Tile latch (for both bit planes).
-            
-    uint16_t        sr_tile[2];         // Shift registers for both tile planes (index 0: low byte; index 1: high byte).
-    uint16_t        sr_attr[2];         // Shift registers for tile attribute.
-
-    /* oam shift registers */
-
-    uint8_t         oam_p[8][2];        // Sprite tile planes.
-    uint8_t         oam_x[8];           // Sprite x position.
-    spr_attr_t      oam_attr[8];        // Sprite attribute memory.
-
-    /* variables used during sprite evaluation */
-
-    unsigned        n   : 8;            // n-iterator for sprite evaluation.
-    unsigned        m   : 2;            // m-iterator for sprite evaluation.
-    unsigned        szc : 1;            // Set if sprite 0 is included in the current scanline.
-    unsigned        szn : 1;            // Set if sprite 0 is included in the next scanline.
-    unsigned            : 4;
 
+    // Sprite evaluation.
+    uint8_t         n;                  // n-iterator for sprite evaluation.
+    uint8_t         m;                  // m-iterator for sprite evaluation (0 to 3).
+    bool            szc;                // Set if sprite 0 is included in the current scanline.
+    bool            szn;                // Set if sprite 0 is included in the next scanline.
     uint8_t         oam2_ptr;           // Pointer to secondary OAM memory during sprite evaluation.
     uint8_t         oam_buffer;         // OAM read buffer during sprite evaluation.
     addr_t          pt_addr;            // Pattern table address of next sprite.
 
-    /* memory mapped registers (stored contiguously) */
-    
     // PPUCTRL
     union ppu_ctrl {
         struct {
@@ -188,7 +226,38 @@ typedef struct ppu {
     } status;
 
     // OAMADDR
-    uint8_t     oam_addr;
+    uint8_t         oam_addr;
+
+    const line_schedule_t   *schedule;  // The operations on each dot of each type of scanline (indexed by line_type_t).
+    void                    (*render_line)(struct ppu *ppu); // Renders a visible scanline in one pass (specialised for the current PPUMASK).
+    void                    (*skip_line)(struct ppu *ppu);   // The same, without outputting pixels (for frames that are skipped).
+    uint16_t                *out;       // Pixel output (PPU_BUFFER pixels of palette index and emphasis bits, owned by the caller; see color_convert).
+
+    // Palettes.
+    uint8_t         bkg_color;          // The universal background color.
+    uint8_t         bkg_palette[15];    // Background palette memory.
+    uint8_t         spr_palette[12];    // Sprite palette memory.
+
+    /* pattern tables and nametables */
+
+    addrspace_t     *as;                    // The PPU's address space.
+    uint32_t        page_generation;        // The generation of the address space when the pages were looked up.
+    const uint8_t   *pages[N_FETCH_PAGES];  // The host memory of each 1KB page of the pattern tables and nametables (`NULL` if not plain memory).
+    tile_cache_t    *tiles;                 // Decoded pattern tiles.
+    uint8_t         *vram;                  // 2KB of memory.
+
+    /* sprites */
+
+    uint8_t         oam[256];           // Object attribute memory.
+    uint8_t         oam2[32];           // Secondary OAM.
+
+    uint8_t         oam_p[8][2];        // Sprite tile planes.
+    uint8_t         oam_pix[8][8];      // Sprite pixels (decoded from the tile planes and flipped horizontally if necessary).
+    uint8_t         oam_x[8];           // Sprite x position.
+    spr_attr_t      oam_attr[8];        // Sprite attribute memory.
+    uint8_t         spr_line[SCREEN_WIDTH]; // The front-most opaque sprite pixel at each x-coordinate of the scanline (see SPR_PIXEL).
+
+    /* registers that are only accessed through ppu_read and ppu_write */
 
     // OAMDATA
     uint8_t     oam_data;
@@ -202,35 +271,25 @@ typedef struct ppu {
     // PPUDATA
     uint8_t     ppu_data;
 
-    /* io flags */
-
-    io_flags_t  ppucontrol_flags;
-    io_flags_t  ppustatus_flags;
-    io_flags_t  oamaddr_flags;
-    io_flags_t  oamdata_flags;
-    io_flags_t  ppuscroll_flags;
-    io_flags_t  ppuaddr_flags;
-    io_flags_t  ppudata_flags;
+    /* synchronisation with the CPU */
 
-    /* variables used for background rendering */
+    uint64_t    cycle;                  // The CPU cycle that the PPU has been rendered up to.
 
-    int16_t     draw_x, draw_y;         // Current screen position of render.
-    char        out[PPU_BUFFER];        // Pixel output (3 bytes per pixel; RGB order).
-    
     unsigned    nmi_occurred    : 1;    // Set if an NMI has already occurred for the current frame.
-    unsigned    nmi_suppress    : 2;    // If set, then NMI will not occur for the given number of PPU cycles.
     unsigned    vbl_occurred    : 1;    // Set if a vblank just occured and the screen should be redrawn.
     unsigned    odd_frame       : 1;    // Set if currently on an odd frame.
-    unsigned                    : 3;
+    unsigned    vbl_suppress    : 1;    // Set if PPUSTATUS was read just before the next cycle (which then doesn't set the VBL flag).
+    unsigned                    : 4;
 
 } ppu_t;
 
 /**
  * @brief Creates a new instance of an emulated PPU.
  * 
+ * @param out The buffer that frames are rendered into (`PPU_BUFFER` pixels), which is owned by the caller.
  * @return The new instance of the PPU.
  */
-ppu_t *ppu_create(void);
+ppu_t *ppu_create(uint16_t *out);
 
 /**
  * @brief Frees the memory associated with the given PPU, including the underlying address space.
@@ -246,6 +305,47 @@ void ppu_destroy(ppu_t *ppu);
  */
 void ppu_reset(ppu_t *ppu);
 
+/**
+ * @brief Sets the host memory that holds the program's CHR-ROM and CHR-RAM, so that the tiles in them
+ * can be decoded once and cached (until they are written to through PPUDATA).
+ * 
+ * @param ppu The PPU.
+ * @param rom The CHR-ROM (or `NULL` if there is none).
+ * @param rom_size The size of the CHR-ROM.
+ * @param ram The CHR-RAM (or `NULL` if there is none).
+ * @param ram_size The size of the CHR-RAM.
+ */
+void ppu_set_chr(ppu_t *ppu, const uint8_t *rom, size_t rom_size, const uint8_t *ram, size_t ram_size);
+
+/**
+ * @brief Renders the PPU up to the given CPU cycle (the PPU only runs when something needs to see its
+ * current state, such as an access to one of its registers).
+ * 
+ * @param ppu The PPU.
+ * @param cycle The CPU cycle to render up to.
+ */
+void ppu_sync(ppu_t *ppu, uint64_t cycle);
+
+/**
+ * @brief Reads from one of the PPU's registers, applying any side effects of the read straight away.
+ * The PPU should be synchronised with the CPU first.
+ * 
+ * @param ppu The PPU.
+ * @param reg The register (PPU_CTRL to PPU_DATA).
+ * @return The value read (write-only registers read as 0).
+ */
+uint8_t ppu_read(ppu_t *ppu, addr_t reg);
+
+/**
+ * @brief Writes to one of the PPU's registers, applying any side effects of the write straight away.
+ * The PPU should be synchronised with the CPU first.
+ * 
+ * @param ppu The PPU.
+ * @param reg The register (PPU_CTRL to PPU_DATA).
+ * @param value The value to write.
+ */
+void ppu_write(ppu_t *ppu, addr_t reg, uint8_t value);
+
 /**
  * @brief Performs rendering on a PPU for the given number of cycles.
  * 
@@ -254,4 +354,35 @@ void ppu_reset(ppu_t *ppu);
  */
 void ppu_render(ppu_t *ppu, int cycles);
 
+/**
+ * @brief Gets the number of PPU cycles until the PPU's status register may next change, or until the
+ * PPU may next generate an NMI. Rendering for up to this many cycles doesn't change anything that the
+ * CPU can observe through PPUSTATUS.
+ * 
+ * @param ppu The PPU.
+ * @return The number of PPU cycles until the next event.
+ */
+int ppu_next_event(const ppu_t *ppu);
+
+/**
+ * @brief Gets the number of PPU cycles that can be rendered before the vblank flag is next set (i.e.
+ * before the frame is completed). This may be one cycle short if the pre-render scanline is ahead.
+ * 
+ * @param ppu The PPU.
+ * @return The number of PPU cycles until the start of vblank.
+ */
+int ppu_next_vblank(const ppu_t *ppu);
+
+/**
+ * @brief Gets the number of PPU cycles that can be rendered before the PPU reaches the given dot of the
+ * given scanline (i.e. before that dot is rendered). This may be one cycle short if the pre-render
+ * scanline is ahead.
+ * 
+ * @param ppu The PPU.
+ * @param y The scanline (-1 for the pre-render scanline).
+ * @param x The dot.
+ * @return The number of PPU cycles until the dot.
+ */
+int ppu_next_dot(const ppu_t *ppu, int y, int x);
+
 #endif
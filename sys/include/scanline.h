@@ -0,0 +1,132 @@
+/**
+ * @file scanline.h
+ * @brief The loop that renders a whole visible scanline in one pass. This is included by ppu.c once for
+ * each variant, with `LINE_NAME` defined as the name of the function to generate, `LINE_MASK` defined
+ * as the PPUMASK flags that the variant is specialised for (a combination of `MASK_*` flags) and
+ * `LINE_OUTPUT` defined as whether the variant outputs pixels (it doesn't for frames that are skipped).
+ * @version 1.0
+ * @date 2022-04-09
+ */
+
+/**
+ * @brief Renders a whole visible scanline (from dot 0 to dot 340) in one pass. This has the same result
+ * as rendering each dot of the scanline (including the order of PPU memory accesses, which mappers may
+ * watch), provided that nothing else accesses the PPU during the scanline.
+ *
+ * @param ppu The PPU.
+ */
+static void LINE_NAME(ppu_t *ppu) {
+    // What is shown (the flags are constant, so the checks are folded away).
+    const unsigned mask = LINE_MASK;
+    const bool output = LINE_OUTPUT;
+    const bool rendering = mask & (MASK_BACKGROUND | MASK_SPRITES);
+    const bool background = output && (mask & MASK_BACKGROUND);
+    const bool sprites = output && (mask & MASK_SPRITES);
+
+    // The color of each background pixel (indexed by its palette and value).
+    uint8_t table[16];
+    if (output) {
+        for (int i = 0; i < 16; i++) {
+            table[i] = (i & 0x03) ? ppu->bkg_palette[i - 1] : ppu->bkg_color;
+        }
+    }
+
+    // The background pixels of the scanline (palette in bits 2-3 and value in bits 0-1), starting with the
+    // two tiles that are already in the shift registers, and offset by the fine x scroll.
+    uint8_t pixels[SCREEN_WIDTH + 16];
+    if (background) {
+        for (int i = 0; i < 16; i++) {
+            const uint16_t sr_mask = 0x8000 >> i;
+            pixels[i] = (((ppu->sr_attr[1] & sr_mask) > 0) << 3) | (((ppu->sr_attr[0] & sr_mask) > 0) << 2)
+                | (((ppu->sr_tile[1] & sr_mask) > 0) << 1) | ((ppu->sr_tile[0] & sr_mask) > 0);
+        }
+    }
+
+    // Draw each tile of the scanline and fetch the tile after next.
+    for (int tile = 0; tile < SCREEN_WIDTH / 8; tile++) {
+        if (output) {
+            const int screen_x = tile * 8;
+            const uint8_t *bkg = &pixels[screen_x + ppu->x];
+
+            // The background may be hidden in the leftmost 8 pixels.
+            const uint8_t clip = tile == 0 && !(mask & MASK_BKG_LEFT) ? 0x00 : 0x0F;
+            uint8_t colors[8];
+            if (background) {
+                resolve_bkg(table, bkg, clip, colors);
+            }
+            else {
+                memset(colors, table[0], sizeof(colors));
+            }
+
+            // Draw any sprite pixels over the background (sprites may also be hidden in the leftmost 8 pixels).
+            if (sprites && (tile > 0 || (mask & MASK_SPR_LEFT))) {
+                uint64_t spr;
+                memcpy(&spr, &ppu->spr_line[screen_x], sizeof(spr));
+                if (spr != 0) {
+                    for (int i = 0; i < 8; i++) {
+                        colors[i] = merge_sprite(ppu, screen_x + i, background && (bkg[i] & clip & 0x03) != 0, colors[i]);
+                    }
+                }
+            }
+            put_pixels(ppu, screen_x, colors);
+        }
+
+        // The pixels of the tile are only needed if the background is shown.
+        if (background) {
+            uint8_t *next = &pixels[(tile + 2) * 8];
+            fetch_tile(ppu, next);
+            for (int i = 0; i < 8; i++) {
+                next[i] |= ppu->attr_latch << 2;
+            }
+        }
+        else {
+            fetch_tile(ppu, NULL);
+        }
+        if (rendering) {
+            if (tile == SCREEN_WIDTH / 8 - 1) {
+                inc_vram_y(&ppu->v);
+            }
+            else {
+                inc_vram_x(&ppu->v);
+            }
+        }
+    }
+
+    // Sprite evaluation for the next scanline (this only accesses OAM).
+    evaluate_sprites(ppu);
+
+    // Reset x.
+    if (rendering) {
+        ppu->v = (ppu->v & ~VRAM_HORIZONTAL) | (ppu->t & VRAM_HORIZONTAL);
+    }
+
+    // Fetch the sprites for the next scanline (with the garbage NT and AT fetches in between). The line
+    // buffer is still drawn if sprites are hidden, as they may be shown again before the next scanline.
+    for (int i = 0; i < 8; i++) {
+        load_sprite(ppu, i);
+        ppu->nt_latch = fetch_nt_byte(ppu);
+        ppu->attr_latch = fetch_at_byte(ppu);
+        fetch_row(ppu, ppu->pt_addr, ppu->oam_attr[i].flip_h, ppu->oam_p[i], ppu->oam_pix[i]);
+        compose_sprite(ppu, i);
+    }
+    ppu->oam_addr = 0;
+    ppu->szc = ppu->szn;
+
+    // Fetch the first two tiles of the next scanline.
+    for (int tile = 0; tile < 2; tile++) {
+        fetch_tile(ppu, NULL);
+        if (rendering) {
+            inc_vram_x(&ppu->v);
+        }
+    }
+
+    // Unused NT fetches.
+    ppu->nt_latch = fetch_nt_byte(ppu);
+    ppu->nt_latch = fetch_nt_byte(ppu);
+
+    ppu->draw_x = 0;
+}
+
+#undef LINE_NAME
+#undef LINE_MASK
+#undef LINE_OUTPUT
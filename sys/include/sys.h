@@ -10,6 +10,9 @@
 #define F_CPU_NTSC  1789773
 #define F_CPU_PAL   1662607
 
+#define FRAME_SKIP_AUTO -1      // Skip frames while emulation is behind real time (see `frame_skip`).
+#define FRAME_SKIP_MAX  8       // The most frames that are skipped in a row in FRAME_SKIP_AUTO mode.
+
 typedef enum tv_sys {
     TV_SYS_NTSC = 0x01,
     TV_SYS_PAL = 0x02
@@ -26,7 +29,8 @@ typedef struct handlers {
     void        (*after_execute)(operation_t ins);      // Run after an instruction is executed.
 
     /* ppu handlers */
-    void        (*update_screen)(const char *data);     // Flushes the PPU data to the screen.
+    void        (*update_screen)(const uint16_t *data); // Flushes the PPU data to the screen (see color_convert). This isn't called for frames that are skipped.
+    int         frame_skip;                             // The number of frames skipped after each frame that is drawn (or FRAME_SKIP_AUTO).
     
     /* input handlers */
     uint8_t     (*poll_input_p1)(void);                 // Polls for input for player 1.
@@ -0,0 +1,99 @@
+#ifndef TILES_H
+#define TILES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TILE_SIZE       16      // The size of a pattern tile in CHR memory (two 8x8 bit planes).
+#define TILE_ROWS       8       // The number of rows in a pattern tile.
+#define TILE_REGIONS    2       // The number of areas of CHR memory that can be cached (CHR-ROM and CHR-RAM).
+
+/**
+ * @brief A pattern tile decoded into rows of pixels (one pixel value from 0 to 3 per byte), both as it
+ * is stored and flipped horizontally.
+ */
+typedef struct tile {
+
+    uint8_t     rows[2][TILE_ROWS][8];  // The rows of the tile (index 0: as stored; index 1: flipped horizontally).
+
+} tile_t;
+
+/**
+ * @brief An area of CHR memory and the tiles decoded from it.
+ */
+typedef struct tile_region {
+
+    const uint8_t   *chr;       // The start of the CHR memory (or `NULL` if unused).
+    size_t          n_tiles;    // The number of tiles in the CHR memory.
+    tile_t          *tiles;     // The decoded tiles.
+    bool            *valid;     // Set for each tile that has been decoded (and not written to since).
+
+} tile_region_t;
+
+/**
+ * @brief A cache of decoded pattern tiles. Tiles are keyed by the host memory that they are stored in,
+ * so they stay valid when CHR banks are switched, and are only decoded again when they are written to.
+ */
+typedef struct tile_cache {
+
+    tile_region_t   regions[TILE_REGIONS];
+
+} tile_cache_t;
+
+/**
+ * @brief Creates an empty tile cache.
+ *
+ * @return The tile cache.
+ */
+tile_cache_t *tc_create(void);
+
+/**
+ * @brief Destroys the given tile cache.
+ *
+ * @param tc The tile cache to destroy.
+ */
+void tc_destroy(tile_cache_t *tc);
+
+/**
+ * @brief Removes all tiles from the cache and sets the host memory that one of the areas of CHR memory
+ * is stored in.
+ *
+ * @param tc The tile cache.
+ * @param region The area of CHR memory (from 0 to `TILE_REGIONS` - 1).
+ * @param chr The start of the CHR memory (or `NULL` if there is none).
+ * @param size The size of the CHR memory.
+ */
+void tc_reset(tile_cache_t *tc, int region, const uint8_t *chr, size_t size);
+
+/**
+ * @brief Looks up a row of a tile, decoding the tile if it isn't in the cache.
+ *
+ * @param tc The tile cache.
+ * @param row The host memory of the row's low bit plane.
+ * @param flip Set if the row should be flipped horizontally.
+ * @return The pixels of the row, or `NULL` if the row isn't in CHR memory (in which case it should be
+ * decoded with tc_decode).
+ */
+const uint8_t *tc_row(tile_cache_t *tc, const uint8_t *row, bool flip);
+
+/**
+ * @brief Removes the tile that contains the given byte of CHR memory from the cache (as it has been
+ * written to).
+ *
+ * @param tc The tile cache.
+ * @param target The host memory that was written to.
+ */
+void tc_invalidate(tile_cache_t *tc, const uint8_t *target);
+
+/**
+ * @brief Decodes a row of a tile from its bit planes.
+ *
+ * @param low The low bit plane of the row.
+ * @param high The high bit plane of the row.
+ * @param flip Set if the row should be flipped horizontally.
+ * @param pixels The pixels of the row (8 bytes).
+ */
+void tc_decode(uint8_t low, uint8_t high, bool flip, uint8_t *pixels);
+
+#endif
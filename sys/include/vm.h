@@ -1,6 +1,7 @@
 #ifndef VM_H
 #define VM_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 #define AS_READ     0x01
@@ -13,31 +14,23 @@ typedef uint16_t addr_t;
 
 /**
  * @brief An area of addressable memory that maps a virtual memory address to a "physical" memory
- * location (i.e. an emulator virtual memory address).
+ * location (i.e. an emulator virtual memory address). The address space is stored as a table of
+ * 256 byte pages so that resolving an address is a single lookup.
  */
 typedef struct addrspace addrspace_t;
 
 /**
- * @brief A resolve rule (occurs whenever a virtual address is resolved).
+ * @brief An I/O handler (occurs whenever an address that the handler is attached to is read from
+ * or written to).
  * 
- * @param as The address space.
- * @param vaddr The virtual address that is being resolved.
- * @param target The current target address (can be remapped via the return value).
- * @param offset The offset of the virtual address from the start of the segment.
- * @return The resolved physical/emulator address.
- */
-typedef uint8_t *(*resolve_rule_t)(const addrspace_t *as, addr_t vaddr, uint8_t *target, size_t offset);
-
-/**
- * @brief An update rule (occurs whenever an address is read from or written to).
- * 
- * @param as The address space that was updated.
- * @param vaddr The virtual address that was updated.
- * @param value The value at the address before the update.
- * @param mode Whether the update was a read or a write.
+ * @param as The address space that was accessed.
+ * @param vaddr The virtual address that was accessed (before any mirrors are applied).
+ * @param value The value at the address before the access (or the value being written).
+ * @param mode Whether the access was a read or a write.
+ * @param data The data that was provided when the handler was attached.
  * @return The value that gets read, or the value to write to the virtual address.
  */
-typedef uint8_t (*update_rule_t)(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode);
+typedef uint8_t (*io_handler_t)(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
 
 /**
  * @brief Creates an empty address space.
@@ -70,7 +63,8 @@ void as_add_segment(addrspace_t *as, addr_t start, size_t size, uint8_t *target,
  * @brief Adds a mirror to the address space that causes a segment of memory to link to another
  * segment of memory within the address space. When resolving virtual addresses, the address
  * is first passed through all mirrors before resolving the address to a segment. Mirrors are
- * evaluated once in the order that they are defined.
+ * evaluated once in the order that they are defined (they are folded into the page table when
+ * added, so mirrors have no cost when resolving an address).
  * 
  * @param as The address space to modify.
  * @param start The start of the mirror.
@@ -95,22 +89,33 @@ void as_add_mirror(addrspace_t *as, addr_t start, addr_t end, size_t repeat, add
 void as_modify_segments(addrspace_t *as, addr_t start, addr_t end, uint8_t *target, uint8_t mode);
 
 /**
- * @brief Sets the resolve rule that is called whenever a virtual address in the given address
- * space is resolved into a "physical" address in the emulator's virtual address space.
+ * @brief Maps a bank of memory into the given address space, replacing whatever the range of
+ * addresses pointed to beforehand. This is intended to be called whenever a bank register is
+ * changed; if the range is already mapped to the target with the same permissions, then the
+ * address space is left untouched, so it is cheap to remap banks that haven't changed.
  * 
- * @param as The address space.
- * @param rule The resolve rule (or `NULL` to clear the rule).
+ * @param as The address space to modify.
+ * @param start The start address.
+ * @param size The size of the bank.
+ * @param target The target memory that the bank points to (or `NULL` to unmap the range).
+ * @param mode The read/write permissions of the bank.
  */
-void as_set_resolve_rule(addrspace_t *as, resolve_rule_t rule);
+void as_map_bank(addrspace_t *as, addr_t start, size_t size, uint8_t *target, uint8_t mode);
 
 /**
- * @brief Sets the update rule that is called whenever a memory address in the given address
- * space is accessed (i.e. read from or written to).
+ * @brief Attaches an I/O handler to a range of addresses in the given address space, which is
+ * called whenever an address in the range is accessed with one of the given modes. Handlers that
+ * are attached to the same address are called in the order that they were attached. Addresses
+ * that don't have any handlers attached are accessed directly.
  * 
  * @param as The address space.
- * @param rule The update rule (or `NULL` to clear the rule).
+ * @param start The start of the range.
+ * @param end The end of the range (inclusive).
+ * @param handler The handler.
+ * @param data Additional data that is passed to the handler.
+ * @param mode The accesses that the handler is called for (reads and/or writes).
  */
-void as_set_update_rule(addrspace_t *as, update_rule_t rule);
+void as_add_handler(addrspace_t *as, addr_t start, addr_t end, io_handler_t handler, void *data, uint8_t mode);
 
 /**
  * @brief Reads the value at the memory location corresponding to the given virtual address. If
@@ -135,15 +140,63 @@ uint8_t as_read(const addrspace_t *as, addr_t vaddr);
 void as_write(const addrspace_t *as, addr_t vaddr, uint8_t value);
 
 /**
- * @brief Traverses the address space, copying any memory found into a new array. Any memory that is
- * not present in the address space will not be filled into the array.
+ * @brief Gets the generation of the given address space, which changes whenever the address space
+ * is modified (i.e. segments, mirrors or handlers are added, or a different bank is mapped). This
+ * can be used to check whether anything derived from the mapping of the address space is stale.
+ * 
+ * @param as The address space.
+ * @return The generation of the address space.
+ */
+uint32_t as_generation(const addrspace_t *as);
+
+/**
+ * @brief Gets the host memory that a range of virtual addresses maps to, so that the range can be
+ * accessed directly. The span ends at the first address that isn't contiguous in host memory, or
+ * that has to be accessed via `as_read`/`as_write` (i.e. memory without the given permissions,
+ * or a page with I/O handlers for the given accesses).
+ * 
+ * @param as The address space.
+ * @param vaddr The virtual address at the start of the span.
+ * @param nbytes The maximum number of bytes in the span.
+ * @param mode The accesses that will be made to the span (reads and/or writes).
+ * @param size Set to the number of bytes in the span (1 if the result is `NULL`).
+ * @return The host memory of the span, or `NULL` if the first address cannot be accessed directly.
+ */
+uint8_t *as_span(const addrspace_t *as, addr_t vaddr, size_t nbytes, uint8_t mode, size_t *size);
+
+/**
+ * @brief Reads a block of memory from the address space. This has the same result as calling
+ * `as_read` for each address, except that spans of plain memory are copied in bulk.
+ * 
+ * @param as The address space.
+ * @param start The virtual address to start at.
+ * @param dest The buffer to read into.
+ * @param nbytes The number of bytes to read (the block must not extend past $FFFF).
+ */
+void as_read_block(const addrspace_t *as, addr_t start, uint8_t *dest, size_t nbytes);
+
+/**
+ * @brief Writes a block of memory to the address space. This has the same result as calling
+ * `as_write` for each address, except that spans of plain memory are copied in bulk.
+ * 
+ * @param as The address space.
+ * @param start The virtual address to start at.
+ * @param src The buffer to write from.
+ * @param nbytes The number of bytes to write (the block must not extend past $FFFF).
+ */
+void as_write_block(const addrspace_t *as, addr_t start, const uint8_t *src, size_t nbytes);
+
+/**
+ * @brief Traverses the address space, copying any readable memory found into the given buffer
+ * without invoking any I/O handlers (so it can be used to inspect memory without side effects).
+ * Any memory that is not present in the address space will not be filled into the buffer.
  * 
  * @param as The address space to traverse.
  * @param start The virtual address to start at.
+ * @param dest The buffer corresponding to each byte of the traversal.
  * @param nbytes The number of bytes to traverse.
- * @return An array corresponding to each byte of the traversal.
  */
-uint8_t *as_traverse(const addrspace_t *as, addr_t start, size_t nbytes);
+void as_traverse(const addrspace_t *as, addr_t start, uint8_t *dest, size_t nbytes);
 
 /**
  * @brief Prints the address space, showing virtual memory ranges and the physical memory location
@@ -15,9 +15,9 @@
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_chr(mapper_t *mapper, prog_t *prog);
 
 const mapper_t ines003 = {
     .init = init
@@ -30,9 +30,6 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_chr = map_chr;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
@@ -51,12 +48,7 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     }
 
     // CHR-ROM/RAM (single switchable 8KB bank).
-    if (prog->chr_rom != NULL) {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-    }
-    else {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-    }
+    map_chr(mapper, prog);
 
     // Name tables are fixed.
     as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
@@ -72,9 +64,12 @@ static void insert(mapper_t *mapper, prog_t *prog) {
         as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram + NT_SIZE, AS_READ | AS_WRITE);
         as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram + NT_SIZE, AS_READ | AS_WRITE);
     }
+
+    // Monitor writes to the bank select register.
+    mapper_watch(mapper, mapper->cpuas, PRG_ROM_START, 0xFFFF, AS_WRITE);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (!write)
         return;
     if (as != mapper->cpuas)
@@ -84,8 +79,15 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
     
     // Bank 0 gets set to the lower 2 bits of the value given.
     mapper->banks[0] = value & 0x03;
+    map_chr(mapper, prog);
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    return target + mapper->banks[0] * CHR_BANK_SIZE; // Offset based on value in bank register.
+static void map_chr(mapper_t *mapper, prog_t *prog) {
+    const size_t offset = mapper->banks[0] * CHR_BANK_SIZE; // Offset based on value in bank register.
+    if (prog->chr_rom != NULL) {
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom + offset, AS_READ);
+    }
+    else {
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, prog->chr_ram + offset, AS_READ | AS_WRITE);
+    }
 }
@@ -24,10 +24,10 @@
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_prg(mapper_t *mapper, prog_t *prog);
+static void map_chr(mapper_t *mapper, prog_t *prog);
 
 const mapper_t ines034 = {
     .init = init
@@ -40,10 +40,6 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_prg = map_prg;
-    mapper->map_chr = map_chr;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
@@ -64,19 +60,11 @@ static void insert(mapper_t *mapper, prog_t *prog) {
         as_add_segment(mapper->cpuas, PRG_RAM, PRG_RAM_SIZE, prog->prg_ram, AS_READ | AS_WRITE);
     }
 
-    // Single fixed 32KB PRG-ROM bank.
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
+    // Single switchable 32KB PRG-ROM bank.
+    map_prg(mapper, prog);
 
-    // Map each CHR bank to the start of the CHR-ROM (or CHR-RAM if it is used).
-    if (prog->chr_rom != NULL) {
-        // NINA-001 uses two switchable 4KB CHR-ROM banks.
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-        as_add_segment(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-    }
-    else {
-        // BNROM uses a single fixed 8KB CHR-RAM bank.
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE * 2, prog->chr_ram, AS_READ | AS_WRITE);
-    }
+    // CHR banks (NINA-001 uses two switchable 4KB CHR-ROM banks, BNROM uses a single 8KB CHR-RAM bank).
+    map_chr(mapper, prog);
 
     // Name tables.
     as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
@@ -95,9 +83,12 @@ static void insert(mapper_t *mapper, prog_t *prog) {
 
     // Record which mapper is being used in one of the 8-bit registers.
     mapper->r8[0] = bnrom;
+
+    // Monitor writes to the bank select registers (NINA-001 registers are at $7FFD-$7FFF).
+    mapper_watch(mapper, mapper->cpuas, 0x7FFD, 0xFFFF, AS_WRITE);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (!write)
         return;
     if (as != mapper->cpuas)
@@ -105,23 +96,36 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
 
     if (vaddr == 0x7FFD) {
         mapper->banks[PRG_SELECT] = value & 0x01;
+        map_prg(mapper, prog);
     }
     else if (vaddr == 0x7FFE) {
         mapper->banks[CHR_SELECT0] = value & 0x0F;
+        map_chr(mapper, prog);
     }
     else if (vaddr == 0x7FFF) {
         mapper->banks[CHR_SELECT1] = value & 0x0F;
+        map_chr(mapper, prog);
     }
     else if (vaddr >= PRG_ROM_START) {
         mapper->banks[PRG_SELECT] = value & 0x03;
+        map_prg(mapper, prog);
     }
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    return target + mapper->banks[PRG_SELECT] * PRG_BANK_SIZE;
+static void map_prg(mapper_t *mapper, prog_t *prog) {
+    as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + mapper->banks[PRG_SELECT] * PRG_BANK_SIZE, AS_READ);
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    uint8_t bank = vaddr < CHR_BANK1 ? CHR_SELECT0 : CHR_SELECT1;
-    return target + mapper->banks[bank] * CHR_BANK_SIZE;
+static void map_chr(mapper_t *mapper, prog_t *prog) {
+    const size_t offset0 = mapper->banks[CHR_SELECT0] * CHR_BANK_SIZE;
+    const size_t offset1 = mapper->banks[CHR_SELECT1] * CHR_BANK_SIZE;
+    if (prog->chr_rom != NULL) {
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom + offset0, AS_READ);
+        as_map_bank(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom + offset1, AS_READ);
+    }
+    else {
+        // CHR-RAM is a single 8KB bank, so the second bank starts halfway through it.
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, prog->chr_ram + offset0, AS_READ | AS_WRITE);
+        as_map_bank(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, prog->chr_ram + CHR_BANK_SIZE + offset1, AS_READ | AS_WRITE);
+    }
 }
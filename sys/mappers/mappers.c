@@ -1,4 +1,5 @@
 #include <mappers.h>
+#include <limits.h>
 #include <stdlib.h>
 
 #define N_MAPPERS 256
@@ -21,8 +22,13 @@ static inline void init_mappers(void) {
     // ...
 }
 
-static uint8_t *default_map(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    return target; // Default mapping behaviour where banks are fixed.
+static uint8_t watch_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    mapper_t *mapper = (mapper_t*)data;
+    if ((mode & AS_WRITE) && as == mapper->cpuas && mapper->sync != NULL) {
+        mapper->sync();
+    }
+    mapper->monitor(mapper, mapper->prog, as, vaddr, value, (mode & AS_WRITE) > 0);
+    return value; // The mapper only monitors the bus, so the value isn't changed.
 }
 
 mapper_t *get_mapper(int number) {
@@ -48,15 +54,11 @@ mapper_t *mapper_create(void) {
     // Allocate memory for the mapper.
     mapper_t *mapper = malloc(sizeof(struct mapper));
     
-    // Mapper functions default to fixed banks if the mapper doesn't assign them to anything.
-    mapper->map_ram = default_map;
-    mapper->map_prg = default_map;
-    mapper->map_chr = default_map;
-    mapper->map_nts = default_map;
-
     // Additional functions which default to not changing anything.
     mapper->cycle = NULL;
     mapper->mix = NULL;
+    mapper->next_irq = NULL;
+    mapper->sync = NULL;
     
     // By default, the mapper contains no bank registers and uses no additional data.
     mapper->banks = NULL;
@@ -64,6 +66,7 @@ mapper_t *mapper_create(void) {
 
     // Ensure that IRQ flag is clear.
     mapper->irq = false;
+    mapper->irq_armed = false;
     
     return mapper;
 }
@@ -83,11 +86,12 @@ void mapper_destroy(mapper_t *mapper) {
 }
 
 void mapper_insert(mapper_t *mapper, prog_t *prog) {
+    mapper->prog = prog;
     mapper->insert(mapper, prog);
 }
 
-void mapper_monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
-    mapper->monitor(mapper, prog, as, vaddr, value, write);
+void mapper_watch(mapper_t *mapper, addrspace_t *as, addr_t start, addr_t end, uint8_t mode) {
+    as_add_handler(as, start, end, watch_handler, mapper, mode);
 }
 
 void mapper_cycle(mapper_t *mapper, prog_t *prog, int cycles) {
@@ -97,6 +101,14 @@ void mapper_cycle(mapper_t *mapper, prog_t *prog, int cycles) {
     }
 }
 
+int mapper_next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu) {
+    if (mapper->next_irq != NULL)
+        return mapper->next_irq(mapper, prog, ppu);
+
+    // Without a deadline, a mapper that is clocked or whose IRQ is armed has to be looked at after every instruction.
+    return mapper->cycle != NULL || mapper->irq_armed ? 0 : INT_MAX;
+}
+
 float mapper_mix(mapper_t *mapper, prog_t *prog, float input) {
     // Default to simply not changing the mixer output.
     return mapper->mix != NULL ? mapper->mix(mapper, prog, input) : input;
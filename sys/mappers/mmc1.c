@@ -36,12 +36,12 @@ struct mmc1_data {
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
-static uint8_t *map_ram(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_ram(mapper_t *mapper, prog_t *prog);
+static void map_prg(mapper_t *mapper, prog_t *prog);
+static void map_chr(mapper_t *mapper, prog_t *prog);
+static void map_nts(mapper_t *mapper, prog_t *prog);
 
 const mapper_t mmc1 = {
     .init = init
@@ -54,12 +54,6 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_ram = map_ram;
-    mapper->map_prg = map_prg;
-    mapper->map_chr = map_chr;
-    mapper->map_nts = map_nts;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
@@ -82,27 +76,6 @@ static mapper_t *init(void) {
 static void insert(mapper_t *mapper, prog_t *prog) {
     // Switchable 8KB of PRG-RAM (if used; max 32KB).
     prog->prg_ram = malloc(N_RAM_BANKS * PRG_RAM_SIZE * sizeof(uint8_t));
-    as_add_segment(mapper->cpuas, PRG_RAM, PRG_RAM_SIZE, prog->prg_ram, AS_READ | AS_WRITE);
-    
-    // Map each PRG bank to the start of the PRG-ROM.
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
-    as_add_segment(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
-
-    // Map each CHR bank to the start of the CHR-ROM (or CHR-RAM if it is used).
-    if (prog->chr_rom != NULL) {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-        as_add_segment(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-    }
-    else {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-        as_add_segment(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-    }
-
-    // Map each nametable to the start of VRAM.
-    as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE1, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram, AS_READ | AS_WRITE); 
-    as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
 
     // Determine mask used to determine CHR bank number (cached for efficiency).
     uint8_t mask;
@@ -117,9 +90,18 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     else
         mask = 0x1F;
     ((struct mmc1_data*)mapper->data)->chr_mask = mask;
+
+    // Map the initial banks.
+    map_ram(mapper, prog);
+    map_prg(mapper, prog);
+    map_chr(mapper, prog);
+    map_nts(mapper, prog);
+
+    // Monitor writes to the shift register.
+    mapper_watch(mapper, mapper->cpuas, PRG_ROM_START, 0xFFFF, AS_WRITE);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (!write)
         return;
     if (as != mapper->cpuas)
@@ -166,89 +148,90 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                     }
                 }
             }
+
+            // Remap the banks using the new register values.
+            map_ram(mapper, prog);
+            map_prg(mapper, prog);
+            map_chr(mapper, prog);
+            map_nts(mapper, prog);
         }
     }
 }
 
-static uint8_t *map_ram(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_ram(mapper_t *mapper, prog_t *prog) {
     struct mmc1_data *data = (struct mmc1_data*)mapper->data;
     const uint8_t bank = data->prg_ram_bank;
-    return target + bank * PRG_RAM_SIZE;
+    as_map_bank(mapper->cpuas, PRG_RAM, PRG_RAM_SIZE, prog->prg_ram + bank * PRG_RAM_SIZE, AS_READ | AS_WRITE);
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_prg(mapper_t *mapper, prog_t *prog) {
     const uint8_t mode = (mapper->banks[0] >> 2) & 0x03;
     const uint8_t bank = mapper->banks[3] & 0x0F;
 
+    // Bit 4 of the bank register selects the 256KB half of PRG-ROM.
+    uint8_t *target = (uint8_t*)prog->prg_rom + (mapper->banks[3] & 0x10) * PRG_BANK_SIZE;
+
     if (mode == 2) {
         // Fix first bank, switch second bank.
-        if (vaddr >= PRG_BANK1) {
-            target += bank * PRG_BANK_SIZE;
-        }
+        as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, target, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, target + bank * PRG_BANK_SIZE, AS_READ);
     }
     else if (mode == 3) {
         // Fix second bank, switch first bank.
-        if (vaddr < PRG_BANK1) {
-            target += bank * PRG_BANK_SIZE;
-        }
-        else {
-            target += ((N_PRG_BANKS(prog, PRG_BANK_SIZE) - 1) & 0x0F) * PRG_BANK_SIZE;
-        }
+        as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, target + bank * PRG_BANK_SIZE, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, target + ((N_PRG_BANKS(prog, PRG_BANK_SIZE) - 1) & 0x0F) * PRG_BANK_SIZE, AS_READ);
     }
     else {
         // Switch entire 32KB bank (ignore lower bit of bank number).
-        uint8_t *start = target - offset;
-        offset = vaddr - PRG_BANK0; // Both banks are needed for offset.
-        target = start + (bank & 0x0E) * PRG_BANK_SIZE + offset;
+        as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE * 2, target + (bank & 0x0E) * PRG_BANK_SIZE, AS_READ);
     }
-
-    return target + (mapper->banks[3] & 0x10) * PRG_BANK_SIZE;
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_chr(mapper_t *mapper, prog_t *prog) {
     struct mmc1_data *data = (struct mmc1_data*)mapper->data;
     const uint8_t mask = data->chr_mask;
 
+    // Map CHR-ROM (or CHR-RAM if it is used).
+    uint8_t *target = prog->chr_rom != NULL ? (uint8_t*)prog->chr_rom : prog->chr_ram;
+    const uint8_t perms = prog->chr_rom != NULL ? AS_READ : AS_READ | AS_WRITE;
+
     // Switch bank depending on mode.
     uint8_t mode = (mapper->banks[0] >> 4) & 0x01;
     if (mode == 1) {
         // Two separate 4KB banks.
-        uint8_t bank = (vaddr >= CHR_BANK1 ? mapper->banks[2] : mapper->banks[1]) & mask;
-        target += bank * CHR_BANK_SIZE;
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, target + (mapper->banks[1] & mask) * CHR_BANK_SIZE, perms);
+        as_map_bank(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, target + (mapper->banks[2] & mask) * CHR_BANK_SIZE, perms);
     }
     else {
         // One combined 8KB bank.
-        uint8_t *start = target - offset;
-        offset = vaddr - CHR_BANK0; // Both banks are needed for offset.
-        target = start + (mapper->banks[1] & ~0x01) * CHR_BANK_SIZE + offset;
+        as_map_bank(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE * 2, target + (mapper->banks[1] & ~0x01) * CHR_BANK_SIZE, perms);
     }
-
-    return target;
 }
 
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_nts(mapper_t *mapper, prog_t *prog) {
     const bool mirror = (mapper->banks[0] & 0x02) > 0;
     const bool hz = (mapper->banks[0] & 0x01) > 0;
-    const uint8_t nt = NT(vaddr);
 
-    if (!mirror) {
-        // One-screen (upper bank if bit 0 is set).
-        if (hz) {
-            target += NT_SIZE;
+    for (int nt = 0; nt < 4; nt++) {
+        uint8_t *target = mapper->vram;
+        if (!mirror) {
+            // One-screen (upper bank if bit 0 is set).
+            if (hz) {
+                target += NT_SIZE;
+            }
         }
-    }
-    else if (hz) {
-        // Horizontal mirroring.
-        if (nt == 2 || nt == 3) {
-            target += NT_SIZE;
+        else if (hz) {
+            // Horizontal mirroring.
+            if (nt == 2 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
-    }
-    else {
-        // Vertical mirroring.
-        if (nt == 1 || nt == 3) {
-            target += NT_SIZE;
+        else {
+            // Vertical mirroring.
+            if (nt == 1 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
+        as_map_bank(mapper->ppuas, NAMETABLE0 + nt * NT_SIZE, NT_SIZE, target, AS_READ | AS_WRITE);
     }
-
-    return target;
 }
@@ -31,11 +31,11 @@
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_prg(mapper_t *mapper, prog_t *prog);
+static void map_chr(mapper_t *mapper, prog_t *prog);
+static void map_nts(mapper_t *mapper, prog_t *prog);
 
 const mapper_t mmc2 = {
     .init = init
@@ -48,11 +48,6 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_prg = map_prg;
-    mapper->map_chr = map_chr;
-    mapper->map_nts = map_nts;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
@@ -68,74 +63,82 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     as_add_segment(mapper->cpuas, PRG_RAM, PRG_RAM_SIZE, prog->prg_ram, AS_READ | AS_WRITE);
     
     // Single 8KB switchable PRG-ROM bank.
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
+    map_prg(mapper, prog);
 
     // Three 8KB PRG-ROM banks fixed to the last 3 banks.
     as_add_segment(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + ((N_PRG_BANKS(prog, PRG_BANK_SIZE) - 3) * PRG_BANK_SIZE), AS_READ);
     as_add_segment(mapper->cpuas, PRG_BANK2, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + ((N_PRG_BANKS(prog, PRG_BANK_SIZE) - 2) * PRG_BANK_SIZE), AS_READ);
     as_add_segment(mapper->cpuas, PRG_BANK3, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + ((N_PRG_BANKS(prog, PRG_BANK_SIZE) - 1) * PRG_BANK_SIZE), AS_READ);
 
-    // Map each CHR bank to the start of the CHR-ROM (or CHR-RAM if it is used).
-    if (prog->chr_rom != NULL) {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-        as_add_segment(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-    }
-    else {
-        as_add_segment(mapper->ppuas, CHR_BANK0, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-        as_add_segment(mapper->ppuas, CHR_BANK1, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-    }
+    // Two 4KB switchable CHR banks (selected by the latches).
+    map_chr(mapper, prog);
 
-    // Map each nametable to the start of VRAM.
-    as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE1, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram, AS_READ | AS_WRITE); 
-    as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
+    // Nametables.
+    map_nts(mapper, prog);
+
+    // Monitor writes to the bank select registers and reads of CHR memory (which update the latches).
+    mapper_watch(mapper, mapper->cpuas, 0xA000, 0xFFFF, AS_WRITE);
+    mapper_watch(mapper, mapper->ppuas, CHR_BANK0, NAMETABLE0 - 1, AS_READ);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (write && as == mapper->cpuas && vaddr >= 0xA000) {
         // Update the appropriate bank register.
-        mapper->banks[(vaddr >> 12) - 0x0A] = value;
+        const uint8_t reg = (vaddr >> 12) - 0x0A;
+        mapper->banks[reg] = value;
+        if (reg == 0) {
+            map_prg(mapper, prog);
+        }
+        else if (reg < 5) {
+            map_chr(mapper, prog);
+        }
+        else {
+            map_nts(mapper, prog);
+        }
     }
     else if (!write && as == mapper->ppuas && vaddr < NAMETABLE0) {
         // Update the value of the appropriate latch (if required).
         uint8_t pt = (vaddr >> 12) & 0x01;
         uint8_t tile = (vaddr >> 4) & 0xFF;
-        if (tile == 0xFD || tile == 0xFE) {
+        if ((tile == 0xFD || tile == 0xFE) && mapper->r8[pt] != tile) {
             mapper->r8[pt] = tile;
+            map_chr(mapper, prog);
         }
     }
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_prg(mapper_t *mapper, prog_t *prog) {
     // Only the first bank is switchable.
-    if (vaddr < PRG_BANK1) {
-        target += (mapper->banks[0] & 0x0F) * PRG_BANK_SIZE;
-    }
-
-    return target;
+    as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + (mapper->banks[0] & 0x0F) * PRG_BANK_SIZE, AS_READ);
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    uint8_t pt = (vaddr >> 12) & 0x01;
-    uint8_t reg = 1 + 2 * pt + (mapper->r8[pt] - 0xFD);
-    target += (mapper->banks[reg] & 0x1F) * CHR_BANK_SIZE;
-    return target;
+static void map_chr(mapper_t *mapper, prog_t *prog) {
+    // Map CHR-ROM (or CHR-RAM if it is used).
+    uint8_t *target = prog->chr_rom != NULL ? (uint8_t*)prog->chr_rom : prog->chr_ram;
+    const uint8_t perms = prog->chr_rom != NULL ? AS_READ : AS_READ | AS_WRITE;
+
+    // Each pattern table uses the bank register selected by its latch.
+    for (int pt = 0; pt < 2; pt++) {
+        uint8_t reg = 1 + 2 * pt + (mapper->r8[pt] - 0xFD);
+        as_map_bank(mapper->ppuas, CHR_BANK0 + pt * CHR_BANK_SIZE, CHR_BANK_SIZE, target + (mapper->banks[reg] & 0x1F) * CHR_BANK_SIZE, perms);
+    }
 }
 
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    uint8_t nt = NT(vaddr);
-    if ((mapper->banks[5] & 0x01) > 0) {
-        // Horizontal mirroring.
-        if (nt == 2 || nt == 3) {
-            target += NT_SIZE;
+static void map_nts(mapper_t *mapper, prog_t *prog) {
+    for (int nt = 0; nt < 4; nt++) {
+        uint8_t *target = mapper->vram;
+        if ((mapper->banks[5] & 0x01) > 0) {
+            // Horizontal mirroring.
+            if (nt == 2 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
-    }
-    else {
-        // Vertical mirroring.
-        if (nt == 1 || nt == 3) {
-            target += NT_SIZE;
+        else {
+            // Vertical mirroring.
+            if (nt == 1 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
+        as_map_bank(mapper->ppuas, NAMETABLE0 + nt * NT_SIZE, NT_SIZE, target, AS_READ | AS_WRITE);
     }
-    return target;
 }
@@ -1,4 +1,5 @@
 #include <mappers.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <ppu.h>
@@ -40,6 +41,10 @@
 #define PRG_BANK3       0xE000
 #define PRG_BANK_SIZE   0x2000
 
+#define SPR_FETCH_X     262     // The dot of the first sprite pattern fetch on a scanline.
+#define BKG_FETCH_X     326     // The dot of the first background pattern fetch for the next scanline.
+#define TALL_EDGES      4       // The most rising edges of A12 on a scanline with 8x16 sprites.
+
 struct mmc3_data {
 
     uint8_t     irq_counter;        // irq counter
@@ -55,11 +60,12 @@ struct mmc3_data {
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static int next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu);
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_prg(mapper_t *mapper, prog_t *prog);
+static void map_chr(mapper_t *mapper, prog_t *prog);
+static void map_nts(mapper_t *mapper, prog_t *prog);
 
 static void clock_irq_counter(mapper_t *mapper, struct mmc3_data *data);
 
@@ -74,17 +80,13 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_prg = map_prg;
-    mapper->map_chr = map_chr;
-    mapper->map_nts = map_nts;
+    mapper->next_irq = next_irq;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
 
     /* additional data */
-    mapper->data = malloc(sizeof(struct mmc3_data));
+    mapper->data = calloc(1, sizeof(struct mmc3_data));
     
     return mapper;
 }
@@ -95,31 +97,27 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     as_add_segment(mapper->cpuas, PRG_RAM, PRG_RAM_SIZE, prog->prg_ram, AS_READ | AS_WRITE);
     
     // Three switchable PRG-ROM banks (one is fixed to the second last bank).
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
-    as_add_segment(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
-    as_add_segment(mapper->cpuas, PRG_BANK2, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
+    map_prg(mapper, prog);
 
     // Fourth bank is fixed to the last bank.
     as_add_segment(mapper->cpuas, PRG_BANK3, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + (N_PRG_BANKS(prog, PRG_BANK_SIZE) - 1) * PRG_BANK_SIZE, AS_READ);
 
-    // Have 8 separate 1KB CHR segments for both possible arrangements of CHR banks.
-    for (int i = 0; i < 8; i++) {
-        if (prog->chr_rom != NULL) {
-            as_add_segment(mapper->ppuas, CHR_BANK0 + i * CHR_BANK_SIZE, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-        }
-        else {
-            as_add_segment(mapper->ppuas, CHR_BANK0 + i * CHR_BANK_SIZE, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-        }
-    }
+    // Have 8 separate 1KB CHR banks for both possible arrangements of CHR banks.
+    map_chr(mapper, prog);
+
+    // Nametables.
+    map_nts(mapper, prog);
 
-    // Map each nametable to the start of VRAM.
-    as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE1, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram, AS_READ | AS_WRITE); 
-    as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
+    // Monitor writes to the bank select and IRQ registers.
+    mapper_watch(mapper, mapper->cpuas, PRG_ROM_START, 0xFFFF, AS_WRITE);
+
+    // Monitor changes to A12 (via PPUADDR writes and CHR memory accesses).
+    mapper_watch(mapper, mapper->cpuas, PPU_STATUS, PPU_STATUS, AS_READ);
+    mapper_watch(mapper, mapper->cpuas, PPU_ADDR, PPU_ADDR, AS_WRITE);
+    mapper_watch(mapper, mapper->ppuas, CHR_BANK0, NAMETABLE0 - 1, AS_READ | AS_WRITE);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (as == mapper->cpuas) {
         // Monitor CPU writes to PRG-ROM.
         if (write && vaddr >= PRG_ROM_START) {
@@ -128,10 +126,13 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                 if (vaddr < 0xA000) {
                     // bank select
                     mapper->banks[0] = value;
+                    map_prg(mapper, prog);
+                    map_chr(mapper, prog);
                 }
                 else if (vaddr < 0xC000) {
                     // mirroring
                     mapper->banks[MIRROR_INDEX] = value;
+                    map_nts(mapper, prog);
                 }
                 else if (vaddr < 0xE000) {
                     // irq latch
@@ -140,6 +141,7 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                 else {
                     // irq disable
                     ((struct mmc3_data*)mapper->data)->irq_enable = false;
+                    mapper->irq_armed = false;
                 }
             }
             else {
@@ -148,6 +150,12 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                     // bank data
                     uint8_t r = mapper->banks[0] & 0x07;
                     mapper->banks[R0 + r] = value;
+                    if (R0 + r < R6) {
+                        map_chr(mapper, prog);
+                    }
+                    else {
+                        map_prg(mapper, prog);
+                    }
                 }
                 else if (vaddr < 0xC000) {
                     // prg-ram protect (not used)
@@ -160,6 +168,7 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                 else {
                     // irq enable
                     ((struct mmc3_data*)mapper->data)->irq_enable = true;
+                    mapper->irq_armed = true;
                 }
             }
         }
@@ -191,84 +200,129 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
     }
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    // Last bank is always fixed.
-    if (vaddr >= PRG_BANK3)
-        return target;
-    
-    // Map depending on the PRG banking mode.
+static int next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu) {
+    struct mmc3_data *data = (struct mmc3_data*)mapper->data;
+    if (!data->irq_enable)
+        return INT_MAX;
+
+    // The number of times that the counter is clocked up to (and including) the one that raises the IRQ.
+    int clocks = data->irq_reload ? data->irq_latch + 2 : data->irq_counter + 1;
+
+    // The PPU fetches patterns on the pre-render and visible scanlines: the background's from dot 6 to dot 256,
+    // the sprites' from dot 262 to dot 320 and the background's again from dot 326 to dot 336. With 8x8 sprites,
+    // A12 rises once on each of these scanlines if the two pattern tables are different (when the table at $1000
+    // is first fetched from). With 8x16 sprites, each sprite selects its own table, so A12 may rise a few times
+    // (from the first sprite fetch onwards).
+    const bool bkg = ppu->controller.bpt_addr, spr = ppu->controller.spt_addr, tall = ppu->controller.spr_size;
+    int edges = 0, edge_x = SPR_FETCH_X;
+    if (tall) {
+        edges = TALL_EDGES;
+    }
+    else if (bkg != spr) {
+        edges = 1;
+        edge_x = spr ? SPR_FETCH_X : BKG_FETCH_X;
+    }
+
+    // Part way through the sprite fetches of a scanline with 8x16 sprites, A12 may still rise a few times. Otherwise,
+    // A12 may not be where these fetches leave it (e.g. after PPUADDR writes), in which case the next fetch may also
+    // clock the counter.
+    const bool fetching = ppu->draw_y < SCREEN_HEIGHT;
+    const bool sprites_fetched = fetching && ppu->draw_x > SPR_FETCH_X && ppu->draw_x <= BKG_FETCH_X;
+    if (tall && sprites_fetched) {
+        clocks -= TALL_EDGES;
+    }
+    else if (data->old_a12 != (sprites_fetched ? spr : bkg)) {
+        clocks--;
+    }
+    if (clocks <= 0)
+        return 0;
+    if (edges == 0)
+        return INT_MAX;
+
+    // Find the scanline on which the counter may reach the IRQ (the current one if its edge is still ahead).
+    int y = fetching && ppu->draw_x <= edge_x ? ppu->draw_y : ppu->draw_y + 1;
+    if (y >= SCREEN_HEIGHT) {
+        y = -1;
+    }
+    y += (clocks - 1) / edges;
+
+    // The frame is completed before any later scanline.
+    if (y >= SCREEN_HEIGHT)
+        return INT_MAX;
+    return ppu_next_dot(ppu, y, edge_x);
+}
+
+static void map_prg(mapper_t *mapper, prog_t *prog) {
+    uint8_t *target = (uint8_t*)prog->prg_rom;
+    uint8_t *second_last = target + (N_PRG_BANKS(prog, PRG_BANK_SIZE) - 2) * PRG_BANK_SIZE;
+
+    // Map depending on the PRG banking mode (last bank is always fixed).
     if ((mapper->banks[SELECT_INDEX] & 0x40) > 0) {
         // Bank 0 fixed to second last bank.
-        if (vaddr < PRG_BANK1) {        // Bank 0
-            target += (N_PRG_BANKS(prog, PRG_BANK_SIZE) - 2) * PRG_BANK_SIZE;
-        }
-        else if (vaddr < PRG_BANK2) {   // Bank 1
-            target += mapper->banks[R7] * PRG_BANK_SIZE;
-        }
-        else {                          // Bank 2
-            target += mapper->banks[R6] * PRG_BANK_SIZE;
-        }
+        as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, second_last, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, target + mapper->banks[R7] * PRG_BANK_SIZE, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK2, PRG_BANK_SIZE, target + mapper->banks[R6] * PRG_BANK_SIZE, AS_READ);
     }
     else {
         // Bank 2 fixed to second last bank.
-        if (vaddr < PRG_BANK1) {        // Bank 0
-            target += mapper->banks[R6] * PRG_BANK_SIZE;
-        }
-        else if (vaddr < PRG_BANK2) {   // Bank 1
-            target += mapper->banks[R7] * PRG_BANK_SIZE;
-        }
-        else {                          // Bank 2
-            target += (N_PRG_BANKS(prog, PRG_BANK_SIZE) - 2) * PRG_BANK_SIZE;
-        }
+        as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, target + mapper->banks[R6] * PRG_BANK_SIZE, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, target + mapper->banks[R7] * PRG_BANK_SIZE, AS_READ);
+        as_map_bank(mapper->cpuas, PRG_BANK2, PRG_BANK_SIZE, second_last, AS_READ);
     }
-
-    return target;
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    uint8_t bank = vaddr / CHR_BANK_SIZE;
-    if ((mapper->banks[0] & 0x80) > 0) {
-        // R2 - R3 - R4 - R5 - R0/R0 - R1/R1
-        if (bank < 4) {
-            target += mapper->banks[R2 + bank] * CHR_BANK_SIZE;
-        }
-        else if (bank < 6) {
-            target += ((mapper->banks[R0] & 0xFE) + (bank % 2)) * CHR_BANK_SIZE;
-        }
-        else {
-            target += ((mapper->banks[R1] & 0xFE) + (bank % 2)) * CHR_BANK_SIZE;
-        }
-    }
-    else {
-        // R0/R0 - R1/R1 - R2 - R3 - R4 - R5
-        if (bank < 2) {
-            target += ((mapper->banks[R0] & 0xFE) + (bank % 2)) * CHR_BANK_SIZE;
-        }
-        else if (bank < 4) {
-            target += ((mapper->banks[R1] & 0xFE) + (bank % 2)) * CHR_BANK_SIZE;
+static void map_chr(mapper_t *mapper, prog_t *prog) {
+    // Map CHR-ROM (or CHR-RAM if it is used).
+    uint8_t *target = prog->chr_rom != NULL ? (uint8_t*)prog->chr_rom : prog->chr_ram;
+    const uint8_t perms = prog->chr_rom != NULL ? AS_READ : AS_READ | AS_WRITE;
+
+    for (int bank = 0; bank < 8; bank++) {
+        size_t select;
+        if ((mapper->banks[0] & 0x80) > 0) {
+            // R2 - R3 - R4 - R5 - R0/R0 - R1/R1
+            if (bank < 4) {
+                select = mapper->banks[R2 + bank];
+            }
+            else if (bank < 6) {
+                select = (mapper->banks[R0] & 0xFE) + (bank % 2);
+            }
+            else {
+                select = (mapper->banks[R1] & 0xFE) + (bank % 2);
+            }
         }
         else {
-            target += mapper->banks[R2 + (bank - 4)] * CHR_BANK_SIZE;
+            // R0/R0 - R1/R1 - R2 - R3 - R4 - R5
+            if (bank < 2) {
+                select = (mapper->banks[R0] & 0xFE) + (bank % 2);
+            }
+            else if (bank < 4) {
+                select = (mapper->banks[R1] & 0xFE) + (bank % 2);
+            }
+            else {
+                select = mapper->banks[R2 + (bank - 4)];
+            }
         }
+        as_map_bank(mapper->ppuas, CHR_BANK0 + bank * CHR_BANK_SIZE, CHR_BANK_SIZE, target + select * CHR_BANK_SIZE, perms);
     }
-    return target;
 }
 
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    uint8_t nt = NT(vaddr);
-    if ((mapper->banks[MIRROR_INDEX] & 0x01) > 0) {
-        // Horizontal mirroring.
-        if (nt == 2 || nt == 3) {
-            target += NT_SIZE;
+static void map_nts(mapper_t *mapper, prog_t *prog) {
+    for (int nt = 0; nt < 4; nt++) {
+        uint8_t *target = mapper->vram;
+        if ((mapper->banks[MIRROR_INDEX] & 0x01) > 0) {
+            // Horizontal mirroring.
+            if (nt == 2 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
-    }
-    else {
-        // Vertical mirroring.
-        if (nt == 1 || nt == 3) {
-            target += NT_SIZE;
+        else {
+            // Vertical mirroring.
+            if (nt == 1 || nt == 3) {
+                target += NT_SIZE;
+            }
         }
+        as_map_bank(mapper->ppuas, NAMETABLE0 + nt * NT_SIZE, NT_SIZE, target, AS_READ | AS_WRITE);
     }
-    return target;
 }
 
 static void clock_irq_counter(mapper_t *mapper, struct mmc3_data *data) {
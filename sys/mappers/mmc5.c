@@ -1,6 +1,7 @@
 #include <mappers.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cpu.h>
 #include <ppu.h>
 
@@ -41,6 +42,8 @@
 #define IN_FRAME_MASK   0x40
 #define IRQ_ACK_MASK    0x80
 
+#define LINE_START_X    2       // The dot on which the start of a scanline is detected (the third read of the same nametable address).
+
 struct mmc5_data {
 
     uint8_t     prg_mode;           // PRG mode.
@@ -74,7 +77,7 @@ struct mmc5_data {
 
     uint8_t     prg_mask;           // PRG-ROM mask.
     uint8_t     chr_mask;           // CHR-ROM mask.
-    uint8_t     read_buffer;        // Read buffer used for fill mode and NT mode 2 with no EX-RAM.
+    uint8_t     fill_nt[NT_SIZE];   // Nametable used for fill mode.
 
     unsigned    sprite_sz   : 1;    // Internal account of PPU sprite size (0: 8x8; 1: 16x16).
     unsigned    rendering   : 2;    // Internal account of whether the PPU is rendering (0: disabled; 1,2,3: enabled).
@@ -94,14 +97,17 @@ struct mmc5_data {
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 static void cycle(mapper_t *mapper, prog_t *prog, int cycles);
+static int next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu);
 static float mix(mapper_t *mapper, prog_t *prog, float input);
 
-static uint8_t *map_ram(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void write_register(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t value);
+
+static void map_ram(mapper_t *mapper, prog_t *prog);
+static void map_prg(mapper_t *mapper, prog_t *prog);
+static void map_chr(mapper_t *mapper, prog_t *prog);
+static void map_nts(mapper_t *mapper, prog_t *prog);
 
 const mapper_t mmc5 = {
     .init = init
@@ -115,13 +121,8 @@ static mapper_t *init(void) {
     mapper->insert = insert;
     mapper->monitor = monitor;
     mapper->cycle = cycle;
+    mapper->next_irq = next_irq;
     mapper->mix = mix;
-
-    /* set mapper rules */
-    mapper->map_ram = map_ram;
-    mapper->map_prg = map_prg;
-    mapper->map_chr = map_chr;
-    mapper->map_nts = map_nts;
     
     /* setup registers */
     mapper->banks = NULL; // MMC5 uses memory-mapped registers in $5000-5FFF region.
@@ -135,18 +136,9 @@ static mapper_t *init(void) {
 static void insert(mapper_t *mapper, prog_t *prog) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
     
-    // Map registers.
-    as_add_segment(mapper->cpuas, PRG_MODE, 1, &data->prg_mode, AS_WRITE);
-    as_add_segment(mapper->cpuas, CHR_MODE, 1, &data->chr_mode, AS_WRITE);
+    // Map registers (registers that affect banking are written by the monitor so that the banks can be remapped).
     as_add_segment(mapper->cpuas, PRG_RAM_PRTC1, 1, &data->prg_ram_protect_1, AS_WRITE);
     as_add_segment(mapper->cpuas, PRG_RAM_PRTC2, 1, &data->prg_ram_protect_2, AS_WRITE);
-    as_add_segment(mapper->cpuas, EX_RAM_MODE, 1, &data->ex_ram_mode, AS_WRITE);
-    as_add_segment(mapper->cpuas, NT_MAPPING, 1, &data->nt_mapping, AS_WRITE);
-    as_add_segment(mapper->cpuas, FILL_MODE_TILE, 1, &data->fill_mode_tile, AS_WRITE);
-    as_add_segment(mapper->cpuas, FILL_MODE_COLOR, 1, &data->fill_mode_color, AS_WRITE);
-
-    as_add_segment(mapper->cpuas, PRG_SELECT, sizeof(data->prg_banks), data->prg_banks, AS_WRITE);
-    as_add_segment(mapper->cpuas, CHR_SELECT, sizeof(data->chr_banks), data->chr_banks, AS_WRITE);
 
     as_add_segment(mapper->cpuas, V_SPLIT_MODE, 1, &data->v_split_mode, AS_WRITE);
     as_add_segment(mapper->cpuas, V_SPLIT_SCROLL, 1, &data->v_split_scroll, AS_WRITE);
@@ -160,31 +152,20 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     
     // Switchable 8KB of PRG-RAM (128KB allocated).
     prog->prg_ram = malloc(PRG_RAM_SIZE * sizeof(uint8_t));
-    as_add_segment(mapper->cpuas, PRG_RAM, PRG_BANK_SIZE, prog->prg_ram, AS_READ | AS_WRITE);
-    
-    // Up to 4 switchable 8KB PRG-ROM (and RAM) banks (map it to start of PRG-ROM).
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ | AS_WRITE);
-    as_add_segment(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ | AS_WRITE);
-    as_add_segment(mapper->cpuas, PRG_BANK2, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ | AS_WRITE);
-
-    // Last bank is always PRG-ROM (so make it read only).
-    as_add_segment(mapper->cpuas, PRG_BANK3, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
-
-    // Have 8 separate 1KB CHR segments for both possible arrangements of CHR banks.
-    for (int i = 0; i < 8; i++) {
-        if (prog->chr_rom != NULL) {
-            as_add_segment(mapper->ppuas, CHR_BANK0 + i * CHR_BANK_SIZE, CHR_BANK_SIZE, (uint8_t*)prog->chr_rom, AS_READ);
-        }
-        else {
-            as_add_segment(mapper->ppuas, CHR_BANK0 + i * CHR_BANK_SIZE, CHR_BANK_SIZE, prog->chr_ram, AS_READ | AS_WRITE);
-        }
-    }
 
-    // Map each nametable to the start of VRAM.
-    as_add_segment(mapper->ppuas, NAMETABLE0, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE1, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
-    as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram, AS_READ | AS_WRITE); 
-    as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram, AS_READ | AS_WRITE);
+    // Monitor writes to the bank registers.
+    mapper_watch(mapper, mapper->cpuas, PRG_MODE, CHR_SELECT + sizeof(data->chr_banks) - 1, AS_WRITE);
+
+    // Monitor writes to the PPU registers that the MMC5 snoops on, and accesses to the IRQ and multiplier registers.
+    mapper_watch(mapper, mapper->cpuas, PPU_CTRL, PPU_MASK, AS_WRITE);
+    mapper_watch(mapper, mapper->cpuas, IRQ_STATUS, IRQ_STATUS, AS_READ | AS_WRITE);
+    mapper_watch(mapper, mapper->cpuas, MULT_LOW, MULT_HIGH, AS_WRITE);
+
+    // Monitor reads of the NMI and reset vectors.
+    mapper_watch(mapper, mapper->cpuas, NMI_VECTOR, RES_VECTOR + 1, AS_READ);
+
+    // Monitor all PPU reads (used to detect scanlines).
+    mapper_watch(mapper, mapper->ppuas, 0x0000, 0xFFFF, AS_READ);
 
     // Games expect $5017 = $FF at power on.
     data->prg_banks[4] = 0xFF;
@@ -232,16 +213,28 @@ static void insert(mapper_t *mapper, prog_t *prog) {
     else
         mask = 0x7F;
     data->chr_mask = mask;
+
+    // Map the initial banks (up to 4 switchable 8KB PRG-ROM/RAM banks, and 8 separate 1KB CHR banks for
+    // both possible arrangements of CHR banks).
+    map_ram(mapper, prog);
+    map_prg(mapper, prog);
+    map_chr(mapper, prog);
+    map_nts(mapper, prog);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
     if (as == mapper->cpuas) {
         // CPU
         if (write) {
-            if (vaddr == PPU_CTRL) {
+            if (vaddr >= PRG_MODE && vaddr < CHR_SELECT + sizeof(data->chr_banks)) {
+                // Update the bank registers.
+                write_register(mapper, prog, vaddr, value);
+            }
+            else if (vaddr == PPU_CTRL) {
                 // Update sprite size flag.
                 data->sprite_sz = (value >> 5) & 0x01;
+                map_chr(mapper, prog);
             }
             else if (vaddr == PPU_MASK) {
                 // Determine whether rendering is enabled.
@@ -313,6 +306,7 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
                 // Reset background flag and NT byte counter.
                 data->bkg_flag = true;   
                 data->nt_bytes_read = 0;
+                map_chr(mapper, prog);
             }
         }
         else {
@@ -326,9 +320,11 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
             data->nt_bytes_read++;
             if (data->nt_bytes_read == 64) {
                 data->bkg_flag = false;
+                map_chr(mapper, prog);
             }
             if (data->nt_bytes_read == 80) {
                 data->bkg_flag = true;
+                map_chr(mapper, prog);
             }
         }
     }
@@ -349,90 +345,154 @@ static void cycle(mapper_t *mapper, prog_t *prog, int cycles) {
     data->ppu_reading = false;
 }
 
+static int next_irq(mapper_t *mapper, prog_t *prog, const ppu_t *ppu) {
+    struct mmc5_data *data = (struct mmc5_data*)mapper->data;
+
+    // The PPU stops reading after the visible scanlines, and the in-frame flag is cleared once the mapper has been
+    // clocked for a few CPU cycles without any reads (so the mapper is clocked after every instruction until then).
+    if (ppu->draw_y >= SCREEN_HEIGHT)
+        return (data->irq_status & IN_FRAME_MASK) ? 0 : ppu_next_dot(ppu, -1, LINE_START_X);
+
+    // While rendering is disabled, the PPU keeps reading the same nametable address, which looks like the start of
+    // a scanline on every third read.
+    if (!ppu->mask.background && !ppu->mask.sprites)
+        return 0;
+
+    // Otherwise, the IRQ and the status register only change at the start of a scanline (and the mapper has to be
+    // clocked after every instruction from the last read of the visible scanlines).
+    if (ppu->draw_x <= LINE_START_X)
+        return ppu_next_dot(ppu, ppu->draw_y, LINE_START_X);
+    if (ppu->draw_y == SCREEN_HEIGHT - 1)
+        return ppu_next_dot(ppu, ppu->draw_y, SCANLINE_END);
+    return ppu_next_dot(ppu, ppu->draw_y + 1, LINE_START_X);
+}
+
 static float mix(mapper_t *mapper, prog_t *prog, float input) {
     // TODO
     return input;
 }
 
-static uint8_t *map_ram(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void write_register(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t value) {
+    struct mmc5_data *data = (struct mmc5_data*)mapper->data;
+    if (vaddr == PRG_MODE) {
+        data->prg_mode = value;
+        map_prg(mapper, prog);
+    }
+    else if (vaddr == CHR_MODE) {
+        data->chr_mode = value;
+        map_chr(mapper, prog);
+    }
+    else if (vaddr == EX_RAM_MODE) {
+        data->ex_ram_mode = value;
+        map_nts(mapper, prog);
+    }
+    else if (vaddr == NT_MAPPING) {
+        data->nt_mapping = value;
+        map_nts(mapper, prog);
+    }
+    else if (vaddr == FILL_MODE_TILE) {
+        data->fill_mode_tile = value;
+        map_nts(mapper, prog);
+    }
+    else if (vaddr == FILL_MODE_COLOR) {
+        data->fill_mode_color = value;
+        map_nts(mapper, prog);
+    }
+    else if (vaddr >= PRG_SELECT && vaddr < PRG_SELECT + sizeof(data->prg_banks)) {
+        data->prg_banks[vaddr - PRG_SELECT] = value;
+        if (vaddr == PRG_SELECT) {
+            map_ram(mapper, prog);
+        }
+        else {
+            map_prg(mapper, prog);
+        }
+    }
+    else if (vaddr >= CHR_SELECT) {
+        data->chr_banks[vaddr - CHR_SELECT] = value;
+        map_chr(mapper, prog);
+    }
+}
+
+static void map_ram(mapper_t *mapper, prog_t *prog) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
-    return target + (data->prg_banks[0] & 0x7F) * PRG_BANK_SIZE;
+    as_map_bank(mapper->cpuas, PRG_RAM, PRG_BANK_SIZE, prog->prg_ram + (data->prg_banks[0] & 0x7F) * PRG_BANK_SIZE, AS_READ | AS_WRITE);
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_prg(mapper_t *mapper, prog_t *prog) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
-    const uint8_t bank = (vaddr - PRG_BANK0) / PRG_BANK_SIZE;
     const uint8_t mode = data->prg_mode & 0x03;
 
-    // Determine the bank selection and ROM/RAM select depending on the mode.
-    uint8_t select;
-    bool prg_ram_select = false;
-    if (mode == 0) {
-        // 32KB switchable ROM bank.
-        select = (data->prg_banks[4] & 0x7C) | (bank & 0x03);
-    }
-    else if (mode == 1) {
-        if (vaddr < PRG_BANK2) {
-            // 16KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
-            select = (data->prg_banks[2] & 0x7E) | (bank & 0x01);
-        }
-        else {
-            // 16KB switchable ROM bank.
-            select = (data->prg_banks[4] & 0x7E) | (bank & 0x01);
+    for (int bank = 0; bank < 4; bank++) {
+        const addr_t vaddr = PRG_BANK0 + bank * PRG_BANK_SIZE;
+
+        // Determine the bank selection and ROM/RAM select depending on the mode.
+        uint8_t select;
+        bool prg_ram_select = false;
+        if (mode == 0) {
+            // 32KB switchable ROM bank.
+            select = (data->prg_banks[4] & 0x7C) | (bank & 0x03);
         }
-    }
-    else if (mode == 2) {
-        if (vaddr < PRG_BANK2) {
-            // 16KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
-            select = (data->prg_banks[2] & 0x7E) | (bank & 0x01);
+        else if (mode == 1) {
+            if (vaddr < PRG_BANK2) {
+                // 16KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
+                select = (data->prg_banks[2] & 0x7E) | (bank & 0x01);
+            }
+            else {
+                // 16KB switchable ROM bank.
+                select = (data->prg_banks[4] & 0x7E) | (bank & 0x01);
+            }
         }
-        else if (vaddr < PRG_BANK3) {
-            // 8KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[3] & 0x80) == 0);
-            select = data->prg_banks[3] & 0x7F;
+        else if (mode == 2) {
+            if (vaddr < PRG_BANK2) {
+                // 16KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
+                select = (data->prg_banks[2] & 0x7E) | (bank & 0x01);
+            }
+            else if (vaddr < PRG_BANK3) {
+                // 8KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[3] & 0x80) == 0);
+                select = data->prg_banks[3] & 0x7F;
+            }
+            else {
+                // 8KB switchable ROM bank.
+                select = data->prg_banks[4] & 0x7F;
+            }
         }
         else {
-            // 8KB switchable ROM bank.
-            select = data->prg_banks[4] & 0x7F;
-        }
-    }
-    else {
-        if (vaddr < PRG_BANK1) {
-            // 8KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[1] & 0x80) == 0);
-            select = data->prg_banks[1] & 0x7F;
-        }
-        else if (vaddr < PRG_BANK2) {
-            // 8KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
-            select = data->prg_banks[2] & 0x7F;
+            if (vaddr < PRG_BANK1) {
+                // 8KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[1] & 0x80) == 0);
+                select = data->prg_banks[1] & 0x7F;
+            }
+            else if (vaddr < PRG_BANK2) {
+                // 8KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[2] & 0x80) == 0);
+                select = data->prg_banks[2] & 0x7F;
+            }
+            else if (vaddr < PRG_BANK3) {
+                // 8KB switchable ROM/RAM bank.
+                prg_ram_select = ((data->prg_banks[3] & 0x80) == 0);
+                select = data->prg_banks[3] & 0x7F;
+            }
+            else {
+                // 8KB switchable ROM bank.
+                select = data->prg_banks[4] & 0x7F;
+            }
         }
-        else if (vaddr < PRG_BANK3) {
-            // 8KB switchable ROM/RAM bank.
-            prg_ram_select = ((data->prg_banks[3] & 0x80) == 0);
-            select = data->prg_banks[3] & 0x7F;
+
+        // Map PRG-RAM if RAM is selected (PRG-ROM is read only).
+        if (prg_ram_select) {
+            as_map_bank(mapper->cpuas, vaddr, PRG_BANK_SIZE, prog->prg_ram + (select & 0x0F) * PRG_BANK_SIZE, AS_READ | AS_WRITE);
         }
         else {
-            // 8KB switchable ROM bank.
-            select = data->prg_banks[4] & 0x7F;
+            as_map_bank(mapper->cpuas, vaddr, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + (select & data->prg_mask) * PRG_BANK_SIZE, AS_READ);
         }
     }
-
-    // Switch to PRG-RAM if RAM is selected.
-    if (prg_ram_select) {
-        target = prog->prg_ram + offset;
-    }
-
-    // Adjust the offset based on the selected bank.
-    uint8_t mask = prg_ram_select ? 0x0F : data->prg_mask;
-    return target + (select & mask) * PRG_BANK_SIZE;
 }
 
-static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_chr(mapper_t *mapper, prog_t *prog) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
-    const uint8_t bank = (vaddr - CHR_BANK0) / CHR_BANK_SIZE;
     const uint8_t mode = data->chr_mode & 0x03;
 
     uint8_t mask, size;
@@ -456,52 +516,52 @@ static uint8_t *map_chr(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *t
         size = 1;
         mask = 0x00;
     }
-    
-    // Offset based on the page that is selected for the current bank.
-    uint8_t index;
-    if (data->bkg_flag && data->sprite_sz) {
-        index = 0x08 | (((bank & ~mask) | mask) & 0x03);
-    }
-    else {
-        index = ((bank & ~mask) | mask) & 0x07;
-    }
-    target += data->chr_banks[index] * size * CHR_BANK_SIZE;
 
-    // Adjust the address to the correct bank (as each 1KB segment points to the top of memory).
-    target += (bank & mask) * CHR_BANK_SIZE;
+    // Map CHR-ROM (or CHR-RAM if it is used).
+    uint8_t *target = prog->chr_rom != NULL ? (uint8_t*)prog->chr_rom : prog->chr_ram;
+    const uint8_t perms = prog->chr_rom != NULL ? AS_READ : AS_READ | AS_WRITE;
+
+    for (int bank = 0; bank < 8; bank++) {
+        // Offset based on the page that is selected for the current bank.
+        uint8_t index;
+        if (data->bkg_flag && data->sprite_sz) {
+            index = 0x08 | (((bank & ~mask) | mask) & 0x03);
+        }
+        else {
+            index = ((bank & ~mask) | mask) & 0x07;
+        }
+        size_t offset = data->chr_banks[index] * size * CHR_BANK_SIZE;
+
+        // Adjust the address to the correct bank within the page.
+        offset += (bank & mask) * CHR_BANK_SIZE;
 
-    return target; 
+        as_map_bank(mapper->ppuas, CHR_BANK0 + bank * CHR_BANK_SIZE, CHR_BANK_SIZE, target + offset, perms);
+    }
 }
 
-static uint8_t *map_nts(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
+static void map_nts(mapper_t *mapper, prog_t *prog) {
     struct mmc5_data *data = (struct mmc5_data*)mapper->data;
-    const uint8_t shift = NT(vaddr) * 2;
-    const uint8_t mask = 0x03 << shift;
-    const uint8_t nt = (data->nt_mapping & mask) >> shift;
-    if (nt < 2) {
-        // Normal nametable behaviour.
-        target += nt * NT_SIZE;
-    }
-    else if (nt == 4) {
-        // Fill mode.
-        if (((vaddr >> 5) & 0x1F) < 30) {
-            data->read_buffer = data->fill_mode_tile;
-            target = &data->read_buffer;
+    for (int i = 0; i < 4; i++) {
+        const addr_t vaddr = NAMETABLE0 + i * NT_SIZE;
+        const uint8_t nt = (data->nt_mapping >> (i * 2)) & 0x03;
+        if (nt < 2) {
+            // Normal nametable behaviour.
+            as_map_bank(mapper->ppuas, vaddr, NT_SIZE, mapper->vram + nt * NT_SIZE, AS_READ | AS_WRITE);
         }
-        else {
+        else if (nt == 4) {
+            // Fill mode (the attribute table starts after 30 rows of tiles).
             uint8_t attr = data->fill_mode_color & 0x03;
-            data->read_buffer = (attr << 6) | (attr << 4) | (attr << 2) | attr;
-            target = &data->read_buffer;
+            memset(data->fill_nt, data->fill_mode_tile, 30 * 32);
+            memset(data->fill_nt + 30 * 32, (attr << 6) | (attr << 4) | (attr << 2) | attr, NT_SIZE - 30 * 32);
+            as_map_bank(mapper->ppuas, vaddr, NT_SIZE, data->fill_nt, AS_READ);
+        }
+        else if ((data->ex_ram_mode & 0x02) == 0) {
+            // Use internal EX-RAM for nametable.
+            as_map_bank(mapper->ppuas, vaddr, NT_SIZE, data->ex_ram, AS_READ | AS_WRITE);
+        }
+        else {
+            // Data is read as zeroes.
+            as_map_bank(mapper->ppuas, vaddr, NT_SIZE, NULL, 0);
         }
     }
-    else if ((data->ex_ram_mode & 0x02) == 0) {
-        // Use internal EX-RAM for nametable.
-        target = data->ex_ram + offset;
-    }
-    else {
-        // Data is read as zeroes.
-        data->read_buffer = 0x00;
-        target = &data->read_buffer;
-    }
-    return target;
 }
@@ -15,9 +15,9 @@
 static mapper_t *init(void);
 
 static void insert(mapper_t *mapper, prog_t *prog);
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write);
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset);
+static void map_prg(mapper_t *mapper, prog_t *prog);
 
 const mapper_t uxrom = {
     .init = init
@@ -30,9 +30,6 @@ static mapper_t *init(void) {
     /* set functions */
     mapper->insert = insert;
     mapper->monitor = monitor;
-
-    /* set mapper rules */
-    mapper->map_prg = map_prg;
     
     /* setup registers */
     mapper->banks = calloc(N_REGISTERS, sizeof(uint8_t));
@@ -41,8 +38,8 @@ static mapper_t *init(void) {
 }
 
 static void insert(mapper_t *mapper, prog_t *prog) {
-    // First PRG bank is switchable (map to the start of PRG-ROM).
-    as_add_segment(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom, AS_READ);
+    // First PRG bank is switchable.
+    map_prg(mapper, prog);
 
     // Second PRG bank is fixed to the last bank.
     as_add_segment(mapper->cpuas, PRG_BANK1, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + (N_PRG_BANKS(prog, PRG_BANK_SIZE) - 1) * PRG_BANK_SIZE, AS_READ);
@@ -69,9 +66,12 @@ static void insert(mapper_t *mapper, prog_t *prog) {
         as_add_segment(mapper->ppuas, NAMETABLE2, NT_SIZE, mapper->vram + NT_SIZE, AS_READ | AS_WRITE);
         as_add_segment(mapper->ppuas, NAMETABLE3, NT_SIZE, mapper->vram + NT_SIZE, AS_READ | AS_WRITE);
     }
+
+    // Monitor writes to the bank select register.
+    mapper_watch(mapper, mapper->cpuas, PRG_ROM_START, 0xFFFF, AS_WRITE);
 }
 
-static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
+static void monitor(mapper_t *mapper, prog_t *prog, const addrspace_t *as, addr_t vaddr, uint8_t value, bool write) {
     if (!write)
         return;
     if (as != mapper->cpuas)
@@ -81,10 +81,11 @@ static void monitor(mapper_t *mapper, prog_t *prog, addrspace_t *as, addr_t vadd
     
     // Bank 0 simply gets set to the value given.
     mapper->banks[0] = value;
+    map_prg(mapper, prog);
 }
 
-static uint8_t *map_prg(mapper_t *mapper, prog_t *prog, addr_t vaddr, uint8_t *target, size_t offset) {
-    // If the address targets the first bank, then offset target depending on the value in the bank register.
-    return vaddr < PRG_BANK1 ? target + mapper->banks[0] * PRG_BANK_SIZE : target;
+static void map_prg(mapper_t *mapper, prog_t *prog) {
+    // Map the first bank depending on the value in the bank register.
+    as_map_bank(mapper->cpuas, PRG_BANK0, PRG_BANK_SIZE, (uint8_t*)prog->prg_rom + mapper->banks[0] * PRG_BANK_SIZE, AS_READ);
 }
 
@@ -4,297 +4,511 @@
 #include <string.h>
 #include <vm.h>
 
-#define N_SEGS 32
-#define SEG_SIZE (65536 / N_SEGS)
+#define N_PAGES 256
+#define PAGE_SIZE (65536 / N_PAGES)
+
+#define PAGE(vaddr) ((vaddr) / PAGE_SIZE)
+#define PAGE_OFFSET(vaddr) ((vaddr) % PAGE_SIZE)
 
 #define max(a,b) (((a) > (b)) ? (a) : (b))
 #define min(a,b) (((a) < (b)) ? (a) : (b))
 
 /**
- * @brief A range of virtual memory that maps to an emulator virtual address.
+ * @brief Maps a virtual address (or the first byte of a page) to an emulator virtual address.
  */
-typedef struct mem_seg {
-    
-    /* segment range */
-    uint32_t        start;          // The start of the address range (inclusive).
-    uint32_t        end;            // The end of the address range (exclusive).
+typedef struct as_entry {
 
-    /* segment target */
-    uint8_t         *target;        // The target emulator address that the start of this segment points to.
-    size_t          offset;         // The offset added to the target when resolving.
+    /* entry target */
+    uint8_t         *target;        // The target emulator address of the first byte covered by this entry.
+    size_t          offset;         // The offset of the first byte from the start of the segment it belongs to.
 
     /* read/write permissions */
-    uint8_t         mode;           // The read/write permissions of the segment.
+    uint8_t         mode;           // The read/write permissions of the entry.
 
-    /* linked list */
-    struct mem_seg  *next;          // A pointer to the next segment.
+} as_entry_t;
 
-} mem_seg_t;
+/**
+ * @brief An I/O handler that is attached to a range of addresses.
+ */
+typedef struct as_handler {
 
-typedef struct as_mirror {
-    
-    addr_t          start;          // The start of the mirror (inclusive).
-    addr_t          end;            // The end of the the mirror (inclusive).
-    addr_t          target;         // The target virtual address.
-    size_t          repeat;         // The amount to repeat by.
+    addr_t              start;      // The start of the range (inclusive).
+    addr_t              end;        // The end of the range (inclusive).
 
-    struct as_mirror   *next;      // A pointer to the next mirror.
+    io_handler_t        handler;    // The handler.
+    void                *data;      // Data that is passed to the handler.
+    uint8_t             mode;       // The accesses that the handler is called for.
 
-} as_mirror_t;
+    struct as_handler   *next;      // A pointer to the next handler attached to the page.
 
-struct addrspace {
+} as_handler_t;
 
-    mem_seg_t       *segs[N_SEGS];  // A pointer to the head of the list of segments for each 2KB block.
+/**
+ * @brief A 256 byte page of virtual memory. Pages that are not mapped uniformly (i.e. when segments
+ * or mirrors are smaller than a page) are split into an entry for each byte.
+ */
+typedef struct as_page {
+
+    as_entry_t      entry;          // The entry that maps the entire page (if the page isn't split).
+    as_entry_t      *bytes;         // The entries for each byte in the page (or `NULL` if the page isn't split).
 
-    as_mirror_t     *mirrors;       // A pointer to the head of the list of mirrors in the address space.
-    as_mirror_t     *mirrors_tail;  // A pointer to the head of the list of mirrors in the address space.
+    as_handler_t    *handlers;      // The I/O handlers attached to the page (in the order they were attached).
+    uint8_t         io;             // The accesses that have at least one handler within the page.
 
-    resolve_rule_t  resolve_rule;   // The resolve rule that is called whenver a virtual address is resolved.
-    update_rule_t   update_rule;    // The update rule that is called whenever a virtual address is accessed.
+} as_page_t;
+
+/**
+ * @brief The virtual addresses that a page resolves to once mirrors have been applied.
+ */
+typedef struct as_link {
+
+    addr_t          base;           // The mirrored address of the first byte in the page.
+    addr_t          low, high;      // The lowest and highest mirrored addresses within the page.
+    addr_t          *bytes;         // The mirrored address of each byte (or `NULL` if the page is mirrored linearly).
+
+} as_link_t;
+
+struct addrspace {
+
+    as_page_t       pages[N_PAGES]; // The page table (with mirrors applied).
+    as_page_t       segs[N_PAGES];  // The segments added to the address space (without mirrors applied).
+    as_link_t       links[N_PAGES]; // The mirrored virtual addresses for each page.
+
+    uint32_t        generation;     // Incremented whenever the page table changes.
 
 };
 
-static inline uint8_t *resolve_vaddr(const addrspace_t *as, addr_t vaddr, uint8_t mode) {
-    uint8_t *target = NULL;
-    size_t offset = 0;
+/**
+ * @brief Splits the given page into an entry for each byte (if it hasn't been split already).
+ *
+ * @param page The page to split.
+ * @return The entries of the page.
+ */
+static as_entry_t *split_page(as_page_t *page);
 
-    // Evaluate mirrors.
-    for (as_mirror_t *mirror = as->mirrors; mirror != NULL; mirror = mirror->next) {
-        if (vaddr < mirror->start || vaddr > mirror->end)
-            continue;
+/**
+ * @brief Gets the segment entry of the given (unmirrored) virtual address.
+ *
+ * @param as The address space.
+ * @param vaddr The virtual address.
+ * @return The segment entry for the address.
+ */
+static as_entry_t seg_entry(const addrspace_t *as, addr_t vaddr);
 
-        size_t offset = vaddr - mirror->start;
-        if (mirror->repeat > 0) {
-            offset %= mirror->repeat;
-        }
-        vaddr = mirror->target + offset;
-    }
+/**
+ * @brief Rebuilds the page table entries of any page that is mirrored to an address in the given
+ * range of the segment table.
+ *
+ * @param as The address space.
+ * @param start The start of the range.
+ * @param end The end of the range (inclusive).
+ */
+static void update_pages(addrspace_t *as, addr_t start, addr_t end);
 
-    // Evaluate resultant virtual address.
-    const mem_seg_t *head = as->segs[vaddr / SEG_SIZE];
-    for (const mem_seg_t *seg = head; seg != NULL; seg = seg->next) {
-        if (vaddr >= seg->end)
-            continue;
-        if (vaddr < seg->start)
-            break;
-        if ((mode & AS_READ) && !(seg->mode & AS_READ))
-            break;
-        if ((mode & AS_WRITE) && !(seg->mode & AS_WRITE))
-            break;
-
-        offset = seg->offset + (vaddr - seg->start);
-        target = seg->target + offset;
-    }
+static inline uint8_t *target_at(uint8_t *target, size_t offset) {
+    return target != NULL ? target + offset : NULL;
+}
+
+static inline addr_t link_vaddr(const as_link_t *link, int i) {
+    return link->bytes != NULL ? link->bytes[i] : (addr_t)(link->base + i);
+}
 
-    // Apply the resolve rule (if it exists).
-    if (target != NULL && as->resolve_rule != NULL) {
-        target = as->resolve_rule(as, vaddr, target, offset);
+static inline uint8_t *resolve_vaddr(const as_page_t *page, addr_t vaddr, uint8_t mode) {
+    const as_entry_t *entry;
+    size_t index;
+    if (page->bytes == NULL) {
+        entry = &page->entry;
+        index = PAGE_OFFSET(vaddr);
+    }
+    else {
+        entry = &page->bytes[PAGE_OFFSET(vaddr)];
+        index = 0;
     }
 
-    // Exit with a "segmentation fault" if the address couldn't be resolved.
-    /*if (target == NULL) {
-        printf("Segmentation fault ($%.4x).\n", vaddr);
-        as_print(as);
-        exit(1);
-    }*/
+    // Check the permissions of the page.
+    if ((entry->mode & mode) != mode)
+        return NULL;
 
-    return target;
+    return entry->target + index;
+}
+
+static inline uint8_t *direct_target(const addrspace_t *as, uint32_t vaddr, uint8_t mode, bool io) {
+    const as_page_t *page = &as->pages[PAGE(vaddr)];
+    if (io && (page->io & mode))
+        return NULL;
+    return resolve_vaddr(page, vaddr, mode);
+}
+
+/**
+ * @brief Gets the number of bytes from a virtual address that map to contiguous host memory.
+ *
+ * @param as The address space.
+ * @param vaddr The virtual address (which must map to the given target).
+ * @param nbytes The maximum number of bytes.
+ * @param mode The accesses that will be made to the memory.
+ * @param io Set if pages with I/O handlers for the accesses end the span.
+ * @param target The host memory that the virtual address maps to.
+ * @return The number of bytes.
+ */
+static size_t span_size(const addrspace_t *as, uint32_t vaddr, size_t nbytes, uint8_t mode, bool io, const uint8_t *target) {
+    const uint32_t end = min(vaddr + nbytes, 65536);
+    uint32_t next = vaddr;
+    while (next < end && direct_target(as, next, mode, io) == target + (next - vaddr)) {
+        // The rest of a page that isn't split is contiguous, so skip to the next page.
+        next = as->pages[PAGE(next)].bytes == NULL ? (PAGE(next) + 1) * PAGE_SIZE : next + 1;
+    }
+    return min(next, end) - vaddr;
+}
+
+static inline uint8_t handle_io(const addrspace_t *as, const as_page_t *page, addr_t vaddr, uint8_t value, uint8_t mode) {
+    for (const as_handler_t *handler = page->handlers; handler != NULL; handler = handler->next) {
+        if ((handler->mode & mode) && vaddr >= handler->start && vaddr <= handler->end) {
+            value = handler->handler(as, vaddr, value, mode, handler->data);
+        }
+    }
+    return value;
 }
 
 addrspace_t *as_create() {
-    addrspace_t *as = malloc(sizeof(struct addrspace));
-    for (int i = 0; i < N_SEGS; i++) {
-        as->segs[i] = NULL;
+    addrspace_t *as = calloc(1, sizeof(struct addrspace));
+    for (int i = 0; i < N_PAGES; i++) {
+        as->links[i].base = i * PAGE_SIZE;
+        as->links[i].low = i * PAGE_SIZE;
+        as->links[i].high = i * PAGE_SIZE + PAGE_SIZE - 1;
     }
-    as->mirrors = NULL;
-    as->mirrors_tail = NULL;
-    as->resolve_rule = NULL;
-    as->update_rule = NULL;
     return as;
 }
 
 void as_destroy(addrspace_t *as) {
-    for (int i = 0; i < N_SEGS; i++) {
-        mem_seg_t *seg = as->segs[i];
-        while (seg != NULL) {
-            mem_seg_t *next = seg->next;
-            free(seg);
-            seg = next;
+    for (int i = 0; i < N_PAGES; i++) {
+        as_handler_t *handler = as->pages[i].handlers;
+        while (handler != NULL) {
+            as_handler_t *next = handler->next;
+            free(handler);
+            handler = next;
         }
+        free(as->pages[i].bytes);
+        free(as->segs[i].bytes);
+        free(as->links[i].bytes);
     }
-    
+
     free(as);
 }
 
 void as_add_segment(addrspace_t *as, addr_t start, size_t size, uint8_t *target, uint8_t mode) {
-    const uint32_t end = start + size;
-    for (int i = start / SEG_SIZE; i <= (end - 1) / SEG_SIZE; i++) {
-        // Determine the start and end of the new segment.
-        const uint32_t new_start = max(start, i * SEG_SIZE);
-        const uint32_t new_end = min(end, (i + 1) * SEG_SIZE);
-
-        // Create the new segment.
-        mem_seg_t *new_seg =  malloc(sizeof(struct mem_seg));
-        new_seg->start = new_start;
-        new_seg->end = new_end;
-        new_seg->offset = new_start - start;
-        new_seg->target = target;
-        new_seg->mode = mode;
-        new_seg->next = NULL;
-
-        // If this is the first segment in the region, then add it and continue.
-        if (as->segs[i] == NULL) {
-            as->segs[i] = new_seg;
-            continue;
+    const uint32_t end = min(start + size, 65536);
+    if (end <= start)
+        return;
+
+    for (int i = PAGE(start); i <= PAGE(end - 1); i++) {
+        as_page_t *seg = &as->segs[i];
+        const uint32_t page_start = i * PAGE_SIZE;
+        const uint32_t page_end = page_start + PAGE_SIZE;
+        if (start <= page_start && end >= page_end) {
+            // The segment covers the entire page.
+            free(seg->bytes);
+            seg->bytes = NULL;
+            seg->entry.target = target_at(target, page_start - start);
+            seg->entry.offset = page_start - start;
+            seg->entry.mode = mode;
         }
-
-        // Otherwise, update the list of segments in the region to fit the new segment.
-        mem_seg_t *seg = as->segs[i];
-        mem_seg_t *prev = NULL;
-        while (seg != NULL) {
-            mem_seg_t *next = seg->next;
-            if (seg->start >= new_seg->end) {
-                // Segment is after new segment; place new segment.
-                new_seg->next = seg;
-                if (prev != NULL) {
-                    prev->next = new_seg;
-                }
-                else {
-                    as->segs[i] = new_seg;
-                }
-                break;
+        else {
+            // The segment covers part of the page, so map each byte separately.
+            as_entry_t *bytes = split_page(seg);
+            for (uint32_t vaddr = max(start, page_start); vaddr < min(end, page_end); vaddr++) {
+                as_entry_t *entry = &bytes[PAGE_OFFSET(vaddr)];
+                entry->target = target_at(target, vaddr - start);
+                entry->offset = vaddr - start;
+                entry->mode = mode;
             }
-            else if (seg->end > new_seg->start) {
-                // Segment is within new segment.
-                if (seg->start >= new_seg->start && seg->end <= new_seg->end) {
-                    // Segment is fully contained within new segment (delete old segment).
-                    new_seg->next = seg->next;
-                    if (prev != NULL) {
-                        prev->next = new_seg;
-                    }
-                    else {
-                        as->segs[i] = new_seg;
-                    }
-                    free(seg);
-                    seg = NULL;
-                }
-                else if (seg->start >= new_seg->start && seg->start < new_seg->end) {
-                    // Segment intersects with new segment at end.
-                    new_seg->next = seg;
-                    if (prev != NULL) {
-                        prev->next = new_seg;
-                    }
-                    else {
-                        as->segs[i] = new_seg;
-                    }
-                    seg->offset += new_seg->end - seg->start;
-                    seg->start = new_seg->end;
-                    break;
-                }
-                else if (seg->start < new_seg->start && seg->end > new_seg->start) {
-                    // Segment intersects with new segment at start.
-                    new_seg->next = seg->next;
-                    seg->next = new_seg;
-                    seg->end = new_seg->start;
+        }
+    }
+
+    update_pages(as, start, end - 1);
+}
+
+void as_add_mirror(addrspace_t *as, addr_t start, addr_t end, size_t repeat, addr_t target) {
+    // Fold the mirror into the mirrored addresses of each page (mirrors are applied after any existing mirrors).
+    for (int i = 0; i < N_PAGES; i++) {
+        as_link_t *link = &as->links[i];
+        if (link->high < start || link->low > end)
+            continue;
+
+        addr_t bytes[PAGE_SIZE];
+        bool linear = true;
+        for (int j = 0; j < PAGE_SIZE; j++) {
+            addr_t vaddr = link_vaddr(link, j);
+            if (vaddr >= start && vaddr <= end) {
+                size_t offset = vaddr - start;
+                if (repeat > 0) {
+                    offset %= repeat;
                 }
+                vaddr = target + offset;
             }
-            
-            if (seg != NULL) {
-                prev = seg;
+            bytes[j] = vaddr;
+            linear &= vaddr == (addr_t)(bytes[0] + j);
+        }
+
+        // Store the result as a base address if possible; otherwise keep the address of each byte.
+        link->base = bytes[0];
+        if (linear) {
+            free(link->bytes);
+            link->bytes = NULL;
+        }
+        else {
+            if (link->bytes == NULL) {
+                link->bytes = malloc(PAGE_SIZE * sizeof(addr_t));
             }
-            seg = next;
+            memcpy(link->bytes, bytes, sizeof(bytes));
         }
 
-        // If we've reached the end of the list, then the segment goes after the last segment.
-        if (seg == NULL) {
-            prev->next = new_seg;
+        // Determine the range of addresses that the page is mirrored to.
+        if (linear && link->base <= 0x10000 - PAGE_SIZE) {
+            link->low = link->base;
+            link->high = link->base + PAGE_SIZE - 1;
+        }
+        else {
+            link->low = 0xFFFF;
+            link->high = 0x0000;
+            for (int j = 0; j < PAGE_SIZE; j++) {
+                link->low = min(link->low, bytes[j]);
+                link->high = max(link->high, bytes[j]);
+            }
         }
     }
-}
 
-void as_add_mirror(addrspace_t *as, addr_t start, addr_t end, size_t repeat, addr_t target) {
-    as_mirror_t *mirror = malloc(sizeof(struct as_mirror));
-    mirror->start = start;
-    mirror->end = end;
-    mirror->repeat = repeat;
-    mirror->target = target;
-    mirror->next = NULL;
-    if (as->mirrors == NULL) {
-        as->mirrors = mirror;
-    }
-    else {
-        as->mirrors_tail->next = mirror;
-    }
-    as->mirrors_tail = mirror;
+    update_pages(as, 0x0000, 0xFFFF);
 }
 
 void as_modify_segments(addrspace_t *as, addr_t start, addr_t end, uint8_t *target, uint8_t mode) {
-    for (int i = start / SEG_SIZE; i <= end / SEG_SIZE; i++) {
-        for (mem_seg_t *seg = as->segs[i]; seg != NULL; seg = seg->next) {
-            // Ensure that the segment is fully contained within the range.
-            if (seg->start < start)
-                continue;
-            if (seg->end - 1 > end)
-                break;
-
-            // Update target.
+    for (int i = PAGE(start); i <= PAGE(end); i++) {
+        as_page_t *seg = &as->segs[i];
+        const uint32_t page_start = i * PAGE_SIZE;
+        const uint32_t page_end = page_start + PAGE_SIZE - 1;
+        if (seg->bytes == NULL && page_start >= start && page_end <= end) {
+            // Update the entire page.
             if (target != NULL) {
-                seg->target = target;
+                seg->entry.target = target + seg->entry.offset;
+            }
+            if (mode > 0) {
+                seg->entry.mode = mode;
             }
+            continue;
+        }
 
-            // Update mode.
+        // Update each byte within the range.
+        as_entry_t *bytes = split_page(seg);
+        for (uint32_t vaddr = max(start, page_start); vaddr <= min(end, page_end); vaddr++) {
+            as_entry_t *entry = &bytes[PAGE_OFFSET(vaddr)];
+            if (entry->mode == 0 && entry->target == NULL)
+                continue;
+            if (target != NULL) {
+                entry->target = target + entry->offset;
+            }
             if (mode > 0) {
-                seg->mode = mode;
+                entry->mode = mode;
             }
         }
     }
+
+    update_pages(as, start, end);
 }
 
-void as_set_resolve_rule(addrspace_t *as, resolve_rule_t rule) {
-    as->resolve_rule = rule;
+void as_map_bank(addrspace_t *as, addr_t start, size_t size, uint8_t *target, uint8_t mode) {
+    const uint32_t end = min(start + size, 65536);
+    if (end <= start)
+        return;
+
+    // Leave the address space untouched if the bank is already mapped.
+    bool mapped = true;
+    for (int i = PAGE(start); i <= PAGE(end - 1) && mapped; i++) {
+        const as_page_t *seg = &as->segs[i];
+        const uint32_t page_start = i * PAGE_SIZE;
+        if (seg->bytes == NULL && start <= page_start && end >= page_start + PAGE_SIZE) {
+            mapped = seg->entry.target == target_at(target, page_start - start) && seg->entry.mode == mode;
+            continue;
+        }
+
+        for (uint32_t vaddr = max(start, page_start); vaddr < min(end, page_start + PAGE_SIZE) && mapped; vaddr++) {
+            const as_entry_t entry = seg_entry(as, vaddr);
+            mapped = entry.target == target_at(target, vaddr - start) && entry.mode == mode;
+        }
+    }
+
+    if (!mapped) {
+        as_add_segment(as, start, size, target, mode);
+    }
 }
 
-void as_set_update_rule(addrspace_t *as, update_rule_t rule) {
-    as->update_rule = rule;
+void as_add_handler(addrspace_t *as, addr_t start, addr_t end, io_handler_t handler, void *data, uint8_t mode) {
+    for (int i = PAGE(start); i <= PAGE(end); i++) {
+        // Each page keeps its own list of handlers so that only the handlers in the page need to be checked.
+        as_handler_t *new_handler = malloc(sizeof(struct as_handler));
+        new_handler->start = start;
+        new_handler->end = end;
+        new_handler->handler = handler;
+        new_handler->data = data;
+        new_handler->mode = mode;
+        new_handler->next = NULL;
+
+        // Handlers are called in the order that they are attached.
+        as_page_t *page = &as->pages[i];
+        as_handler_t **tail = &page->handlers;
+        while (*tail != NULL) {
+            tail = &(*tail)->next;
+        }
+        *tail = new_handler;
+        page->io |= mode;
+    }
+
+    as->generation++;
 }
 
 uint8_t as_read(const addrspace_t *as, addr_t vaddr) {
-    uint8_t *target = resolve_vaddr(as, vaddr, AS_READ);
+    const as_page_t *page = &as->pages[PAGE(vaddr)];
+    uint8_t *target = resolve_vaddr(page, vaddr, AS_READ);
     uint8_t value = target != NULL ? *target : 0; // Only read if the segment has read permissions.
-    if (as->update_rule != NULL) {
-        value = as->update_rule(as, vaddr, value, AS_READ);
+    if (page->io & AS_READ) {
+        value = handle_io(as, page, vaddr, value, AS_READ);
     }
     return value;
 }
 
 void as_write(const addrspace_t *as, addr_t vaddr, uint8_t value) {
-    uint8_t *target = resolve_vaddr(as, vaddr, AS_WRITE);
-    if (as->update_rule != NULL) {
-        value = as->update_rule(as, vaddr, value, AS_WRITE);
+    const as_page_t *page = &as->pages[PAGE(vaddr)];
+    uint8_t *target = resolve_vaddr(page, vaddr, AS_WRITE);
+    if (page->io & AS_WRITE) {
+        value = handle_io(as, page, vaddr, value, AS_WRITE);
     }
     if (target != NULL) {
         *target = value; // Only write if the segment has write permissions.
     }
 }
 
-uint8_t *as_traverse(const addrspace_t *as, addr_t start, size_t nbytes) {
-    uint8_t *result = calloc(nbytes, sizeof(uint8_t));
-    const uint32_t end = start + nbytes;
-    for (int i = start / SEG_SIZE; i <= (end - 1) / SEG_SIZE; i++) {
-        for (mem_seg_t *seg = as->segs[i]; seg != NULL; seg = seg->next) {
-            const uint32_t cpy_start = max(start, seg->start);
-            const size_t cpy_bytes = min(end, seg->end) - cpy_start;
-            memcpy(result + (cpy_start - start), seg->target + (cpy_start - seg->start), cpy_bytes);
+uint32_t as_generation(const addrspace_t *as) {
+    return as->generation;
+}
+
+uint8_t *as_span(const addrspace_t *as, addr_t vaddr, size_t nbytes, uint8_t mode, size_t *size) {
+    uint8_t *target = direct_target(as, vaddr, mode, true);
+    *size = target != NULL ? span_size(as, vaddr, nbytes, mode, true, target) : 1;
+    return target;
+}
+
+void as_read_block(const addrspace_t *as, addr_t start, uint8_t *dest, size_t nbytes) {
+    size_t i = 0;
+    while (i < nbytes) {
+        size_t size;
+        const uint8_t *span = as_span(as, start + i, nbytes - i, AS_READ, &size);
+        if (span != NULL) {
+            memcpy(dest + i, span, size);
+        }
+        else {
+            dest[i] = as_read(as, start + i);
+        }
+        i += size;
+    }
+}
+
+void as_write_block(const addrspace_t *as, addr_t start, const uint8_t *src, size_t nbytes) {
+    size_t i = 0;
+    while (i < nbytes) {
+        size_t size;
+        uint8_t *span = as_span(as, start + i, nbytes - i, AS_WRITE, &size);
+        if (span != NULL) {
+            memcpy(span, src + i, size);
+        }
+        else {
+            as_write(as, start + i, src[i]);
+        }
+        i += size;
+    }
+}
+
+void as_traverse(const addrspace_t *as, addr_t start, uint8_t *dest, size_t nbytes) {
+    size_t i = 0;
+    while (i < nbytes && start + i < 65536) {
+        const uint8_t *target = direct_target(as, start + i, AS_READ, false);
+        if (target == NULL) {
+            i++; // Memory that isn't present is skipped.
+            continue;
         }
+
+        const size_t size = span_size(as, start + i, nbytes - i, AS_READ, false, target);
+        memcpy(dest + i, target, size);
+        i += size;
     }
-    return result;
 }
 
 void as_print(const addrspace_t *as) {
-    for (int i = 0; i < N_SEGS; i++) {
-        const mem_seg_t *head = as->segs[i];
-        for (const mem_seg_t *seg = head; seg != NULL; seg = seg->next) {
-            printf("$%.4x - $%.4x -> 0x%p\n", seg->start, seg->end, seg->target);
+    uint32_t start = 0;
+    as_entry_t first = seg_entry(as, 0);
+    for (uint32_t vaddr = 1; vaddr <= 65536; vaddr++) {
+        // Find the end of each range of addresses that map to contiguous memory.
+        if (vaddr < 65536) {
+            const as_entry_t entry = seg_entry(as, vaddr);
+            if (first.target != NULL && entry.target == first.target + (vaddr - start) && entry.mode == first.mode)
+                continue;
+            if (first.target == NULL && entry.target == NULL)
+                continue;
+        }
+
+        if (first.target != NULL) {
+            printf("$%.4x - $%.4x -> 0x%p\n", start, vaddr, first.target);
+        }
+        if (vaddr < 65536) {
+            start = vaddr;
+            first = seg_entry(as, vaddr);
+        }
+    }
+}
+
+static as_entry_t *split_page(as_page_t *page) {
+    if (page->bytes == NULL) {
+        const as_entry_t entry = page->entry;
+        page->bytes = malloc(PAGE_SIZE * sizeof(as_entry_t));
+        for (int i = 0; i < PAGE_SIZE; i++) {
+            page->bytes[i].target = target_at(entry.target, i);
+            page->bytes[i].offset = entry.offset + i;
+            page->bytes[i].mode = entry.mode;
+        }
+    }
+    return page->bytes;
+}
+
+static as_entry_t seg_entry(const addrspace_t *as, addr_t vaddr) {
+    const as_page_t *seg = &as->segs[PAGE(vaddr)];
+    if (seg->bytes != NULL) {
+        return seg->bytes[PAGE_OFFSET(vaddr)];
+    }
+
+    const int i = PAGE_OFFSET(vaddr);
+    as_entry_t entry = seg->entry;
+    entry.target = target_at(entry.target, i);
+    entry.offset += i;
+    return entry;
+}
+
+static void update_pages(addrspace_t *as, addr_t start, addr_t end) {
+    as->generation++;
+    for (int i = 0; i < N_PAGES; i++) {
+        const as_link_t *link = &as->links[i];
+        if (link->high < start || link->low > end)
+            continue;
+
+        as_page_t *page = &as->pages[i];
+        if (link->bytes == NULL && PAGE_OFFSET(link->base) == 0 && as->segs[PAGE(link->base)].bytes == NULL) {
+            // The page is mirrored to a page that is mapped uniformly.
+            free(page->bytes);
+            page->bytes = NULL;
+            page->entry = as->segs[PAGE(link->base)].entry;
+            continue;
+        }
+
+        // Otherwise, resolve each byte of the page separately.
+        as_entry_t *bytes = split_page(page);
+        for (int j = 0; j < PAGE_SIZE; j++) {
+            bytes[j] = seg_entry(as, link_vaddr(link, j));
         }
     }
 }
@@ -1,13 +1,70 @@
 #include <sys.h>
 #include <mappers.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
-
-static uint8_t *cpu_resolve_rule(const addrspace_t *as, addr_t vaddr, uint8_t *target, size_t offset);
-static uint8_t *ppu_resolve_rule(const addrspace_t *as, addr_t vaddr, uint8_t *target, size_t offset);
-
-static uint8_t cpu_update_rule(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode);
-static uint8_t ppu_update_rule(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode);
+#include <string.h>
+
+
+static uint8_t ppu_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+static uint8_t apu_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+static uint8_t apu_status_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+static uint8_t io_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data);
+
+static void sync_apu(void);
+static void sync_mapper(void);
+static int next_event(const handlers_t *handlers);
+static void run_to_event(handlers_t *handlers, int budget);
+static void step(handlers_t *handlers);
+static void check_irq(void);
+static void end_frame(handlers_t *handlers);
+
+static bool pure_read(addr_t vaddr);
+static bool same_state(const tframe_t *a, const tframe_t *b);
+static int skip_idle_loop(int budget);
+
+// The CPU cycle that the APU has been updated up to.
+static uint64_t apu_cycles;
+
+/**
+ * @brief The idle loop that the CPU was last found at the start of.
+ */
+static struct idle_loop {
+
+    bool        valid;          // Set if the CPU was at the start of an idle loop.
+    addr_t      pc;             // The address of the start of the loop.
+    uint32_t    generation;     // The generation of the CPU's address space when the loop was checked.
+    tframe_t    frame;          // The state of the CPU at the start of the loop.
+    uint8_t     status;         // The PPU status register at the start of the loop.
+    uint64_t    cycles;         // The CPU's cycle counter at the start of the loop.
+    int         period;         // The number of cycles taken by each iteration of the loop.
+
+} idle;
+
+// The CPU core specialised for each mapper (mappers that aren't listed use the generic core).
+static const cpu_core_t MAPPER_CORES[] = {
+    [0] = CPU_CORE_NROM,
+    [1] = CPU_CORE_MMC1,
+    [2] = CPU_CORE_UXROM,
+    [3] = CPU_CORE_CNROM,
+    [4] = CPU_CORE_MMC3,
+    [5] = CPU_CORE_MMC5,
+    [9] = CPU_CORE_MMC2,
+    [34] = CPU_CORE_INES034
+};
+
+// The APU is also brought up to date this many cycles before its frame counter steps, so that the step
+// happens at the start of a short update (as it does when the APU is updated after every instruction).
+#define APU_STEP_LEAD   8
+
+// The bits of each APU register (excluding status) that are used by the APU.
+static const uint8_t APU_REG_MASKS[] = {
+    0xFF, 0xFF, 0xFF, 0xFF,     // pulse 1
+    0xFF, 0xFF, 0xFF, 0xFF,     // pulse 2
+    0xFF, 0xFF, 0xFF, 0xFF,     // triangle
+    0x3F, 0xFF, 0x8F, 0xF8,     // noise
+    0xCF, 0x7F, 0xFF, 0xFF      // DMC
+};
 
 apu_t *apu = NULL;
 cpu_t *cpu = NULL;
@@ -15,30 +72,27 @@ ppu_t *ppu = NULL;
 prog_t *curprog = NULL;
 tv_sys_t tv_sys = TV_SYS_NTSC;
 
+// The frame that the PPU renders into (see color_convert).
+static uint16_t *framebuffer = NULL;
+
+// The number of frames that have been skipped since the last frame that was drawn.
+static int skipped = 0;
+
 void sys_poweron(void) {
     /* Create CPU and PPU. */
     apu = apu_create();
     cpu = cpu_create();
-    ppu = ppu_create();
+    framebuffer = calloc(PPU_BUFFER, sizeof(uint16_t));
+    ppu = ppu_create(framebuffer);
 
     /* Setup CPU address space. */
 
-    // Work memory.
-    for (int i = 0; i < 4; i++) {
-        as_add_segment(cpu->as, i * WMEM_SIZE, WMEM_SIZE, cpu->wmem, AS_READ | AS_WRITE);
-    }
+    // Work memory (mirrored up to $1FFF).
+    as_add_segment(cpu->as, 0x0000, WMEM_SIZE, cpu->wmem, AS_READ | AS_WRITE);
+    as_add_mirror(cpu->as, WMEM_SIZE, 0x1FFF, WMEM_SIZE, 0x0000);
 
-    // PPU memory-mapped registers.
-    for (int i = 0x2000; i < 0x4000; i += 8) {
-        as_add_segment(cpu->as, i, 1, &ppu->controller.value, AS_WRITE);
-        as_add_segment(cpu->as, i + 1, 1, &ppu->mask.value, AS_WRITE);
-        as_add_segment(cpu->as, i + 2, 1, &ppu->status.value, AS_READ);
-        as_add_segment(cpu->as, i + 3, 1, &ppu->oam_addr, AS_WRITE);
-        as_add_segment(cpu->as, i + 4, 1, &ppu->oam_data, AS_READ | AS_WRITE);
-        as_add_segment(cpu->as, i + 5, 1, &ppu->scroll, AS_WRITE);
-        as_add_segment(cpu->as, i + 6, 1, &ppu->ppu_addr, AS_WRITE);
-        as_add_segment(cpu->as, i + 7, 1, &ppu->ppu_data, AS_READ | AS_WRITE);
-    }
+    // PPU registers (mirrored every 8 bytes up to $3FFF) are only accessed through their handler, which
+    // brings the PPU up to date first.
 
     // APU registers.
     as_add_segment(cpu->as, APU_PULSE1 + 0, 1, &apu->pulse[0].reg0, AS_WRITE);
@@ -81,17 +135,15 @@ void sys_poweron(void) {
 
     /* Setup PPU address space. */
 
-    // Palette memory (not configurable by mapper).
-    for (int i = 0; i < 8; i++) {
-        addr_t offset = 0x3F00 + (i * 0x20);
-        as_add_segment(ppu->as, offset, 1, &ppu->bkg_color, AS_READ | AS_WRITE);
-        as_add_segment(ppu->as, offset + 1, 15, ppu->bkg_palette, AS_READ | AS_WRITE);
-        for (int j = 0; j < 4; j++) {
-            addr_t start = offset + 0x10 + (j << 2);
-            as_add_segment(ppu->as, start, 1, j > 0 ? &ppu->bkg_palette[j * 4 - 1] : &ppu->bkg_color, AS_READ | AS_WRITE);
-            as_add_segment(ppu->as, start + 1, 3, &ppu->spr_palette[j * 3], AS_READ | AS_WRITE);
-        }
+    // Palette memory (not configurable by mapper; mirrored every 32 bytes up to $3FFF).
+    as_add_segment(ppu->as, 0x3F00, 1, &ppu->bkg_color, AS_READ | AS_WRITE);
+    as_add_segment(ppu->as, 0x3F01, 15, ppu->bkg_palette, AS_READ | AS_WRITE);
+    for (int j = 0; j < 4; j++) {
+        addr_t start = 0x3F10 + (j << 2);
+        as_add_segment(ppu->as, start, 1, j > 0 ? &ppu->bkg_palette[j * 4 - 1] : &ppu->bkg_color, AS_READ | AS_WRITE);
+        as_add_segment(ppu->as, start + 1, 3, &ppu->spr_palette[j * 3], AS_READ | AS_WRITE);
     }
+    as_add_mirror(ppu->as, 0x3F20, 0x3FFF, 0x20, 0x3F00);
 
     // Nametables are mirrored (i.e. $3000-$3EFF is a mirror of $2000-$2EFF).
     as_add_mirror(ppu->as, 0x3000, 0x3EFF, 0, 0x2000);
@@ -101,18 +153,19 @@ void sys_poweron(void) {
     as_add_mirror(ppu->as, 0x8000, 0xBFFF, 0, 0x0000);
     as_add_mirror(ppu->as, 0xC000, 0xFFFF, 0, 0x0000);
 
-    /* Set address space resolve and update rules. */
-    as_set_resolve_rule(cpu->as, cpu_resolve_rule);
-    as_set_resolve_rule(ppu->as, ppu_resolve_rule);
-    
-    as_set_update_rule(cpu->as, cpu_update_rule);
-    as_set_update_rule(ppu->as, ppu_update_rule);
+    /* Attach handlers to memory-mapped registers. */
+    as_add_handler(cpu->as, 0x2000, 0x3FFF, ppu_reg_handler, NULL, AS_READ | AS_WRITE);
+    as_add_handler(cpu->as, APU_PULSE1, APU_DMC + 0x03, apu_reg_handler, NULL, AS_WRITE);
+    as_add_handler(cpu->as, APU_STATUS, APU_STATUS, apu_status_handler, NULL, AS_READ | AS_WRITE);
+    as_add_handler(cpu->as, OAM_DMA, OAM_DMA, io_reg_handler, NULL, AS_WRITE);
+    as_add_handler(cpu->as, JOYPAD1, JOYPAD2, io_reg_handler, NULL, AS_READ | AS_WRITE);
 }
 
 void sys_poweroff(void) {
     apu_destroy(apu);
     cpu_destroy(cpu);
     ppu_destroy(ppu);
+    free(framebuffer);
     curprog = NULL;
 }
 
@@ -136,11 +189,28 @@ void sys_insert(prog_t *prog) {
 
     // Invoke the mapper to initialize the address space.
     mapper_insert(prog->mapper, prog);
+
+    // Let the CPU know where PRG-ROM is (so that code in PRG-ROM can be cached).
+    cpu_set_rom(cpu, (const uint8_t *)prog->prg_rom, prog->header.prg_rom_size * INES_PRG_ROM_UNIT);
+
+    // Let the PPU know where CHR-ROM and CHR-RAM are (so that their tiles can be cached).
+    ppu_set_chr(ppu, (const uint8_t *)prog->chr_rom, prog->header.chr_rom_size * INES_CHR_ROM_UNIT, prog->chr_ram, sizeof(prog->chr_ram));
+
+    // Run the CPU with the core that is specialised for the program's mapper.
+    const int n_cores = sizeof(MAPPER_CORES) / sizeof(MAPPER_CORES[0]);
+    cpu_set_core(cpu, prog->header.mapper_no < n_cores ? MAPPER_CORES[prog->header.mapper_no] : CPU_CORE_GENERIC);
+
+    // Bring the rest of the system up to date before the mapper switches banks.
+    prog->mapper->sync = sync_mapper;
 }
 
 void sys_run(handlers_t *handlers) {
     // Reset the CPU (so the program counter is set correctly).
     cpu_reset(cpu);
+
+    // The rest of the system is brought up to date with the CPU lazily.
+    ppu->cycle = cpu->cycles;
+    apu_cycles = cpu->cycles;
     
     // Run the program.
     handlers->running = true;
@@ -151,399 +221,466 @@ void sys_run(handlers_t *handlers) {
             continue;
         }
 
-        // Record the old state of the NMI enable flag as enabling it while VBL flag is set should delay NMI for one instruction.
-        bool nmi_delay = !ppu->status.vblank || !ppu->controller.nmi;
-
-        int cycles;
-        if (cpu->oam_upload) {
-            const addr_t offset = cpu->oam_dma << 8;
-            for (int i = 0; i < 256; i++) {
-                ppu->oam[(ppu->oam_addr + i) & 0xFF] = as_read(cpu->as, offset + i);
-            }
-            cycles = 513 + (cpu->cycles % 2); // Add 1 cycle on odd CPU cycle.
-            cpu->oam_upload = false;
+        // Run the CPU on its own until the next event, or run a single instruction in lockstep with the rest of
+        // the system if something needs to be looked at after every instruction.
+        const int budget = next_event(handlers);
+        if (budget > 0) {
+            run_to_event(handlers, budget);
         }
         else {
-            // Fetch and decode the next instruction.
-            uint8_t opc = cpu_fetch(cpu);
-            operation_t ins = cpu_decode(cpu, opc);
+            step(handlers);
+        }
+    }
+}
 
-            // Handle any events that occur before the instruction is executed.
-            if (handlers->before_execute != NULL) {
-                handlers->before_execute(ins);
-            }
+/**
+ * @brief Updates the APU up to the start of the CPU's current instruction.
+ */
+static void sync_apu(void) {
+    if (cpu->cycles > apu_cycles) {
+        apu_update(apu, cpu->as, cpu->cycles - apu_cycles);
+        apu_cycles = cpu->cycles;
+    }
+}
 
-            // Execute the instruction.
-            cycles = cpu_execute(cpu, ins);
-            
-            // Handle any events that occur after the instruction is executed.
-            if (handlers->after_execute != NULL) {
-                handlers->after_execute(ins);
-            }
+/**
+ * @brief Brings the rest of the system up to date before the mapper sees a write (which may switch the
+ * banks that the PPU and DMC read from, or arm an IRQ).
+ */
+static void sync_mapper(void) {
+    ppu_sync(ppu, cpu->cycles);
+    sync_apu();
+    cpu_stop(cpu);
+}
+
+/**
+ * @brief Gets the number of cycles that the CPU can run for on its own before the rest of the system has
+ * to be looked at (i.e. before an interrupt may occur or the frame is completed). Anything that the CPU
+ * accesses in the meantime is brought up to date by the I/O handlers, and any write that may bring an
+ * event forward stops the CPU early.
+ * 
+ * @param handlers The emulator's handlers.
+ * @return The number of cycles until the next event, or 0 if the next instruction has to be run in lockstep.
+ */
+static int next_event(const handlers_t *handlers) {
+    // Handlers that see every instruction, OAM DMA and polling the controllers need the rest of the system to
+    // be updated after every instruction, as does a mapper IRQ that is waiting to be taken.
+    if (handlers->before_execute != NULL || handlers->after_execute != NULL || cpu->oam_upload || cpu->jp_strobe)
+        return 0;
+    if (curprog->mapper->irq)
+        return 0;
+
+    // The frame is completed by the instruction that renders the first cycle of vblank (an NMI at the start of
+    // vblank can't occur any earlier).
+    int budget = ppu_next_vblank(ppu) / 3 + 1;
+
+    // An NMI occurs after the first instruction that starts once NMI is no longer suppressed.
+    if (ppu->status.vblank && ppu->controller.nmi && !ppu->nmi_occurred) {
+        const int nmi = (ppu->nmi_suppress + 2) / 3;
+        if (nmi < budget) {
+            budget = nmi;
         }
+    }
 
-        // Cycle the mapper.
-        mapper_cycle(curprog->mapper, curprog, cycles);  
+    // The APU's frame counter steps (which is when the frame IRQ occurs).
+    int step = apu_next_step(apu);
+    if (step > APU_STEP_LEAD) {
+        step -= APU_STEP_LEAD;
+    }
+    if (step < budget) {
+        budget = step;
+    }
 
-        // Cycle the APU.
-        apu_update(apu, cpu->as, cycles);
+    // The mapper may raise an IRQ while the PPU renders (the IRQ is taken after the instruction that follows the one
+    // that raised it, so the instruction that renders the deadline can be the last one).
+    const int irq = mapper_next_irq(curprog->mapper, curprog, ppu);
+    if (irq == 0)
+        return 0;
+    if (irq != INT_MAX && irq / 3 + 1 < budget) {
+        budget = irq / 3 + 1;
+    }
 
-        // Check for IRQ.
-        if ((apu->irq_flag || curprog->mapper->irq) && !cpu->frame.sr.irq) {
-            curprog->mapper->irq = false;
-            cpu_irq(cpu);
-        }
-        apu->irq_flag = false;
+    return budget;
+}
 
-        // Check for NMI.
-        if (ppu->status.vblank && ppu->controller.nmi && !(nmi_delay && ppu->controller.nmi) && !ppu->nmi_suppress && !ppu->nmi_occurred) {
-            ppu->nmi_occurred = true;
-            cpu_nmi(cpu);
-        }
+/**
+ * @brief Runs the CPU until the given number of cycles has elapsed (or until an I/O handler stops it), then
+ * brings the rest of the system up to date. Only the last instruction can have caused an event.
+ * 
+ * @param handlers The emulator's handlers.
+ * @param budget The number of cycles until the next event.
+ */
+static void run_to_event(handlers_t *handlers, int budget) {
+    // Fast-forward through idle loops.
+    budget = skip_idle_loop(budget);
+    const uint64_t start = cpu->cycles;
+    if (budget > 0) {
+        cpu_run(cpu, budget);
+    }
 
-        // Increment the CPU's cycle counter.
-        cpu->cycles += cycles;
+    // Cycle the mapper.
+    mapper_cycle(curprog->mapper, curprog, cpu->cycles - start);
 
-        // Cycle the PPU.
-        ppu_render(ppu, cycles * 3);
-        if (ppu->vbl_occurred) {
-            handlers->update_screen(ppu->out);
-            ppu->vbl_occurred = false;
-        }
+    // Update the APU and check for IRQ.
+    sync_apu();
+    check_irq();
 
-        // Check for input.
-        if (cpu->jp_strobe) {
-            cpu->joypad1_t = handlers->poll_input_p1();
-            cpu->joypad2_t = handlers->poll_input_p2();
-        }
+    // Render the PPU (an NMI can't occur until the next instruction).
+    ppu_sync(ppu, cpu->cycles);
+    end_frame(handlers);
 
-        // Store the state of next key to be checked in the joypad I/O registers.
-        cpu->joypad1 = cpu->joypad1_t & 0x01;
-        cpu->joypad2 = cpu->joypad2_t & 0x01;
-    }
+    // Writing to the joypad registers (which stops the CPU) overwrites the next key to be checked.
+    cpu->joypad1 = cpu->joypad1_t & 0x01;
+    cpu->joypad2 = cpu->joypad2_t & 0x01;
 }
 
-static uint8_t *cpu_resolve_rule(const addrspace_t *as, addr_t vaddr, uint8_t *target, size_t offset) {
-    // Let the mapper remap PRG-ROM and PRG-RAM.
-    if (vaddr >= PRG_RAM_START && vaddr < PRG_ROM_START) {
-        target = curprog->mapper->map_ram(curprog->mapper, curprog, vaddr, target, offset);
+/**
+ * @brief Runs a single instruction (or OAM DMA) in lockstep with the rest of the system.
+ * 
+ * @param handlers The emulator's handlers.
+ */
+static void step(handlers_t *handlers) {
+    // Record the old state of the NMI enable flag as enabling it while VBL flag is set should delay NMI for one instruction.
+    bool nmi_delay = !ppu->status.vblank || !ppu->controller.nmi;
+
+    // The NMI is signalled when the VBL flag is set, so reading PPUSTATUS during the instruction doesn't cancel it.
+    const bool vblank = ppu->status.vblank;
+
+    // Idle loops can only be skipped if the handlers don't need to see every instruction.
+    const addr_t last_pc = cpu->frame.pc;
+    bool skip_idle = false;
+
+    int cycles;
+    if (cpu->oam_upload) {
+        // Copy the page into OAM (wrapping around to the start of OAM from the current OAM address).
+        uint8_t page[256];
+        as_read_block(cpu->as, cpu->oam_dma << 8, page, sizeof(page));
+        memcpy(ppu->oam + ppu->oam_addr, page, sizeof(page) - ppu->oam_addr);
+        memcpy(ppu->oam, page + sizeof(page) - ppu->oam_addr, ppu->oam_addr);
+        cycles = 513 + (cpu->cycles % 2); // Add 1 cycle on odd CPU cycle.
+        cpu->oam_upload = false;
+        cpu->cycles += cycles;
     }
-    else if (vaddr >= PRG_ROM_START) {
-        target = curprog->mapper->map_prg(curprog->mapper, curprog, vaddr, target, offset);
+    else if (handlers->before_execute == NULL && handlers->after_execute == NULL) {
+        // Run the next instruction with the threaded core (this advances the CPU's cycle counter).
+        cycles = cpu_run(cpu, 1);
+        skip_idle = true;
     }
+    else {
+        // Fetch and decode the next instruction.
+        uint8_t opc = cpu_fetch(cpu);
+        operation_t ins = cpu_decode(cpu, opc);
 
-    return target;
-}
+        // Handle any events that occur before the instruction is executed.
+        if (handlers->before_execute != NULL) {
+            handlers->before_execute(ins);
+        }
 
-static uint8_t *ppu_resolve_rule(const addrspace_t *as, addr_t vaddr, uint8_t *target, size_t offset) {
-    // Let the mapper remap CHR-ROM (i.e. pattern tables) and nametaables.
-    if (vaddr < NAMETABLE0) {
-        target = curprog->mapper->map_chr(curprog->mapper, curprog, vaddr, target, offset);
+        // Execute the instruction.
+        cycles = cpu_execute(cpu, ins);
+        cpu->cycles += cycles;
+        
+        // Handle any events that occur after the instruction is executed.
+        if (handlers->after_execute != NULL) {
+            handlers->after_execute(ins);
+        }
     }
-    else if (vaddr < NAMETABLE3 + NT_SIZE) {
-        target = curprog->mapper->map_nts(curprog->mapper, curprog, vaddr, target, offset);
+
+    // Cycle the mapper.
+    mapper_cycle(curprog->mapper, curprog, cycles);  
+
+    // Cycle the APU and check for IRQ.
+    sync_apu();
+    check_irq();
+
+    // Check for NMI.
+    if (vblank && ppu->controller.nmi && !(nmi_delay && ppu->controller.nmi) && !ppu->nmi_suppress && !ppu->nmi_occurred) {
+        ppu->nmi_occurred = true;
+        cpu_nmi(cpu);
     }
 
-    return target;
-}
+    // Cycle the PPU.
+    ppu_sync(ppu, cpu->cycles);
+    end_frame(handlers);
 
-static uint8_t cpu_update_rule(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode) {
-    bool read = mode & AS_READ;
-    bool write = mode & AS_WRITE;
+    // Check for input.
+    if (cpu->jp_strobe) {
+        cpu->joypad1_t = handlers->poll_input_p1();
+        cpu->joypad2_t = handlers->poll_input_p2();
+    }
+
+    // Store the state of next key to be checked in the joypad I/O registers.
+    cpu->joypad1 = cpu->joypad1_t & 0x01;
+    cpu->joypad2 = cpu->joypad2_t & 0x01;
 
-    // Allow the mapper to monitor writes.
-    if (write) {
-        mapper_monitor(curprog->mapper, curprog, cpu->as, vaddr, value, true);
+    // Fast-forward through idle loops (a loop can only be closed by jumping backwards).
+    if (skip_idle && cpu->frame.pc <= last_pc) {
+        skip_idle_loop(INT_MAX);
+        sync_apu();
+        apu->irq_flag = false;
+        ppu_sync(ppu, cpu->cycles);
     }
+}
 
-    if ((vaddr & 0xC000) == 0 && (vaddr & 0x2000) > 0) {
-        // PPU memory-mapped registers.
-        switch (vaddr & 0x2007) {
-            case PPU_CTRL:
-                if (write) {
-                    // Resolve the bitmask.
-                    union ppu_ctrl ctrl;
-                    ctrl.nt_addr = value & 0x03;
-                    ctrl.vram_inc = (value >> 2) & 0x01;
-                    ctrl.spt_addr = (value >> 3) & 0x01;
-                    ctrl.bpt_addr = (value >> 4) & 0x01;
-                    ctrl.spr_size = (value >> 5) & 0x01;
-                    ctrl.m_slave = (value >> 6) & 0x01;
-                    ctrl.nmi = (value >> 7) & 0x01;
-                    value = ctrl.value;
-
-                    // Set the write flag to true.
-                    ppu->ppucontrol_flags.write = 1;
-                }
-                break;
-            case PPU_MASK:
-                if (write) {
-                    // Resolve the bitmask.
-                    union ppu_mask mask;
-                    mask.grayscale = value & 0x01;
-                    mask.bkg_left = (value >> 1) & 0x01;
-                    mask.spr_left = (value >> 2) & 0x01;
-                    mask.background = (value >> 3) & 0x01;
-                    mask.sprites = (value >> 4) & 0x01;
-                    mask.em_red = (value >> 5) & 0x01;
-                    mask.em_green = (value >> 6) & 0x01;
-                    mask.em_blue = (value >> 7) & 0x01;
-                    value = mask.value;
-                }
-                break;
-            case PPU_STATUS:
-                if (read) {
-                    // Resolve the bitmask.
-                    union ppu_status status = { .value = value };
-                    value = (status.vblank << 7) | (status.hit << 6) | (status.overflow << 5);
-
-                    // Set the read flag to true.
-                    ppu->ppustatus_flags.read = 1;
-                }
-                break;
-            case PPU_SCROLL:
-                if (write) {
-                    ppu->ppuscroll_flags.write = 1;
-                }
-                break;
-            case OAM_DATA:
-                if (read) {
-                    ppu->oamdata_flags.read = 1;
-                }
-                if (write) {
-                    ppu->oamdata_flags.write = 1;
-                }
-                break;
-            case PPU_ADDR:
-                if (write) {
-                    ppu->ppuaddr_flags.write = 1;
-                }
-                break;
-            case PPU_DATA:
-                if (read) {
-                    ppu->ppudata_flags.read = 1;
-                }
-                if (write) {
-                    ppu->ppudata_flags.write = 1;
-                }
-                break;
-        }
+/**
+ * @brief Generates an IRQ if the APU or the mapper has raised one (and IRQs aren't disabled).
+ */
+static void check_irq(void) {
+    if ((apu->irq_flag || curprog->mapper->irq) && !(cpu->frame.flags & SR_INTERRUPT)) {
+        curprog->mapper->irq = false;
+        cpu_irq(cpu);
     }
-    else if (vaddr >= APU_PULSE1 && vaddr <= APU_DMC + 0x03) {
-        // APU memory-mapped registers (excluding status).
-        pulse_t pulse;
-        triangle_t triangle;
-        noise_t noise;
-        dmc_t dmc;
-        
-        if (write) {
-            // Set start flag of envelopes and reload flag of sweep units, and reset sequencers (if necessary).
-            switch (vaddr) {
-                case APU_PULSE1 + 0x01:
-                    apu->pulse[0].sweep_u.reload_flag = true;
-                    break;
-                case APU_PULSE1 + 0x03:
-                    apu->pulse[0].envelope.start_flag = true;
-                    apu->pulse[0].len_counter_reload = true;
-                    apu->pulse[0].sequencer = 0;
-                    break;
-                case APU_PULSE2 + 0x01:
-                    apu->pulse[1].sweep_u.reload_flag = true;
-                    break;
-                case APU_PULSE2 + 0x03:
-                    apu->pulse[1].envelope.start_flag = true;
-                    apu->pulse[1].len_counter_reload = true;
-                    apu->pulse[1].sequencer = 0;
-                    break;
-                case APU_TRIANGLE + 0x03:
-                    apu->triangle.lin_counter_reload = true;
-                    apu->triangle.len_counter_reload = true;
-                    break;
-                case APU_NOISE + 0x02:
-                    //apu->noise.timer_reload = true;
-                    break;
-                case APU_NOISE + 0x03:
-                    apu->noise.len_counter_reload = true;
-                    break;
-                case APU_DMC + 0x01:
-                    apu->dmc.output_reload = true;
-                    break;
-            }
+    apu->irq_flag = false;
+}
 
-            // Ensure that the correct value is put into the register after evaluating bitmasks.
-            switch (vaddr) {
-                case APU_PULSE1:
-                case APU_PULSE2:
-                    pulse.vol = value & 0x0F;
-                    pulse.cons = (value >> 4) & 0x01;
-                    pulse.loop = (value >> 5) & 0x01;
-                    pulse.duty = (value >> 6) & 0x03;
-                    value = pulse.reg0;
-                    break;
-                case APU_PULSE1 + 0x01:
-                case APU_PULSE2 + 0x01:
-                    pulse.sweep.shift = value & 0x07;
-                    pulse.sweep.negate = (value >> 3) & 0x01;
-                    pulse.sweep.period = (value >> 4) & 0x07;
-                    pulse.sweep.enabled = (value >> 7) & 0x01;
-                    value = pulse.reg1;
-                    break;
-                case APU_PULSE1 + 0x02:
-                case APU_PULSE2 + 0x02:
-                    pulse.timer_low = value;
-                    value = pulse.reg2;
-                    break;
-                case APU_PULSE1 + 0x03:
-                case APU_PULSE2 + 0x03:
-                    pulse.timer_high = value & 0x07;
-                    pulse.len_counter_load = value >> 3;
-                    value = pulse.reg3;
-                    break;
-                case APU_TRIANGLE:
-                    triangle.lin_counter_load = value & 0x7F;
-                    triangle.loop = value >> 7;
-                    value = triangle.reg0;
-                    break;
-                case APU_TRIANGLE + 0x02:
-                    triangle.timer_low = value;
-                    value = triangle.reg2;
-                    break;
-                case APU_TRIANGLE + 0x03:
-                    triangle.timer_high = value & 0x07;
-                    triangle.len_counter_load = value >> 3;
-                    value = triangle.reg3;
-                    break;
-                case APU_NOISE:
-                    noise.vol = value & 0x0F;
-                    noise.cons = (value >> 4) & 0x01;
-                    noise.loop = (value >> 5) & 0x01;
-                    value = noise.reg0;
-                    break;
-                case APU_NOISE + 0x02:
-                    noise.period = value & 0x0F;
-                    noise.mode = value >> 7;
-                    value = noise.reg2;
-                    break;
-                case APU_NOISE + 0x03:
-                    noise.len_counter_load = value >> 3;
-                    value = noise.reg3;
-                    break;
-                case APU_DMC:
-                    dmc.rate = value & 0x0F;
-                    dmc.loop = (value >> 6) & 0x01;
-                    dmc.irq = (value >> 7) & 0x01;
-                    value = dmc.reg0;
-                    break;
-                case APU_DMC + 0x01:
-                    dmc.load = value & 0x7F;
-                    value = dmc.reg1;
-                    break;
-                case APU_DMC + 0x02:
-                    dmc.addr = value;
-                    value = dmc.reg2;
-                    break;
-                case APU_DMC + 0x03:
-                    dmc.length = value;
-                    value = dmc.reg3;
-                    break;
-            }
+/**
+ * @brief Decides whether the next frame should be skipped (its pixels aren't output, but everything that
+ * the program can observe, such as sprite 0 hit, is still emulated exactly).
+ * 
+ * @param handlers The emulator's handlers.
+ * @return Set if the next frame should be skipped.
+ */
+static bool skip_frame(const handlers_t *handlers) {
+    if (handlers->frame_skip != FRAME_SKIP_AUTO)
+        return skipped < handlers->frame_skip;
+
+    // The APU blocks while it is far enough ahead of the audio output, so emulation is behind real time if
+    // less than that is buffered (a frame is about half of it). Some frames are still drawn.
+    const int buffered = (MIXER_BUFFER + apu->out.prod - apu->out.cons) % MIXER_BUFFER;
+    return buffered < MIXER_MAX_DELTA / 2 && skipped < FRAME_SKIP_MAX;
+}
+
+/**
+ * @brief Flushes the frame to the screen if the PPU has just entered vblank (unless the frame was skipped),
+ * and decides whether to skip the next frame.
+ * 
+ * @param handlers The emulator's handlers.
+ */
+static void end_frame(handlers_t *handlers) {
+    if (ppu->vbl_occurred) {
+        if (!ppu->skip) {
+            handlers->update_screen(framebuffer);
+            skipped = 0;
         }
         else {
-            // APU registers are not meant to be read from, so just return a value of 0.
-            value = 0x00;
+            skipped++;
         }
+        ppu->vbl_occurred = false;
+        ppu->skip = skip_frame(handlers);
     }
-    else if (vaddr == APU_STATUS) {
-        union apu_status status;
-        if (write) {
-            // Set the channel status flags.
-            status.p1 = (value & 0x01) > 0;
-            status.p2 = (value & 0x02) > 0;
-            status.tri = (value & 0x04) > 0;
-            status.noise = (value & 0x08) > 0;
-            status.dmc = (value & 0x10) > 0;
-            
-            // Writing doesn't change frame interrupt flag.
-            status.f_irq = apu->status.f_irq;
-
-            // Writing clears DMC interrupt flag.
-            status.d_irq = false;
-
-            // Restart the DMC sample if necessary.
-            if (status.dmc) {
-                apu->dmc.start_flag = true;
-            }
-
-            value = status.value;
-        }
-        else if (read) {
-            // Set the channel status flags if its respective length counter is greater than 0.
-            status.p1 = apu->pulse[0].len_counter > 0;
-            status.p2 = apu->pulse[1].len_counter > 0;
-            status.tri = apu->triangle.len_counter > 0;
-            status.noise = apu->noise.len_counter > 0;
+}
 
-            // Set the DMC status flag if its bytes remaining is greater than 0.
-            status.dmc = apu->dmc.bytes_remaining > 0;
+static uint8_t ppu_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    const addr_t reg = vaddr & 0x2007;
 
-            // Set the interrupt flags.
-            status.f_irq = apu->status.f_irq;
-            status.d_irq = apu->status.d_irq;
+    // Render the PPU up to this instruction, so that the access sees (and takes effect from) the current state of the PPU.
+    ppu_sync(ppu, cpu->cycles);
 
-            // Reading clears the frame interrupt flag.
-            apu->status.f_irq = false;
+    if (mode & AS_WRITE) {
+        ppu_write(ppu, reg, value);
 
-            // Return the correct value.
-            value = (status.d_irq << 7) | (status.f_irq << 6) | (status.dmc << 4) | (status.noise << 3) | (status.tri << 2) | (status.p2 << 1) | status.p1;
+        // Enabling NMI may cause one straight away.
+        if (reg == PPU_CTRL) {
+            cpu_stop(cpu);
         }
     }
     else {
-        switch (vaddr) {
-            case OAM_DMA:
-                cpu->oam_upload = true;
-                break;
-            case JOYPAD1:
-                if (write) {
-                    cpu->jp_strobe = (value & 0x01) > 0;
-                }
-                else if (read) {
-                    cpu->joypad1_t = 0x80 | (cpu->joypad1_t >> 1);
-                }
-                break;
-            case JOYPAD2:
-                if (write) {
-                    // This is the APU frame counter.
-                    apu->frame.mode = (value & 0x80) > 0;
-                    apu->frame.irq = (value & 0x40) > 0;
-                    apu->frame_reset = 3 + apu->cyc_carry;
-                    
-                    // If the interrupt inhibit flag gets set, then clear the frame interrupt flag.
-                    if (apu->frame.irq) {
-                        apu->status.f_irq = false;
-                    }
-                }
-                else if (read) {
-                    // This is the input from Joypad 2.
-                    cpu->joypad2_t = 0x80 | (cpu->joypad2_t >> 1);
-                }
-                break;
-        }
+        value = ppu_read(ppu, reg);
     }
 
-    // Allow the mapper to monitor reads.
-    if (read) {
-        mapper_monitor(curprog->mapper, curprog, cpu->as, vaddr, value, false);
+    // Accessing PPU memory through PPUDATA may clock the mapper's IRQ counter (which brings its IRQ forward).
+    if (reg == PPU_DATA && curprog->mapper->irq_armed) {
+        cpu_stop(cpu);
     }
-
-    //printf("cpu %c: $%.4x - %.2x\n", write ? 'w' : 'r', vaddr, value);
     return value;
 }
 
-static uint8_t ppu_update_rule(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode) {
-    // Allow the mapper to monitor reads and writes.
+static uint8_t apu_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    // Update the APU up to this instruction (the new value takes effect from this instruction onwards), and stop
+    // the CPU so that the next event is found again (a DMC sample may raise an IRQ).
+    sync_apu();
+    cpu_stop(cpu);
+
+    // Set start flag of envelopes and reload flag of sweep units, and reset sequencers (if necessary).
+    switch (vaddr) {
+        case APU_PULSE1 + 0x01:
+            apu->pulse[0].sweep_u.reload_flag = true;
+            break;
+        case APU_PULSE1 + 0x03:
+            apu->pulse[0].envelope.start_flag = true;
+            apu->pulse[0].len_counter_reload = true;
+            apu->pulse[0].sequencer = 0;
+            break;
+        case APU_PULSE2 + 0x01:
+            apu->pulse[1].sweep_u.reload_flag = true;
+            break;
+        case APU_PULSE2 + 0x03:
+            apu->pulse[1].envelope.start_flag = true;
+            apu->pulse[1].len_counter_reload = true;
+            apu->pulse[1].sequencer = 0;
+            break;
+        case APU_TRIANGLE + 0x03:
+            apu->triangle.lin_counter_reload = true;
+            apu->triangle.len_counter_reload = true;
+            break;
+        case APU_NOISE + 0x02:
+            //apu->noise.timer_reload = true;
+            break;
+        case APU_NOISE + 0x03:
+            apu->noise.len_counter_reload = true;
+            break;
+        case APU_DMC + 0x01:
+            apu->dmc.output_reload = true;
+            break;
+    }
+
+    // Clear any bits that aren't used by the register.
+    return value & APU_REG_MASKS[vaddr - APU_PULSE1];
+}
+
+static uint8_t apu_status_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    // Update the APU up to this instruction.
+    sync_apu();
+
+    if (mode & AS_WRITE) {
+        // Enabling or disabling the DMC may change when the next IRQ occurs.
+        cpu_stop(cpu);
+
+        // Restart the DMC sample if necessary.
+        if (value & 0x10) {
+            apu->dmc.start_flag = true;
+        }
+
+        // Set the channel status flags. Writing doesn't change the frame interrupt flag and clears the DMC interrupt flag.
+        return (value & 0x1F) | (apu->status.f_irq << 6);
+    }
+
+    // Set the channel status flags if its respective length counter is greater than 0.
+    union apu_status status = { .value = 0 };
+    status.p1 = apu->pulse[0].len_counter > 0;
+    status.p2 = apu->pulse[1].len_counter > 0;
+    status.tri = apu->triangle.len_counter > 0;
+    status.noise = apu->noise.len_counter > 0;
+
+    // Set the DMC status flag if its bytes remaining is greater than 0.
+    status.dmc = apu->dmc.bytes_remaining > 0;
+
+    // Set the interrupt flags.
+    status.f_irq = apu->status.f_irq;
+    status.d_irq = apu->status.d_irq;
+
+    // Reading clears the frame interrupt flag.
+    apu->status.f_irq = false;
+
+    return status.value;
+}
+
+static uint8_t io_reg_handler(const addrspace_t *as, addr_t vaddr, uint8_t value, uint8_t mode, void *data) {
+    bool read = mode & AS_READ;
     bool write = mode & AS_WRITE;
-    mapper_monitor(curprog->mapper, curprog, ppu->as, vaddr, value, write);
 
-    //printf("ppu %c: $%.4x - %.2x\n", write ? 'w' : 'r', vaddr, value);
+    switch (vaddr) {
+        case OAM_DMA:
+            // The DMA is run in lockstep with the PPU.
+            ppu_sync(ppu, cpu->cycles);
+            cpu->oam_upload = true;
+            cpu_stop(cpu);
+            break;
+        case JOYPAD1:
+            if (write) {
+                cpu->jp_strobe = (value & 0x01) > 0;
+                cpu_stop(cpu);
+            }
+            else if (read) {
+                // Shift the next key into the register (it may be read again before the system is updated).
+                cpu->joypad1_t = 0x80 | (cpu->joypad1_t >> 1);
+                cpu->joypad1 = cpu->joypad1_t & 0x01;
+            }
+            break;
+        case JOYPAD2:
+            if (write) {
+                // This is the APU frame counter (which is reset from this instruction onwards).
+                sync_apu();
+                cpu_stop(cpu);
+                apu->frame.mode = (value & 0x80) > 0;
+                apu->frame.irq = (value & 0x40) > 0;
+                apu->frame_reset = 3 + apu->cyc_carry;
+                
+                // If the interrupt inhibit flag gets set, then clear the frame interrupt flag.
+                if (apu->frame.irq) {
+                    apu->status.f_irq = false;
+                }
+            }
+            else if (read) {
+                // This is the input from Joypad 2.
+                cpu->joypad2_t = 0x80 | (cpu->joypad2_t >> 1);
+                cpu->joypad2 = cpu->joypad2_t & 0x01;
+            }
+            break;
+    }
+
     return value;
 }
+
+static bool pure_read(addr_t vaddr) {
+    // Reading PPUSTATUS clears the VBL flag and the write toggle, so reading it again has no further effect.
+    return vaddr >= 0x2000 && vaddr < 0x4000 && (vaddr & 0x2007) == PPU_STATUS;
+}
+
+static bool same_state(const tframe_t *a, const tframe_t *b) {
+    return a->pc == b->pc && a->ac == b->ac && a->x == b->x && a->y == b->y && a->sp == b->sp && get_sr(a) == get_sr(b);
+}
+
+static int skip_idle_loop(int budget) {
+    bool confirm = false;
+    if (idle.pc != cpu->frame.pc || idle.generation != as_generation(cpu->as)) {
+        // Check whether the CPU is at the start of an idle loop (this is only done again if the address space changes).
+        idle.period = cpu_idle_loop(cpu, pure_read);
+        idle.valid = idle.period > 0;
+        idle.pc = cpu->frame.pc;
+        idle.generation = as_generation(cpu->as);
+        confirm = idle.valid;
+    }
+    else if (idle.valid && cpu->cycles - idle.cycles == idle.period && same_state(&idle.frame, &cpu->frame)
+            && idle.status == ppu->status.value) {
+        // The last iteration of the loop left the CPU unchanged (and nothing it may read has changed since), so every
+        // iteration after it will do the same until something that the loop reads changes or an interrupt occurs. Find
+        // the next event that the loop could observe (IRQs can't occur while they are disabled).
+        int horizon = budget;
+        if (ppu_next_event(ppu) / 3 < horizon) {
+            horizon = ppu_next_event(ppu) / 3;
+        }
+        if (apu_next_step(apu) < horizon) {
+            horizon = apu_next_step(apu);
+        }
+        if (!(cpu->frame.flags & SR_INTERRUPT)) {
+            const int irq = mapper_next_irq(curprog->mapper, curprog, ppu);
+            if (curprog->mapper->irq || irq == 0) {
+                horizon = 0;
+            }
+            else if (irq != INT_MAX && irq / 3 < horizon) {
+                horizon = irq / 3;
+            }
+            if (apu_next_event(apu) < horizon) {
+                horizon = apu_next_event(apu);
+            }
+        }
+
+        // Skip every iteration up to the event in one step (the last iteration before the event is run normally). The
+        // caller brings the rest of the system up to date.
+        const int cycles = (horizon / idle.period - 1) * idle.period;
+        if (cycles > 0) {
+            mapper_cycle(curprog->mapper, curprog, cycles);
+            cpu->cycles += cycles;
+            budget -= cycles;
+        }
+        confirm = true;
+    }
+
+    idle.frame = cpu->frame;
+    idle.status = ppu->status.value;
+    idle.cycles = cpu->cycles;
+
+    // Stop after a single iteration of the loop, so that the CPU is back at the start of it when it is checked again.
+    return confirm && idle.period < budget ? idle.period : budget;
+}
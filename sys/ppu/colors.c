@@ -1,10 +1,99 @@
 #include <color.h>
+#include <stdio.h>
+#include <string.h>
 
-static color_t colors[MAX_COLOR + 1] = DEFAULT_COLORS;
+static const color_t default_colors[MAX_COLOR + 1] = DEFAULT_COLORS;
 
-color_t color_resolve(uint8_t index) {
-    if (index > MAX_COLOR) {
-        return colors[0x0F];
+/* The colors of every pixel value (4 bytes per color so that each can be copied with a single store). */
+static uint8_t colors[N_COLORS][4];
+static bool colors_ready = false;
+
+/**
+ * @brief Fills in the color table from the 64 palette colors, approximating emphasis by dimming the
+ * components that aren't emphasised.
+ * 
+ * @param base The palette colors.
+ */
+static void build_colors(const color_t *base) {
+    for (int e = 0; e < N_EMPHASIS; e++) {
+        for (int i = 0; i <= MAX_COLOR; i++) {
+            color_t c = base[i];
+
+            // Black columns aren't affected by emphasis.
+            if (e > 0 && (i & 0x0F) < 0x0E) {
+                if ((e & 0x06) != 0) c.red = c.red * 3 / 4;         // Green or blue emphasised.
+                if ((e & 0x05) != 0) c.green = c.green * 3 / 4;     // Red or blue emphasised.
+                if ((e & 0x03) != 0) c.blue = c.blue * 3 / 4;       // Red or green emphasised.
+            }
+
+            uint8_t *entry = colors[(e << COLOR_EMPHASIS_SHIFT) | i];
+            entry[0] = c.red;
+            entry[1] = c.green;
+            entry[2] = c.blue;
+            entry[3] = 0;
+        }
+    }
+    colors_ready = true;
+}
+
+color_t color_resolve(uint16_t pixel) {
+    if (!colors_ready) {
+        build_colors(default_colors);
+    }
+
+    const uint8_t *entry = colors[pixel % N_COLORS];
+    color_t result = { entry[0], entry[1], entry[2] };
+    return result;
+}
+
+void color_convert(const uint16_t *pixels, uint8_t *rgb, size_t n) {
+    if (!colors_ready) {
+        build_colors(default_colors);
     }
-    return colors[index];
+    if (n == 0)
+        return;
+
+    // Copy 4 bytes per pixel (the 4th byte is overwritten by the next pixel), except for the last one.
+    for (size_t i = 0; i < n - 1; i++) {
+        memcpy(rgb + i * COLOR_STRIDE, colors[pixels[i] % N_COLORS], 4);
+    }
+    memcpy(rgb + (n - 1) * COLOR_STRIDE, colors[pixels[n - 1] % N_COLORS], COLOR_STRIDE);
+}
+
+bool color_load(const char *path) {
+    FILE *fp = fopen(path, "rb");
+    if (fp == NULL)
+        return false;
+
+    // Read the file (which may contain up to 512 colors).
+    uint8_t data[N_COLORS * COLOR_STRIDE];
+    const size_t size = fread(data, 1, sizeof(data), fp);
+    const bool extra = fgetc(fp) != EOF;
+    fclose(fp);
+
+    if (extra)
+        return false;
+
+    if (size == (MAX_COLOR + 1) * COLOR_STRIDE) {
+        // Palette colors only.
+        color_t base[MAX_COLOR + 1];
+        for (int i = 0; i <= MAX_COLOR; i++) {
+            base[i].red = data[i * COLOR_STRIDE];
+            base[i].green = data[i * COLOR_STRIDE + 1];
+            base[i].blue = data[i * COLOR_STRIDE + 2];
+        }
+        build_colors(base);
+        return true;
+    }
+    if (size == N_COLORS * COLOR_STRIDE) {
+        // Every color (including emphasis).
+        for (int i = 0; i < N_COLORS; i++) {
+            memcpy(colors[i], &data[i * COLOR_STRIDE], COLOR_STRIDE);
+            colors[i][3] = 0;
+        }
+        colors_ready = true;
+        return true;
+    }
+
+    return false;
 }
@@ -4,8 +4,29 @@
 #include <stdlib.h>
 #include <string.h>
 
-static inline void render_cycle(ppu_t *ppu, bool rendering, bool vbl_suppress);
-static inline void sprite_evaluation(ppu_t *ppu);
+// The background is only resolved with SIMD instructions if SSSE3 is available (for byte shuffles).
+#if defined(PPU_SIMD) && !defined(__SSSE3__)
+#undef PPU_SIMD
+#endif
+
+#ifdef PPU_SIMD
+#include <tmmintrin.h>
+#endif
+
+static const line_schedule_t *get_schedule(void);
+static inline void render_dot(ppu_t *ppu, bool rendering, bool vbl_suppress);
+static void select_line(ppu_t *ppu);
+
+/**
+ * @brief Gets the position of a dot within a frame (counting from the start of the pre-render scanline).
+ * 
+ * @param y The scanline.
+ * @param x The dot within the scanline.
+ * @return The index of the dot.
+ */
+static inline int dot_index(int y, int x) {
+    return (y + 1) * (SCANLINE_END + 1) + x;
+}
 
 /**
  * @brief Gets the address of the corresponding nametable entry.
@@ -14,7 +35,7 @@ static inline void sprite_evaluation(ppu_t *ppu);
  * @return The resultant address.
  */
 static inline addr_t get_nt_addr(vram_reg_t addr) {
-    return 0x2000 | (addr.nt_y << 11) | (addr.nt_x << 10) | (addr.coarse_y << 5) | addr.coarse_x;
+    return NAMETABLE0 | (addr & (VRAM_NT_Y | VRAM_NT_X | VRAM_COARSE_Y | VRAM_COARSE_X));
 }
 
 /**
@@ -34,16 +55,64 @@ static inline addr_t get_pt_addr(pt_entry_t entry) {
  * @return The resultant attribute table address.
  */
 static inline addr_t get_at_addr(vram_reg_t addr) {
-    return 0x2000 | (addr.nt_y << 11) | (addr.nt_x << 10) | (0x0F << 6) | ((addr.coarse_y >> 2) << 3) | (addr.coarse_x >> 2);
+    return NAMETABLE0 | (addr & (VRAM_NT_Y | VRAM_NT_X)) | (0x0F << 6) | ((addr >> 4) & 0x38) | ((addr >> 2) & 0x07);
+}
+
+/**
+ * @brief Gets the address that PPUDATA accesses (the whole of the VRAM address register).
+ * 
+ * @param addr The VRAM address.
+ * @return The resultant address.
+ */
+static inline addr_t get_data_addr(vram_reg_t addr) {
+    return addr & VRAM_ADDR;
+}
+
+/**
+ * @brief Gets the host memory of a byte of the pattern tables or nametables, if it can be read directly
+ * (i.e. it is plain memory that no mapper watches reads of).
+ * 
+ * @param ppu The PPU.
+ * @param addr The address of the byte (from $0000 to $2FFF).
+ * @return The host memory of the byte, or `NULL` if it has to be read with `as_read`.
+ */
+static inline const uint8_t *fetch_ptr(ppu_t *ppu, addr_t addr) {
+    // Look up the pages again if a bank has been switched or the mirroring has changed.
+    if (ppu->page_generation != as_generation(ppu->as)) {
+        for (int i = 0; i < N_FETCH_PAGES; i++) {
+            size_t size;
+            ppu->pages[i] = as_span(ppu->as, i * FETCH_PAGE_SIZE, FETCH_PAGE_SIZE, AS_READ, &size);
+            if (size < FETCH_PAGE_SIZE) {
+                ppu->pages[i] = NULL;
+            }
+        }
+        ppu->page_generation = as_generation(ppu->as);
+    }
+
+    const uint8_t *page = ppu->pages[addr / FETCH_PAGE_SIZE];
+    return page != NULL ? page + addr % FETCH_PAGE_SIZE : NULL;
+}
+
+/**
+ * @brief Reads a byte of the pattern tables or nametables for rendering (directly from host memory
+ * unless a mapper watches reads of it).
+ * 
+ * @param ppu The PPU.
+ * @param addr The address of the byte (from $0000 to $2FFF).
+ * @return The byte at the address.
+ */
+static inline uint8_t fetch_byte(ppu_t *ppu, addr_t addr) {
+    const uint8_t *ptr = fetch_ptr(ppu, addr);
+    return ptr != NULL ? *ptr : as_read(ppu->as, addr);
 }
 
 static inline pt_entry_t fetch_nt_byte(ppu_t *ppu) {
     pt_entry_t result = {
         .table = ppu->controller.bpt_addr,
-        .fine_y = ppu->v.fine_y
+        .fine_y = ppu->v >> 12
     };
     addr_t nt_addr = get_nt_addr(ppu->v);
-    uint8_t tile = as_read(ppu->as, nt_addr);
+    uint8_t tile = fetch_byte(ppu, nt_addr);
     result.tile_x = tile & 0x0F;
     result.tile_y = (tile & 0xF0) >> 4;
     return result;
@@ -51,19 +120,50 @@ static inline pt_entry_t fetch_nt_byte(ppu_t *ppu) {
 
 static inline uint8_t fetch_at_byte(ppu_t *ppu) {
     addr_t attr_addr = get_at_addr(ppu->v);
-    uint8_t attr = as_read(ppu->as, attr_addr);
-    if ((ppu->v.coarse_x & 0x02) > 0)
-        attr >>= 2;
-    if ((ppu->v.coarse_y & 0x02) > 0)
-        attr >>= 4;
-    return attr & 0x03;
+    uint8_t attr = fetch_byte(ppu, attr_addr);
+
+    // Bit 1 of coarse x selects the right half of the attribute's area, and bit 1 of coarse y the bottom half.
+    return (attr >> (((ppu->v >> 4) & 0x04) | (ppu->v & 0x02))) & 0x03;
 }
 
-static inline void put_pixel(ppu_t *ppu, int screen_x, int screen_y, color_t color) {
-    int index = (screen_x + screen_y * SCREEN_WIDTH) * PIXEL_STRIDE;
-    ppu->out[index + OUT_R] = color.red;
-    ppu->out[index + OUT_G] = color.green;
-    ppu->out[index + OUT_B] = color.blue;
+/**
+ * @brief Fetches both bit planes of a row of a tile and decodes its pixels.
+ * 
+ * @param ppu The PPU.
+ * @param addr The pattern table address of the row's low bit plane.
+ * @param flip Set if the row should be flipped horizontally.
+ * @param planes The bit planes of the row.
+ * @param pixels The pixels of the row (8 bytes; may be `NULL` if the pixels aren't needed).
+ */
+static inline void fetch_row(ppu_t *ppu, addr_t addr, bool flip, uint8_t *planes, uint8_t *pixels) {
+    const uint8_t *row = fetch_ptr(ppu, addr);
+    if (row == NULL) {
+        // The fetches may be watched by the mapper.
+        planes[0] = as_read(ppu->as, addr);
+        planes[1] = as_read(ppu->as, addr + 0x08);
+        if (pixels != NULL) {
+            tc_decode(planes[0], planes[1], flip, pixels);
+        }
+        return;
+    }
+
+    planes[0] = row[0];
+    planes[1] = row[0x08];
+    if (pixels != NULL) {
+        const uint8_t *decoded = tc_row(ppu->tiles, row, flip);
+        if (decoded != NULL) {
+            memcpy(pixels, decoded, 8);
+        }
+        else {
+            tc_decode(planes[0], planes[1], flip, pixels);
+        }
+    }
+}
+
+static inline void put_pixel(ppu_t *ppu, int screen_x, int screen_y, uint8_t col_index) {
+    // Greyscale only keeps the column of the palette; the emphasis bits are output with the pixel.
+    const uint8_t mask = ppu->mask.grayscale ? 0x30 : MAX_COLOR;
+    ppu->out[screen_x + screen_y * SCREEN_WIDTH] = (col_index & mask) | ((ppu->mask.value >> 5) << COLOR_EMPHASIS_SHIFT);
 }
 
 static inline bool sprite_in_range(ppu_t *ppu, uint8_t sprite_y) {
@@ -71,67 +171,118 @@ static inline bool sprite_in_range(ppu_t *ppu, uint8_t sprite_y) {
 }
 
 static inline void inc_vram_addr(ppu_t *ppu, vram_reg_t *addr) {
-    if (!ppu->controller.vram_inc) {
-        addr->coarse_x++;
-    }
-    if (ppu->controller.vram_inc || addr->coarse_x == 0) {
-        addr->coarse_y++;
-        if (addr->coarse_y == 0) {
-            addr->nt_x++;
-            if (addr->nt_x == 0) {
-                addr->nt_y++;
-                if (addr->nt_y == 0) {
-                    addr->fine_y++;
-                    if (addr->fine_y == 0) {
-                        if (!ppu->controller.vram_inc) {
-                            addr->coarse_x = 0;
-                        }
-                        addr->coarse_y = 0;
-                        addr->nt_x = 0;
-                        addr->nt_y = 0;
-                        addr->fine_y = 0;
-                    }
-                }
-            }
-        }
-    }
+    // The whole register is incremented (carrying from coarse x into coarse y, and so on).
+    *addr = (*addr + (ppu->controller.vram_inc ? NT_COLS : 1)) & VRAM_ADDR;
 }
 
 static inline void inc_vram_x(vram_reg_t *addr) {
-    if (addr->coarse_x < 31) {
-        addr->coarse_x++;
+    if ((*addr & VRAM_COARSE_X) < 31) {
+        (*addr)++;
     }
     else {
-        addr->coarse_x = 0;
-        addr->nt_x = !addr->nt_x;
+        *addr = (*addr & ~VRAM_COARSE_X) ^ VRAM_NT_X;
     }
 }
 
 static inline void inc_vram_y(vram_reg_t *addr) {
-    if (addr->fine_y < 7) {
-        addr->fine_y++;
+    if ((*addr & VRAM_FINE_Y) < VRAM_FINE_Y) {
+        *addr += 0x1000;
+        return;
+    }
+
+    *addr &= ~VRAM_FINE_Y;
+    const int coarse_y = (*addr & VRAM_COARSE_Y) >> 5;
+    if (coarse_y == 29) {
+        *addr = (*addr & ~VRAM_COARSE_Y) ^ VRAM_NT_Y;
+    }
+    else if (coarse_y == 31) {
+        *addr &= ~VRAM_COARSE_Y;
     }
     else {
-        addr->fine_y = 0;
-        if (addr->coarse_y == 29) {
-            addr->coarse_y = 0;
-            addr->nt_y = !addr->nt_y;
-        }
-        else if (addr->coarse_y == 31) {
-            addr->coarse_y = 0;
-        }
-        else {
-            addr->coarse_y++;
-        }
+        *addr += 0x0020;
+    }
+}
+
+/**
+ * @brief Draws the sprite pixel (if any) at the given x-coordinate of the current scanline over a
+ * background pixel, and checks for sprite 0 hit (sprites must be shown at the x-coordinate).
+ * 
+ * @param ppu The PPU.
+ * @param screen_x The x-coordinate of the pixel.
+ * @param opaque Set if the background pixel is opaque (and shown).
+ * @param col_index The color of the background pixel.
+ * @return The color of the pixel.
+ */
+static inline uint8_t merge_sprite(ppu_t *ppu, uint8_t screen_x, bool opaque, uint8_t col_index) {
+    // Only the front-most opaque sprite pixel matters.
+    const uint8_t spr = ppu->spr_line[screen_x];
+    if (!(spr & SPR_PIXEL))
+        return col_index;
+
+    // Check if the sprite 0 hit flag should be updated.
+    if ((spr & SPR_ZERO) && opaque && ppu->szc && screen_x != 255) {
+        ppu->status.hit = 1;
     }
+
+    // If there is an opaque background pixel and the sprite's priority bit is set, then the background pixel is drawn.
+    if (opaque && (spr & SPR_BEHIND))
+        return col_index;
+
+    return ppu->spr_palette[((spr & SPR_PALETTE) >> 2) * 3 + (spr & SPR_PIXEL) - 1];
 }
 
-ppu_t *ppu_create(void) {
-    // Create the PPU.
-    ppu_t *ppu = malloc(sizeof(struct ppu));
+/**
+ * @brief Checks if sprite 0 hit may occur on the current scanline (i.e. sprite 0 is on the scanline, both
+ * the background and sprites are shown, and the flag hasn't been set yet). On frames that are skipped,
+ * only these scanlines have to be drawn.
+ * 
+ * @param ppu The PPU.
+ * @return Set if sprite 0 hit may occur.
+ */
+static inline bool can_hit(const ppu_t *ppu) {
+    return ppu->szc && ppu->mask.background && ppu->mask.sprites && !ppu->status.hit;
+}
+
+/**
+ * @brief Outputs a pixel of the current scanline, drawing any sprite pixel over the background pixel.
+ * 
+ * @param ppu The PPU.
+ * @param screen_x The x-coordinate of the pixel.
+ * @param bkg The value of the background pixel (0 if transparent).
+ * @param attr The palette of the background pixel.
+ */
+static inline void render_pixel(ppu_t *ppu, uint8_t screen_x, uint8_t bkg, uint8_t attr) {
+    // The background may be hidden (either entirely or in the leftmost 8 pixels).
+    if (!ppu->mask.background || (screen_x < 8 && !ppu->mask.bkg_left)) {
+        bkg = 0;
+    }
+    
+    // Determine the color of the pixel.
+    uint8_t col_index = bkg > 0 ? ppu->bkg_palette[attr * 4 + bkg - 1] : ppu->bkg_color;
+
+    // Sprites may also be hidden.
+    if (ppu->mask.sprites && (screen_x >= 8 || ppu->mask.spr_left)) {
+        col_index = merge_sprite(ppu, screen_x, bkg > 0, col_index);
+    }
+
+    // Output the pixel.
+    put_pixel(ppu, screen_x, ppu->draw_y, col_index);
+}
+
+ppu_t *ppu_create(uint16_t *out) {
+    // Create the PPU (with all of its state cleared).
+    ppu_t *ppu = calloc(1, sizeof(struct ppu));
+    ppu->out = out;
     ppu->vram = malloc(sizeof(uint8_t) * VRAM_SIZE);
     ppu->as = as_create();
 
+    // Create the tile cache (the pattern tables and nametables are looked up on the first fetch).
+    ppu->tiles = tc_create();
+    ppu->page_generation = as_generation(ppu->as) - 1;
+
+    // Get the schedule of operations on each dot.
+    ppu->schedule = get_schedule();
+
     // Clear registers.
     ppu->controller.value = 0;
     ppu->mask.value = 0;
@@ -141,6 +292,11 @@ ppu_t *ppu_create(void) {
     ppu->ppu_addr = 0;
     ppu->ppu_data = 0;
     ppu->w = 0;
+    ppu->vbl_suppress = 0;
+    select_line(ppu);
+
+    // The PPU is synchronised with the CPU from cycle 0.
+    ppu->cycle = 0;
 
     // Set the draw position to (0, 0).
     ppu->draw_x = 0;
@@ -149,6 +305,12 @@ ppu_t *ppu_create(void) {
     // Clear the odd frame flag.
     ppu->odd_frame = false;
 
+    // Output every frame.
+    ppu->skip = false;
+
+    // No sprites are drawn on the first scanline.
+    memset(ppu->spr_line, 0, sizeof(ppu->spr_line));
+
     // Make the background black at the start.
     ppu->bkg_color = 0x0F;
 
@@ -157,6 +319,7 @@ ppu_t *ppu_create(void) {
 
 void ppu_destroy(ppu_t *ppu) {
     as_destroy(ppu->as);
+    tc_destroy(ppu->tiles);
     free(ppu->vram);
     free(ppu);
 }
@@ -168,107 +331,150 @@ void ppu_reset(ppu_t *ppu) {
     ppu->scroll = 0;
     ppu->ppu_data = 0;
     ppu->w = 0;
+    select_line(ppu);
 
     // Odd frame flag is reset.
     ppu->odd_frame = false;
 }
 
-void ppu_render(ppu_t *ppu, int cycles) {
-    bool vbl_suppress = false;
-
-    // PPUCONTROL
-    if (ppu->ppucontrol_flags.write) {
-        // Update nametable.
-        ppu->t.nt_x = ppu->controller.nt_addr & 0x01;
-        ppu->t.nt_y = (ppu->controller.nt_addr >> 1) & 0x01;
-
-        // Update NMI status.
-        if (!ppu->controller.nmi) {
-            ppu->nmi_occurred = false;
-        }
+void ppu_set_chr(ppu_t *ppu, const uint8_t *rom, size_t rom_size, const uint8_t *ram, size_t ram_size) {
+    tc_reset(ppu->tiles, 0, rom, rom_size);
+    tc_reset(ppu->tiles, 1, ram, ram_size);
+}
 
-        ppu->ppucontrol_flags.write = 0;
+void ppu_sync(ppu_t *ppu, uint64_t cycle) {
+    if (cycle > ppu->cycle) {
+        ppu_render(ppu, (cycle - ppu->cycle) * 3);
+        ppu->cycle = cycle;
     }
+}
 
-    // PPUSTATUS
-    if (ppu->ppustatus_flags.read) {
-        // Clear VBL flag and write toggle bit.
-        ppu->status.vblank = 0;
-        ppu->w = 0;
-
-        // Suppress VBL flag if set in the next PPU cycle.
-        vbl_suppress = true;
-
-        ppu->ppustatus_flags.read = 0;
-    }
+uint8_t ppu_read(ppu_t *ppu, addr_t reg) {
+    switch (reg) {
+        case PPU_STATUS: {
+            // Only the vblank, sprite 0 hit and sprite overflow flags are readable.
+            const uint8_t value = ppu->status.value & 0xE0;
 
-    // PPUSCROLL
-    if (ppu->ppuscroll_flags.write) {
-        if (ppu->w) {
-            // second write
-            ppu->t.fine_y = ppu->scroll & 0x07;
-            ppu->t.coarse_y = ppu->scroll >> 3;
+            // Clear VBL flag and write toggle bit, and suppress VBL flag if set in the next PPU cycle.
+            ppu->status.vblank = 0;
+            ppu->w = 0;
+            ppu->vbl_suppress = 1;
+            return value;
         }
-        else {
-            // first write
-            ppu->x = ppu->scroll & 0x07;
-            ppu->t.coarse_x = ppu->scroll >> 3;
+        case OAM_DATA:
+            return ppu->oam_data;
+        case PPU_DATA: {
+            // Reads are buffered (the buffer is then filled from the current VRAM address).
+            const uint8_t value = ppu->ppu_data;
+            ppu->ppu_data = as_read(ppu->as, get_data_addr(ppu->v));
+            inc_vram_addr(ppu, &ppu->v);
+            return value;
         }
-        ppu->ppuscroll_flags.write = 0;
-        ppu->w= !ppu->w;
+        default:
+            // The rest of the registers are write-only.
+            return 0;
     }
+}
 
-    // OAMDATA
-    if (ppu->oamdata_flags.write) {
-        ppu->oam[ppu->oam_addr] = ppu->oam_data;
-        ppu->oam_addr++;
-        ppu->oamdata_flags.write = 0;
-    }
-    if (ppu->oamdata_flags.read) {
-        ppu->oamdata_flags.read = 0;
-    }
+void ppu_write(ppu_t *ppu, addr_t reg, uint8_t value) {
+    switch (reg) {
+        case PPU_CTRL:
+            ppu->controller.value = value;
 
-    // PPUADDR
-    if (ppu->ppuaddr_flags.write) {
-        if (ppu->w) {
-            // second write
-            ppu->t.coarse_x = ppu->ppu_addr & 0x1F;
-            ppu->t.coarse_y = (ppu->t.coarse_y & ~0x07) | (ppu->ppu_addr >> 5);
-            ppu->v = ppu->t;
-        }
-        else {
-            // first write
-            ppu->t.coarse_y = (ppu->t.coarse_y & 0x07) | ((ppu->ppu_addr & 0x03) << 3);
-            ppu->t.nt_x = (ppu->ppu_addr >> 2) & 0x01;
-            ppu->t.nt_y = (ppu->ppu_addr >> 3) & 0x01;
-            ppu->t.fine_y = (ppu->ppu_addr >> 4) & 0x03;
-        }
-        ppu->ppuaddr_flags.write = 0;
-        ppu->w = !ppu->w;
-    }
+            // Update nametable.
+            ppu->t = (ppu->t & ~(VRAM_NT_X | VRAM_NT_Y)) | ((value & 0x03) << 10);
 
-    // PPUDATA
-    if (ppu->ppudata_flags.write || ppu->ppudata_flags.read) {
-        addr_t addr = (ppu->v.fine_y << 12) | (ppu->v.nt_y << 11) | (ppu->v.nt_x << 10) | (ppu->v.coarse_y << 5) | ppu->v.coarse_x;
-        if (ppu->ppudata_flags.write) {
-            as_write(ppu->as, addr, ppu->ppu_data);
-        }
-        if (ppu->ppudata_flags.read) {
-            ppu->ppu_data = as_read(ppu->as, addr);
+            // Update NMI status.
+            if (!ppu->controller.nmi) {
+                ppu->nmi_occurred = false;
+            }
+            break;
+        case PPU_MASK:
+            ppu->mask.value = value;
+            select_line(ppu);
+            break;
+        case OAM_ADDR:
+            ppu->oam_addr = value;
+            break;
+        case OAM_DATA:
+            ppu->oam_data = value;
+            ppu->oam[ppu->oam_addr] = value;
+            ppu->oam_addr++;
+            break;
+        case PPU_SCROLL:
+            ppu->scroll = value;
+            if (ppu->w) {
+                // second write
+                ppu->t = (ppu->t & ~(VRAM_FINE_Y | VRAM_COARSE_Y)) | ((value & 0x07) << 12) | ((value >> 3) << 5);
+            }
+            else {
+                // first write
+                ppu->x = value & 0x07;
+                ppu->t = (ppu->t & ~VRAM_COARSE_X) | (value >> 3);
+            }
+            ppu->w = !ppu->w;
+            break;
+        case PPU_ADDR:
+            ppu->ppu_addr = value;
+            if (ppu->w) {
+                // second write
+                ppu->t = (ppu->t & 0xFF00) | value;
+                ppu->v = ppu->t;
+            }
+            else {
+                // first write
+                ppu->t = (ppu->t & 0x00FF) | ((value & 0x3F) << 8); // Bit 14 is cleared.
+            }
+            ppu->w = !ppu->w;
+            break;
+        case PPU_DATA: {
+            // The value also replaces the contents of the read buffer.
+            const addr_t addr = get_data_addr(ppu->v) & 0x3FFF;
+            ppu->ppu_data = value;
+            as_write(ppu->as, addr, value);
+            inc_vram_addr(ppu, &ppu->v);
+
+            // A tile in CHR-RAM has to be decoded again.
+            if (addr < NAMETABLE0) {
+                const uint8_t *target = fetch_ptr(ppu, addr);
+                if (target != NULL) {
+                    tc_invalidate(ppu->tiles, target);
+                }
+            }
+            break;
         }
-        inc_vram_addr(ppu, &ppu->v);
-        ppu->ppudata_flags.write = 0;
-        ppu->ppudata_flags.read = 0;
     }
-    
+}
+
+void ppu_render(ppu_t *ppu, int cycles) {
+    // Reading PPUSTATUS just before the VBL flag is set suppresses it.
+    bool vbl_suppress = ppu->vbl_suppress;
+    ppu->vbl_suppress = 0;
+
     // Rendering.
     bool rendering = ppu->mask.background || ppu->mask.sprites;
     while (cycles > 0) {
-        // Render background and sprites.
-        render_cycle(ppu, rendering, vbl_suppress);
-        
-        // Sprite evaluation.
-        sprite_evaluation(ppu);
+        // Nothing can change the PPU's registers or CHR banks during this call, so whole visible scanlines can
+        // be rendered in one pass, and nothing happens on the scanlines after them (other than at the start of
+        // vblank). The pre-render scanline is rendered a dot at a time.
+        if (ppu->draw_x == 0 && cycles > SCANLINE_END && ppu->draw_y != -1 && ppu->draw_y != 241) {
+            if (ppu->draw_y < SCREEN_HEIGHT) {
+                if (ppu->skip && !can_hit(ppu)) {
+                    ppu->skip_line(ppu);
+                }
+                else {
+                    ppu->render_line(ppu);
+                }
+            }
+            ppu->draw_y = ppu->draw_y == N_SCANLINES ? -1 : ppu->draw_y + 1;
+            vbl_suppress = false;
+            ppu->nmi_suppress = 0;
+            cycles -= SCANLINE_END + 1;
+            continue;
+        }
+
+        // Render background and sprites, and evaluate sprites.
+        render_dot(ppu, rendering, vbl_suppress);
 
         // Increment scanline pointer.
         ppu->draw_x++;
@@ -288,173 +494,308 @@ void ppu_render(ppu_t *ppu, int cycles) {
     }
 }
 
-static inline void render_cycle(ppu_t *ppu, bool rendering, bool vbl_suppress) {
-    if (ppu->draw_y < 240) {
-        if (ppu->draw_y == -1) {
-            // Pre-render scanline.
-            if (ppu->draw_x == 1) {
-                ppu->status.vblank = 0;
-                ppu->status.overflow = 0;
-                ppu->status.hit = 0;
+int ppu_next_event(const ppu_t *ppu) {
+    // An NMI is about to occur.
+    if (ppu->status.vblank && ppu->controller.nmi && !ppu->nmi_occurred)
+        return 0;
+
+    const int frame = dot_index(N_SCANLINES + 1, 0);
+    const int now = dot_index(ppu->draw_y, ppu->draw_x);
+
+    // The vblank flag is set at the start of vblank, and the status flags are cleared on the pre-render scanline.
+    int target = dot_index(241, 1);
+    int cycles = (target - now + frame) % frame;
+    target = dot_index(-1, 1);
+    if ((target - now + frame) % frame < cycles) {
+        cycles = (target - now + frame) % frame;
+    }
+
+    // Find the first visible scanline (from the current one) on which sprite 0 hit or sprite overflow may occur.
+    if (ppu->mask.background || ppu->mask.sprites) {
+        const int height = ppu->controller.spr_size ? 16 : 8;
+        const int first = ppu->draw_y > 0 ? ppu->draw_y : 0;
+        int line = SCREEN_HEIGHT;
+        if (ppu->oam_addr != 0) {
+            // Sprite evaluation doesn't start at sprite 0.
+            line = first;
+        }
+        if (!ppu->status.hit && ppu->mask.background && ppu->mask.sprites) {
+            // Sprite 0 is drawn on the scanlines after its y-coordinate.
+            const int top = ppu->oam[0] + 1;
+            if (top + height > first && top < line) {
+                line = top > first ? top : first;
             }
-            else if (ppu->draw_x >= 280 && ppu->draw_x <= 304) {
-                // Reset y.
-                if (rendering) {
-                    ppu->v.coarse_y = ppu->t.coarse_y;
-                    ppu->v.fine_y = ppu->t.fine_y;
-                    ppu->v.nt_y = ppu->t.nt_y;
+        }
+        if (!ppu->status.overflow) {
+            // Overflow can only be set (even falsely) on a scanline with at least 8 sprites in range.
+            int count[SCREEN_HEIGHT + 1] = { 0 };
+            for (int i = 0; i < N_SPRITES; i++) {
+                const int top = ppu->oam[i * 4];
+                if (top < SCREEN_HEIGHT) {
+                    count[top]++;
+                    count[top + height < SCREEN_HEIGHT ? top + height : SCREEN_HEIGHT]--;
                 }
             }
-            else if (ppu->draw_x == 339) {
-                // Skip a frame at x=339 on odd frames if background rendering is enabled.
-                if (ppu->mask.background) {
-                    if (ppu->odd_frame) {
-                        ppu->draw_x++;
-                    }
+            int n = 0;
+            for (int y = 0; y < line; y++) {
+                n += count[y];
+                if (y >= first && n >= 8) {
+                    line = y;
+                    break;
                 }
-                ppu->odd_frame = !ppu->odd_frame;
             }
         }
-        else if (ppu->draw_x > 0 && ppu->draw_x <= 256) {
-            // Get the x-coordinate of the pixel on the screen.
-            const uint8_t screen_x = ppu->draw_x - 1;
+        if (line < SCREEN_HEIGHT) {
+            if (line == ppu->draw_y)
+                return 0;
+            target = dot_index(line, 0);
+            if ((target - now + frame) % frame < cycles) {
+                cycles = (target - now + frame) % frame;
+            }
+        }
+    }
 
-            // Get the mask used for the shift registers.
-            const uint16_t sr_mask = 0x8000 >> ppu->x;
+    // The pre-render scanline may be one cycle shorter (on odd frames).
+    if (cycles > (dot_index(-1, 339) - now + frame) % frame) {
+        cycles--;
+    }
 
-            // Determine the value of the bit at this pixel of the tile.
-            uint8_t bkg;
-            if (!ppu->mask.background) {
-                bkg = 0;
-            }
-            else if (ppu->draw_x <= 8 && !ppu->mask.bkg_left) {
-                bkg = 0;
-            }
-            else {
-                uint8_t b0 = (ppu->sr_tile[0] & sr_mask) > 0;
-                uint8_t b1 = (ppu->sr_tile[1] & sr_mask) > 0;
-                bkg = (b1 << 1) | b0;
+    return cycles;
+}
+
+int ppu_next_vblank(const ppu_t *ppu) {
+    return ppu_next_dot(ppu, 241, 1);
+}
+
+int ppu_next_dot(const ppu_t *ppu, int y, int x) {
+    const int frame = dot_index(N_SCANLINES + 1, 0);
+    const int now = dot_index(ppu->draw_y, ppu->draw_x);
+    int cycles = (dot_index(y, x) - now + frame) % frame;
+
+    // The pre-render scanline may be one cycle shorter (on odd frames).
+    if (cycles > (dot_index(-1, 339) - now + frame) % frame) {
+        cycles--;
+    }
+
+    return cycles;
+}
+
+/**
+ * @brief Loads the position and attributes of one of the sprites in secondary OAM, and determines the
+ * pattern table address of its row on the next scanline.
+ * 
+ * @param ppu The PPU.
+ * @param i The index of the sprite in secondary OAM.
+ */
+static inline void load_sprite(ppu_t *ppu, int i) {
+    // Get sprite data.
+    const uint8_t sprite_y = ppu->oam2[4 * i];
+    uint8_t fine_y = ppu->draw_y - sprite_y;
+    const uint8_t tile = ppu->oam2[4 * i + 1];
+
+    // Fetch attribute data.
+    const uint8_t attr = ppu->oam2[4 * i + 2];
+    ppu->oam_attr[i].palette = attr & 0x03;
+    ppu->oam_attr[i].priority = (attr >> 5) & 0x01;
+    ppu->oam_attr[i].flip_h = (attr >> 6) & 0x01;
+    ppu->oam_attr[i].flip_v = (attr >> 7) & 0x01;
+
+    // Flip vertically if necessary.
+    if (ppu->oam_attr[i].flip_v) {
+        fine_y = (ppu->controller.spr_size ? 15 : 7) - fine_y;
+    }
+
+    // Get pattern table address.
+    if (ppu->controller.spr_size) {
+        ppu->pt_addr = ((tile & 0x01) << 12) | ((tile & ~0x01) << 4) | ((fine_y & 0x08) << 1) | (fine_y & 0x07); // 8x16 sprite mode.
+    }
+    else {
+        ppu->pt_addr = (ppu->controller.spt_addr << 12) | (tile << 4) | (fine_y & 0x07); // 8x8 sprite mode.
+    }
+
+    // Fetch x-position.
+    ppu->oam_x[i] = ppu->oam2[4 * i + 3];
+}
+
+/**
+ * @brief Draws one of the sprites fetched for the next scanline into the sprite line buffer, behind the
+ * sprites that come before it in secondary OAM (the buffer is cleared for the first sprite).
+ * 
+ * @param ppu The PPU.
+ * @param i The index of the sprite in secondary OAM.
+ */
+static inline void compose_sprite(ppu_t *ppu, int i) {
+    if (i == 0) {
+        memset(ppu->spr_line, 0, sizeof(ppu->spr_line));
+    }
+
+    // Unused slots of secondary OAM are filled with $FF (so sprites at x=255 aren't drawn either).
+    const int x = ppu->oam_x[i];
+    if (x == 0xFF)
+        return;
+
+    const uint8_t attr = (ppu->oam_attr[i].palette << 2) | (ppu->oam_attr[i].priority ? SPR_BEHIND : 0) | (i == 0 ? SPR_ZERO : 0);
+    for (int j = 0; j < 8 && x + j < SCREEN_WIDTH; j++) {
+        if (ppu->oam_pix[i][j] != 0 && !(ppu->spr_line[x + j] & SPR_PIXEL)) {
+            ppu->spr_line[x + j] = ppu->oam_pix[i][j] | attr;
+        }
+    }
+}
+
+/**
+ * @brief Performs a step of the sprite evaluation state machine (on the even dots from 66 to 256), which
+ * uses the byte of OAM read on the previous dot.
+ * 
+ * @param ppu The PPU.
+ */
+static inline void eval_step(ppu_t *ppu) {
+    if (ppu->oam2_ptr % 4 != 0) {
+        // Copy remaining sprite data into secondary OAM.
+        if (ppu->oam2_ptr < sizeof(ppu->oam2)) {
+            ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
+        }
+        ppu->oam2_ptr++;
+        if (ppu->m == 3) {
+            ppu->n++;
+        }
+        ppu->m = (ppu->m + 1) & 0x03;
+    }
+    else if (ppu->n >= N_SPRITES) {
+        // All 64 sprites have already been evaluated.
+        if (ppu->oam2_ptr < sizeof(ppu->oam2)) {
+            ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
+        }
+        ppu->n++;
+    }
+    else if (ppu->oam2_ptr >= sizeof(ppu->oam2)) {
+        // Sprite overflow.
+        if (sprite_in_range(ppu, ppu->oam_buffer)) {
+            if (ppu->mask.background || ppu->mask.sprites) {
+                ppu->status.overflow = true; // Shouldn't be set if all rendering is off.
             }
-            
-            // Determine the color of the pixel.
-            uint8_t b0 = (ppu->sr_attr[0] & sr_mask) > 0;
-            uint8_t b1 = (ppu->sr_attr[1] & sr_mask) > 0;
-            uint8_t index = (b1 << 1) | b0;
-            uint8_t col_index = bkg > 0 ? ppu->bkg_palette[index * 4 + bkg - 1] : ppu->bkg_color;
-
-            // Check if the pixel should be overriden with one from a sprite.
-            if (ppu->mask.sprites) {
-                // Get active sprites.
-                for (int i = 0; i < 8; i++) {
-                    if (ppu->oam_x[i] == 0xFF)
-                        continue;
-                    if (ppu->oam_x[i] > screen_x)
-                        continue;
-                    if (screen_x > ppu->oam_x[i] + 8)
-                        continue;
-                    if (ppu->draw_x <= 8 && !ppu->mask.spr_left)
-                        continue;
-                    
-                    // Get fine-x and flip horizontally if necessary.
-                    uint8_t fine_x = screen_x - ppu->oam_x[i];
-                    if (ppu->oam_attr[i].flip_h) {
-                        fine_x = 7 - fine_x;
-                    }
-
-                    // Get value of sprite at current pixel and decide whether it should override the background.
-                    uint8_t mask = 0x80 >> fine_x;
-                    uint8_t low = (ppu->oam_p[i][0] & mask) > 0;
-                    uint8_t high = (ppu->oam_p[i][1] & mask) > 0;
-                    uint8_t spr = (high << 1) | low;
-                    if (spr == 0)
-                        continue;
-                    
-                    // Check if the sprite 0 hit flag should be updated.
-                    if (i == 0 && bkg > 0 && ppu->szc && ppu->draw_x != 256) {
-                        ppu->status.hit = 1;
-                    }
-
-                    // At this stage, if there is an opaque background pixel and the sprite's priority bit is set,
-                    // then the background pixel should be drawn regardless of the priority of any remaining sprites.
-                    if (bkg > 0 && ppu->oam_attr[i].priority)
-                        break;
-                    
-                    // Update the color and break as any subsequent sprites would be displayed behind this sprite.
-                    col_index = ppu->spr_palette[ppu->oam_attr[i].palette * 3 + spr - 1];
-                    break;
-                }
+            ppu->oam2_ptr++;
+            ppu->m = (ppu->m + 1) & 0x03;
+        }
+        else {
+            ppu->n++;
+            ppu->m = (ppu->m + 1) & 0x03; // Sprite overflow bug.
+        }
+    }
+    else {
+        // Fetch next sprite and check if y-coordinate is within range.
+        ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
+        if (sprite_in_range(ppu, ppu->oam_buffer)) {
+            if (ppu->n == 0) {
+                ppu->szn = true;
             }
-
-            // Output the pixel.
-            color_t col = color_resolve(col_index);
-            put_pixel(ppu, screen_x, ppu->draw_y, col);
+            ppu->oam2_ptr++;
+            ppu->m = (ppu->m + 1) & 0x03;
         }
+        else {
+            ppu->n++;
+        }
+    }
+}
 
-        // Tile fetches.
-        if ((ppu->draw_x > 0 && ppu->draw_x <= 256) || (ppu->draw_x > 320 && ppu->draw_x <= 336)) {
-            // Clock shift registers.
-            ppu->sr_attr[0] <<= 1;
-            ppu->sr_attr[1] <<= 1;
-            ppu->sr_tile[0] <<= 1;
-            ppu->sr_tile[1] <<= 1;
-        
-            // Do tile fetches if necessary.
-            if (ppu->draw_x % 8 == 0) {
-                // Fetch high BG tile byte.
-                ppu->nt_latch.plane = 1;
-                addr_t pt_addr = get_pt_addr(ppu->nt_latch);
-                ppu->tile_latch[1] = as_read(ppu->as, pt_addr);
-                
-                // Increment VRAM address.
-                if (rendering) {
-                    if (ppu->draw_x == 256) {
-                        // Increment y.
-                        inc_vram_y(&ppu->v);
-                    }
-                    else {
-                        // Increment x.
-                        inc_vram_x(&ppu->v);
-                    }
-                }
+/**
+ * @brief Gets the operations that the PPU performs on each dot of each type of scanline (see DOT_PIXEL).
+ * 
+ * @return The schedule (indexed by the type of scanline and then the dot).
+ */
+static const line_schedule_t *get_schedule(void) {
+    static line_schedule_t schedule[N_LINE_TYPES];
+    static bool ready = false;
+    if (ready)
+        return schedule;
 
-                // Reload shift registers (for next cycle).
-                bool attr_low = (ppu->attr_latch & 0x01) > 0;
-                bool attr_high = (ppu->attr_latch & 0x02) > 0;
-                
-                ppu->sr_attr[0] = (ppu->sr_attr[0] & 0xFF00) | (attr_low ? 0xFF : 0x00);
-                ppu->sr_attr[1] = (ppu->sr_attr[1] & 0xFF00) | (attr_high ? 0xFF : 0x00);
+    for (int x = 0; x <= SCANLINE_END; x++) {
+        dot_ops_t ops = 0;
 
-                ppu->sr_tile[0] = (ppu->sr_tile[0] & 0xFF00) | ppu->tile_latch[0];
-                ppu->sr_tile[1] = (ppu->sr_tile[1] & 0xFF00) | ppu->tile_latch[1];
+        // Background fetches.
+        if ((x > 0 && x <= 256) || (x > 320 && x <= 336)) {
+            ops |= DOT_SHIFT;
+            if (x % 8 == 0) {
+                ops |= DOT_FETCH_HIGH | (x == 256 ? DOT_INC_Y : DOT_INC_X);
             }
-            if (ppu->draw_x % 8 == 2) {
-                // Fetch NT byte.
-                ppu->nt_latch = fetch_nt_byte(ppu);
+            else if (x % 8 == 2) {
+                ops |= DOT_FETCH_NT;
             }
-            else if (ppu->draw_x % 8 == 4) {
-                // Fetch AT byte.
-                ppu->attr_latch = fetch_at_byte(ppu);
+            else if (x % 8 == 4) {
+                ops |= DOT_FETCH_AT;
             }
-            else if (ppu->draw_x % 8 == 6) {
-                // Fetch low BG tile byte.
-                ppu->nt_latch.plane = 0;
-                addr_t pt_addr = get_pt_addr(ppu->nt_latch);
-                ppu->tile_latch[0] = as_read(ppu->as, pt_addr);
+            else if (x % 8 == 6) {
+                ops |= DOT_FETCH_LOW;
             }
         }
-        else if (ppu->draw_x == 257 && rendering) {
-            // Reset x.
-            ppu->v.coarse_x = ppu->t.coarse_x;
-            ppu->v.nt_x = ppu->t.nt_x;
+        else if (x == 257) {
+            ops |= DOT_COPY_X;
         }
-        else if (ppu->draw_x == 338 || ppu->draw_x == 340) {
+        else if (x == 338 || x == 340) {
             // Unused NT fetches.
-            ppu->nt_latch = fetch_nt_byte(ppu);
+            ops |= DOT_FETCH_NT;
+        }
+
+        // Sprite evaluation.
+        if (x == 0) {
+            ops |= DOT_EVAL_RESET;
         }
+        else if (x <= 64) {
+            ops |= DOT_OAM2_CLEAR;
+        }
+        else if (x <= 256) {
+            ops |= x % 2 == 1 ? DOT_EVAL_READ : DOT_EVAL_STEP;
+        }
+        else if (x <= 320) {
+            // Sprite fetches (with garbage NT and AT fetches in between).
+            const dot_ops_t fetches[8] = { DOT_SPR_HIGH, DOT_SPR_LOAD, DOT_FETCH_NT, 0, DOT_FETCH_AT, 0, DOT_SPR_LOW, 0 };
+            ops |= fetches[x % 8] | DOT_OAM_ADDR_RESET;
+        }
+        else if (x == 321) {
+            ops |= DOT_SZC;
+        }
+
+        schedule[LINE_VISIBLE][x] = ops | (x > 0 && x <= 256 ? DOT_PIXEL : 0);
+        schedule[LINE_PRE_RENDER][x] = ops;
+        schedule[LINE_POST_RENDER][x] = 0;
+        schedule[LINE_VBLANK][x] = 0;
     }
-    else if (ppu->draw_y == 241) {
-        // Vblank.
-        if (ppu->draw_x == 1) {
+
+    // Flags are cleared and the y scroll is reset on the pre-render scanline (which is a dot shorter on odd frames).
+    schedule[LINE_PRE_RENDER][1] |= DOT_CLEAR_FLAGS;
+    for (int x = 280; x <= 304; x++) {
+        schedule[LINE_PRE_RENDER][x] |= DOT_COPY_Y;
+    }
+    schedule[LINE_PRE_RENDER][339] |= DOT_ODD_FRAME;
+
+    // The VBL flag is set on the second dot of vblank.
+    schedule[LINE_VBLANK][1] = DOT_SET_VBLANK;
+
+    ready = true;
+    return schedule;
+}
+
+/**
+ * @brief Performs the operations of the current dot (using the schedule for its type of scanline).
+ * 
+ * @param ppu The PPU.
+ * @param rendering Set if either background or sprite rendering is enabled.
+ * @param vbl_suppress Set if PPUSTATUS was read just before this dot.
+ */
+static inline void render_dot(ppu_t *ppu, bool rendering, bool vbl_suppress) {
+    const dot_ops_t *line = ppu->schedule[ppu->draw_y < 0 ? LINE_PRE_RENDER : ppu->draw_y < SCREEN_HEIGHT ? LINE_VISIBLE
+        : ppu->draw_y == SCREEN_HEIGHT + 1 ? LINE_VBLANK : LINE_POST_RENDER];
+    dot_ops_t ops = line[ppu->draw_x];
+    if (ops == 0)
+        return;
+
+    // Status flags and scroll.
+    if (ops & DOT_STATUS_OPS) {
+        if (ops & DOT_CLEAR_FLAGS) {
+            ppu->status.vblank = 0;
+            ppu->status.overflow = 0;
+            ppu->status.hit = 0;
+        }
+        if (ops & DOT_SET_VBLANK) {
             // Set VBL flag if not suppressed.
             ppu->status.vblank = !vbl_suppress;
 
@@ -464,129 +805,352 @@ static inline void render_cycle(ppu_t *ppu, bool rendering, bool vbl_suppress) {
             ppu->vbl_occurred = true;
             ppu->nmi_occurred = false;
         }
+        if ((ops & DOT_COPY_Y) && rendering) {
+            ppu->v = (ppu->v & ~VRAM_VERTICAL) | (ppu->t & VRAM_VERTICAL);
+        }
+        if (ops & DOT_ODD_FRAME) {
+            // Skip a dot on odd frames if background rendering is enabled (doing the last dot's operations instead).
+            if (ppu->mask.background && ppu->odd_frame) {
+                ppu->draw_x++;
+                ops = line[ppu->draw_x];
+            }
+            ppu->odd_frame = !ppu->odd_frame;
+        }
     }
-}
 
-static inline void sprite_evaluation(ppu_t *ppu) {
-    if (ppu->draw_y < 240) {
-        if (ppu->draw_x == 0) {
+    // Background.
+    if (ops & DOT_BKG_OPS) {
+        if ((ops & DOT_PIXEL) && (!ppu->skip || can_hit(ppu))) {
+            // Determine the value of the bit at this pixel of the tile, and its palette.
+            const uint16_t sr_mask = 0x8000 >> ppu->x;
+            uint8_t bkg = (((ppu->sr_tile[1] & sr_mask) > 0) << 1) | ((ppu->sr_tile[0] & sr_mask) > 0);
+            uint8_t attr = (((ppu->sr_attr[1] & sr_mask) > 0) << 1) | ((ppu->sr_attr[0] & sr_mask) > 0);
+
+            // Output the pixel.
+            render_pixel(ppu, ppu->draw_x - 1, bkg, attr);
+        }
+        if (ops & DOT_SHIFT) {
+            ppu->sr_attr[0] <<= 1;
+            ppu->sr_attr[1] <<= 1;
+            ppu->sr_tile[0] <<= 1;
+            ppu->sr_tile[1] <<= 1;
+        }
+        if (ops & DOT_FETCH_HIGH) {
+            // Fetch high BG tile byte.
+            ppu->nt_latch.plane = 1;
+            ppu->tile_latch[1] = fetch_byte(ppu, get_pt_addr(ppu->nt_latch));
+
+            // Increment VRAM address.
+            if (rendering) {
+                if (ops & DOT_INC_Y) {
+                    inc_vram_y(&ppu->v);
+                }
+                else {
+                    inc_vram_x(&ppu->v);
+                }
+            }
+
+            // Reload shift registers (for next cycle).
+            ppu->sr_attr[0] = (ppu->sr_attr[0] & 0xFF00) | ((ppu->attr_latch & 0x01) ? 0xFF : 0x00);
+            ppu->sr_attr[1] = (ppu->sr_attr[1] & 0xFF00) | ((ppu->attr_latch & 0x02) ? 0xFF : 0x00);
+            ppu->sr_tile[0] = (ppu->sr_tile[0] & 0xFF00) | ppu->tile_latch[0];
+            ppu->sr_tile[1] = (ppu->sr_tile[1] & 0xFF00) | ppu->tile_latch[1];
+        }
+        if (ops & DOT_FETCH_NT) {
+            ppu->nt_latch = fetch_nt_byte(ppu);
+        }
+        if (ops & DOT_FETCH_AT) {
+            ppu->attr_latch = fetch_at_byte(ppu);
+        }
+        if (ops & DOT_FETCH_LOW) {
+            // Fetch low BG tile byte.
+            ppu->nt_latch.plane = 0;
+            ppu->tile_latch[0] = fetch_byte(ppu, get_pt_addr(ppu->nt_latch));
+        }
+        if ((ops & DOT_COPY_X) && rendering) {
+            ppu->v = (ppu->v & ~VRAM_HORIZONTAL) | (ppu->t & VRAM_HORIZONTAL);
+        }
+    }
+
+    // Sprite evaluation and sprite fetches.
+    if (ops & DOT_SPR_OPS) {
+        if (ops & DOT_EVAL_RESET) {
             // Idle (reset iterators).
             ppu->n = 0;
             ppu->m = 0;
             ppu->szn = false;
             ppu->oam2_ptr = 0;
         }
-        else if (ppu->draw_x <= 64) {
-            // Secondary OAM clear.
+        if (ops & DOT_OAM2_CLEAR) {
             ppu->oam2[((ppu->draw_x - 1) >> 1) & 0x1F] = 0xFF;
         }
-        else if (ppu->draw_x <= 256) {
-            if (ppu->draw_x % 2 == 1) {
-                // Read OAM data on odd cycles into a buffer.
-                uint8_t oam_index = (4 * ppu->n + ppu->m + ppu->oam_addr) & 0xFF;
-                ppu->oam_buffer = ppu->oam[oam_index];
-            }
-            else if (ppu->oam2_ptr % 4 != 0) {
-                // Copy remaining sprite data into secondary OAM.
-                if (ppu->oam2_ptr < sizeof(ppu->oam2)) {
-                    ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
-                }
-                ppu->oam2_ptr++;
-                if (ppu->m == 3) {
-                    ppu->n++;
-                }
-                ppu->m++;
-            }
-            else if (ppu->n >= N_SPRITES) {
-                // All 64 sprites have already been evaluated.
-                if (ppu->oam2_ptr < sizeof(ppu->oam2)) {
-                    ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
-                }
-                ppu->n++;
-            }
-            else if (ppu->oam2_ptr >= sizeof(ppu->oam2)) {
-                // Sprite overflow.
-                if (sprite_in_range(ppu, ppu->oam_buffer)) {
-                    if (ppu->mask.background || ppu->mask.sprites) {
-                        ppu->status.overflow = true; // Shouldn't be set if all rendering is off.
-                    }
-                    ppu->oam2_ptr++;
-                    ppu->m++;
-                }
-                else {
-                    ppu->n++;
-                    ppu->m++; // Sprite overflow bug.
-                }
-            }
-            else {
-                // Fetch next sprite and check if y-coordinate is within range.
-                ppu->oam2[ppu->oam2_ptr] = ppu->oam_buffer;
-                if (sprite_in_range(ppu, ppu->oam_buffer)) {
-                    if (ppu->n == 0) {
-                        ppu->szn = true;
-                    }
-                    ppu->oam2_ptr++;
-                    ppu->m++;
-                }
-                else {
-                    ppu->n++;
-                }
-            }
+        if (ops & DOT_EVAL_READ) {
+            // Read OAM data on odd cycles into a buffer.
+            ppu->oam_buffer = ppu->oam[(4 * ppu->n + ppu->m + ppu->oam_addr) & 0xFF];
+        }
+        if (ops & DOT_EVAL_STEP) {
+            eval_step(ppu);
         }
-        else if (ppu->draw_x <= 320) {
-            int i = (ppu->draw_x - 257) / 8;
-            if (ppu->draw_x % 8 == 0) {
-                // Fetch high BG sprite byte.
-                ppu->oam_p[i][1] = as_read(ppu->as, ppu->pt_addr + 0x08);
-            }
-            else if (ppu->draw_x % 8 == 1) {
-                // Get sprite data.
-                uint8_t sprite_y = ppu->oam2[4 * i];
-                uint8_t fine_y = ppu->draw_y - sprite_y;
-                uint8_t tile = ppu->oam2[4 * i + 1];
-
-                // Fetch attribute data.
-                uint8_t attr = ppu->oam2[4 * i + 2];
-                ppu->oam_attr[i].palette = attr & 0x03;
-                ppu->oam_attr[i].priority = (attr >> 5) & 0x01;
-                ppu->oam_attr[i].flip_h = (attr >> 6) & 0x01;
-                ppu->oam_attr[i].flip_v = (attr >> 7) & 0x01;
-
-                // Flip vertically if necessary.
-                if (ppu->oam_attr[i].flip_v) {
-                    fine_y = (ppu->controller.spr_size ? 15 : 7) - fine_y;
-                }
 
-                // Get pattern table address.
-                if (ppu->controller.spr_size) {
-                    ppu->pt_addr = ((tile & 0x01) << 12) | ((tile & ~0x01) << 4) | ((fine_y & 0x08) << 1) | (fine_y & 0x07); // 8x16 sprite mode.
-                }
-                else {
-                    ppu->pt_addr = (ppu->controller.spt_addr << 12) | (tile << 4) | (fine_y & 0x07); // 8x8 sprite mode.
-                }
+        if (ops & DOT_SPR_HIGH) {
+            // Fetch high BG sprite byte and draw the sprite into the line buffer.
+            const int i = (ppu->draw_x - 257) / 8;
+            ppu->oam_p[i][1] = fetch_byte(ppu, ppu->pt_addr + 0x08);
+            tc_decode(ppu->oam_p[i][0], ppu->oam_p[i][1], ppu->oam_attr[i].flip_h, ppu->oam_pix[i]);
+            compose_sprite(ppu, i);
+        }
+        if (ops & DOT_SPR_LOAD) {
+            load_sprite(ppu, (ppu->draw_x - 257) / 8);
+        }
+        if (ops & DOT_SPR_LOW) {
+            // Fetch low BG sprite byte.
+            ppu->oam_p[(ppu->draw_x - 257) / 8][0] = fetch_byte(ppu, ppu->pt_addr);
+        }
+        if (ops & DOT_OAM_ADDR_RESET) {
+            ppu->oam_addr = 0;
+        }
+        if (ops & DOT_SZC) {
+            // Check if sprite 0 is included at indices 0-3 of the secondary OAM.
+            ppu->szc = ppu->szn;
+        }
+    }
+}
 
-                // Fetch x-position.
-                ppu->oam_x[i] = ppu->oam2[4 * i + 3];
-            }
-            else if (ppu->draw_x % 8 == 2) {
-                // Garbage NT fetch.
-                ppu->nt_latch = fetch_nt_byte(ppu);
+/**
+ * @brief Evaluates which sprites are in range of the next scanline in one pass (dots 0 to 256). This
+ * leaves secondary OAM, the sprite overflow flag and the evaluation state exactly as the dot-by-dot
+ * state machine in eval_step does (including its sprite overflow bug), provided that OAM and
+ * OAMADDR aren't accessed during those dots.
+ * 
+ * @param ppu The PPU.
+ */
+static void evaluate_sprites(ppu_t *ppu) {
+    // Sprite evaluation takes 2 dots for each read of OAM, from dot 65 to dot 256.
+    int pairs = (SCREEN_WIDTH - 64) / 2;
+    int n = 0, m = 0, ptr = 0;
+    uint8_t buffer = ppu->oam_buffer;
+    bool szn = false;
+
+    // Secondary OAM clear.
+    memset(ppu->oam2, 0xFF, sizeof(ppu->oam2));
+
+    // Copy the first 8 sprites in range into secondary OAM.
+    while (pairs > 0 && n < N_SPRITES && ptr < sizeof(ppu->oam2)) {
+        buffer = ppu->oam[(4 * n + ppu->oam_addr) & 0xFF];
+        ppu->oam2[ptr] = buffer;
+        pairs--;
+        if (!sprite_in_range(ppu, buffer)) {
+            n++;
+            continue;
+        }
+        if (n == 0) {
+            szn = true;
+        }
+
+        // Copy the rest of the sprite (if there is time).
+        ptr++;
+        for (m = 1; m < 4 && pairs > 0; m++, pairs--) {
+            buffer = ppu->oam[(4 * n + m + ppu->oam_addr) & 0xFF];
+            ppu->oam2[ptr++] = buffer;
+        }
+        if (m == 4) {
+            m = 0;
+            n++;
+        }
+    }
+
+    // Look for sprite overflow (this follows the same steps as eval_step).
+    const bool rendering = ppu->mask.background || ppu->mask.sprites;
+    while (pairs > 0 && (ptr % 4 != 0 || n < N_SPRITES)) {
+        buffer = ppu->oam[(4 * n + m + ppu->oam_addr) & 0xFF];
+        if (ptr % 4 != 0) {
+            if (ptr < sizeof(ppu->oam2)) {
+                ppu->oam2[ptr] = buffer;
             }
-            else if (ppu->draw_x % 8 == 4) {
-                // Garbage AT byte.
-                ppu->attr_latch = fetch_at_byte(ppu);
+            ptr++;
+            if (m == 3) {
+                n++;
             }
-            else if (ppu->draw_x % 8 == 6) {
-                // Fetch low BG sprite byte.
-                ppu->oam_p[i][0] = as_read(ppu->as, ppu->pt_addr);
+            m = (m + 1) & 0x03;
+        }
+        else if (sprite_in_range(ppu, buffer)) {
+            if (rendering) {
+                ppu->status.overflow = true;
             }
-
-            // Reset OAMADDR.
-            ppu->oam_addr = 0;
+            ptr++;
+            m = (m + 1) & 0x03;
         }
-        else if (ppu->draw_x == 321) {
-            // Check if sprite 0 is included at indices 0-3 of the secondary OAM.
-            ppu->szc = ppu->szn;
+        else {
+            n++;
+            m = (m + 1) & 0x03; // Sprite overflow bug.
         }
+        pairs--;
+    }
+
+    // Once all 64 sprites have been evaluated, the remaining reads only overwrite the next byte of secondary OAM.
+    if (pairs > 0) {
+        n += pairs;
+        buffer = ppu->oam[(4 * (n - 1) + m + ppu->oam_addr) & 0xFF];
+        if (ptr < sizeof(ppu->oam2)) {
+            ppu->oam2[ptr] = buffer;
+        }
+    }
+
+    ppu->n = n;
+    ppu->m = m;
+    ppu->oam2_ptr = ptr;
+    ppu->oam_buffer = buffer;
+    ppu->szn = szn;
+}
+
+/**
+ * @brief Fetches the tile for the next 8 pixels into the background latches and reloads the shift registers
+ * (these would otherwise be done on the 2nd to 8th dots of the tile).
+ * 
+ * @param ppu The PPU.
+ * @param pixels The pixels of the tile (8 bytes; may be `NULL` if the pixels aren't needed).
+ */
+static inline void fetch_tile(ppu_t *ppu, uint8_t *pixels) {
+    ppu->nt_latch = fetch_nt_byte(ppu);
+    ppu->attr_latch = fetch_at_byte(ppu);
+    ppu->nt_latch.plane = 0;
+    fetch_row(ppu, get_pt_addr(ppu->nt_latch), false, ppu->tile_latch, pixels);
+    ppu->nt_latch.plane = 1;
+
+    // The shift registers have been shifted through the previous tile by the time they are reloaded.
+    ppu->sr_attr[0] = (ppu->sr_attr[0] << 8) | ((ppu->attr_latch & 0x01) ? 0xFF : 0x00);
+    ppu->sr_attr[1] = (ppu->sr_attr[1] << 8) | ((ppu->attr_latch & 0x02) ? 0xFF : 0x00);
+    ppu->sr_tile[0] = (ppu->sr_tile[0] << 8) | ppu->tile_latch[0];
+    ppu->sr_tile[1] = (ppu->sr_tile[1] << 8) | ppu->tile_latch[1];
+}
+
+/**
+ * @brief Resolves the colors of 8 background pixels.
+ * 
+ * @param table The color of each background pixel (indexed by its palette and value).
+ * @param bkg The background pixels (palette in bits 2-3 and value in bits 0-1).
+ * @param clip The mask applied to each pixel (0x00 if the background is hidden; otherwise 0x0F).
+ * @param colors The colors of the pixels.
+ */
+static inline void resolve_bkg(const uint8_t *table, const uint8_t *bkg, uint8_t clip, uint8_t *colors) {
+#ifdef PPU_SIMD
+    const __m128i pixels = _mm_and_si128(_mm_loadl_epi64((const __m128i *)bkg), _mm_set1_epi8(clip));
+    _mm_storel_epi64((__m128i *)colors, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)table), pixels));
+#else
+    for (int i = 0; i < 8; i++) {
+        colors[i] = table[bkg[i] & clip];
+    }
+#endif
+}
+
+/**
+ * @brief Outputs 8 pixels of the current scanline (see put_pixel).
+ * 
+ * @param ppu The PPU.
+ * @param screen_x The x-coordinate of the first pixel.
+ * @param colors The colors of the pixels.
+ */
+static inline void put_pixels(ppu_t *ppu, int screen_x, const uint8_t *colors) {
+    const uint8_t mask = ppu->mask.grayscale ? 0x30 : MAX_COLOR;
+    const uint16_t emphasis = (ppu->mask.value >> 5) << COLOR_EMPHASIS_SHIFT;
+    uint16_t *out = &ppu->out[screen_x + ppu->draw_y * SCREEN_WIDTH];
+#ifdef PPU_SIMD
+    const __m128i indices = _mm_and_si128(_mm_loadl_epi64((const __m128i *)colors), _mm_set1_epi8(mask));
+    _mm_storeu_si128((__m128i *)out, _mm_or_si128(_mm_unpacklo_epi8(indices, _mm_setzero_si128()), _mm_set1_epi16(emphasis)));
+#else
+    for (int i = 0; i < 8; i++) {
+        out[i] = (colors[i] & mask) | emphasis;
+    }
+#endif
+}
+
+/**
+ * Scanline renderers (one for each combination of the PPUMASK flags that affect rendering, except that the
+ * leftmost 8 pixels are only clipped for layers that are shown).
+ */
+
+#define LINE_NAME       line_blank
+#define LINE_MASK       0
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_bkg
+#define LINE_MASK       (MASK_BACKGROUND | MASK_BKG_LEFT)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_bkg_clipped
+#define LINE_MASK       MASK_BACKGROUND
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_spr
+#define LINE_MASK       (MASK_SPRITES | MASK_SPR_LEFT)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_spr_clipped
+#define LINE_MASK       MASK_SPRITES
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_all
+#define LINE_MASK       (MASK_BACKGROUND | MASK_SPRITES | MASK_BKG_LEFT | MASK_SPR_LEFT)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_all_bkg_clipped
+#define LINE_MASK       (MASK_BACKGROUND | MASK_SPRITES | MASK_SPR_LEFT)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_all_spr_clipped
+#define LINE_MASK       (MASK_BACKGROUND | MASK_SPRITES | MASK_BKG_LEFT)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+#define LINE_NAME       line_all_clipped
+#define LINE_MASK       (MASK_BACKGROUND | MASK_SPRITES)
+#define LINE_OUTPUT     true
+#include <scanline.h>
+
+// Skipped frames only need the memory accesses and the sprite evaluation (see can_hit).
+#define LINE_NAME       skip_blank
+#define LINE_MASK       0
+#define LINE_OUTPUT     false
+#include <scanline.h>
+
+#define LINE_NAME       skip_rendering
+#define LINE_MASK       (MASK_BACKGROUND | MASK_SPRITES)
+#define LINE_OUTPUT     false
+#include <scanline.h>
+
+static void (*const LINES[MASK_RENDERING + 1])(ppu_t *ppu) = {
+    [0] = line_blank,
+    [MASK_BACKGROUND | MASK_BKG_LEFT] = line_bkg,
+    [MASK_BACKGROUND] = line_bkg_clipped,
+    [MASK_SPRITES | MASK_SPR_LEFT] = line_spr,
+    [MASK_SPRITES] = line_spr_clipped,
+    [MASK_BACKGROUND | MASK_SPRITES | MASK_BKG_LEFT | MASK_SPR_LEFT] = line_all,
+    [MASK_BACKGROUND | MASK_SPRITES | MASK_SPR_LEFT] = line_all_bkg_clipped,
+    [MASK_BACKGROUND | MASK_SPRITES | MASK_BKG_LEFT] = line_all_spr_clipped,
+    [MASK_BACKGROUND | MASK_SPRITES] = line_all_clipped
+};
+
+/**
+ * @brief Selects the scanline renderers for the current PPUMASK (this is done whenever PPUMASK is written).
+ * 
+ * @param ppu The PPU.
+ */
+static void select_line(ppu_t *ppu) {
+    // The left column flags don't matter for layers that are hidden.
+    unsigned mask = ppu->mask.value & MASK_RENDERING;
+    if (!(mask & MASK_BACKGROUND)) {
+        mask &= ~MASK_BKG_LEFT;
+    }
+    if (!(mask & MASK_SPRITES)) {
+        mask &= ~MASK_SPR_LEFT;
     }
+    ppu->render_line = LINES[mask];
+    ppu->skip_line = mask != 0 ? skip_rendering : skip_blank;
 }
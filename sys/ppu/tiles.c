@@ -0,0 +1,80 @@
+/**
+ * @file tiles.c
+ * @brief Cache of decoded pattern tiles.
+ * @version 1.0
+ * @date 2022-04-02
+ */
+
+#include <tiles.h>
+#include <stdlib.h>
+
+tile_cache_t *tc_create(void) {
+    return calloc(1, sizeof(struct tile_cache));
+}
+
+void tc_destroy(tile_cache_t *tc) {
+    for (int i = 0; i < TILE_REGIONS; i++) {
+        tc_reset(tc, i, NULL, 0);
+    }
+    free(tc);
+}
+
+void tc_reset(tile_cache_t *tc, int region, const uint8_t *chr, size_t size) {
+    // Forget the tiles of every area (as the memory of any of them may be reused).
+    for (int i = 0; i < TILE_REGIONS; i++) {
+        tile_region_t *r = &tc->regions[i];
+        for (size_t j = 0; j < r->n_tiles; j++) {
+            r->valid[j] = false;
+        }
+    }
+
+    // Replace the given area.
+    tile_region_t *r = &tc->regions[region];
+    free(r->tiles);
+    free(r->valid);
+    r->chr = chr;
+    r->n_tiles = chr != NULL ? size / TILE_SIZE : 0;
+    r->tiles = r->n_tiles > 0 ? malloc(r->n_tiles * sizeof(tile_t)) : NULL;
+    r->valid = r->n_tiles > 0 ? calloc(r->n_tiles, sizeof(bool)) : NULL;
+}
+
+const uint8_t *tc_row(tile_cache_t *tc, const uint8_t *row, bool flip) {
+    for (int i = 0; i < TILE_REGIONS; i++) {
+        tile_region_t *r = &tc->regions[i];
+        if (row < r->chr || row >= r->chr + r->n_tiles * TILE_SIZE)
+            continue;
+
+        // Decode the whole tile the first time that any of its rows is used.
+        const size_t offset = row - r->chr;
+        const size_t index = offset / TILE_SIZE;
+        tile_t *tile = &r->tiles[index];
+        if (!r->valid[index]) {
+            const uint8_t *planes = r->chr + index * TILE_SIZE;
+            for (int y = 0; y < TILE_ROWS; y++) {
+                tc_decode(planes[y], planes[y + TILE_ROWS], false, tile->rows[0][y]);
+                tc_decode(planes[y], planes[y + TILE_ROWS], true, tile->rows[1][y]);
+            }
+            r->valid[index] = true;
+        }
+
+        return tile->rows[flip][offset % TILE_ROWS];
+    }
+
+    return NULL;
+}
+
+void tc_invalidate(tile_cache_t *tc, const uint8_t *target) {
+    for (int i = 0; i < TILE_REGIONS; i++) {
+        tile_region_t *r = &tc->regions[i];
+        if (target >= r->chr && target < r->chr + r->n_tiles * TILE_SIZE) {
+            r->valid[(target - r->chr) / TILE_SIZE] = false;
+        }
+    }
+}
+
+void tc_decode(uint8_t low, uint8_t high, bool flip, uint8_t *pixels) {
+    for (int x = 0; x < 8; x++) {
+        const int bit = flip ? x : 7 - x;
+        pixels[x] = (((high >> bit) & 0x01) << 1) | ((low >> bit) & 0x01);
+    }
+}